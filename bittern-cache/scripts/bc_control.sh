@@ -99,10 +99,58 @@ $0: --set bgwriter_conf_cluster_size --value [1 .. 32] (default 1)
 	A higher value will decrease the overall seek penalty for writebacks,
 	while at the possible expense of the cache block replacement.
 
+$0: --set bgwriter_conf_workers --value [1 .. 8] (default 1)
+	Set the number of bgwriter threads. The cached device is split in
+	cluster sized ranges, and each thread writes back the dirty blocks of
+	every N-th range. More threads help when the cached device needs
+	several concurrent writebacks to reach full throughput.
+
 $0: --set bgwriter_conf_policy --value [classic|aggressive] (default classic)
 	Set bgwriter policy used to determine queue depth and other writeback
 	parameters.
 
+$0: --set bgwriter_conf_latency_target_us --value [100 .. 1000000] (default 10000)
+	Set the read miss latency target of the latency-feedback bgwriter
+	policy. The policy writes back as fast as it can while keeping the
+	average read miss latency below this value.
+
+$0: --set bgwriter_conf_hot_writes --value [0 .. 15] (default 0)
+$0: --set bgwriter_conf_hot_max_age_secs --value [1 .. 3600] (default 60)
+$0: --set bgwriter_conf_hot_max_dirty_pct --value [1 .. 100] (default 50)
+	Keep write-hot dirty blocks dirty longer. A block which saw
+	hot_writes recent write hits is skipped by the bgwriter until it has
+	been dirty for hot_max_age_secs, or until hot_max_dirty_pct of the
+	cache is dirty. A value of 0 for hot_writes disables this.
+
+$0: --set invalidator_conf_batch_size --value [1 .. 64] (default 16)
+	Set the maximum number of clean blocks the invalidator thread selects
+	and invalidates at once. Larger batches take the cache lock fewer
+	times. 1 invalidates one block at a time.
+
+$0: --set direct_submit_enabled --value [0,1] (default 1)
+	When set to 1, requests to the cached device and to a block cache
+	device are submitted from the calling thread whenever it is safe,
+	and only deferred to a workqueue from interrupt context.
+	When set to 0, requests are always deferred to a workqueue.
+
+$0: --set one_io_commit_enabled --value [0,1] (default 1)
+	When set to 1, a block cache device writes the data and the metadata
+	of a cache block with a single two page request, so that a write
+	miss is acknowledged after one cache device write instead of two.
+	When set to 0, metadata is written after the data write completes.
+
+$0: --set mlog_enabled --value [0,1] (default 0)
+	When set to 1, on a block cache device invalidations and writebacks
+	append the new state of the cache block to an intent log past the
+	end of the cache, so that the updates of many blocks are written
+	with one sequential page write. The log is checkpointed to the
+	metadata of the blocks in the background and replayed on restore.
+	When set to 0, the log is checkpointed and closed.
+
+$0: --set numa_node --value [-1 .. N] (default: node of the cache device)
+	Bind the bittern kernel threads to the cpus of the given NUMA node.
+	-1 lets them run on any cpu.
+
 $0: --set read_bypass_enabled --value [0,1] (default 0 : enabled)
 $0: --set write_bypass_enabled --value [0,1] (default 0 : enabled)
 	To enable sequential read_bypass or write_bypass, set value to 1.
@@ -125,6 +173,17 @@ $0: --set write_bypass_timeout --value [100 .. 180000 ] (default 5000)
 	How long before a tracked sequential stream is considered idle,
 	and therefore is no longer tracked.
 
+$0: --set read_admit_threshold --value [0 .. 15] (default 0 : disabled)
+$0: --set write_admit_threshold --value [0 .. 15] (default 0 : disabled)
+	Miss admission filter. Accesses to each cache block are counted in
+	a frequency sketch which is periodically aged. A read or write miss
+	only allocates a cache block if its block has been accessed at least
+	this many times recently, otherwise it bypasses the cache. Hits are
+	not affected. This keeps blocks which are accessed only once from
+	evicting hot blocks.
+	Admit/reject counts and the hit ratio before and since the last change
+	are in /sys/fs/bittern/<cache_name>/admission .
+
 $0: --set enable-extra-checksum-check
 $0: --set disable-extra-checksum-check
 	Enable/disable extra cache block checksum checking. Each extra checksum
@@ -174,6 +233,43 @@ $0 --set flush
 $0 --set invalidate
 	Invalidate all clean blocks.
 
+$0 --set resize --value mbytes
+	Resize the cache online to mbytes megabytes. A value of 0 grows the
+	cache to the current size of the cache device (for instance after
+	the underlying volume has been extended).
+	Growing makes the new blocks available in batches as they are
+	initialized. Shrinking writes back and invalidates the blocks past
+	the new end of the cache before releasing them, which can take a
+	while on a busy cache.
+	Only caches using the interleaved (block device) layout can be
+	resized. The command waits for the resize to complete; it can be
+	interrupted, in which case the resize continues in the background.
+
+$0 --set pool_min_pct --value pct (default 0)
+$0 --set pool_max_pct --value pct (default 100)
+	Min and max quotas of the pool's own cached device, as percentages of
+	the cache blocks. Quotas of member devices are given when they join.
+
+$0 --set io_class_<class>_max_pct --value pct (default 100, low 25)
+$0 --set io_class_<class>_pending_pct --value pct (default 100, low 50)
+	Quotas of an I/O class, <class> is high, normal or low. Requests of
+	realtime processes are high, of idle processes (ionice -c3) low.
+	max_pct caps the cache blocks the class can fill, misses over it
+	bypass the cache. pending_pct caps its share of max_pending_requests,
+	requests over it wait behind the other classes.
+	Statistics are in /sys/fs/bittern/<cache_name>/io_classes .
+
+$0 --set l1_max_mbytes --value mbytes (default 0)
+	Size of the DRAM front tier, which keeps copies of recently read
+	clean blocks in memory so that read hits do not go to the cache
+	device. A value of 0 disables it. Shrinking evicts entries right away.
+	Statistics are in /sys/fs/bittern/<cache_name>/l1 .
+
+$0 --set iotrace_sample --value N (default 0)
+	Records a binary trace event for one every N completed requests,
+	1 records all of them. A value of 0 disables tracing. Events are
+	drained with bc_iotrace -c <cache_name> (requires debugfs).
+
 $0: --set verify
 	Starts a full verify cycle. The contents of all clean blocks are
 	compared against the content of the cached device. Verification failure
@@ -187,6 +283,15 @@ $0: --set verify_start
 $0: --set verify_stop
 	Disable continuous clean block verification.
 
+$0 --set verifier_max_iops --value iops (default 0)
+	Max clean blocks verified per second, each block costs one read of
+	the cached device and one of the cache device. 0 is unlimited.
+
+$0 --set verifier_scan_target_secs --value secs (default 0)
+	Paces the verifier so that a full scan takes about secs seconds,
+	within the verifier_max_iops budget. 0 disables pacing, in which case
+	verifier_scan_delay_ms applies.
+
 $0 --set writeback
 	Set cache in writeback mode.
 
@@ -316,6 +421,10 @@ get_cache_sequential() {
 	local __param=$1
 	__get_cache_info "sequential" $__param
 }
+get_cache_admission() {
+	local __param=$1
+	__get_cache_info "admission" $__param
+}
 get_cache_verifier() {
 	local __param=$1
 	__get_cache_info "verifier" $__param
@@ -328,6 +437,10 @@ get_replacement() {
 	local __param=$1
 	__get_cache_info "replacement" $__param
 }
+get_cache_resize() {
+	local __param=$1
+	__get_cache_info "resize" $__param
+}
 get_cache_trace() {
 	local __param=$1
 	__get_cache_info "trace" $__param
@@ -375,8 +488,18 @@ do_get() {
 	echo "	 bgwriter_conf_greedyness = $(get_cache_conf bgwriter_conf_greedyness)"
 	echo "	 bgwriter_conf_max_queue_depth_pct = $(get_cache_conf bgwriter_conf_max_queue_depth_pct)"
 	echo "	 bgwriter_conf_cluster_size = $(get_cache_conf bgwriter_conf_cluster_size)"
+	echo "	 bgwriter_conf_workers = $(get_cache_conf bgwriter_conf_workers)"
+	echo "	 bgwriter_conf_latency_target_us = $(get_cache_conf bgwriter_conf_latency_target_us)"
+	echo "	 bgwriter_conf_hot_writes = $(get_cache_conf bgwriter_conf_hot_writes)"
+	echo "	 bgwriter_conf_hot_max_age_secs = $(get_cache_conf bgwriter_conf_hot_max_age_secs)"
+	echo "	 bgwriter_conf_hot_max_dirty_pct = $(get_cache_conf bgwriter_conf_hot_max_dirty_pct)"
 	echo "	 bgwriter_policy = $(get_cache_conf bgwriter_conf_policy)"
 	echo "	 invalidator_conf_min_invalid_count = $(get_cache_conf invalidator_conf_min_invalid_count)"
+	echo "	 invalidator_conf_batch_size = $(get_cache_conf invalidator_conf_batch_size)"
+	echo "	 direct_submit_enabled = $(get_cache_conf direct_submit_enabled)"
+	echo "	 one_io_commit_enabled = $(get_cache_conf one_io_commit_enabled)"
+	echo "	 mlog_enabled = $(get_cache_conf mlog_enabled)"
+	echo "	 numa_node = $(get_cache_conf numa_node)"
 	echo "	 enable_extra_checksum_check = $(get_cache_conf enable_extra_checksum_check)"
 	echo "debug parameters:"
 	echo "	 trace = $(get_cache_trace trace)"
@@ -388,6 +511,9 @@ do_get() {
 	echo "	 write_bypass_enabled = $(get_cache_sequential write_bypass_enabled)"
 	echo "	 write_bypass_threshold = $(get_cache_sequential write_bypass_threshold)"
 	echo "	 write_bypass_timeout = $(get_cache_sequential write_bypass_timeout)"
+	echo "miss admission filter:"
+	echo "	 read_admit_threshold = $(get_cache_admission read_admit_threshold)"
+	echo "	 write_admit_threshold = $(get_cache_admission write_admit_threshold)"
 	echo "verifier thread:"
 	__verifier_running=$(get_cache_verifier running)
 	echo "	 running = $__verifier_running"
@@ -399,6 +525,9 @@ do_get() {
 		echo "	 not_verified_dirty = $(get_cache_verifier blocks_not_verified_dirty)"
 		echo "	 not_verified_busy = $(get_cache_verifier blocks_not_verified_busy)"
 		echo "	 scans = $(get_cache_verifier scans)"
+		echo "	 scan_progress_pct = $(get_cache_verifier scan_progress_pct)"
+		echo "	 scan_blocks_per_sec = $(get_cache_verifier scan_blocks_per_sec)"
+		echo "	 scan_eta = $(get_cache_verifier scan_eta)"
 	fi
 }
 
@@ -493,6 +622,33 @@ do_verify() {
 	fi
 }
 
+do_resize() {
+	set_cache_conf resize_mbytes $VALUE_OPTION
+	if [ $? -ne 0 ]
+	then
+		echo $0: ERROR: $CACHE_NAME: resize failed to start
+		exit 1
+	fi
+	local __resize_active
+	__resize_active=$(get_cache_resize active)
+	while [ "$__resize_active" -ne 0 ]
+	do
+		echo $0: $CACHE_NAME resize still running, \
+			$(get_cache_resize total_entries)/$(get_cache_resize target_blocks) \
+			blocks, $(get_cache_resize evacuated) evacuated
+		sleep 1
+		__resize_active=$(get_cache_resize active)
+	done
+	local __resize_ret
+	__resize_ret=$(get_cache_resize last_ret)
+	if [ "$__resize_ret" -ne 0 ]
+	then
+		echo $0: ERROR: $CACHE_NAME resize failed: $__resize_ret
+		exit 1
+	fi
+	echo $0: $CACHE_NAME resized to $(get_cache_resize total_entries) blocks
+}
+
 do_verify_start(){
 	set_cache_conf_silent verifier_running 0
 	sleep 1
@@ -540,6 +696,11 @@ do_set() {
 	"invalidate")
 		set_cache_conf invalidate_cache 0
 		;;
+	"resize")
+		do_set_check_value
+		echo $0: $CACHE_NAME: resizing '(hit ^C to stop waiting)'
+		do_resize
+		;;
 	"verify")
 		echo $0: $CACHE_NAME: verifying clean blocks '(hit ^C to stop)'
 		do_verify
@@ -568,6 +729,19 @@ do_set() {
 		do_set_check_value
 		set_cache_conf bgwriter_conf_cluster_size $VALUE_OPTION
 		;;
+	"bgwriter_conf_workers")
+		do_set_check_value
+		set_cache_conf bgwriter_conf_workers $VALUE_OPTION
+		;;
+	"bgwriter_conf_latency_target_us")
+		do_set_check_value
+		set_cache_conf bgwriter_conf_latency_target_us $VALUE_OPTION
+		;;
+	"bgwriter_conf_hot_writes"|"bgwriter_conf_hot_max_age_secs"|\
+	"bgwriter_conf_hot_max_dirty_pct")
+		do_set_check_value
+		set_cache_conf $__set_option $VALUE_OPTION
+		;;
 	"bgwriter_conf_policy")
 		do_set_check_value
 		set_cache_conf bgwriter_conf_policy $VALUE_OPTION
@@ -584,10 +758,52 @@ do_set() {
 		do_set_check_value
 		set_cache_conf invalidator_conf_min_invalid_count $VALUE_OPTION
 		;;
+	"invalidator_conf_batch_size")
+		do_set_check_value
+		set_cache_conf invalidator_conf_batch_size $VALUE_OPTION
+		;;
+	"direct_submit_enabled")
+		do_set_check_value
+		set_cache_conf direct_submit_enabled $VALUE_OPTION
+		;;
+	"one_io_commit_enabled")
+		do_set_check_value
+		set_cache_conf one_io_commit_enabled $VALUE_OPTION
+		;;
+	"mlog_enabled")
+		do_set_check_value
+		set_cache_conf mlog_enabled $VALUE_OPTION
+		;;
+	"numa_node")
+		do_set_check_value
+		set_cache_conf numa_node $VALUE_OPTION
+		;;
 	"max_pending_requests")
 		do_set_check_value
 		set_cache_conf max_pending_requests $VALUE_OPTION
 		;;
+	"l1_max_mbytes")
+		do_set_check_value
+		set_cache_conf l1_max_mbytes $VALUE_OPTION
+		;;
+	"iotrace_sample")
+		do_set_check_value
+		set_cache_conf iotrace_sample $VALUE_OPTION
+		;;
+	"verifier_max_iops"|"verifier_scan_target_secs")
+		do_set_check_value
+		set_cache_conf $__set_option $VALUE_OPTION
+		;;
+	"pool_min_pct"|"pool_max_pct")
+		do_set_check_value
+		set_cache_conf $__set_option $VALUE_OPTION
+		;;
+	"io_class_high_max_pct"|"io_class_high_pending_pct"|\
+	"io_class_normal_max_pct"|"io_class_normal_pending_pct"|\
+	"io_class_low_max_pct"|"io_class_low_pending_pct")
+		do_set_check_value
+		set_cache_conf $__set_option $VALUE_OPTION
+		;;
 	"disable-extra-checksum-check")
 		set_cache_conf enable_extra_checksum_check 0
 		;;
@@ -618,6 +834,10 @@ do_set() {
 		do_set_check_value
 		set_cache_conf write_bypass_timeout $VALUE_OPTION
 		;;
+	"read_admit_threshold"|"write_admit_threshold")
+		do_set_check_value
+		set_cache_conf $__set_option $VALUE_OPTION
+		;;
 	"trace")
 		do_set_check_value
 		set_cache_conf trace $VALUE_OPTION
@@ -38,16 +38,21 @@ fi
 usage() {
         echo $0: usage: $0 arguments
         echo '          [-i|--ignore-already-setup]'
-        echo '          [-o|--cache-operation create|restore] (default is restore if unspecified)'
+        echo '          [-o|--cache-operation create|restore|join] (default is restore if unspecified)'
         echo '          -n|--cache-name name'
-        echo '          -c|--cache-device cache_device'
+        echo '          -c|--cache-device cache_device (pool cache for join, e.g. /dev/mapper/bitcache0)'
+        echo '                  (comma separated list of up to 8 devices to stripe the cache across)'
         echo '          -d|--device cached_device'
+        echo '          [-m|--member-id id] (join only, 1 to 15, must not change across restarts)'
+        echo '          [--min-pct percent] [--max-pct percent] (join only, share of pool cache blocks)'
         echo ''
         echo 'examples:'
         echo "          $0 -o create -n bitcache0 -s 128 -c /dev/adrbd0 -t mem -d /dev/mapper/vg-volume-being-cached"
         echo "          $0 -n bitcache0 -c /dev/adrbd0 -t mem -d /dev/mapper/vg-volume-being-cached"
         echo "          $0 -n bitcache0 -c /dev/mvwamb0 -t block -d /dev/mapper/vg-volume-being-cached"
         echo "          $0 -n bitcache0 -c /dev/pmem_ram0 -t block -d /dev/mapper/vg-volume-being-cached"
+        echo "          $0 -o create -n bitcache0 -c /dev/nvme0n1,/dev/nvme1n1 -t block -d /dev/mapper/vg-volume-being-cached"
+        echo "          $0 -o join -n bitcache1 -c /dev/mapper/bitcache0 -m 1 --min-pct 10 --max-pct 50 -d /dev/mapper/vg-other-volume"
 }
 
 # arguments processing
@@ -57,14 +62,20 @@ CACHE_NAME=""
 CACHE_DEVICE=""
 CACHED_DEVICE=""
 DISCARD_CACHE_DEVICE="no"
+MEMBER_ID=""
+MEMBER_MIN_PCT="0"
+MEMBER_MAX_PCT="100"
 
-__getopt_options_single_letter="hio:n:c:d:"
+__getopt_options_single_letter="hio:n:c:d:m:"
 __getopt_options_full="help"                                            # -h
 __getopt_options_full="$__getopt_options_full,ignore-already-setup"     # -i
 __getopt_options_full="$__getopt_options_full,cache-operation:"         # -o
 __getopt_options_full="$__getopt_options_full,cache-name:"              # -n
 __getopt_options_full="$__getopt_options_full,cache-device:"            # -c
 __getopt_options_full="$__getopt_options_full,device:"                  # -d
+__getopt_options_full="$__getopt_options_full,member-id:"               # -m
+__getopt_options_full="$__getopt_options_full,min-pct:"
+__getopt_options_full="$__getopt_options_full,max-pct:"
 ARGS=$(getopt -o $__getopt_options_single_letter -l $__getopt_options_full -n "bc_setup.sh" -- "$@");
 __status=$?
 if [ $__status -ne 0 ]
@@ -104,6 +115,21 @@ do
                 CACHED_DEVICE="$1"
                 shift
                 ;;
+        -m|--member-id)
+                shift
+                MEMBER_ID="$1"
+                shift
+                ;;
+        --min-pct)
+                shift
+                MEMBER_MIN_PCT="$1"
+                shift
+                ;;
+        --max-pct)
+                shift
+                MEMBER_MAX_PCT="$1"
+                shift
+                ;;
         --)
                 if [ $# -ne 1 ]
                 then
@@ -146,13 +172,23 @@ DEV_MAPPER_NAME="/dev/mapper/$CACHE_NAME"
 case "$CACHE_OPERATION" in
         "create"|"restore")
                 ;;
+        "join")
+                if [ "$MEMBER_ID" = "" ]
+                then
+                        echo $0: ERROR: --member-id parameter is mandatory for join
+                        usage
+                        exit 21
+                fi
+                ;;
         *)
-                echo $0: usage: "supported cache operations are 'create', 'restore'"
+                echo $0: usage: "supported cache operations are 'create', 'restore', 'join'"
                 exit 2
                 ;;
 esac
 
 echo $0: NOTE: cache device is $CACHE_DEVICE
+# striped caches have a comma separated list of cache devices
+CACHE_DEVICE_LIST=$(echo $CACHE_DEVICE | tr ',' ' ')
 
 check_privileges() {
         #
@@ -174,11 +210,14 @@ do_common_preflight() {
                 echo $0: ERROR: $CACHED_DEVICE is not a block device
                 exit 3
         fi
-        if [ ! -b $CACHE_DEVICE ]
-        then
-                echo $0: ERROR: $CACHE_DEVICE is not a block device
-                exit 3
-        fi
+        for __cache_device in $CACHE_DEVICE_LIST
+        do
+                if [ ! -b $__cache_device ]
+                then
+                        echo $0: ERROR: $__cache_device is not a block device
+                        exit 3
+                fi
+        done
         #
         # check cache existence first -- this will save us from a few headaches
         # (like for instance blkdev dying on us because the device is busy)
@@ -227,36 +266,46 @@ do_create_preflight() {
         #
         # trim cache device
         #
-        echo $0: NOTE: discarding cache device $CACHE_DEVICE
-        __blkdiscard_output=$(blkdiscard -v $CACHE_DEVICE 2>&1)
-        __status=$?
-        if [ $__status != 0 ]
-        then
-                echo $0: WARNING: cache discard failed: $__blkdiscard_output
-        else
-                echo $0: NOTE: cache discard succeeded: $__blkdiscard_output
-        fi
+        for __cache_device in $CACHE_DEVICE_LIST
+        do
+                echo $0: NOTE: discarding cache device $__cache_device
+                __blkdiscard_output=$(blkdiscard -v $__cache_device 2>&1)
+                __status=$?
+                if [ $__status != 0 ]
+                then
+                        echo $0: WARNING: cache discard failed: $__blkdiscard_output
+                else
+                        echo $0: NOTE: cache discard succeeded: $__blkdiscard_output
+                fi
+        done
 }
 
 check_cache_operation() {
-        $BCTOOL_EXE --silent --read --cache-device $CACHE_DEVICE
-        __bctool_status=$?
-        if [ $__bctool_status -eq 0 ]
-        then
-                __cache_exists="yes"
-                if [ $CACHE_OPERATION = "create" ]
-                then
-                        echo $0: ERROR: $CACHE_OPERATION cache operation cannot be done, a cache already exists in $CACHE_DEVICE
-                        exit 11
-                fi
-        else
-                __cache_exists="no"
-                if [ $CACHE_OPERATION = "restore" ]
+        #
+        # the header is replicated on every stripe, the kernel checks
+        # that all stripes of a restored cache belong together.
+        #
+        for __cache_device in $CACHE_DEVICE_LIST
+        do
+                $BCTOOL_EXE --silent --read --cache-device $__cache_device
+                __bctool_status=$?
+                if [ $__bctool_status -eq 0 ]
                 then
-                        echo $0: ERROR: $CACHE_OPERATION cache operation cannot be done, there is no existing cache in $CACHE_DEVICE
-                        exit 11
+                        __cache_exists="yes"
+                        if [ $CACHE_OPERATION = "create" ]
+                        then
+                                echo $0: ERROR: $CACHE_OPERATION cache operation cannot be done, a cache already exists in $__cache_device
+                                exit 11
+                        fi
+                else
+                        __cache_exists="no"
+                        if [ $CACHE_OPERATION = "restore" ]
+                        then
+                                echo $0: ERROR: $CACHE_OPERATION cache operation cannot be done, there is no existing cache in $__cache_device
+                                exit 11
+                        fi
                 fi
-        fi
+        done
 }
 
 #
@@ -291,17 +340,45 @@ do_operation() {
                 echo $0: ERROR: /sbin/dmsetup create $CACHE_NAME succeeded sysfs entry $__sysfs_pmem_api does not exist, or is not readable
                 exit 7
         fi
-	__actual_cache_size=$(cat $__sysfs_pmem_api  | sed -e 's/^.*bdev_actual_size_mbytes=//' -e 's/ .*$//')
+	__actual_cache_size=$(grep stripe_count= $__sysfs_pmem_api | sed -e 's/^.*bdev_actual_size_mbytes=//' -e 's/ .*$//')
 	echo $0: NOTE: allocated cache size is $__actual_cache_size mbytes
-	__cache_size=$(cat $__sysfs_pmem_api  | sed -e 's/^.*bdev_size_mbytes=//' -e 's/ .*$//')
+	__cache_size=$(grep stripe_count= $__sysfs_pmem_api | sed -e 's/^.*bdev_size_mbytes=//' -e 's/ .*$//')
 	echo $0: NOTE: used cache size is $__cache_size mbytes
 }
 
+#
+# do_join_operation adds the cached device to the shared pool of an
+# existing cache. members are removed with bc_remove.sh like any cache.
+#
+do_join_operation() {
+        __dmsetup_input="0 $CACHED_DEVICE_SECTORS bittern_cache_member $CACHE_DEVICE $CACHED_DEVICE $MEMBER_ID $MEMBER_MIN_PCT $MEMBER_MAX_PCT"
+        echo $0: NOTE: /sbin/dmsetup create $CACHE_NAME --table "$__dmsetup_input"
+        /sbin/dmsetup create $CACHE_NAME --table "$__dmsetup_input"
+        __status=$?
+        if [ $__status != 0 ]
+        then
+                echo $0: ERROR: /sbin/dmsetup create $CACHE_NAME failed with status $__status
+                exit 6
+        fi
+        echo $0: /sbin/dmsetup create $CACHE_NAME succeeded
+        if [ ! -b "$DEV_MAPPER_NAME" ]
+        then
+                echo $0: ERROR: /sbin/dmsetup create $CACHE_NAME succeeded but $DEV_MAPPER_NAME does not exist, or is not a block device
+                exit 7
+        fi
+}
+
 #
 # main
 #
 main() {
         check_privileges
+        if [ $CACHE_OPERATION = "join" ]
+        then
+                do_common_preflight
+                do_join_operation
+                return
+        fi
         check_cache_operation
         if [ $CACHE_OPERATION = "create" ]
         then
@@ -21,7 +21,11 @@ use Getopt::Long;
 
 my($help_msg) =
 "
-        The bc.stats.pl tool prints cache statistics every second.
+        The bc_stats.pl tool prints cache statistics every second, or every
+        --interval seconds. Statistics are read with the bc_snapshot tool,
+        which takes a single consistent binary snapshot of each cache per
+        interval (see /sys/fs/bittern/<name>/stats_snapshot). All counts
+        are per second rates over the last interval.
         The following fields are printed:
 
         (bittern) device:
@@ -54,6 +58,11 @@ my($help_msg) =
         (hits) w-hits:
                 Write hit count.
 
+        (latency) r-usec:
+                Average read request latency in microseconds.
+        (latency) w-usec:
+                Average write request latency in microseconds.
+
         (cache-blocks) invalid:
         (cache-blocks) clean:
         (cache-blocks) dirty:
@@ -69,13 +78,25 @@ my($help_msg) =
                 Bypass read requests issued to the cached device.
         (cached-device) wrseq:
                 Bypass write requests issued to the cached device.
+
+        Options:
+        --interval <secs>
+                Sampling interval, default is 1 second.
+        --snapshot-tool <path>
+                Path of the bc_snapshot tool, default is bc_snapshot
+                from \$PATH.
 ";
 sub do_help {
 	print "$0:\n$help_msg\n";
 	exit(0);
 }
 
-Getopt::Long::GetOptions("help", sub { do_help(); });
+my($interval) = 1;
+my($snapshot_tool) = "bc_snapshot";
+
+Getopt::Long::GetOptions("help" => sub { do_help(); },
+			 "interval=i" => \$interval,
+			 "snapshot-tool=s" => \$snapshot_tool);
 
 sub setup_cache_list {
 	my @cache_list = ();
@@ -84,7 +105,8 @@ sub setup_cache_list {
 	# unless specified in the cmdline.
 	if ($#ARGV >= 0) {
 		for my $cache_name (@ARGV) {
-			my($cache_stats) = "/sys/fs/bittern/$cache_name/stats";
+			my($cache_stats) =
+				"/sys/fs/bittern/$cache_name/stats_snapshot";
 			if (! -r $cache_stats) {
 				print "warning: $cache_stats does not exist\n";
 			}
@@ -100,77 +122,66 @@ sub setup_cache_list {
 	return @cache_list;
 }
 
-sub parse_cache_stat {
-	my($hash_ret) = undef;
-	my($cache_name, $stat_file) = @_;
-	my($file);
-	if (open($file, $stat_file)) {
-		my($stat_str);
-		while ($stat_str = <$file>) {
-			chomp($stat_str);
-			my($dummy1, $dummy2, $nvpairs) = split(': ', $stat_str);
-			my(@stat_strs);
-			@stat_strs = split(' ', $nvpairs);
-			foreach my $s (@stat_strs) {
-				my($name, $value) = split('=', $s);
-				# strip percentage or other trailing info
-				$value =~ s/\(.*//;
-				$hash_ret->{$name} = $value;
-			}
-		}
-		close($file);
-	}
-
-	return $hash_ret;
-}
-
-sub parse_cache_stats {
-	my($name) = @_;
-	my($hash_ret) = undef;
-
-	for my $file (qw(stats stats_extra bgwriter)) {
-		my $full_path = "/sys/fs/bittern/$name/$file";
-		$hash_ret->{$file} = parse_cache_stat($name, $full_path);
-		# Make it simple and just behave all-or-nothing.
-		# This allows to main code to just check one hash ref
-		# instead of the whole set.
-		if (!defined($hash_ret->{$file})) {
-			return undef;
+#
+# parse one round of bc_snapshot output, that is one line per cache
+# terminated by an empty line, and return a hash of hashes indexed by
+# cache name and value name. returns undef on end of file.
+#
+sub parse_snapshot_round {
+	my($pipe) = @_;
+	my($hash_ret) = {};
+	my($line);
+
+	while ($line = <$pipe>) {
+		chomp($line);
+		last if ($line eq "");
+		my($cache_name, $dummy, $nvpairs) = split(': ', $line);
+		foreach my $s (split(' ', $nvpairs)) {
+			my($name, $value) = split('=', $s);
+			$hash_ret->{$cache_name}->{$name} = $value;
 		}
 	}
-
-	return $hash_ret;
-}
-
-sub parse_caches_stats {
-	my @caches = @_;
-	my($hash_ret) = undef;
-
-	for my $name (@caches) {
-		$hash_ret->{$name} = parse_cache_stats($name);
-	}
+	return undef if (!defined($line));
 
 	return $hash_ret;
 }
 
 #
-# do delta of (curr, prev) and return 3 hashes,
+# returns 3 hashes,
 # {c} which contains current values,
-# {p} which contains previous values,
-# {d} which contains the deltas.
-sub do_deltas {
+# {d} which contains the per second rate of change since the previous sample,
+# {secs} which is the time elapsed since the previous sample.
+# values are 32 bit counters in the kernel, so handle wraparound.
+#
+sub do_rates {
 	my($curr, $prev) = @_;
 	my($hash_ret) = undef;
-	if ($curr && $prev) {
-		foreach my $key (keys %$curr) {
-			$hash_ret->{c}->{$key} = $curr->{$key};
-			$hash_ret->{p}->{$key} = $prev->{$key};
-			$hash_ret->{d}->{$key} = $curr->{$key} - $prev->{$key};
+	my($secs) = ($curr->{ts_nsec} - $prev->{ts_nsec}) / 1000000000.0;
+
+	return undef if ($secs <= 0);
+	$hash_ret->{secs} = $secs;
+	foreach my $key (keys %$curr) {
+		my($delta) = $curr->{$key} - $prev->{$key};
+		if ($delta < 0 && $prev->{$key} <= 0xffffffff) {
+			$delta += 4294967296;
 		}
+		$hash_ret->{c}->{$key} = $curr->{$key};
+		$hash_ret->{d}->{$key} = $delta / $secs;
 	}
 	$hash_ret;
 }
 
+#
+# average latency in microseconds of a snapshot timer over the last sample
+#
+sub timer_avg_usecs {
+	my($stats, $timer) = @_;
+	my($count) = $stats->{d}->{"timer_${timer}_count"};
+
+	return 0 if ($count == 0);
+	return $stats->{d}->{"timer_${timer}_sum_nsec"} / $count / 1000.0;
+}
+
 sub str_pad_symbol {
 	my($str, $len, $symbol) = @_;
 	while (length($str) + 1 < $len) {
@@ -196,9 +207,7 @@ sub str_pad_spaces {
 sub do_stats {
 	my($cache_name,
 	   $print_hdr,
-	   $stats,
-	   $stats_extra,
-	   $stats_bgwriter) = @_;
+	   $stats) = @_;
 
 	my($s_hdr0) = "";
 	my($s_hdr) = "";
@@ -229,10 +238,10 @@ sub do_stats {
 			  "wrback",
 			  "invals");
 	$s_val .= sprintf("%6d %6d %6d %6d" . $s_spaces,
-			  $stats_extra->{d}->{completed_read_requests},
-			  $stats_extra->{d}->{completed_write_requests},
-			  $stats_extra->{d}->{completed_writebacks},
-			  $stats_extra->{d}->{completed_invalidations});
+			  $stats->{d}->{completed_read_requests},
+			  $stats->{d}->{completed_write_requests},
+			  $stats->{d}->{completed_writebacks},
+			  $stats->{d}->{completed_invalidations});
 	#
 	# hits
 	#
@@ -246,10 +255,21 @@ sub do_stats {
 			  $r_hits,
 			  $w_hits);
 	#
+	# latency
+	#
+	$s_hdr0 .= sprintf("%15s" . $s_spaces, str_pad_dashes("latency", 15));
+	$s_hdr .= sprintf("%7s %7s" . $s_spaces, "r-usec", "w-usec");
+	$s_val .= sprintf("%7d %7d" . $s_spaces,
+			  timer_avg_usecs($stats, "reads"),
+			  timer_avg_usecs($stats, "writes"));
+	#
 	# clean/dirty
 	#
-	my($pct_f) = ($stats->{c}->{valid_dirty_cache_entries} * 100) /
-		     $stats->{c}->{total_entries};
+	my($pct_f) = 0;
+	if ($stats->{c}->{total_entries} > 0) {
+		$pct_f = ($stats->{c}->{valid_dirty_cache_entries} * 100) /
+			 $stats->{c}->{total_entries};
+	}
 	my($pct_s) = sprintf("%3.2f%%", $pct_f);
 	$s_hdr0 .= sprintf("%34s" . $s_spaces,
 			   str_pad_dashes("cache-blocks", 34));
@@ -276,8 +296,8 @@ sub do_stats {
 	$s_val .= sprintf("%6d %6d %6d %6d" . $s_spaces,
 			  $stats->{d}->{read_cached_device_requests},
 			  $stats->{d}->{write_cached_device_requests},
-			  $stats_extra->{d}->{read_sequential_bypass_count},
-			  $stats_extra->{d}->{write_sequential_bypass_count});
+			  $stats->{d}->{read_sequential_bypass_count},
+			  $stats->{d}->{write_sequential_bypass_count});
 
 	if ($print_hdr != 0) {
 		printf("%s\n", $s_hdr0);
@@ -296,32 +316,36 @@ if ($#cache_name_list < 0) {
 	exit;
 }
 
-my($caches_stats) = parse_caches_stats(@cache_name_list);
+#
+# A single bc_snapshot process samples all caches for the whole run,
+# printing one line per cache every interval.
+#
+my($snapshot_pipe);
+open($snapshot_pipe, "-|", $snapshot_tool, "-i", $interval,
+     @cache_name_list) or
+	die "$0: cannot run $snapshot_tool: $!\n";
+
+my($caches_stats) = parse_snapshot_round($snapshot_pipe);
 my($loop_count) = 0;
 
 # How many lines we get to print before printing the header? We print two lines
 # for the header, then a line per cache, 5 times, then the next header(s).
 my ($loop_before_printing_header) = 5;
 
-while (1) {
+while (defined($caches_stats)) {
 	my($print_hdr) = 0;
 	if ($loop_count % $loop_before_printing_header == 0) {
 		$print_hdr = 1;
 	}
 
-	sleep(1);
-
-	#
-	# parse stats from /sys/fs/
-	#
-
-	my($curr_caches_stats) = parse_caches_stats(@cache_name_list);
+	my($curr_caches_stats) = parse_snapshot_round($snapshot_pipe);
 	my($prev_caches_stats) = $caches_stats;
+	last if (!defined($curr_caches_stats));
 
 	foreach my $cache_name (@cache_name_list) {
 
 		#
-		# calc deltas
+		# calc rates
 		#
 
 		my($curr) = $curr_caches_stats->{$cache_name};
@@ -332,18 +356,12 @@ while (1) {
 			next;
 		}
 
-		my($stats) = do_deltas($curr->{'stats'},
-				       $prev->{'stats'});
-		my($stats_extra) = do_deltas($curr->{'stats_extra'},
-					     $prev->{'stats_extra'});
-		my($stats_bgwriter) = do_deltas($curr->{'bgwriter'},
-						$prev->{'bgwriter'});
+		my($stats) = do_rates($curr, $prev);
+		next if (!defined($stats));
 
 		do_stats($cache_name,
 			 $print_hdr,
-			 $stats,
-			 $stats_extra,
-			 $stats_bgwriter);
+			 $stats);
 
 		$print_hdr = 0;
 		$loop_count++;
@@ -351,3 +369,5 @@ while (1) {
 
 	$caches_stats = $curr_caches_stats;
 }
+
+close($snapshot_pipe);
@@ -0,0 +1,557 @@
+#!/bin/bash
+#
+# Bittern Cache.
+#
+# Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU General Public License,
+# version 2, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+#
+#
+# Reproducible benchmark harness.
+#
+# Builds a cache out of stand-in devices, so that builds and tunables can be
+# compared without real NVMe/NVDIMM and HDD hardware:
+#
+# * cache device: a brd ramdisk (mem backend, direct access) or a loop device
+#   over a sparse file (block backend).
+# * cached device: a dm-delay device over a loop device (default), or a
+#   null_blk device with timer based completions. Either one adds a fixed
+#   latency to every request, the way a slow disk would.
+#
+# Then runs a fixed matrix of fio jobs against it. The cache is recreated
+# before each job, so every job starts from the same (empty) state. Sysfs
+# statistics are saved before and after each job and a results file is
+# written with one line of key=value pairs per job, which can be diffed
+# or loaded into a spreadsheet.
+#
+# Requirements:
+# * root, fio, perl with JSON::PP, dmsetup, losetup.
+# * bittern module built in ../bittern_cache_kmod (it is loaded with
+#   bc_insmod_devel.sh if not already loaded).
+# * null_blk does not keep any data, so only use it with production builds,
+#   developer builds track data checksums and will complain.
+#
+# To run script, simply type (in this directory):
+#	bash ./bc_bench.sh
+# or, to compare a tunable:
+#	bash ./bc_bench.sh -o /var/tmp/classic -s bgwriter_conf_policy=classic
+#	bash ./bc_bench.sh -o /var/tmp/qd -s bgwriter_conf_policy=exp/queue-depth-adaptive
+#	diff /var/tmp/classic/results.txt /var/tmp/qd/results.txt
+#
+
+__dirpath=$(cd $(dirname $0) && pwd)
+SCRIPTS_DIR="$__dirpath/../../scripts"
+
+BENCH_ALL_JOBS="randread randwrite mixed7030 seqread seqwrite rmw journal"
+
+BENCH_CACHE_NAME="bitcache_bench"
+BENCH_CACHE_BACKEND="mem"
+BENCH_CACHE_MBYTES=1024
+BENCH_CACHED_BACKEND="delay"
+BENCH_CACHED_MBYTES=8192
+BENCH_DELAY_MS=5
+BENCH_WORKING_SET_PCT=80
+BENCH_RUNTIME=60
+BENCH_WARMUP=0
+BENCH_IODEPTH=32
+BENCH_CACHE_MODE="writeback"
+BENCH_JOBS="$BENCH_ALL_JOBS"
+BENCH_WORK_DIR="/var/tmp/bc_bench"
+BENCH_OUTPUT_DIR=""
+BENCH_KEEP="no"
+BENCH_TUNABLES=""
+
+# devices created by setup, torn down on exit
+BENCH_CACHE_LOOP=""
+BENCH_CACHED_LOOP=""
+BENCH_CACHED_DELAY=""
+BENCH_CACHED_NULL_BLK="no"
+BENCH_CACHE_DEVICE=""
+BENCH_CACHED_DEVICE=""
+BENCH_SYSFS_PATH=""
+
+# sysfs entries saved before and after each job
+BENCH_SYSFS_FILES="conf stats stats_extra pmem_stats sequential admission l1 replacement iotrace bgwriter bgwriter_policy timers"
+
+# counters from stats, stats_extra and sequential included in the results
+BENCH_COUNTERS="read_requests write_requests deferred_requests"
+BENCH_COUNTERS="$BENCH_COUNTERS total_read_hits total_read_misses"
+BENCH_COUNTERS="$BENCH_COUNTERS total_write_hits total_write_misses"
+BENCH_COUNTERS="$BENCH_COUNTERS clean_write_misses_rmw clean_write_hits_rmw"
+BENCH_COUNTERS="$BENCH_COUNTERS dirty_write_misses_rmw dirty_write_hits_rmw"
+BENCH_COUNTERS="$BENCH_COUNTERS writebacks invalidations"
+BENCH_COUNTERS="$BENCH_COUNTERS s_sequential_bypass_count"
+
+usage() {
+	echo $0: usage: $0 arguments
+	echo '		[-n|--cache-name name] (default '$BENCH_CACHE_NAME')'
+	echo '		[-c|--cache-backend mem|block] (default '$BENCH_CACHE_BACKEND')'
+	echo '		[-C|--cache-mbytes mbytes] (default '$BENCH_CACHE_MBYTES')'
+	echo '		[-d|--cached-backend delay|null_blk] (default '$BENCH_CACHED_BACKEND')'
+	echo '		[-D|--cached-mbytes mbytes] (default '$BENCH_CACHED_MBYTES')'
+	echo '		[-l|--delay-ms msecs] (cached device latency, default '$BENCH_DELAY_MS')'
+	echo '		[-w|--working-set-pct pct] (of cache size, default '$BENCH_WORKING_SET_PCT')'
+	echo '		[-r|--runtime secs] (per job, default '$BENCH_RUNTIME')'
+	echo '		[-W|--warmup secs] (random read warmup before each job, default '$BENCH_WARMUP')'
+	echo '		[-q|--iodepth depth] (default '$BENCH_IODEPTH')'
+	echo '		[-m|--cache-mode writeback|writethrough] (default '$BENCH_CACHE_MODE')'
+	echo '		[-j|--jobs job1,job2,...] (default all: '$BENCH_ALL_JOBS')'
+	echo '		[-s|--set option=value] (bc_control.sh --set, can be repeated)'
+	echo '		[-t|--work-dir dir] (loop device backing files, default '$BENCH_WORK_DIR')'
+	echo '		[-o|--output-dir dir] (default ./bc_bench.<date>)'
+	echo '		[-k|--keep] (keep the cache and devices when done)'
+	echo ''
+	echo 'jobs:'
+	echo '		randread   4k random reads'
+	echo '		randwrite  4k random writes'
+	echo '		mixed7030  4k random, 70% reads 30% writes'
+	echo '		seqread    128k sequential reads (sequential bypass)'
+	echo '		seqwrite   128k sequential writes (sequential bypass)'
+	echo '		rmw        1k random writes (partial page read-modify-write)'
+	echo '		journal    4k sequential writes, fdatasync after each (flush heavy)'
+}
+
+__getopt_options_single_letter="hn:c:C:d:D:l:w:r:W:q:m:j:s:t:o:k"
+__getopt_options_full="help,cache-name:,cache-backend:,cache-mbytes:"
+__getopt_options_full="$__getopt_options_full,cached-backend:,cached-mbytes:"
+__getopt_options_full="$__getopt_options_full,delay-ms:,working-set-pct:"
+__getopt_options_full="$__getopt_options_full,runtime:,warmup:,iodepth:"
+__getopt_options_full="$__getopt_options_full,cache-mode:,jobs:,set:"
+__getopt_options_full="$__getopt_options_full,work-dir:,output-dir:,keep"
+ARGS=$(getopt -o $__getopt_options_single_letter -l $__getopt_options_full -n "bc_bench.sh" -- "$@");
+__status=$?
+if [ $__status -ne 0 ]
+then
+	exit 1
+fi
+eval set -- "$ARGS";
+while true
+do
+	case "$1" in
+	-h|--help)
+		usage
+		exit 0
+		;;
+	-n|--cache-name)
+		BENCH_CACHE_NAME="$2"
+		shift 2
+		;;
+	-c|--cache-backend)
+		BENCH_CACHE_BACKEND="$2"
+		shift 2
+		;;
+	-C|--cache-mbytes)
+		BENCH_CACHE_MBYTES="$2"
+		shift 2
+		;;
+	-d|--cached-backend)
+		BENCH_CACHED_BACKEND="$2"
+		shift 2
+		;;
+	-D|--cached-mbytes)
+		BENCH_CACHED_MBYTES="$2"
+		shift 2
+		;;
+	-l|--delay-ms)
+		BENCH_DELAY_MS="$2"
+		shift 2
+		;;
+	-w|--working-set-pct)
+		BENCH_WORKING_SET_PCT="$2"
+		shift 2
+		;;
+	-r|--runtime)
+		BENCH_RUNTIME="$2"
+		shift 2
+		;;
+	-W|--warmup)
+		BENCH_WARMUP="$2"
+		shift 2
+		;;
+	-q|--iodepth)
+		BENCH_IODEPTH="$2"
+		shift 2
+		;;
+	-m|--cache-mode)
+		BENCH_CACHE_MODE="$2"
+		shift 2
+		;;
+	-j|--jobs)
+		BENCH_JOBS=$(echo "$2" | tr ',' ' ')
+		shift 2
+		;;
+	-s|--set)
+		BENCH_TUNABLES="$BENCH_TUNABLES $2"
+		shift 2
+		;;
+	-t|--work-dir)
+		BENCH_WORK_DIR="$2"
+		shift 2
+		;;
+	-o|--output-dir)
+		BENCH_OUTPUT_DIR="$2"
+		shift 2
+		;;
+	-k|--keep)
+		BENCH_KEEP="yes"
+		shift
+		;;
+	--)
+		shift
+		break
+		;;
+	esac
+done
+if [ $# -ne 0 ]
+then
+	usage
+	exit 1
+fi
+
+case "$BENCH_CACHE_BACKEND" in
+mem|block)
+	;;
+*)
+	echo $0: ERROR: unknown cache backend $BENCH_CACHE_BACKEND
+	exit 1
+	;;
+esac
+case "$BENCH_CACHED_BACKEND" in
+delay|null_blk)
+	;;
+*)
+	echo $0: ERROR: unknown cached backend $BENCH_CACHED_BACKEND
+	exit 1
+	;;
+esac
+case "$BENCH_CACHE_MODE" in
+writeback|writethrough)
+	;;
+*)
+	echo $0: ERROR: unknown cache mode $BENCH_CACHE_MODE
+	exit 1
+	;;
+esac
+for __job in $BENCH_JOBS
+do
+	case " $BENCH_ALL_JOBS " in
+	*" $__job "*)
+		;;
+	*)
+		echo $0: ERROR: unknown job $__job
+		exit 1
+		;;
+	esac
+done
+if [ "$(id -u)" != "0" ]
+then
+	echo $0: ERROR: needs to run as root
+	exit 1
+fi
+for __exe in fio perl /sbin/dmsetup /sbin/losetup
+do
+	if ! which $__exe > /dev/null 2>&1
+	then
+		echo $0: ERROR: cannot find $__exe
+		exit 1
+	fi
+done
+if ! perl -MJSON::PP -e 1 > /dev/null 2>&1
+then
+	echo $0: ERROR: perl JSON::PP module is required
+	exit 1
+fi
+
+if [ "$BENCH_OUTPUT_DIR" == "" ]
+then
+	BENCH_OUTPUT_DIR="./bc_bench.$(date +%Y%m%d-%H%M%S)"
+fi
+BENCH_RESULTS="$BENCH_OUTPUT_DIR/results.txt"
+BENCH_WORKING_SET_MBYTES=$((BENCH_CACHE_MBYTES * BENCH_WORKING_SET_PCT / 100))
+if [ $BENCH_WORKING_SET_MBYTES -gt $BENCH_CACHED_MBYTES ]
+then
+	BENCH_WORKING_SET_MBYTES=$BENCH_CACHED_MBYTES
+fi
+
+set -e
+
+#
+# stand-in devices
+#
+setup_devices() {
+	local __cached_sectors
+
+	mkdir -p $BENCH_WORK_DIR
+
+	if ! /sbin/lsmod | grep -q "^bittern_cache "
+	then
+		if [ "$BENCH_CACHE_BACKEND" == "mem" ]
+		then
+			$SCRIPTS_DIR/bc_insmod_devel.sh --insmod-brd \
+				--insmod-brd-size $((BENCH_CACHE_MBYTES * 1024))
+		else
+			$SCRIPTS_DIR/bc_insmod_devel.sh
+		fi
+	elif [ "$BENCH_CACHE_BACKEND" == "mem" ] && [ ! -b /dev/ram0 ]
+	then
+		/sbin/modprobe brd rd_nr=1 rd_size=$((BENCH_CACHE_MBYTES * 1024))
+	fi
+
+	if [ "$BENCH_CACHE_BACKEND" == "mem" ]
+	then
+		BENCH_CACHE_DEVICE=/dev/ram0
+	else
+		rm -f $BENCH_WORK_DIR/cache.img
+		truncate -s ${BENCH_CACHE_MBYTES}M $BENCH_WORK_DIR/cache.img
+		BENCH_CACHE_LOOP=$(/sbin/losetup -f --show $BENCH_WORK_DIR/cache.img)
+		BENCH_CACHE_DEVICE=$BENCH_CACHE_LOOP
+	fi
+
+	if [ "$BENCH_CACHED_BACKEND" == "null_blk" ]
+	then
+		# irqmode=2 completes requests from a timer after completion_nsec
+		/sbin/modprobe null_blk nr_devices=1 queue_mode=2 \
+			gb=$(((BENCH_CACHED_MBYTES + 1023) / 1024)) \
+			bs=4096 irqmode=2 \
+			completion_nsec=$((BENCH_DELAY_MS * 1000000))
+		BENCH_CACHED_NULL_BLK="yes"
+		BENCH_CACHED_DEVICE=/dev/nullb0
+	else
+		rm -f $BENCH_WORK_DIR/cached.img
+		truncate -s ${BENCH_CACHED_MBYTES}M $BENCH_WORK_DIR/cached.img
+		BENCH_CACHED_LOOP=$(/sbin/losetup -f --show $BENCH_WORK_DIR/cached.img)
+		__cached_sectors=$(blockdev --getsz $BENCH_CACHED_LOOP)
+		echo "0 $__cached_sectors delay $BENCH_CACHED_LOOP 0 $BENCH_DELAY_MS $BENCH_CACHED_LOOP 0 $BENCH_DELAY_MS" | \
+			/sbin/dmsetup create ${BENCH_CACHE_NAME}_hdd
+		BENCH_CACHED_DELAY=${BENCH_CACHE_NAME}_hdd
+		BENCH_CACHED_DEVICE=/dev/mapper/$BENCH_CACHED_DELAY
+	fi
+}
+
+teardown_devices() {
+	set +e
+	if [ -b /dev/mapper/$BENCH_CACHE_NAME ]
+	then
+		$SCRIPTS_DIR/bc_remove.sh $BENCH_CACHE_NAME
+	fi
+	if [ "$BENCH_CACHED_DELAY" != "" ]
+	then
+		/sbin/dmsetup remove $BENCH_CACHED_DELAY
+	fi
+	if [ "$BENCH_CACHED_LOOP" != "" ]
+	then
+		/sbin/losetup -d $BENCH_CACHED_LOOP
+		rm -f $BENCH_WORK_DIR/cached.img
+	fi
+	if [ "$BENCH_CACHE_LOOP" != "" ]
+	then
+		/sbin/losetup -d $BENCH_CACHE_LOOP
+		rm -f $BENCH_WORK_DIR/cache.img
+	fi
+	if [ "$BENCH_CACHED_NULL_BLK" == "yes" ]
+	then
+		/sbin/rmmod null_blk
+	fi
+}
+
+on_exit() {
+	if [ "$BENCH_KEEP" == "yes" ]
+	then
+		echo $0: keeping /dev/mapper/$BENCH_CACHE_NAME on $BENCH_CACHE_DEVICE and $BENCH_CACHED_DEVICE
+		return
+	fi
+	teardown_devices
+}
+
+#
+# cache
+#
+cache_create() {
+	local __tunable
+
+	if [ -b /dev/mapper/$BENCH_CACHE_NAME ]
+	then
+		$SCRIPTS_DIR/bc_remove.sh $BENCH_CACHE_NAME
+	fi
+	$SCRIPTS_DIR/bc_delete.sh $BENCH_CACHE_DEVICE --force
+	$SCRIPTS_DIR/bc_setup.sh --cache-operation create \
+				--cache-name $BENCH_CACHE_NAME \
+				--cache-device $BENCH_CACHE_DEVICE \
+				--device $BENCH_CACHED_DEVICE
+	$SCRIPTS_DIR/bc_control.sh --set $BENCH_CACHE_MODE $BENCH_CACHE_NAME
+	for __tunable in $BENCH_TUNABLES
+	do
+		case "$__tunable" in
+		*=*)
+			$SCRIPTS_DIR/bc_control.sh --set ${__tunable%%=*} \
+				--value ${__tunable#*=} $BENCH_CACHE_NAME
+			;;
+		*)
+			$SCRIPTS_DIR/bc_control.sh --set $__tunable \
+				$BENCH_CACHE_NAME
+			;;
+		esac
+	done
+	BENCH_SYSFS_PATH="/sys/fs/bittern/$(/sbin/dmsetup info --noheadings -c -o major,minor $BENCH_CACHE_NAME)"
+}
+
+# saves all sysfs entries of interest to $1.<entry>
+sysfs_save() {
+	local __f
+
+	for __f in $BENCH_SYSFS_FILES
+	do
+		if [ -r $BENCH_SYSFS_PATH/$__f ]
+		then
+			cat $BENCH_SYSFS_PATH/$__f > $1.$__f
+		fi
+	done
+}
+
+# prints "name value" for each numeric counter in the saved sysfs entries $1.*
+# counters which appear more than once (e.g. read and write) are summed up
+sysfs_counters() {
+	cat $1.stats $1.stats_extra $1.sequential 2> /dev/null | \
+	awk '{
+		for (i = 3; i <= NF; i++) {
+			if (split($i, kv, "=") != 2)
+				continue;
+			if (kv[2] !~ /^[0-9]+/)
+				continue;
+			sum[kv[1]] += int(kv[2]);
+		}
+	}
+	END {
+		for (k in sum)
+			print k, sum[k];
+	}'
+}
+
+# prints "name=delta" for each of BENCH_COUNTERS between $1.* and $2.*
+sysfs_deltas() {
+	local __c __b __a
+
+	sysfs_counters $1 > $1.counters
+	sysfs_counters $2 > $2.counters
+	for __c in $BENCH_COUNTERS
+	do
+		__b=$(awk -v k=$__c '$1 == k { print $2 }' $1.counters)
+		__a=$(awk -v k=$__c '$1 == k { print $2 }' $2.counters)
+		if [ "$__b" != "" ] && [ "$__a" != "" ]
+		then
+			echo -n " $__c=$((__a - __b))"
+		fi
+	done
+}
+
+# prints iops, bandwidth and latency from fio json output, in key=value form
+fio_results() {
+	perl -MJSON::PP -e '
+		local $/;
+		open(my $fh, "<", $ARGV[0]) or die "cannot open $ARGV[0]\n";
+		my $j = decode_json(<$fh>);
+		my $job = $j->{jobs}[0];
+		for my $dir ("read", "write") {
+			my $d = $job->{$dir};
+			# fio 3.x reports nanoseconds, older versions microseconds
+			my ($lat, $clat, $div) = ($d->{lat_ns}, $d->{clat_ns}, 1000);
+			($lat, $clat, $div) = ($d->{lat}, $d->{clat}, 1)
+				unless defined $lat;
+			my $p99 = $clat->{percentile}{"99.000000"} // 0;
+			printf(" %s_iops=%.0f %s_bw_kbs=%d %s_lat_usecs=%.1f %s_lat_p99_usecs=%.0f",
+			       $dir, $d->{iops}, $dir, $d->{bw},
+			       $dir, $lat->{mean} / $div,
+			       $dir, $p99 / $div);
+		}
+		printf(" usr_cpu=%.1f sys_cpu=%.1f", $job->{usr_cpu}, $job->{sys_cpu});
+	' $1
+}
+
+# fio arguments for each job
+job_args() {
+	case "$1" in
+	randread)
+		echo "--rw=randread --bs=4k --ioengine=libaio --iodepth=$BENCH_IODEPTH"
+		;;
+	randwrite)
+		echo "--rw=randwrite --bs=4k --ioengine=libaio --iodepth=$BENCH_IODEPTH"
+		;;
+	mixed7030)
+		echo "--rw=randrw --rwmixread=70 --bs=4k --ioengine=libaio --iodepth=$BENCH_IODEPTH"
+		;;
+	seqread)
+		echo "--rw=read --bs=128k --ioengine=libaio --iodepth=4"
+		;;
+	seqwrite)
+		echo "--rw=write --bs=128k --ioengine=libaio --iodepth=4"
+		;;
+	rmw)
+		echo "--rw=randwrite --bs=1k --blockalign=512 --ioengine=libaio --iodepth=$BENCH_IODEPTH"
+		;;
+	journal)
+		# a small circular log, as a filesystem journal would be
+		echo "--rw=write --bs=4k --ioengine=sync --fdatasync=1 --size=64m"
+		;;
+	esac
+}
+
+run_job() {
+	local __job=$1
+	local __out=$BENCH_OUTPUT_DIR/$__job
+	local __fio_common
+
+	echo $0: running $__job
+	cache_create
+	__fio_common="--filename=/dev/mapper/$BENCH_CACHE_NAME --direct=1"
+	__fio_common="$__fio_common --size=${BENCH_WORKING_SET_MBYTES}m"
+	__fio_common="$__fio_common --randrepeat=1 --time_based"
+	if [ $BENCH_WARMUP -gt 0 ]
+	then
+		fio --name=warmup $__fio_common --runtime=$BENCH_WARMUP \
+			--rw=randread --bs=4k --ioengine=libaio \
+			--iodepth=$BENCH_IODEPTH > $__out.warmup.log
+	fi
+	sysfs_save $__out.before
+	fio --name=$__job $__fio_common --runtime=$BENCH_RUNTIME \
+		$(job_args $__job) \
+		--output-format=json --output=$__out.fio.json
+	sysfs_save $__out.after
+
+	echo "job=$__job cache_backend=$BENCH_CACHE_BACKEND cached_backend=$BENCH_CACHED_BACKEND mode=$BENCH_CACHE_MODE$(fio_results $__out.fio.json)$(sysfs_deltas $__out.before $__out.after)" >> $BENCH_RESULTS
+	tail -1 $BENCH_RESULTS
+}
+
+mkdir -p $BENCH_OUTPUT_DIR
+trap on_exit EXIT
+setup_devices
+
+{
+	echo "# bc_bench: $(date)"
+	echo "# kernel: $(uname -r)"
+	echo "# fio: $(fio --version)"
+	echo "# cache_backend=$BENCH_CACHE_BACKEND cache_device=$BENCH_CACHE_DEVICE cache_mbytes=$BENCH_CACHE_MBYTES"
+	echo "# cached_backend=$BENCH_CACHED_BACKEND cached_device=$BENCH_CACHED_DEVICE cached_mbytes=$BENCH_CACHED_MBYTES delay_ms=$BENCH_DELAY_MS"
+	echo "# mode=$BENCH_CACHE_MODE working_set_mbytes=$BENCH_WORKING_SET_MBYTES runtime=$BENCH_RUNTIME warmup=$BENCH_WARMUP iodepth=$BENCH_IODEPTH"
+	echo "# tunables:$BENCH_TUNABLES"
+} > $BENCH_RESULTS
+
+for __job in $BENCH_JOBS
+do
+	run_job $__job
+	if [ ! -s $BENCH_OUTPUT_DIR/build_info ]
+	then
+		# same for all jobs
+		cat $BENCH_SYSFS_PATH/build_info > $BENCH_OUTPUT_DIR/build_info
+		cat $BENCH_SYSFS_PATH/git_info > $BENCH_OUTPUT_DIR/git_info
+	fi
+done
+
+echo $0: results are in $BENCH_RESULTS
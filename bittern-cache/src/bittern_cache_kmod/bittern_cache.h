@@ -40,6 +40,7 @@
 #include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 #include <linux/interrupt.h>
+#include <linux/ioprio.h>
 
 /* this must be first */
 #include "bittern_cache_config.h"
@@ -84,6 +85,9 @@
 
 #include "bittern_cache_states.h"
 
+#include "bittern_cache_iotrace.h"
+#include "bittern_cache_snapshot.h"
+
 /*
  * intel x86-sse memcpy_nt
  */
@@ -146,6 +150,42 @@ static inline sector_t sector_to_cache_block_sector(sector_t s)
 	return s & ~(SECTORS_PER_CACHE_BLOCK - 1);
 }
 
+/*!
+ * Shared pool mode. Several dm targets share the cache blocks of one
+ * bittern cache. The high bits of the sector number carry the id of the
+ * pool member which owns the block, id 0 is the pool's own cached device.
+ * See bittern_cache_pool.c .
+ */
+#define CACHE_POOL_OWNER_SHIFT	48
+#define CACHE_POOL_SECTOR_MASK	((1ULL << CACHE_POOL_OWNER_SHIFT) - 1ULL)
+/*! max number of devices sharing a pool, including the pool's own */
+#define CACHE_POOL_MAX_OWNERS	16
+
+/*!
+ * NUMA nodes with per-node counters, see bittern_cache_numa.c .
+ * nodes past this are still used, but are not accounted for.
+ */
+#define CACHE_NUMA_MAX_NODES	8
+
+/*! returns the pool owner id encoded in a valid sector number */
+static inline unsigned int cache_pool_sector_owner(sector_t s)
+{
+	return (unsigned int)((uint64_t)s >> CACHE_POOL_OWNER_SHIFT);
+}
+
+/*! returns the sector number on the owner's cached device */
+static inline sector_t cache_pool_sector_device(sector_t s)
+{
+	return (sector_t)((uint64_t)s & CACHE_POOL_SECTOR_MASK);
+}
+
+/*! encodes owner id and cached device sector into a pool sector number */
+static inline sector_t cache_pool_sector_make(unsigned int owner, sector_t s)
+{
+	return (sector_t)(((uint64_t)owner << CACHE_POOL_OWNER_SHIFT) |
+			  ((uint64_t)s & CACHE_POOL_SECTOR_MASK));
+}
+
 /*! bio equivalent of @ref is_sector_cache_aligned */
 #define bio_is_sector_cache_aligned(__bio) \
 	is_sector_cache_aligned((__bio)->bi_iter.bi_sector)
@@ -247,6 +287,26 @@ struct work_item {
 	uint64_t wi_ts_physio_flush;
 	/*! pmem async context for cache operations */
 	struct async_context wi_async_context;
+	/*!
+	 * L1 entry this read hit is being served from, if any.
+	 * See bittern_cache_l1.c .
+	 */
+	struct cache_l1_entry *wi_l1_entry;
+	/*!
+	 * Binary I/O trace info, see bittern_cache_iotrace.c .
+	 * Sector and size are copied from the original bio, as the bio
+	 * can be acked before the work_item is freed. Size is zero for
+	 * bittern initiated requests.
+	 */
+	sector_t wi_iotrace_sector;
+	unsigned int wi_iotrace_size;
+	pid_t wi_iotrace_pid;
+	/*! last state machine path this work_item went thru */
+	enum cache_transition wi_iotrace_transition;
+	/*! node this work_item was allocated on */
+	int wi_numa_node;
+	/*! I/O class of the user request, see @ref cache_io_class */
+	int wi_io_class;
 	int wi_magic2;
 	/*! bi_data_dir used for deferred worker */
 	int bi_datadir;
@@ -256,6 +316,11 @@ struct work_item {
 	struct list_head devio_pending_list;
 	/*! access serialized with @ref devio spinlock */
 	int64_t devio_gennum;
+	/*!
+	 * flush generation which makes this write stable.
+	 * access serialized with @ref devio spinlock
+	 */
+	uint64_t devio_flush_gen;
 	/*!
 	 * Copy of current bio's flags. Looking at the bio flags
 	 * is not possible, as bio strips them before acking the request.
@@ -324,9 +389,28 @@ struct cache_block {
 	struct rb_node bcb_rb_node;
 	enum cache_state bcb_state:8;
 	enum cache_transition bcb_cache_transition:8;
+	/*! I/O class which allocated this block, not persisted */
+	unsigned int bcb_io_class:8;
+	/*!
+	 * write heat and bgwriter skip flag, see
+	 * @ref cache_bgwriter_write_hit . not persisted.
+	 */
+	unsigned int bcb_write_heat:4;
+	unsigned int bcb_hot_deferred:1;
+	/*! time the block became dirty, in seconds since boot */
+	unsigned int bcb_dirty_since;
 	uint32_t bcb_magic3;
 };
 
+/*!
+ * the in-memory cache block array is allocated in chunks of this many
+ * cache blocks, see @ref bittern_cache::bc_cache_blocks .
+ */
+#define CACHE_BLOCKS_CHUNK_SHIFT	14
+#define CACHE_BLOCKS_PER_CHUNK		(1U << CACHE_BLOCKS_CHUNK_SHIFT)
+/*! enough chunks to cover all positive block ids */
+#define CACHE_BLOCKS_MAX_CHUNKS		(1U << (31 - CACHE_BLOCKS_CHUNK_SHIFT))
+
 #define BC_MAGIC1 0xf10c7a93
 #define BC_MAGIC2 0xf10c754a
 #define BC_MAGIC3 0xf10ca793
@@ -385,6 +469,35 @@ struct seq_io_bypass {
 	uint64_t lru_hit_depth_count;
 };
 
+/*!
+ * Per direction miss admission policy, see bittern_cache_admit.c .
+ */
+struct cache_admit_policy {
+	/*! superuser tunable, zero admits all misses */
+	unsigned int admit_threshold;
+	/* counters */
+	atomic_t admit_count;
+	atomic_t reject_count;
+	/*! hit/miss counts when the threshold was last changed */
+	unsigned int base_hits;
+	unsigned int base_misses;
+};
+
+/*!
+ * Count-min sketch of cache block access frequencies, shared by the read
+ * and write admission policies.
+ */
+struct cache_admit_sketch {
+	/*! CACHE_ADMIT_SKETCH_DEPTH rows of CACHE_ADMIT_SKETCH_WIDTH counters */
+	uint8_t *counters;
+	/*! accesses since the last aging */
+	atomic_t sample_count;
+	unsigned int sample_size;
+	atomic_t agings;
+	/*! halves the counters, queued by the access which hits sample_size */
+	struct work_struct aging_work;
+};
+
 /*! holds queue of deferred requests */
 struct deferred_queue {
 	struct bio_list list;
@@ -397,14 +510,97 @@ struct deferred_queue {
 	uint64_t tstamp;
 };
 
+/*! max number of cache devices a cache can be striped across */
+#define PMEM_MAX_STRIPES	8
+
+/*!
+ * One of the cache devices backing a striped cache.
+ * Cache blocks are distributed round robin across stripes by block id,
+ * and each stripe has its own submission workqueue.
+ */
+struct pmem_stripe {
+	struct block_device *ps_bdev;
+	struct workqueue_struct *ps_make_request_wq;
+	/* actual size of this device */
+	size_t ps_bdev_size_bytes;
+	/* number of async requests submitted to this device */
+	atomic_t ps_make_req_count;
+};
+
+/*!
+ * Metadata intent log, see bittern_cache_pmem_mlog.c .
+ * Page sequence numbers only ever grow, page seq is stored in ring slot
+ * seq % ml_pages. Pages [ml_tail_seq, ml_written_seq) are on the cache
+ * device and not checkpointed yet, page ml_written_seq may be in flight,
+ * page ml_head_seq is the one being filled.
+ */
+struct pmem_mlog {
+	/*! protects the append state below */
+	spinlock_t ml_lock;
+	/*! serializes checkpoints */
+	struct mutex ml_mutex;
+	/*! serializes start and stop */
+	struct mutex ml_state_mutex;
+	/*! log is started, buffers are allocated */
+	bool ml_started;
+	/*! log takes appends */
+	bool ml_open;
+	uint64_t ml_epoch;
+	uint64_t ml_offset_bytes;
+	unsigned int ml_pages;
+	uint64_t ml_head_seq;
+	uint64_t ml_written_seq;
+	uint64_t ml_tail_seq;
+	/*! records in the page being filled */
+	unsigned int ml_head_records;
+	bool ml_write_inflight;
+	/*! page being filled is ml_page[ml_head_seq & 1] */
+	void *ml_page[2];
+	/*! updates in the page being filled */
+	struct list_head ml_head_waiters;
+	/*! updates in the page being written */
+	struct list_head ml_inflight_waiters;
+	/*! block ids of the records of each ring slot */
+	uint32_t *ml_block_ids;
+	/*! checkpoint copy of ml_block_ids */
+	uint32_t *ml_ckpt_block_ids;
+	/*! page seq is written with ml_pmem_ctx[seq & 1] */
+	struct pmem_context ml_pmem_ctx[2];
+	wait_queue_head_t ml_wait;
+	struct workqueue_struct *ml_wq;
+	struct work_struct ml_checkpoint_work;
+	uint64_t ml_write_started;
+	/*! stats */
+	atomic_t ml_appends;
+	atomic_t ml_full_fallbacks;
+	atomic_t ml_busy_fallbacks;
+	atomic_t ml_page_writes;
+	atomic_t ml_write_errors;
+	/*! records per page write, protected by ml_lock */
+	unsigned int ml_batch_hist[PMEM_MLOG_BATCH_HIST_BUCKETS];
+	unsigned int ml_checkpoints;
+	unsigned int ml_checkpoint_pages;
+	unsigned int ml_checkpoint_blocks;
+	unsigned int ml_checkpoint_busy_retries;
+	unsigned int ml_checkpoint_errors;
+	struct cache_timer ml_write_timer;
+	struct cache_timer ml_checkpoint_timer;
+	/*! sorted records of the log left by a crash, used during restore */
+	struct pmem_block_metadata *ml_replay;
+	unsigned int ml_replay_count;
+};
+
 struct pmem_api {
 	/*
 	 * per instance state
 	 * FIXME: should move to per instance
 	 */
+	/* first (or only) cache device, same as papi_stripes[0].ps_bdev */
 	struct block_device *papi_bdev;
-	struct workqueue_struct *papi_make_request_wq;
-	/* used size */
+	/* number of cache devices, 1 unless the cache is striped */
+	unsigned int papi_stripe_count;
+	struct pmem_stripe papi_stripes[PMEM_MAX_STRIPES];
+	/* used size (logical size across all stripes) */
 	size_t papi_bdev_size_bytes;
 	size_t papi_bdev_actual_size_bytes;
 	/* pmem stats */
@@ -413,8 +609,160 @@ struct pmem_api {
 	struct pmem_header papi_hdr;
 	/* tells which copy (0 or 1) we updated last */
 	int papi_hdr_updated_last;
+	/* serializes header updates against online resize */
+	struct mutex papi_hdr_mutex;
 	/* pmem_api context */
 	const struct cache_papi_interface *papi_interface;
+	/* metadata intent log */
+	struct pmem_mlog papi_mlog;
+	/*
+	 * epochs of the data/metadata writes which go out as one request.
+	 * the epoch advances at header updates once all the writes issued
+	 * in the previous epoch have completed. see lm_one_io_epoch.
+	 */
+	spinlock_t papi_one_io_lock;
+	uint64_t papi_one_io_epoch;
+	/* writes in flight issued in even and odd epochs */
+	unsigned int papi_one_io_inflight[2];
+	/* lm_one_io_acked_epoch of the header the cache was restored from */
+	uint64_t papi_one_io_restore_acked_epoch;
+	/* epoch cannot advance until all blocks have been restored */
+	bool papi_one_io_restoring;
+};
+
+/*!
+ * DRAM front tier (L1) entry. Holds a copy of the data of a clean cache
+ * block. Entries are indexed by cache block id, and are looked up before
+ * reading from the cache device. See bittern_cache_l1.c .
+ */
+struct cache_l1_entry {
+	/*! hash chain, protected by @ref bittern_cache::bc_l1_lock */
+	struct hlist_node l1e_hash_node;
+	/*! lru list, protected by @ref bittern_cache::bc_l1_lock */
+	struct list_head l1e_lru_node;
+	unsigned int l1e_block_id;
+	/*! sector of the cache block at the time the entry was created */
+	sector_t l1e_sector;
+	/*! one reference for the index, one for each reader */
+	atomic_t l1e_refcount;
+	/*! PAGE_SIZE data buffer, allocated from bc_kmem_map */
+	void *l1e_vaddr;
+};
+
+/*!
+ * State of one bgwriter worker thread. Worker 0 is started by the ctr, it
+ * computes the writeback policy and starts and stops the other workers.
+ * Each worker only writes back the dirty blocks in its own shard of the
+ * cached device, see @ref cache_bgwriter_shard .
+ */
+struct cache_bgwriter_worker {
+	struct bittern_cache *bgw_cache;
+	struct task_struct *bgw_task;
+	unsigned int bgw_id;
+	/*! number of shards used in the current loop */
+	unsigned int bgw_nr_shards;
+	unsigned long bgw_loop_count;
+	unsigned int bgw_no_work_count;
+	/*! loops spent parked because bgw_id >= conf_workers */
+	unsigned int bgw_idle_count;
+	/*! loops with dirty blocks, but none in this worker's shard */
+	unsigned int bgw_no_shard_work_count;
+	unsigned int bgw_writebacks;
+	unsigned int bgw_clusters;
+	/*! writeback rate, recomputed about once a second by the worker */
+	unsigned int bgw_writebacks_per_sec;
+	unsigned int bgw_rate_writebacks;
+	unsigned long bgw_rate_jiffies;
+};
+
+/*! per NUMA node counters, see bittern_cache_numa.c */
+struct cache_numa_node {
+	/*! cache block chunks allocated on this node */
+	atomic_t cnn_chunks;
+	/*! work_items allocated on this node */
+	atomic_t cnn_wi_allocs;
+	/*! work_items allocated on this node and freed on another one */
+	atomic_t cnn_wi_remote_frees;
+};
+
+/*!
+ * Per-device state of a shared pool, indexed by owner id.
+ * Slot 0 is the pool's own cached device, the other slots are used by
+ * member targets, see bittern_cache_pool.c .
+ */
+struct cache_pool_owner {
+	struct bittern_cache *cpo_bc;
+	unsigned int cpo_id;
+	/*!
+	 * cached device, NULL if no target is attached to this slot.
+	 * for slot 0 this is the same as devio.dm_dev .
+	 */
+	struct dm_dev *cpo_dm_dev;
+	/*! member target, NULL for slot 0 */
+	struct dm_target *cpo_ti;
+	/*! pool device held open by the member, keeps the pool around */
+	struct block_device *cpo_pool_bdev;
+	char cpo_device_name[BC_NAMELEN];
+	/*! quotas, in percent of the total number of cache blocks */
+	unsigned int cpo_min_pct;
+	unsigned int cpo_max_pct;
+	/*! valid cache blocks owned, protected by bc_entries_lock */
+	atomic_t cpo_valid_entries;
+	/*! restored dirty blocks waiting for this owner to attach */
+	atomic_t cpo_orphan_dirty;
+	atomic_t cpo_read_requests;
+	atomic_t cpo_write_requests;
+	atomic_t cpo_read_hits;
+	atomic_t cpo_write_hits;
+	atomic_t cpo_read_misses;
+	atomic_t cpo_write_misses;
+	/*! misses bypassed because the owner is at its max quota */
+	atomic_t cpo_max_quota_bypasses;
+	/*! blocks not evicted because the owner is at its min quota */
+	atomic_t cpo_min_quota_skips;
+	/*! member detach: blocks written back and invalidated */
+	uint64_t cpo_evacuate_writebacks;
+	uint64_t cpo_evacuate_invalidations;
+};
+
+/*!
+ * I/O classes, see bittern_cache_ioclass.c .
+ * A request's class comes from the I/O priority of its submitter.
+ * Normal is zero, so that restored blocks belong to it.
+ */
+enum cache_io_class_id {
+	CACHE_IO_CLASS_NORMAL = 0,
+	CACHE_IO_CLASS_HIGH,
+	CACHE_IO_CLASS_LOW,
+	CACHE_IO_CLASSES,
+};
+
+/*! Per-class quotas and statistics. */
+struct cache_io_class {
+	/*!
+	 * runtime configurable options.
+	 * max_pct caps the cache blocks the class can fill, in percent of
+	 * the total number of cache blocks. pending_pct caps the pending
+	 * requests of the class, in percent of bc_max_pending_requests.
+	 */
+	unsigned int cic_max_pct;
+	unsigned int cic_pending_pct;
+	/*! valid cache blocks allocated by this class */
+	atomic_t cic_valid_entries;
+	/*! user requests of this class in the state machine */
+	atomic_t cic_pending_requests;
+	atomic_t cic_read_requests;
+	atomic_t cic_write_requests;
+	atomic_t cic_read_hits;
+	atomic_t cic_write_hits;
+	atomic_t cic_read_misses;
+	atomic_t cic_write_misses;
+	/*! misses bypassed because the class is at its max quota */
+	atomic_t cic_max_quota_bypasses;
+	/*! requests put back in the deferred queue to yield a pending slot */
+	atomic_t cic_pending_yields;
+	/*! requests of this class waiting in @ref bittern_cache::defer_class */
+	atomic_t cic_throttled_requests;
 };
 
 /*! error state */
@@ -618,6 +966,8 @@ struct bittern_cache {
 	struct cache_timer bc_timer_read_clean_hits;
 	struct cache_timer bc_timer_write_clean_hits;
 	struct cache_timer bc_timer_read_dirty_hits;
+	/*! read hits served from the DRAM front tier */
+	struct cache_timer bc_timer_read_l1_hits;
 	struct cache_timer bc_timer_write_dirty_hits;
 	struct cache_timer bc_timer_cached_device_reads;
 	struct cache_timer bc_timer_cached_device_writes;
@@ -640,6 +990,11 @@ struct bittern_cache {
 	/*! delayed work struct for seq_io bypass */
 	struct delayed_work bc_seq_work;
 
+	/*! miss admission filter */
+	struct cache_admit_sketch bc_admit_sketch;
+	struct cache_admit_policy bc_admit_read;
+	struct cache_admit_policy bc_admit_write;
+
 	int bc_magic2;
 
 	/*! PMEM state */
@@ -730,6 +1085,26 @@ struct bittern_cache {
 	struct cache_timer bc_make_request_wq_timer;
 	atomic_t bc_make_request_wq_count;
 	atomic_t bc_make_request_count;
+	/*! requests submitted from the calling context, see above */
+	atomic_t bc_make_request_direct_count;
+	/*!
+	 * runtime configurable option.
+	 * submit requests from the calling context when it is safe to do so,
+	 * rather than always deferring them to a workqueue.
+	 */
+	volatile int bc_direct_submit_enabled;
+	/*!
+	 * runtime configurable option.
+	 * on block cache devices, write data and metadata of a block with
+	 * one two page request, see @ref MCBM_MAGIC_ONE_IO.
+	 */
+	volatile int bc_one_io_commit_enabled;
+	/*!
+	 * runtime configurable option.
+	 * on block cache devices, batch metadata-only updates of different
+	 * blocks in the metadata intent log, see bittern_cache_pmem_mlog.c .
+	 */
+	volatile int bc_mlog_enabled;
 
 #ifdef ENABLE_TRACK_CRC32C
 #define CACHE_TRACK_HASH_MAGIC0       UINT128_FROM_UINT(0xf10c6a4a)
@@ -757,20 +1132,31 @@ struct bittern_cache {
 	atomic_t bc_cache_transitions_counters[__TS_NUM];
 	atomic_t bc_cache_states_counters[__CACHE_STATES_NUM];
 
-	/*! synchronizes access to both deferred queues */
+	/*! synchronizes access to all deferred queues */
 	spinlock_t defer_lock;
 	/*! deferred queue, cases 1 and 2. see @ref (doxy_deferredqueues.md) */
 	struct deferred_queue defer_busy;
 	/*! deferred queue, cases 3 and 4. see @ref (doxy_deferredqueues.md) */
 	struct deferred_queue defer_page;
+	/*!
+	 * requests held back by their I/O class pending quota. these are
+	 * not accounted in bc_deferred_requests, so they do not hold back
+	 * the requests of other classes. see @ref (doxy_deferredqueues.md)
+	 */
+	struct deferred_queue defer_class;
 	/*! deferred queue workqueue */
 	struct workqueue_struct *defer_wq;
 	struct work_struct defer_work;
 
 	/*
-	 * background writer kernel thread to writeback dirty blocks
+	 * background writer kernel threads to writeback dirty blocks.
+	 * workers[0] is always running, the others are started on demand
+	 * by workers[0] according to bc_bgwriter_conf_workers.
 	 */
-	struct task_struct *bc_bgwriter_task;
+	struct cache_bgwriter_worker
+			bc_bgwriter_workers[CACHE_BGWRITER_MAX_WORKERS];
+	/*! number of workers started so far, only changed by workers[0] */
+	unsigned int bc_bgwriter_nr_workers;
 	wait_queue_head_t bc_bgwriter_wait;
 	unsigned int bc_bgwriter_no_work_count;
 	unsigned int bc_bgwriter_work_count;
@@ -853,6 +1239,27 @@ struct bittern_cache {
 	 * used by writeback policy
 	 */
 	volatile unsigned int bc_bgwriter_conf_max_queue_depth_pct;
+	/*
+	 * number of bgwriter workers, each one owning a shard of the
+	 * cached device. all workers share the policy queue depth.
+	 */
+	volatile unsigned int bc_bgwriter_conf_workers;
+	/*
+	 * read miss latency target in usecs.
+	 * used by the latency-feedback writeback policy.
+	 */
+	volatile unsigned int bc_bgwriter_conf_latency_target_us;
+	/*
+	 * write-hot dirty blocks are kept dirty longer, see
+	 * @ref cache_bgwriter_block_is_hot . hot_writes of 0 disables it.
+	 */
+	volatile unsigned int bc_bgwriter_conf_hot_writes;
+	volatile unsigned int bc_bgwriter_conf_hot_max_age_secs;
+	volatile unsigned int bc_bgwriter_conf_hot_max_dirty_pct;
+	/*! write-hot blocks skipped by the bgwriter */
+	atomic_t bc_bgwriter_hot_deferred_count;
+	/*! write hits on skipped blocks, each one a writeback saved */
+	atomic_t bc_bgwriter_hot_writebacks_saved;
 
 	unsigned long bc_bgwriter_loop_count;
 
@@ -869,9 +1276,122 @@ struct bittern_cache {
 	 * maintain.
 	 */
 	volatile unsigned int bc_invalidator_conf_min_invalid_count;
+	/*
+	 * config variable.
+	 * max number of clean blocks invalidated in one batch.
+	 */
+	volatile unsigned int bc_invalidator_conf_batch_size;
+	/*! histogram of batch sizes, bucket N counts sizes [2^N, 2^(N+1)) */
+	unsigned int bc_invalidator_batch_hist[INVALIDATOR_BATCH_HIST_BUCKETS];
+
+	/*!
+	 * in-memory cache block metadata.
+	 * this is a directory of chunks of @ref CACHE_BLOCKS_PER_CHUNK
+	 * cache blocks each, so that the cache can be resized online
+	 * without moving the cache blocks already in use.
+	 * always use @ref cache_block_from_id to access it.
+	 */
+	struct cache_block **bc_cache_blocks;
+	/*! number of chunks currently allocated in @ref bc_cache_blocks */
+	unsigned int bc_cache_blocks_chunks;
+
+	/*
+	 * NUMA placement, see bittern_cache_numa.c
+	 */
+	/*! node closest to the cache device, NUMA_NO_NODE if unknown */
+	int bc_numa_device_node;
+	/*!
+	 * runtime configurable option.
+	 * node the kernel threads are bound to, NUMA_NO_NODE if unbound.
+	 */
+	volatile int bc_numa_node;
+	struct cache_numa_node bc_numa_nodes[CACHE_NUMA_MAX_NODES];
+
+	/*
+	 * I/O classes, see bittern_cache_ioclass.c
+	 */
+	struct cache_io_class bc_io_classes[CACHE_IO_CLASSES];
 
-	/*! array of in-memory cache block metadata */
-	struct cache_block *bc_cache_blocks;
+	/*
+	 * online resize state, see bittern_cache_resize.c
+	 */
+	struct workqueue_struct *bc_resize_wq;
+	struct work_struct bc_resize_work;
+	/*! non-zero while a resize is in progress */
+	atomic_t bc_resize_active;
+	/*! set by dtr to abort a resize in progress */
+	volatile int bc_resize_abort;
+	/*! number of cache blocks requested by the current/last resize */
+	unsigned int bc_resize_target_blocks;
+	/*!
+	 * during shrink, blocks with id greater than this are being evacuated
+	 * and are parked in @ref bc_resize_evacuated_list as soon as they
+	 * become invalid. zero when no shrink is in progress.
+	 * protected by @ref bc_entries_lock .
+	 */
+	unsigned int bc_resize_fence;
+	struct list_head bc_resize_evacuated_list;
+	atomic_t bc_resize_evacuated;
+	int bc_resize_ret;
+	unsigned int bc_resize_grows;
+	unsigned int bc_resize_shrinks;
+	unsigned int bc_resize_aborts;
+	unsigned int bc_resize_passes;
+	uint64_t bc_resize_blocks_added;
+	uint64_t bc_resize_blocks_removed;
+	uint64_t bc_resize_writebacks;
+	uint64_t bc_resize_invalidations;
+	unsigned long bc_resize_started;
+	unsigned long bc_resize_completed;
+
+	/*
+	 * shared pool state, see bittern_cache_pool.c
+	 */
+	struct cache_pool_owner bc_pool_owners[CACHE_POOL_MAX_OWNERS];
+	/*! number of member targets currently attached */
+	unsigned int bc_pool_members;
+	/*!
+	 * restored dirty blocks owned by members which are not attached.
+	 * they cannot be written back, so they are kept off the dirty list.
+	 * protected by @ref bc_entries_lock .
+	 */
+	struct list_head bc_pool_orphan_list;
+	atomic_t bc_pool_orphan_dirty;
+	/*! entry in the global list of pools */
+	struct list_head bc_pool_list;
+
+	/*
+	 * DRAM front tier (L1) of clean pages, see bittern_cache_l1.c .
+	 * bc_l1_lock is a leaf lock, it can be taken with bc_entries_lock
+	 * or bcb_spinlock held.
+	 */
+	spinlock_t bc_l1_lock;
+	struct hlist_head *bc_l1_hash;
+	struct list_head bc_l1_lru;
+	/*! number of entries, used for a lockless "is empty" check */
+	atomic_t bc_l1_entries;
+	/*! L1 size limit in megabytes, zero means disabled */
+	unsigned int bc_l1_max_mbytes;
+	/*! L1 size limit in pages, derived from @ref bc_l1_max_mbytes */
+	unsigned int bc_l1_max_entries;
+	atomic_t bc_l1_hits;
+	atomic_t bc_l1_misses;
+	atomic_t bc_l1_inserts;
+	atomic_t bc_l1_evictions;
+	atomic_t bc_l1_invalidations;
+	atomic_t bc_l1_alloc_failures;
+
+	/*
+	 * binary I/O trace, see bittern_cache_iotrace.c .
+	 */
+	/*! record one every bc_iotrace_sample requests, zero means disabled */
+	unsigned int bc_iotrace_sample;
+	/*! per-cpu event rings, indexed by cpu id */
+	struct cache_iotrace_ring **bc_iotrace_rings;
+	/*! serializes ring allocation and readers */
+	struct mutex bc_iotrace_mutex;
+	/*! per-cache debugfs directory, NULL if not available */
+	struct dentry *bc_iotrace_dentry;
 
 	/*! red-black tree index for metadata */
 	struct rb_root bc_rb_root;
@@ -937,6 +1457,11 @@ struct bittern_cache {
 	 * above case W1 and W3 will be acknowledged, but W3 cannot because it
 	 * was issued after F3.
 	 *
+	 * Matching is actually done on flush generations rather than on the
+	 * issue gennum: a flush only makes stable the writes which completed
+	 * before it was issued, so W2, which completed after F3 was issued,
+	 * waits for the next flush too. See bittern_cache_cached_devio.c .
+	 *
 	 */
 	struct devio {
 		/*! device being cached */
@@ -979,8 +1504,36 @@ struct bittern_cache {
 		 * \todo handle rollover
 		 */
 		uint64_t gennum_flush;
+		/*!
+		 * Flush generation of the last flush issued, pure or
+		 * write+flush. See bittern_cache_cached_devio.c .
+		 */
+		uint64_t flush_gen_issued;
+		/*! flush generation the last write which completed waits for */
+		uint64_t flush_gen_wanted;
+		/*! flushes in flight, pure or write+flush */
+		int flush_inflight_count;
+		int flush_inflight_max;
+		/*! flushes issued while another one was in flight */
+		uint64_t flush_overlap_count;
+		/*! flushes issued by the delayed worker */
+		uint64_t flush_delayed_count;
+		/*! flushes which acked no waiting write */
+		uint64_t flush_empty_count;
+		/*!
+		 * histogram of waiting writes acked per flush,
+		 * bucket N counts sizes [2^N, 2^(N+1))
+		 */
+		unsigned int flush_batch_hist[CACHED_DEV_FLUSH_BATCH_HIST_BUCKETS];
+		/*!
+		 * histogram of the time writes wait for a flush,
+		 * bucket N counts waits of [2^N, 2^(N+1)) microseconds
+		 */
+		unsigned int flush_wait_hist[CACHED_DEV_FLUSH_WAIT_HIST_BUCKETS];
 		/*! workqueue used to issue explicit flushes */
 		struct workqueue_struct *flush_wq;
+		/*! work struct for flushes dispatched on write completion */
+		struct work_struct flush_work;
 		/*! work struct for explicit flushes */
 		struct delayed_work flush_delayed_work;
 		/*! conf param - how often the delayed worker runs */
@@ -989,8 +1542,9 @@ struct bittern_cache {
 		int conf_fua_insert;
 	} devio;
 
-	/*! device acting as the cache */
-	struct dm_dev *bc_cache_dev;
+	/*! devices acting as the cache, more than one if striped */
+	struct dm_dev *bc_cache_devs[PMEM_MAX_STRIPES];
+	unsigned int bc_cache_dev_count;
 
 	int bc_verifier_running;
 	struct task_struct *bc_verifier_task;
@@ -1005,6 +1559,14 @@ struct bittern_cache {
 	unsigned long bc_verifier_scan_last_block;
 	unsigned long bc_verifier_scan_completed;
 	int bc_verifier_scan_delay_ms;
+	/*! conf param - max blocks verified per second, 0 is unlimited */
+	int bc_verifier_max_iops;
+	/*! conf param - spread a full scan over this many seconds, 0 is off */
+	int bc_verifier_scan_target_secs;
+	/*! last block id scanned by the current scan */
+	int bc_verifier_scan_position;
+	uint64_t bc_verifier_device_reads;
+	uint64_t bc_verifier_device_read_errors;
 	int bc_verifier_verify_errors;
 	int bc_verifier_verify_errors_cumulative;
 	int bc_verifier_bug_on_verify_errors;
@@ -1017,6 +1579,204 @@ struct bittern_cache {
 	int bc_magic4;
 };
 
+/*!
+ * returns the in-memory cache block for the given block id.
+ * block_id starts from 1, the chunked array starts from 0.
+ */
+static inline struct cache_block *cache_block_from_id(struct bittern_cache *bc,
+						      unsigned int block_id)
+{
+	unsigned int idx = block_id - 1;
+
+	ASSERT(block_id >= 1);
+	ASSERT((idx >> CACHE_BLOCKS_CHUNK_SHIFT) < bc->bc_cache_blocks_chunks);
+	return &bc->bc_cache_blocks[idx >> CACHE_BLOCKS_CHUNK_SHIFT]
+				   [idx & (CACHE_BLOCKS_PER_CHUNK - 1)];
+}
+
+/*! number of chunks needed to hold the given number of cache blocks */
+static inline unsigned int cache_blocks_chunks(uint64_t cache_blocks)
+{
+	return DIV_ROUND_UP(cache_blocks, (uint64_t)CACHE_BLOCKS_PER_CHUNK);
+}
+
+/*! returns the pool owner slot for a valid pool sector number */
+static inline struct cache_pool_owner *cache_pool_owner_of(
+					struct bittern_cache *bc,
+					sector_t sector)
+{
+	unsigned int owner = cache_pool_sector_owner(sector);
+
+	ASSERT(is_sector_number_valid(sector));
+	M_ASSERT(owner < CACHE_POOL_MAX_OWNERS);
+	return &bc->bc_pool_owners[owner];
+}
+
+/*!
+ * returns the cached device which holds the given pool sector,
+ * NULL if its owner is not attached.
+ */
+static inline struct dm_dev *cache_pool_owner_dev(struct bittern_cache *bc,
+						  sector_t sector)
+{
+	if (cache_pool_sector_owner(sector) == 0)
+		return bc->devio.dm_dev;
+	return cache_pool_owner_of(bc, sector)->cpo_dm_dev;
+}
+
+/*!
+ * returns true if a miss for this pool sector must not allocate a new
+ * cache block because the owner is at or above its max quota.
+ */
+static inline bool cache_pool_over_max_quota(struct bittern_cache *bc,
+					     sector_t sector)
+{
+	struct cache_pool_owner *cpo = cache_pool_owner_of(bc, sector);
+
+	if (cpo->cpo_max_pct >= 100)
+		return false;
+	return (uint64_t)atomic_read(&cpo->cpo_valid_entries) * 100ULL >=
+	       (uint64_t)cpo->cpo_max_pct *
+	       (uint64_t)atomic_read(&bc->bc_total_entries);
+}
+
+/*!
+ * returns true if a request can be submitted with generic_make_request()
+ * from the current context instead of being deferred to a workqueue, that
+ * is, if we are in process context with interrupts enabled and no spinlock
+ * held. without CONFIG_PREEMPT_COUNT in_atomic() cannot see held
+ * spinlocks, so requests are always deferred on such kernels.
+ */
+static inline bool cache_can_submit_direct(struct bittern_cache *bc)
+{
+	return IS_ENABLED(CONFIG_PREEMPT_COUNT) &&
+	       bc->bc_direct_submit_enabled &&
+	       !in_interrupt() &&
+	       !irqs_disabled() &&
+	       !in_atomic();
+}
+
+/*!
+ * returns true if evicting this valid cache block would take its owner
+ * below its min quota. caller holds bc_entries_lock, which keeps
+ * bcb_sector stable.
+ */
+static inline bool cache_pool_block_protected(struct bittern_cache *bc,
+					      struct cache_block *cache_block)
+{
+	struct cache_pool_owner *cpo;
+
+	if (bc->bc_pool_members == 0)
+		return false;
+	cpo = cache_pool_owner_of(bc, cache_block->bcb_sector);
+	if (cpo->cpo_min_pct == 0)
+		return false;
+	if ((uint64_t)atomic_read(&cpo->cpo_valid_entries) * 100ULL >
+	    (uint64_t)cpo->cpo_min_pct *
+	    (uint64_t)atomic_read(&bc->bc_total_entries))
+		return false;
+	atomic_inc(&cpo->cpo_min_quota_skips);
+	return true;
+}
+
+/*!
+ * I/O class of a request. map() tags the bio with the submitter's I/O
+ * priority, so the class is the same when the request comes back from
+ * a deferred queue.
+ */
+static inline int cache_io_class_of_bio(struct bio *bio)
+{
+	switch (IOPRIO_PRIO_CLASS(bio_prio(bio))) {
+	case IOPRIO_CLASS_RT:
+		return CACHE_IO_CLASS_HIGH;
+	case IOPRIO_CLASS_IDLE:
+		return CACHE_IO_CLASS_LOW;
+	default:
+		return CACHE_IO_CLASS_NORMAL;
+	}
+}
+
+/*!
+ * returns true if a miss of this class must not allocate a new cache
+ * block because the class is at or above its max quota.
+ */
+static inline bool cache_io_class_over_max_quota(struct bittern_cache *bc,
+						 int io_class)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[io_class];
+
+	if (cic->cic_max_pct >= 100)
+		return false;
+	return (uint64_t)atomic_read(&cic->cic_valid_entries) * 100ULL >=
+	       (uint64_t)cic->cic_max_pct *
+	       (uint64_t)atomic_read(&bc->bc_total_entries);
+}
+
+/*!
+ * returns true if a request of this class has to leave its pending slot
+ * to other classes, because the class already has its share of
+ * @ref bittern_cache::bc_max_pending_requests in flight.
+ */
+static inline bool cache_io_class_over_pending(struct bittern_cache *bc,
+					       int io_class)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[io_class];
+
+	if (cic->cic_pending_pct >= 100)
+		return false;
+	return atomic_read(&cic->cic_pending_requests) * 100U >=
+	       cic->cic_pending_pct * bc->bc_max_pending_requests;
+}
+
+/*!
+ * returns true if a new request of this class has to wait in
+ * @ref bittern_cache::defer_class, that is if the class is over its
+ * pending quota or if older requests of the class are already waiting
+ * there (so that requests of a class are not reordered).
+ */
+static inline bool cache_io_class_must_wait(struct bittern_cache *bc,
+					    int io_class)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[io_class];
+
+	return atomic_read(&cic->cic_throttled_requests) > 0 ||
+	       cache_io_class_over_pending(bc, io_class);
+}
+
+/*!
+ * DRAM front tier (L1), see bittern_cache_l1.c .
+ * @ref cache_l1_get returns a referenced entry which holds the data of the
+ * given clean cache block, or NULL. The reference is dropped with
+ * @ref cache_l1_put .
+ */
+extern struct cache_l1_entry *cache_l1_get(struct bittern_cache *bc,
+					   struct cache_block *cache_block);
+extern void cache_l1_put(struct bittern_cache *bc,
+			 struct cache_l1_entry *l1e);
+/*! copies the clean cache block data in buffer into L1 */
+extern void cache_l1_insert(struct bittern_cache *bc,
+			    struct cache_block *cache_block,
+			    void *buffer);
+extern void __cache_l1_drop(struct bittern_cache *bc,
+			    unsigned int block_id);
+/*! drops the L1 copy of a cache block, if any */
+static inline void cache_l1_drop(struct bittern_cache *bc,
+				 struct cache_block *cache_block)
+{
+	if (atomic_read(&bc->bc_l1_entries) != 0)
+		__cache_l1_drop(bc, cache_block->bcb_block_id);
+}
+
+extern void __cache_iotrace_record(struct bittern_cache *bc,
+				   struct work_item *wi);
+/*! records a binary trace event for a completed request, if enabled */
+static inline void cache_iotrace_record(struct bittern_cache *bc,
+					struct work_item *wi)
+{
+	if (ACCESS_ONCE(bc->bc_iotrace_sample) != 0)
+		__cache_iotrace_record(bc, wi);
+}
+
 /*!
  * returns true if a dm map() request can be queued into the state machine.
  * needs a minimum number of free blocks, which is the sum of
@@ -1085,8 +1845,7 @@ static inline const char *cache_mode_to_str(struct bittern_cache *bc)
 	ASSERT(atomic_read(&(__bcb)->bcb_refcount) >= 0);               \
 	ASSERT_CACHE_STATE(__bcb);                                      \
 	ASSERT_CACHE_TRANSITION_VALID(__bcb);                           \
-	/* block_id starts from 1, array starts from 0 */               \
-	ASSERT(&(__bc)->bc_cache_blocks[(__bcb)->bcb_block_id - 1] ==	\
+	ASSERT(cache_block_from_id((__bc), (__bcb)->bcb_block_id) ==	\
 	       (__bcb));						\
 })
 
@@ -1097,8 +1856,6 @@ static inline const char *cache_mode_to_str(struct bittern_cache *bc)
 	__bc = (__bc);                                                                        \
 	ASSERT((__bc) != NULL);                                                               \
 	ASSERT((__bcb) != NULL);                                                              \
-	ASSERT((__bcb) >= &(__bc)->bc_cache_blocks[0] &&                                      \
-		(__bcb) < &(__bc)->bc_cache_blocks[atomic_read(&(__bc)->bc_total_entries)]);  \
 	ASSERT((__bcb)->bcb_block_id >= 1 &&                                                  \
 		(__bcb)->bcb_block_id <= atomic_read(&(__bc)->bc_total_entries));             \
 	__ASSERT_CACHE_BLOCK(__bcb, __bc);                                            \
@@ -1127,7 +1884,8 @@ static inline const char *cache_mode_to_str(struct bittern_cache *bc)
 
 #define ASSERT_BITTERN_CACHE(__bc) ({                                                               \
 	__ASSERT_BITTERN_CACHE(__bc);                                                               \
-	ASSERT(atomic_read(&(__bc)->bc_total_entries) == (__bc)->bc_papi.papi_hdr.lm_cache_blocks); \
+	ASSERT(atomic_read(&(__bc)->bc_resize_active) != 0 ||                                      \
+	       atomic_read(&(__bc)->bc_total_entries) == (__bc)->bc_papi.papi_hdr.lm_cache_blocks); \
 })
 
 extern int seq_bypass_initialize(struct bittern_cache *bc);
@@ -1139,6 +1897,21 @@ extern int seq_bypass_stats(struct bittern_cache *bc,
 			    char *result,
 			    size_t maxlen);
 
+extern int cache_admit_initialize(struct bittern_cache *bc);
+extern void cache_admit_deinitialize(struct bittern_cache *bc);
+/*!
+ * records an access to the cache block of this bio, and returns true if
+ * a miss on it should be admitted into the cache.
+ */
+extern bool cache_admit_filter(struct bittern_cache *bc, struct bio *bio);
+extern int cache_admit_stats(struct bittern_cache *bc,
+			     char *result,
+			     size_t maxlen);
+int set_read_admit_threshold(struct bittern_cache *bc, int value);
+int read_admit_threshold(struct bittern_cache *bc);
+int set_write_admit_threshold(struct bittern_cache *bc, int value);
+int write_admit_threshold(struct bittern_cache *bc);
+
 int set_read_bypass_enabled(struct bittern_cache *bc, int value);
 int read_bypass_enabled(struct bittern_cache *bc);
 int set_read_bypass_threshold(struct bittern_cache *bc, int value);
@@ -1188,9 +1961,13 @@ extern struct cache_block *cache_rb_last(struct bittern_cache *bc);
 
 #include "bittern_cache_main.h"
 
-extern int cache_bgwriter_kthread(void *__bc);
+/*! takes a pointer to struct cache_bgwriter_worker */
+extern int cache_bgwriter_kthread(void *__bgw);
 extern int cache_invalidator_kthread(void *__bc);
 extern int cache_invalidator_has_work_schmitt(struct bittern_cache *bc);
+/*! bind a kernel thread to the cpus of @ref bittern_cache::bc_numa_node */
+extern void cache_numa_bind_task(struct bittern_cache *bc,
+				 struct task_struct *task);
 
 /*! worker used to issue explicit flushes */
 extern void cache_deferred_worker(struct work_struct *work);
@@ -1199,16 +1976,68 @@ extern void cache_deferred_worker(struct work_struct *work);
 extern const char *cache_bgwriter_policy(struct bittern_cache *bc);
 extern ssize_t cache_bgwriter_op_show_policy(struct bittern_cache *bc,
 					     char *result);
+/*! show the internal state of the current policy, if it has any */
+extern ssize_t cache_bgwriter_op_show_policy_state(struct bittern_cache *bc,
+						   char *result,
+						   size_t maxlen);
 extern int cache_bgwriter_policy_set(struct bittern_cache *bc,
 				     const char *buf);
 extern void cache_bgwriter_policy_init(struct bittern_cache *bc);
 
 extern void cache_bgwriter_flush_dirty_blocks(struct bittern_cache *bc);
+extern int cache_bgwriter_wait_for_resources(struct bittern_cache *bc,
+					     bool do_wait);
+extern int cache_bgwriter_io_start_one(struct bittern_cache *bc,
+				       sector_t sector_hint,
+				       sector_t *o_sector_hint);
 extern void cache_bgwriter_compute_policy_slow(struct bittern_cache *bc);
 extern void cache_bgwriter_compute_policy_fast(struct bittern_cache *bc);
+/*! carries the write history of a block over to its write hit clone */
+extern void cache_bgwriter_write_hit(struct bittern_cache *bc,
+				     struct cache_block *original_cache_block,
+				     struct cache_block *cloned_cache_block,
+				     bool original_is_dirty);
+/*! true if the bgwriter should skip a held dirty block for now */
+extern bool cache_bgwriter_block_is_hot(struct bittern_cache *bc,
+					struct cache_block *cache_block);
+
+/*!
+ * bgwriter shard of a cached device sector. the cached device is split in
+ * ranges of bc_bgwriter_conf_cluster_size cache blocks, and range N
+ * belongs to shard (N % nr_shards), so that each bgwriter worker can
+ * still write back full clusters without overlapping with the others.
+ */
+static inline unsigned int cache_bgwriter_shard(struct bittern_cache *bc,
+						sector_t sector,
+						unsigned int nr_shards)
+{
+	uint64_t range;
+
+	if (nr_shards <= 1)
+		return 0;
+	range = div_u64(sector, bc->bc_bgwriter_conf_cluster_size *
+			SECTORS_PER_CACHE_BLOCK);
+	return do_div(range, nr_shards);
+}
 
 /*! the main DM entry point for bittern */
 extern int bittern_cache_map(struct dm_target *ti, struct bio *bio);
+/*! map entry point shared by the cache target and pool member targets */
+extern int __bittern_cache_map(struct bittern_cache *bc, struct bio *bio);
+/*!
+ * point bio to the cached device of the owner of its sector, and
+ * turn the sector into a device sector. returns the owner id.
+ */
+extern unsigned int cache_pool_remap_bio(struct bittern_cache *bc,
+					 struct bio *bio);
+/*! give bio the I/O priority of the submitter if it has none */
+extern void cache_io_class_tag_bio(struct bio *bio);
+/*! per-class accounting of the user requests in the state machine */
+extern void cache_io_class_request_start(struct bittern_cache *bc,
+					 struct work_item *wi,
+					 struct bio *bio);
+extern void cache_io_class_request_done(struct bittern_cache *bc,
+					struct work_item *wi);
 
 extern int cache_block_verifier_kthread(void *bc);
 extern void cache_invalidate_clean_block(struct bittern_cache *bc,
@@ -1224,6 +2053,8 @@ extern void cache_invalidate_block_io_start(struct bittern_cache *bc,
 
 /*! worker used to issue explicit flushes */
 extern void cached_devio_flush_delayed_worker(struct work_struct *work);
+extern void cached_devio_flush_worker(struct work_struct *work);
+extern ssize_t cached_devio_op_show(struct bittern_cache *bc, char *result);
 /*! queue request to devio layer */
 extern void cached_devio_make_request(struct bittern_cache *bc,
 				      struct work_item *wi,
@@ -1239,11 +2070,15 @@ extern void cache_walk(struct bittern_cache *bc);
 extern void *kmem_allocate(size_t size, int flags, int zero);
 #define kmem_alloc(__size, __flags) kmem_allocate((__size), (__flags), 0)
 #define kmem_zalloc(__size, __flags) kmem_allocate((__size), (__flags), 1)
+#define kmem_zalloc_node(__size, __flags, __node)			\
+	kmem_allocate((__size), (__flags), 1)
 extern void kmem_free(void *buf, size_t size);
 extern unsigned int kmem_buffers_in_use(void);
 #else /*ENABLE_KMALLOC_DEBUG */
 #define kmem_alloc(__size, __flags) kmalloc((__size), (__flags))
 #define kmem_zalloc(__size, __flags) kzalloc((__size), (__flags))
+#define kmem_zalloc_node(__size, __flags, __node)			\
+	kzalloc_node((__size), (__flags), (__node))
 #define kmem_free(__buf, __size) kfree((__buf))
 #define kmem_buffers_in_use() (0)
 #endif /*ENABLE_KMALLOC_DEBUG */
@@ -1392,4 +2227,6 @@ extern void cache_track_hash_clear(struct bittern_cache *bc,
 
 #endif /*ENABLE_TRACK_CRC32C */
 
+#include "bittern_cache_trace.h"
+
 #endif /* BITTERN_CACHE_H */
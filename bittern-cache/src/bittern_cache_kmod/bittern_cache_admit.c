@@ -0,0 +1,292 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <linux/hash.h>
+
+#include "bittern_cache.h"
+
+/*
+ * Miss admission filter.
+ *
+ * Every access to a cache block sector is recorded in a count-min sketch
+ * (TinyLFU style). A miss only allocates a cache block if the estimated
+ * recent access frequency of its block is at least the admission
+ * threshold for its direction, otherwise it bypasses the cache the same
+ * way a sequential access does. This keeps blocks which are only accessed
+ * once from evicting blocks which are accessed repeatedly.
+ *
+ * Counters are halved every sample_size accesses, so the sketch tracks
+ * recent frequency. Halving the whole sketch is too long to do on the map
+ * path, so the one access which brings sample_count to sample_size queues
+ * a work item to do it, and the work item restarts the count once done.
+ * Sketch updates are not serialized, lost updates only make the estimate
+ * a bit less accurate.
+ */
+
+static const uint64_t cache_admit_seeds[CACHE_ADMIT_SKETCH_DEPTH] = {
+	0x9e3779b97f4a7c15ULL,
+	0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL,
+	0x27d4eb2f165667c5ULL,
+};
+
+static inline uint8_t *cache_admit_counter(struct cache_admit_sketch *cas,
+					   unsigned int row,
+					   sector_t sector)
+{
+	unsigned int col;
+
+	col = hash_64((uint64_t)sector ^ cache_admit_seeds[row],
+		      ilog2(CACHE_ADMIT_SKETCH_WIDTH));
+	return &cas->counters[row * CACHE_ADMIT_SKETCH_WIDTH + col];
+}
+
+/*! halves all counters */
+static void cache_admit_aging_worker(struct work_struct *work)
+{
+	struct cache_admit_sketch *cas;
+	unsigned int i;
+
+	cas = container_of(work, struct cache_admit_sketch, aging_work);
+	for (i = 0; i < CACHE_ADMIT_SKETCH_DEPTH * CACHE_ADMIT_SKETCH_WIDTH;
+	     i++)
+		cas->counters[i] >>= 1;
+	atomic_inc(&cas->agings);
+	/*
+	 * accesses recorded while aging count towards the next one. if
+	 * they already are a full sample, nobody else will see the count
+	 * reach sample_size, so age again.
+	 */
+	if (atomic_sub_return(cas->sample_size, &cas->sample_count) >=
+	    (int)cas->sample_size)
+		schedule_work(&cas->aging_work);
+}
+
+/*!
+ * records one access to sector and returns its estimated frequency.
+ * uses conservative update, i.e. only the smallest counters are
+ * incremented.
+ */
+static unsigned int cache_admit_record(struct cache_admit_sketch *cas,
+				       sector_t sector)
+{
+	uint8_t *counters[CACHE_ADMIT_SKETCH_DEPTH];
+	unsigned int row, min = CACHE_ADMIT_COUNTER_MAX;
+
+	for (row = 0; row < CACHE_ADMIT_SKETCH_DEPTH; row++) {
+		counters[row] = cache_admit_counter(cas, row, sector);
+		if (*counters[row] < min)
+			min = *counters[row];
+	}
+	if (min < CACHE_ADMIT_COUNTER_MAX) {
+		for (row = 0; row < CACHE_ADMIT_SKETCH_DEPTH; row++)
+			if (*counters[row] == min)
+				*counters[row] = min + 1;
+		min++;
+	}
+
+	/* only one access can see the count reach sample_size */
+	if (atomic_inc_return(&cas->sample_count) == cas->sample_size)
+		schedule_work(&cas->aging_work);
+
+	return min;
+}
+
+bool cache_admit_filter(struct bittern_cache *bc, struct bio *bio)
+{
+	struct cache_admit_policy *cap;
+	unsigned int freq;
+
+	if (bio_data_dir(bio) == WRITE)
+		cap = &bc->bc_admit_write;
+	else
+		cap = &bc->bc_admit_read;
+	if (bc->bc_admit_read.admit_threshold == 0 &&
+	    bc->bc_admit_write.admit_threshold == 0)
+		return true;
+
+	/*
+	 * record accesses in both directions as long as either policy is
+	 * enabled, a block which is read often is worth caching on write.
+	 */
+	freq = cache_admit_record(&bc->bc_admit_sketch,
+				  bio_sector_to_cache_block_sector(bio));
+	return cap->admit_threshold == 0 || freq >= cap->admit_threshold;
+}
+
+static void __cache_admit_policy_initialize(struct cache_admit_policy *cap)
+{
+	cap->admit_threshold = CACHE_ADMIT_THRESHOLD_DEFAULT;
+	atomic_set(&cap->admit_count, 0);
+	atomic_set(&cap->reject_count, 0);
+	cap->base_hits = 0;
+	cap->base_misses = 0;
+}
+
+int cache_admit_initialize(struct bittern_cache *bc)
+{
+	struct cache_admit_sketch *cas = &bc->bc_admit_sketch;
+
+	__cache_admit_policy_initialize(&bc->bc_admit_read);
+	__cache_admit_policy_initialize(&bc->bc_admit_write);
+
+	cas->counters = vzalloc(CACHE_ADMIT_SKETCH_DEPTH *
+				CACHE_ADMIT_SKETCH_WIDTH);
+	if (cas->counters == NULL) {
+		printk_err("%s: cannot allocate admission sketch\n",
+			   bc->bc_name);
+		return -ENOMEM;
+	}
+	atomic_set(&cas->sample_count, 0);
+	cas->sample_size = CACHE_ADMIT_SAMPLE_FACTOR *
+			   CACHE_ADMIT_SKETCH_WIDTH;
+	atomic_set(&cas->agings, 0);
+	INIT_WORK(&cas->aging_work, cache_admit_aging_worker);
+
+	return 0;
+}
+
+void cache_admit_deinitialize(struct bittern_cache *bc)
+{
+	if (bc->bc_admit_sketch.counters != NULL) {
+		cancel_work_sync(&bc->bc_admit_sketch.aging_work);
+		vfree(bc->bc_admit_sketch.counters);
+		bc->bc_admit_sketch.counters = NULL;
+	}
+}
+
+/*!
+ * sets the threshold and restarts the hit ratio baseline, so that
+ * the effect of the new setting can be compared to the old one.
+ */
+static void __set_admit_threshold(struct cache_admit_policy *cap,
+				  int value,
+				  atomic_t *hits,
+				  atomic_t *misses)
+{
+	cap->admit_threshold = value;
+	cap->base_hits = atomic_read(hits);
+	cap->base_misses = atomic_read(misses);
+	atomic_set(&cap->admit_count, 0);
+	atomic_set(&cap->reject_count, 0);
+}
+
+int set_read_admit_threshold(struct bittern_cache *bc, int value)
+{
+	__set_admit_threshold(&bc->bc_admit_read,
+			      value,
+			      &bc->bc_total_read_hits,
+			      &bc->bc_total_read_misses);
+	printk_info("bc->bc_name='%s', read_admit_threshold=%d\n",
+		    bc->bc_name,
+		    value);
+	return 0;
+}
+
+int read_admit_threshold(struct bittern_cache *bc)
+{
+	return bc->bc_admit_read.admit_threshold;
+}
+
+int set_write_admit_threshold(struct bittern_cache *bc, int value)
+{
+	__set_admit_threshold(&bc->bc_admit_write,
+			      value,
+			      &bc->bc_total_write_hits,
+			      &bc->bc_total_write_misses);
+	printk_info("bc->bc_name='%s', write_admit_threshold=%d\n",
+		    bc->bc_name,
+		    value);
+	return 0;
+}
+
+int write_admit_threshold(struct bittern_cache *bc)
+{
+	return bc->bc_admit_write.admit_threshold;
+}
+
+/*! hit ratio in hundredths of percent */
+static unsigned int cache_admit_hit_ratio(unsigned int hits,
+					  unsigned int misses)
+{
+	if (hits + misses == 0)
+		return 0;
+	return (unsigned int)(((uint64_t)hits * 10000ULL) /
+			      ((uint64_t)hits + (uint64_t)misses));
+}
+
+static int __cache_admit_stats(struct bittern_cache *bc,
+			       struct cache_admit_policy *cap,
+			       const char *subclass,
+			       atomic_t *hits,
+			       atomic_t *misses,
+			       char *result,
+			       size_t maxlen)
+{
+	size_t sz = 0;
+	unsigned int h = atomic_read(hits), m = atomic_read(misses);
+	unsigned int before, since;
+
+	/* rejected misses bypass the cache and are not counted as misses */
+	before = cache_admit_hit_ratio(cap->base_hits, cap->base_misses);
+	since = cache_admit_hit_ratio(h - cap->base_hits,
+				      m - cap->base_misses +
+				      atomic_read(&cap->reject_count));
+
+	DMEMIT("%s: admission: %s_admit_threshold=%u %s_admit_count=%u %s_reject_count=%u %s_hit_ratio_before=%u.%02u%% %s_hit_ratio_since=%u.%02u%%\n",
+	       bc->bc_name,
+	       subclass, cap->admit_threshold,
+	       subclass, atomic_read(&cap->admit_count),
+	       subclass, atomic_read(&cap->reject_count),
+	       subclass, before / 100, before % 100,
+	       subclass, since / 100, since % 100);
+
+	return sz;
+}
+
+int cache_admit_stats(struct bittern_cache *bc,
+		      char *result,
+		      size_t maxlen)
+{
+	size_t sz = 0;
+
+	ASSERT(bc != NULL);
+	ASSERT_BITTERN_CACHE(bc);
+	DMEMIT("%s: admission: sketch_depth=%u sketch_width=%u sample_size=%u sample_count=%u agings=%u\n",
+	       bc->bc_name,
+	       CACHE_ADMIT_SKETCH_DEPTH,
+	       CACHE_ADMIT_SKETCH_WIDTH,
+	       bc->bc_admit_sketch.sample_size,
+	       atomic_read(&bc->bc_admit_sketch.sample_count),
+	       atomic_read(&bc->bc_admit_sketch.agings));
+	sz += __cache_admit_stats(bc,
+				  &bc->bc_admit_read,
+				  "read",
+				  &bc->bc_total_read_hits,
+				  &bc->bc_total_read_misses,
+				  result + sz,
+				  maxlen - sz);
+	sz += __cache_admit_stats(bc,
+				  &bc->bc_admit_write,
+				  "write",
+				  &bc->bc_total_write_hits,
+				  &bc->bc_total_write_misses,
+				  result + sz,
+				  maxlen - sz);
+	return sz;
+}
@@ -18,6 +18,82 @@
 
 #include "bittern_cache.h"
 
+/*
+ * write-hot dirty blocks.
+ *
+ * A dirty block which is rewritten every few seconds (a filesystem
+ * superblock, a busy journal region) would be written back as soon as it
+ * ages past the policy minimum age, and be dirtied again right after.
+ * Each cache block keeps a small write heat, bumped by every write hit and
+ * halved every CACHE_BGWRITER_HOT_DECAY_SECS without an access, together
+ * with the time it became dirty. Write hits always go to a clone, so both
+ * are carried over from the original block.
+ *
+ * Once its heat reaches bgwriter_conf_hot_writes, the bgwriter skips the
+ * block and moves it to the tail of the dirty list, unless it has been
+ * dirty for hot_max_age_secs or the dirty ratio is at hot_max_dirty_pct.
+ * Each write hit on a skipped block absorbs a writeback, and is counted
+ * in bc_bgwriter_hot_writebacks_saved.
+ */
+
+static unsigned int cache_bgwriter_write_heat(struct cache_block *cache_block,
+					      unsigned int now)
+{
+	unsigned int halvings;
+
+	halvings = (now - cache_block->bcb_last_modify) /
+		   CACHE_BGWRITER_HOT_DECAY_SECS;
+	if (halvings >= 4)
+		return 0;
+	return cache_block->bcb_write_heat >> halvings;
+}
+
+void cache_bgwriter_write_hit(struct bittern_cache *bc,
+			      struct cache_block *original_cache_block,
+			      struct cache_block *cloned_cache_block,
+			      bool original_is_dirty)
+{
+	unsigned int now = jiffies_to_secs(jiffies);
+	unsigned int heat;
+
+	heat = cache_bgwriter_write_heat(original_cache_block, now);
+	if (heat < CACHE_BGWRITER_MAX_HOT_WRITES)
+		heat++;
+	cloned_cache_block->bcb_write_heat = heat;
+	cloned_cache_block->bcb_hot_deferred = 0;
+	if (original_is_dirty) {
+		cloned_cache_block->bcb_dirty_since =
+			original_cache_block->bcb_dirty_since;
+		if (original_cache_block->bcb_hot_deferred)
+			atomic_inc(&bc->bc_bgwriter_hot_writebacks_saved);
+	} else {
+		cloned_cache_block->bcb_dirty_since = now;
+	}
+}
+
+bool cache_bgwriter_block_is_hot(struct bittern_cache *bc,
+				 struct cache_block *cache_block)
+{
+	unsigned int hot_writes = bc->bc_bgwriter_conf_hot_writes;
+	unsigned int now = jiffies_to_secs(jiffies);
+	unsigned int total_entries, dirty_pct;
+
+	ASSERT(cache_block->bcb_state == S_DIRTY);
+	if (hot_writes == 0 || !is_cache_mode_writeback(bc))
+		return false;
+	if (cache_bgwriter_write_heat(cache_block, now) < hot_writes)
+		return false;
+	if (now - cache_block->bcb_dirty_since >=
+	    bc->bc_bgwriter_conf_hot_max_age_secs)
+		return false;
+	total_entries = atomic_read(&bc->bc_total_entries);
+	if (total_entries == 0)
+		return false;
+	dirty_pct = (atomic_read(&bc->bc_valid_entries_dirty) * 100) /
+		    total_entries;
+	return dirty_pct < bc->bc_bgwriter_conf_hot_max_dirty_pct;
+}
+
 void cache_bgwriter_io_end(struct bittern_cache *bc,
 			   struct work_item *wi,
 			   struct cache_block *cache_block)
@@ -73,17 +149,21 @@ void cache_bgwriter_io_end(struct bittern_cache *bc,
 
 /*
  * start one writeback, possibly using sector_hint.
+ * without sector_hint, only dirty blocks in the shard of the bgwriter
+ * worker are considered. bgw is NULL when called outside of the bgwriter.
  * returns 1 if writeback was started, 0 otherwise.
  */
-int cache_bgwriter_io_start_one(struct bittern_cache *bc,
-					sector_t sector_hint,
-					sector_t *o_sector_hint)
+static int __cache_bgwriter_io_start_one(struct bittern_cache *bc,
+					 struct cache_bgwriter_worker *bgw,
+					 sector_t sector_hint,
+					 sector_t *o_sector_hint)
 {
 	unsigned long flags, cache_flags;
 	struct work_item *wi;
 	struct cache_block *cache_block = NULL;
 	int ret;
 	enum cache_state update_state;
+	unsigned int shard = 0, nr_shards = 1;
 
 	ASSERT(bc != NULL);
 	ASSERT_BITTERN_CACHE(bc);
@@ -91,12 +171,18 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 	       sector_hint == SECTOR_NUMBER_INVALID);
 	ASSERT(o_sector_hint != NULL);
 	*o_sector_hint = SECTOR_NUMBER_INVALID;
+	if (bgw != NULL) {
+		shard = bgw->bgw_id;
+		nr_shards = bgw->bgw_nr_shards;
+	}
 
 	if (sector_hint == SECTOR_NUMBER_INVALID) {
 		ret = cache_get_dirty_from_head(bc,
 						&cache_block,
 						bc->
-						bc_bgwriter_curr_min_age_secs);
+						bc_bgwriter_curr_min_age_secs,
+						shard,
+						nr_shards);
 		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL,
 			 "ret=%d (m=%u, q=%u, p=%u, pw=%u)", ret,
 			 bc->bc_bgwriter_curr_min_age_secs,
@@ -110,8 +196,20 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 			 * called when we are below the threshold for
 			 * invalid (free) blocks
 			 */
+			trace_bittern_bgwriter_decision(bc, SECTOR_NUMBER_INVALID,
+						BGWRITER_DECISION_NO_WORK);
+			if (nr_shards > 1) {
+				/*
+				 * the dirty blocks at the head of the list
+				 * belong to the other workers
+				 */
+				bgw->bgw_no_shard_work_count++;
+				msleep(1);
+			}
 			return 0;
 		case -EBUSY:
+			trace_bittern_bgwriter_decision(bc, SECTOR_NUMBER_INVALID,
+						BGWRITER_DECISION_BUSY);
 			atomic_inc(&bc->bc_writebacks_stalls);
 			bc->bc_bgwriter_stalls_count++;
 			bc->bc_bgwriter_cache_block_busy_count++;
@@ -119,6 +217,8 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 			return 0;
 		case -ETIME:
 			/* not considered a write stall */
+			trace_bittern_bgwriter_decision(bc, SECTOR_NUMBER_INVALID,
+						BGWRITER_DECISION_TOO_YOUNG);
 			bc->bc_bgwriter_too_young_count++;
 			msleep(2);
 			return 0;
@@ -142,15 +242,40 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 				/*
 				 * block is not dirty, release
 				 */
+				trace_bittern_bgwriter_decision(bc, sector_hint,
+						BGWRITER_DECISION_HINT_CLEAN);
 				bc->bc_bgwriter_hint_block_clean_count++;
 				cache_put(bc, cache_block, 1);
 				return 0;
 			}
+			if (bgw != NULL &&
+			    cache_bgwriter_block_is_hot(bc, cache_block)) {
+				/*
+				 * do not write back a write-hot block just
+				 * because it is next to another one. writebacks
+				 * forced by resize and pool evacuation
+				 * (bgw == NULL) are never skipped.
+				 */
+				trace_bittern_bgwriter_decision(bc, sector_hint,
+						BGWRITER_DECISION_HOT);
+				spin_lock_irqsave(&cache_block->bcb_spinlock,
+						  cache_flags);
+				cache_block->bcb_hot_deferred = 1;
+				spin_unlock_irqrestore(&cache_block->bcb_spinlock,
+						       cache_flags);
+				atomic_inc(&bc->bc_bgwriter_hot_deferred_count);
+				cache_put(bc, cache_block, 1);
+				return 0;
+			}
 			break;
 		case CACHE_GET_RET_HIT_BUSY:
+			trace_bittern_bgwriter_decision(bc, sector_hint,
+						BGWRITER_DECISION_BUSY);
 			bc->bc_bgwriter_cache_block_busy_count++;
 			return 0;
 		case CACHE_GET_RET_MISS:
+			trace_bittern_bgwriter_decision(bc, sector_hint,
+						BGWRITER_DECISION_HINT_MISS);
 			bc->bc_bgwriter_hint_no_block_count++;
 			return 0;
 		default:
@@ -176,6 +301,11 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 	else
 		update_state = S_CLEAN;
 
+	trace_bittern_bgwriter_decision(bc, cache_block->bcb_sector,
+				(update_state == S_INVALID ?
+				 BGWRITER_DECISION_WRITEBACK_INVALIDATE :
+				 BGWRITER_DECISION_WRITEBACK));
+
 	ASSERT(cache_block->bcb_state == S_DIRTY);
 	ASSERT(atomic_read(&cache_block->bcb_refcount) > 0);
 	ASSERT(is_sector_number_valid(cache_block->bcb_sector));
@@ -287,6 +417,16 @@ int cache_bgwriter_io_start_one(struct bittern_cache *bc,
 	return 1;
 }
 
+int cache_bgwriter_io_start_one(struct bittern_cache *bc,
+				sector_t sector_hint,
+				sector_t *o_sector_hint)
+{
+	return __cache_bgwriter_io_start_one(bc,
+					     NULL,
+					     sector_hint,
+					     o_sector_hint);
+}
+
 /*
  * wait for needed writeback resources (queue and buffers).
  * return -EWOULDBLOCK if waiting would be needed and we indicated we do not
@@ -331,9 +471,11 @@ int cache_bgwriter_wait_for_resources(struct bittern_cache *bc,
 
 /*
  * start a batch of sequential writebacks.
+ * the batch does not extend past the end of the worker's shard range.
  * returns count of started writebacks.
  */
-int cache_bgwriter_io_start_batch(struct bittern_cache *bc)
+static int cache_bgwriter_io_start_batch(struct bittern_cache *bc,
+					 struct cache_bgwriter_worker *bgw)
 {
 	int ret, count;
 	sector_t sector_hint = SECTOR_NUMBER_INVALID;
@@ -345,8 +487,8 @@ int cache_bgwriter_io_start_batch(struct bittern_cache *bc)
 	ASSERT(ret == 0);
 
 	/* printk_debug("bgwriter: hint[0]=%lu\n", sector_hint); */
-	ret =
-	    cache_bgwriter_io_start_one(bc, sector_hint, &sector_hint);
+	ret = __cache_bgwriter_io_start_one(bc, bgw, sector_hint,
+					    &sector_hint);
 	ASSERT(ret == 0 || ret == 1);
 	if (ret == 0)
 		return 0;
@@ -371,9 +513,14 @@ int cache_bgwriter_io_start_batch(struct bittern_cache *bc)
 			if (ret < 0)
 				break;
 			ASSERT(sector_hint != SECTOR_NUMBER_INVALID);
-			ret = cache_bgwriter_io_start_one(bc,
-							  sector_hint,
-							  &sector_hint);
+			if (cache_bgwriter_shard(bc, sector_hint,
+						 bgw->bgw_nr_shards) !=
+			    bgw->bgw_id)
+				break;
+			ret = __cache_bgwriter_io_start_one(bc,
+							    bgw,
+							    sector_hint,
+							    &sector_hint);
 			ASSERT(ret == 0 || ret == 1);
 			if (ret == 0) {
 				ASSERT(sector_hint == SECTOR_NUMBER_INVALID);
@@ -392,7 +539,18 @@ int cache_bgwriter_io_start_batch(struct bittern_cache *bc)
 	return count;
 }
 
-void cache_bgwriter_start_io(struct bittern_cache *bc)
+/*!
+ * dirty blocks the bgwriter can write back, that is all of them except
+ * the ones belonging to pool members which have not joined yet.
+ */
+static int cache_bgwriter_dirty_entries(struct bittern_cache *bc)
+{
+	return atomic_read(&bc->bc_valid_entries_dirty) -
+	       atomic_read(&bc->bc_pool_orphan_dirty);
+}
+
+static void cache_bgwriter_start_io(struct bittern_cache *bc,
+				    struct cache_bgwriter_worker *bgw)
 {
 	unsigned long jiffies_begin_msecs;
 	unsigned int msleep_sum = 0;
@@ -407,9 +565,11 @@ void cache_bgwriter_start_io(struct bittern_cache *bc)
 	if (bc->bc_bgwriter_curr_rate_per_sec > 0) {
 		/*
 		 * rate limiting. in no case we'll issue more than 1000 iops
-		 * if rate limiting is enabled.
+		 * if rate limiting is enabled. the rate is split evenly
+		 * among the workers.
 		 */
-		msleep_ms = 1000 / bc->bc_bgwriter_curr_rate_per_sec;
+		msleep_ms = (1000 * bgw->bgw_nr_shards) /
+			    bc->bc_bgwriter_curr_rate_per_sec;
 		if (msleep_ms == 0)
 			msleep_ms = 1;
 	} else {
@@ -421,13 +581,13 @@ void cache_bgwriter_start_io(struct bittern_cache *bc)
 
 	jiffies_begin_msecs = jiffies_to_msecs(jiffies);
 
-	while (atomic_read(&bc->bc_valid_entries_dirty) > 0) {
+	while (cache_bgwriter_dirty_entries(bc) > 0) {
 		int count;
 
 		/*
 		 * start writeback batch
 		 */
-		count = cache_bgwriter_io_start_batch(bc);
+		count = cache_bgwriter_io_start_batch(bc, bgw);
 
 		if (msleep_ms > 0) {
 			msleep(msleep_ms * count);
@@ -460,11 +620,13 @@ void cache_bgwriter_start_io(struct bittern_cache *bc)
 			break;
 
 		/*
-		 * recompute policy parameters (fast plug)
+		 * recompute policy parameters (fast plug), only the first
+		 * worker updates the policy.
 		 *
 		 * FIXME: should fast plug be also inside the cluster loop?
 		 */
-		cache_bgwriter_compute_policy_fast(bc);
+		if (bgw->bgw_id == 0)
+			cache_bgwriter_compute_policy_fast(bc);
 	}
 
 	if (wb_block_count > 0) {
@@ -479,6 +641,8 @@ void cache_bgwriter_start_io(struct bittern_cache *bc)
 		bc->bc_bgwriter_curr_msecs_elapsed_start_io +=
 		    (jiffies_to_msecs(jiffies) - jiffies_begin_msecs);
 		bc->bc_bgwriter_curr_msecs_slept_start_io += msleep_sum;
+		bgw->bgw_writebacks += wb_block_count;
+		bgw->bgw_clusters += wb_cluster_count;
 	}
 }
 
@@ -544,7 +708,7 @@ void cache_bgwriter_flush_dirty_blocks(struct bittern_cache *bc)
 
 	printk_info("waiting for flush completion - dirty blocks = %u\n",
 		    atomic_read(&bc->bc_valid_entries_dirty));
-	while (atomic_read(&bc->bc_valid_entries_dirty) > 0) {
+	while (cache_bgwriter_dirty_entries(bc) > 0) {
 		unsigned int d = atomic_read(&bc->bc_valid_entries_dirty);
 		/* using msleep instead of event wait so print flushing rate */
 		msleep(1000);
@@ -554,30 +718,121 @@ void cache_bgwriter_flush_dirty_blocks(struct bittern_cache *bc)
 	}
 	printk_info("done waiting for flush completion - dirty blocks = %u\n",
 		    atomic_read(&bc->bc_valid_entries_dirty));
-	M_ASSERT(atomic_read(&bc->bc_valid_entries_dirty) == 0);
+	M_ASSERT(atomic_read(&bc->bc_valid_entries_dirty) ==
+		 atomic_read(&bc->bc_pool_orphan_dirty));
 }
 
 static int cache_bgwriter_has_work(struct bittern_cache *bc)
 {
-	return atomic_read(&bc->bc_valid_entries_dirty) > 0 &&
+	return cache_bgwriter_dirty_entries(bc) > 0 &&
 	    atomic_read(&bc->bc_pending_writeback_requests) <
 	    bc->bc_bgwriter_curr_queue_depth;
 }
 
-int cache_bgwriter_kthread(void *__bc)
+/*
+ * start the workers which have been configured but are not running yet.
+ * only called by the first worker.
+ */
+static void cache_bgwriter_start_workers(struct bittern_cache *bc,
+					 unsigned int conf_workers)
+{
+	while (bc->bc_bgwriter_nr_workers < conf_workers) {
+		struct cache_bgwriter_worker *bgw;
+		struct task_struct *task;
+
+		bgw = &bc->bc_bgwriter_workers[bc->bc_bgwriter_nr_workers];
+		ASSERT(bgw->bgw_id == bc->bc_bgwriter_nr_workers);
+		ASSERT(bgw->bgw_task == NULL);
+		task = kthread_create_on_node(cache_bgwriter_kthread,
+					      bgw,
+					      bc->bc_numa_node,
+					      "b_bgw%u/%s",
+					      bgw->bgw_id,
+					      bc->bc_name);
+		if (IS_ERR(task)) {
+			printk_err_ratelimited("%s: cannot create bgwriter worker %u: %ld\n",
+					       bc->bc_name,
+					       bgw->bgw_id,
+					       PTR_ERR(task));
+			return;
+		}
+		bgw->bgw_task = task;
+		printk_info("bgwriter worker %u instantiated, task=%p\n",
+			    bgw->bgw_id, bgw->bgw_task);
+		cache_numa_bind_task(bc, task);
+		bc->bc_bgwriter_nr_workers++;
+		wake_up_process(task);
+	}
+}
+
+static void cache_bgwriter_stop_workers(struct bittern_cache *bc)
+{
+	while (bc->bc_bgwriter_nr_workers > 1) {
+		struct cache_bgwriter_worker *bgw;
+		int ret;
+
+		bgw = &bc->bc_bgwriter_workers[bc->bc_bgwriter_nr_workers - 1];
+		printk_info("stopping bgwriter worker %u (task=%p)\n",
+			    bgw->bgw_id, bgw->bgw_task);
+		ret = kthread_stop(bgw->bgw_task);
+		M_ASSERT(bgw->bgw_task == NULL);
+		printk_info("stopped bgwriter worker %u: ret=%d\n",
+			    bgw->bgw_id, ret);
+		bc->bc_bgwriter_nr_workers--;
+	}
+}
+
+static void cache_bgwriter_worker_rate(struct cache_bgwriter_worker *bgw)
 {
-	struct bittern_cache *bc = (struct bittern_cache *)__bc;
+	unsigned long elapsed = jiffies - bgw->bgw_rate_jiffies;
+
+	if (elapsed < HZ)
+		return;
+	bgw->bgw_writebacks_per_sec =
+		((bgw->bgw_writebacks - bgw->bgw_rate_writebacks) * HZ) /
+		elapsed;
+	bgw->bgw_rate_writebacks = bgw->bgw_writebacks;
+	bgw->bgw_rate_jiffies = jiffies;
+}
+
+int cache_bgwriter_kthread(void *__bgw)
+{
+	struct cache_bgwriter_worker *bgw =
+				(struct cache_bgwriter_worker *)__bgw;
+	struct bittern_cache *bc = bgw->bgw_cache;
 
 	set_user_nice(current, CACHE_BACKGROUND_WRITER_THREAD_NICE);
 
 	BT_TRACE(BT_LEVEL_TRACE0, bc, NULL, NULL, NULL, NULL,
-		 "enter, nice=%d", CACHE_BACKGROUND_WRITER_THREAD_NICE);
+		 "enter, worker=%u, nice=%d",
+		 bgw->bgw_id, CACHE_BACKGROUND_WRITER_THREAD_NICE);
+
+	bgw->bgw_rate_jiffies = jiffies;
 
 	while (!kthread_should_stop()) {
+		unsigned int conf_workers = bc->bc_bgwriter_conf_workers;
 		int ret;
 
 		ASSERT(bc != NULL);
 		ASSERT_BITTERN_CACHE(bc);
+		ASSERT(conf_workers >= CACHE_BGWRITER_MIN_WORKERS &&
+		       conf_workers <= CACHE_BGWRITER_MAX_WORKERS);
+
+		if (bgw->bgw_id == 0)
+			cache_bgwriter_start_workers(bc, conf_workers);
+
+		if (bgw->bgw_id >= conf_workers) {
+			/*
+			 * the number of workers has been lowered,
+			 * park until it is raised again or we are stopped
+			 */
+			bgw->bgw_idle_count++;
+			bgw->bgw_writebacks_per_sec = 0;
+			msleep(100);
+			continue;
+		}
+		bgw->bgw_nr_shards = min(conf_workers,
+					 bc->bc_bgwriter_nr_workers);
 
 		/*
 		 * we get woken up at each cache fill or completed writeback
@@ -591,12 +846,17 @@ int cache_bgwriter_kthread(void *__bc)
 		if (signal_pending(current))
 			flush_signals(current);
 
-		if (atomic_read(&bc->bc_valid_entries_dirty) > 0) {
+		if (cache_bgwriter_dirty_entries(bc) > 0) {
 
 			/*
-			 * recompute policy parameters (slow plug)
+			 * recompute policy parameters (slow plug).
+			 * the policy is shared by all the workers.
 			 */
-			cache_bgwriter_compute_policy_slow(bc);
+			if (bgw->bgw_id == 0) {
+				cache_bgwriter_compute_policy_slow(bc);
+				trace_bittern_bgwriter_policy(bc,
+					cache_bgwriter_dirty_entries(bc));
+			}
 
 			/*
 			 * sanity check
@@ -613,7 +873,7 @@ int cache_bgwriter_kthread(void *__bc)
 			 * start writebacks, the number and delays being
 			 * determined by the recomputed policy parameters
 			 */
-			cache_bgwriter_start_io(bc);
+			cache_bgwriter_start_io(bc, bgw);
 
 			bc->bc_bgwriter_work_count++;
 
@@ -631,22 +891,31 @@ int cache_bgwriter_kthread(void *__bc)
 			/*
 			 * there is nothing dirty -- not a writeback stall
 			 */
+			bgw->bgw_no_work_count++;
 			bc->bc_bgwriter_no_work_count++;
 			msleep(5);
 		}
 
-		bc->bc_bgwriter_loop_count++;
+		cache_bgwriter_worker_rate(bgw);
+		bgw->bgw_loop_count++;
+		if (bgw->bgw_id == 0)
+			bc->bc_bgwriter_loop_count++;
 
 		schedule();
 	}
 
-	/*
-	 * do a sync drain of pending writebacks before exiting
-	 */
-	cache_bgwriter_wait_io(bc);
+	if (bgw->bgw_id == 0) {
+		/*
+		 * stop the other workers, then do a sync drain of pending
+		 * writebacks before exiting
+		 */
+		cache_bgwriter_stop_workers(bc);
+		cache_bgwriter_wait_io(bc);
+	}
 
-	BT_TRACE(BT_LEVEL_TRACE0, bc, NULL, NULL, NULL, NULL, "exit");
+	BT_TRACE(BT_LEVEL_TRACE0, bc, NULL, NULL, NULL, NULL,
+		 "exit, worker=%u", bgw->bgw_id);
 
-	bc->bc_bgwriter_task = NULL;
+	bgw->bgw_task = NULL;
 	return 0;
 }
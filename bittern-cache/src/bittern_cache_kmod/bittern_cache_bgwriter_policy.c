@@ -16,7 +16,15 @@
 
 /*! \file */
 
+/*
+ * This file is also built in userspace by the trace driven simulator,
+ * see ../sim/bittern_cache_user.h .
+ */
+#ifdef BITTERN_CACHE_USERSPACE
+#include "bittern_cache_user.h"
+#else /* BITTERN_CACHE_USERSPACE */
 #include "bittern_cache.h"
+#endif /* BITTERN_CACHE_USERSPACE */
 
 /*
  * IMPORTANT: this code is unnecessarily messy and will undergo a major cleanup
@@ -203,6 +211,212 @@ void cache_bgwriter_compute_policy_dirty_ratio(struct bittern_cache *bc)
 	bc->bc_bgwriter_curr_min_age_secs = 4;
 }
 
+/*
+ * latency-feedback policy.
+ *
+ * closed loop AIMD control of the writeback window, which is the
+ * writeback queue depth in units of 1/8th of a request. below 8 the queue
+ * depth is 1 and the window is used as rate limit instead.
+ *
+ * every CACHE_BGWRITER_LATENCY_INTERVAL_MS the average latency of the
+ * read misses completed in the interval is compared with
+ * bc_bgwriter_conf_latency_target_us. if there were too few read misses to
+ * tell, the average cached device write latency is used instead, which
+ * also tracks how busy the cached device is.
+ * - latency above target, or foreground requests deferred:
+ *   halve the window (multiplicative decrease).
+ * - latency below 3/4 of target and the writeback queue is full:
+ *   grow the window by one request (additive increase).
+ * - otherwise keep the window.
+ *
+ * the window never drops below half of the maximum queue depth once
+ * the cache is almost all dirty, as at that point foreground requests
+ * stall for free blocks no matter what.
+ */
+#define CACHE_BGWRITER_LF_SHIFT		3
+#define CACHE_BGWRITER_LF_ONE		(1UL << CACHE_BGWRITER_LF_SHIFT)
+#define CACHE_BGWRITER_LF_MAX_RATE	300
+#define CACHE_BGWRITER_LF_HIGH_DIRTY_PCT	90
+
+/* bc_bgwriter_curr_policy[8]; */
+#define bc_bgwriter_curr_policy_window bc_bgwriter_curr_policy[0]
+#define bc_bgwriter_curr_policy_sample_msecs bc_bgwriter_curr_policy[1]
+#define bc_bgwriter_curr_policy_read_miss_count bc_bgwriter_curr_policy[2]
+#define bc_bgwriter_curr_policy_read_miss_usecs bc_bgwriter_curr_policy[3]
+#define bc_bgwriter_curr_policy_write_count bc_bgwriter_curr_policy[4]
+#define bc_bgwriter_curr_policy_write_usecs bc_bgwriter_curr_policy[5]
+#define bc_bgwriter_curr_policy_latency_usecs bc_bgwriter_curr_policy[6]
+#define bc_bgwriter_curr_policy_decrease_count bc_bgwriter_curr_policy[7]
+
+/*
+ * timer count and sum in usecs, truncated to unsigned long.
+ * only differences between two reads are used, so wraparound is harmless.
+ */
+static void cache_bgwriter_timer_read(struct cache_timer *timer,
+				      unsigned long *count,
+				      unsigned long *sum_usecs)
+{
+	unsigned long flags;
+	uint64_t c, sum_nsec;
+
+	spin_lock_irqsave(&timer->bct_spinlock, flags);
+	c = timer->bct_count;
+	sum_nsec = timer->bct_sum_nsec;
+	spin_unlock_irqrestore(&timer->bct_spinlock, flags);
+	*count = (unsigned long)c;
+	*sum_usecs = (unsigned long)div_u64(sum_nsec, 1000);
+}
+
+/*
+ * sample latencies and update the window, returns the latency used as
+ * control signal in usecs, or 0 if there were not enough samples.
+ */
+static unsigned long
+cache_bgwriter_latency_feedback_sample(struct bittern_cache *bc)
+{
+	unsigned long rm_count, rm_usecs, wr_count, wr_usecs;
+	unsigned long d_count, latency_usecs = 0;
+	unsigned long target_usecs = bc->bc_bgwriter_conf_latency_target_us;
+	unsigned int pending_wb;
+
+	cache_bgwriter_timer_read(&bc->bc_timer_read_misses,
+				  &rm_count, &rm_usecs);
+	cache_bgwriter_timer_read(&bc->bc_timer_cached_device_writes,
+				  &wr_count, &wr_usecs);
+
+	d_count = rm_count - bc->bc_bgwriter_curr_policy_read_miss_count;
+	if (d_count >= CACHE_BGWRITER_LATENCY_MIN_SAMPLES) {
+		latency_usecs = (rm_usecs -
+				 bc->bc_bgwriter_curr_policy_read_miss_usecs) /
+				d_count;
+	} else {
+		d_count = wr_count - bc->bc_bgwriter_curr_policy_write_count;
+		if (d_count >= CACHE_BGWRITER_LATENCY_MIN_SAMPLES)
+			latency_usecs = (wr_usecs -
+				bc->bc_bgwriter_curr_policy_write_usecs) /
+				d_count;
+	}
+	bc->bc_bgwriter_curr_policy_read_miss_count = rm_count;
+	bc->bc_bgwriter_curr_policy_read_miss_usecs = rm_usecs;
+	bc->bc_bgwriter_curr_policy_write_count = wr_count;
+	bc->bc_bgwriter_curr_policy_write_usecs = wr_usecs;
+
+	pending_wb = atomic_read(&bc->bc_pending_writeback_requests);
+	if (latency_usecs > target_usecs ||
+	    atomic_read(&bc->bc_deferred_requests) > 0) {
+		bc->bc_bgwriter_curr_policy_window /= 2;
+		if (bc->bc_bgwriter_curr_policy_window < 1)
+			bc->bc_bgwriter_curr_policy_window = 1;
+		bc->bc_bgwriter_curr_policy_decrease_count++;
+	} else if (latency_usecs <= (target_usecs * 3) / 4 &&
+		   pending_wb + 1 >= bc->bc_bgwriter_curr_queue_depth) {
+		/*
+		 * only grow the window if it is what limits writebacks,
+		 * otherwise it grows without bounds while idle.
+		 */
+		bc->bc_bgwriter_curr_policy_window += CACHE_BGWRITER_LF_ONE;
+	}
+
+	return latency_usecs;
+}
+
+void cache_bgwriter_compute_policy_latency_feedback(struct bittern_cache *bc)
+{
+	int dirty_pct;
+	unsigned int valid_entries_dirty, total_entries;
+	unsigned int now_msecs, max_queue_depth;
+
+	ASSERT(bc != NULL);
+	ASSERT_BITTERN_CACHE(bc);
+	valid_entries_dirty = atomic_read(&bc->bc_valid_entries_dirty);
+	total_entries = atomic_read(&bc->bc_total_entries);
+	ASSERT(valid_entries_dirty <= total_entries);
+	dirty_pct = T_PCT(total_entries, valid_entries_dirty);
+	ASSERT(dirty_pct <= 100);
+
+	max_queue_depth = (bc->bc_max_pending_requests * bc->bc_bgwriter_conf_max_queue_depth_pct) / 100;
+	if (max_queue_depth < 1)
+		max_queue_depth = 1;
+	bc->bc_bgwriter_curr_max_queue_depth = max_queue_depth;
+
+	now_msecs = jiffies_to_msecs(jiffies);
+	if (bc->bc_bgwriter_curr_policy_window == 0) {
+		/* policy state has just been reset, start with one request */
+		bc->bc_bgwriter_curr_policy_window = CACHE_BGWRITER_LF_ONE;
+		bc->bc_bgwriter_curr_policy_sample_msecs = now_msecs;
+		cache_bgwriter_timer_read(&bc->bc_timer_read_misses,
+			&bc->bc_bgwriter_curr_policy_read_miss_count,
+			&bc->bc_bgwriter_curr_policy_read_miss_usecs);
+		cache_bgwriter_timer_read(&bc->bc_timer_cached_device_writes,
+			&bc->bc_bgwriter_curr_policy_write_count,
+			&bc->bc_bgwriter_curr_policy_write_usecs);
+	} else if (now_msecs -
+		   (unsigned int)bc->bc_bgwriter_curr_policy_sample_msecs >=
+		   CACHE_BGWRITER_LATENCY_INTERVAL_MS) {
+		bc->bc_bgwriter_curr_policy_latency_usecs =
+			cache_bgwriter_latency_feedback_sample(bc);
+		bc->bc_bgwriter_curr_policy_sample_msecs = now_msecs;
+	}
+	if (bc->bc_bgwriter_curr_policy_window >
+	    max_queue_depth << CACHE_BGWRITER_LF_SHIFT)
+		bc->bc_bgwriter_curr_policy_window =
+			max_queue_depth << CACHE_BGWRITER_LF_SHIFT;
+
+	if (bc->bc_bgwriter_curr_policy_window >= CACHE_BGWRITER_LF_ONE) {
+		bc->bc_bgwriter_curr_queue_depth =
+			bc->bc_bgwriter_curr_policy_window >>
+			CACHE_BGWRITER_LF_SHIFT;
+		bc->bc_bgwriter_curr_rate_per_sec = 0;
+	} else {
+		bc->bc_bgwriter_curr_queue_depth = 1;
+		bc->bc_bgwriter_curr_rate_per_sec =
+			(bc->bc_bgwriter_curr_policy_window *
+			 CACHE_BGWRITER_LF_MAX_RATE) >> CACHE_BGWRITER_LF_SHIFT;
+	}
+
+	if (dirty_pct >= CACHE_BGWRITER_LF_HIGH_DIRTY_PCT) {
+		if (bc->bc_bgwriter_curr_queue_depth < max_queue_depth / 2)
+			bc->bc_bgwriter_curr_queue_depth = max_queue_depth / 2;
+		bc->bc_bgwriter_curr_rate_per_sec = 0;
+	}
+	/* let recently written blocks absorb more writes until half dirty */
+	bc->bc_bgwriter_curr_min_age_secs = dirty_pct < 50 ? 4 : 0;
+}
+
+static ssize_t
+cache_bgwriter_op_show_latency_feedback(struct bittern_cache *bc,
+					char *result,
+					size_t maxlen)
+{
+	size_t sz = 0;
+
+	DMEMIT("%s: bgwriter: latency_feedback: "
+	       "conf_latency_target_us=%u "
+	       "latency_us=%lu "
+	       "window_x8=%lu "
+	       "queue_depth=%u "
+	       "rate_per_sec=%u "
+	       "decrease_count=%lu "
+	       "\n",
+	       bc->bc_name,
+	       bc->bc_bgwriter_conf_latency_target_us,
+	       bc->bc_bgwriter_curr_policy_latency_usecs,
+	       bc->bc_bgwriter_curr_policy_window,
+	       bc->bc_bgwriter_curr_queue_depth,
+	       bc->bc_bgwriter_curr_rate_per_sec,
+	       bc->bc_bgwriter_curr_policy_decrease_count);
+	return sz;
+}
+
+#undef bc_bgwriter_curr_policy_window
+#undef bc_bgwriter_curr_policy_sample_msecs
+#undef bc_bgwriter_curr_policy_read_miss_count
+#undef bc_bgwriter_curr_policy_read_miss_usecs
+#undef bc_bgwriter_curr_policy_write_count
+#undef bc_bgwriter_curr_policy_write_usecs
+#undef bc_bgwriter_curr_policy_latency_usecs
+#undef bc_bgwriter_curr_policy_decrease_count
+
 #define BITTERN_CACHE_ALLOW_EXPERIMENTAL_POLICIES
 #ifdef BITTERN_CACHE_ALLOW_EXPERIMENTAL_POLICIES
 
@@ -394,6 +608,10 @@ struct cache_bgwriter_policy {
 	const char *bgw_policy_name;
 	void (*bgw_policy_function_slow)(struct bittern_cache *bc);
 	void (*bgw_policy_function_fast)(struct bittern_cache *bc);
+	/*! optional, shows policy specific state in the bgwriter sysfs file */
+	ssize_t (*bgw_policy_function_show)(struct bittern_cache *bc,
+					    char *result,
+					    size_t maxlen);
 } cache_bgwriter_policies[] = {
 	/*! current default writeback policy */
 	{
@@ -413,6 +631,13 @@ struct cache_bgwriter_policy {
 		cache_bgwriter_compute_policy_dirty_ratio,
 		cache_bgwriter_compute_policy_dirty_ratio,
 	},
+	/*! queue depth driven by measured read miss latency */
+	{
+		"latency-feedback",
+		cache_bgwriter_compute_policy_latency_feedback,
+		NULL,
+		cache_bgwriter_op_show_latency_feedback,
+	},
 #ifdef BITTERN_CACHE_ALLOW_EXPERIMENTAL_POLICIES
 	/*! experimental, use at your own risk and peril */
 	{
@@ -456,6 +681,20 @@ ssize_t cache_bgwriter_op_show_policy(struct bittern_cache *bc, char *result)
 	return sz;
 }
 
+ssize_t cache_bgwriter_op_show_policy_state(struct bittern_cache *bc,
+					    char *result,
+					    size_t maxlen)
+{
+	int p = bc->bc_bgwriter_active_policy;
+	struct cache_bgwriter_policy *bp;
+
+	bp = &cache_bgwriter_policies[p];
+	ASSERT(p >= 0 && p < CACHE_BGWRITER_POLICIES);
+	if (bp->bgw_policy_function_show == NULL)
+		return 0;
+	return (*bp->bgw_policy_function_show)(bc, result, maxlen);
+}
+
 int cache_bgwriter_policy_set(struct bittern_cache *bc, const char *buf)
 {
 	int p;
@@ -18,83 +18,132 @@
 
 #include "bittern_cache.h"
 
-/*! used to carry state to delayed worker */
+/*
+ * Flush group commit.
+ *
+ * A write to the cached device is acked once it has completed and a
+ * flush issued after its completion has completed too. Each flush issued,
+ * be it a pure flush or a write with REQ_FLUSH | REQ_FUA, gets the next
+ * flush generation. A completed write waits for the generation following
+ * the last one issued, so any flush issued from then on covers it.
+ *
+ * Flushes are dispatched from @ref cached_devio_flush_worker as soon as
+ * some waiter is not covered by an issued flush and either no flush is in
+ * flight, or the cached device has nothing else in flight that could join
+ * the next flush. In the latter case up to @ref CACHED_DEV_FLUSH_INFLIGHT_MAX
+ * flush generations overlap. Writes which complete while a flush is in
+ * flight are grouped into the next one, which is dispatched as soon as the
+ * current one completes. The delayed worker only issues a flush if
+ * waiters are somehow left behind.
+ */
+
+/*! used to carry state to flush completion */
 struct flush_meta {
 	struct bittern_cache *bc;
-	/*! work struct for explicit flushes */
-	struct delayed_work dwork;
-	/*! pass as arg to delayed worker */
+	/*! flush generation of this flush */
 	uint64_t gennum;
 };
 
 /*!
- * if err == 0, complete requests which have gennum <= gennum.
- * if err != 0, complete all requests as it may not be possible to issue
- * an explicit flush.
+ * returns true if a flush should be dispatched now.
+ * caller holds devio spinlock.
+ */
+static bool __cached_devio_flush_needed(struct bittern_cache *bc)
+{
+	if (bc->devio.flush_gen_wanted <= bc->devio.flush_gen_issued)
+		return false;
+	if (bc->devio.flush_inflight_count == 0)
+		return true;
+	return bc->devio.pending_count == 0 &&
+	       bc->devio.flush_inflight_count < CACHED_DEV_FLUSH_INFLIGHT_MAX;
+}
+
+/*! dispatch a flush if needed. can be called from any context */
+static void cached_devio_flush_kick(struct bittern_cache *bc)
+{
+	unsigned long flags;
+	bool needed;
+
+	spin_lock_irqsave(&bc->devio.spinlock, flags);
+	needed = __cached_devio_flush_needed(bc);
+	spin_unlock_irqrestore(&bc->devio.spinlock, flags);
+	if (needed)
+		queue_work(bc->devio.flush_wq, &bc->devio.flush_work);
+}
+
+/*!
+ * if err == 0, complete the writes waiting for flush generations up to
+ * gennum. if err != 0, complete all of them as it may not be possible to
+ * issue an explicit flush.
  */
 static void cached_devio_flush_end_bio_process(struct bittern_cache *bc,
 					       uint64_t gennum,
 					       int err)
 {
-	bool processed;
+	struct work_item *wi, *next_wi;
+	unsigned long flags;
+	LIST_HEAD(acked_list);
+	uint64_t now = current_kernel_time_nsec();
+	unsigned int acked = 0;
 
 	ASSERT_BITTERN_CACHE(bc);
+
+	spin_lock_irqsave(&bc->devio.spinlock, flags);
+	list_for_each_entry_safe(wi,
+				 next_wi,
+				 &bc->devio.flush_pending_list,
+				 devio_pending_list) {
+		unsigned long wait_usecs;
+
+		ASSERT_WORK_ITEM(wi, bc);
+		if (err == 0 && wi->devio_flush_gen > gennum) {
+			BT_TRACE(BT_LEVEL_TRACE1,
+				 bc, NULL, NULL, wi->wi_cloned_bio, NULL,
+				 "not processing bi_sector=%lu, flush_gen=%llu/%llu",
+				 wi->wi_cloned_bio->bi_iter.bi_sector,
+				 wi->devio_flush_gen, gennum);
+			continue;
+		}
+		list_move_tail(&wi->devio_pending_list, &acked_list);
+		bc->devio.flush_pending_count--;
+		M_ASSERT(bc->devio.flush_pending_count >= 0);
+		wait_usecs = (unsigned long)div_u64(now - wi->wi_ts_physio_flush,
+						    1000);
+		bc->devio.flush_wait_hist[min_t(unsigned int,
+				ilog2(wait_usecs | 1),
+				CACHED_DEV_FLUSH_WAIT_HIST_BUCKETS - 1)]++;
+		acked++;
+	}
+	if (bc->devio.flush_pending_count == 0)
+		M_ASSERT(list_empty(&bc->devio.flush_pending_list));
+	else
+		M_ASSERT(!list_empty(&bc->devio.flush_pending_list));
+	if (acked == 0)
+		bc->devio.flush_empty_count++;
+	else
+		bc->devio.flush_batch_hist[min_t(unsigned int,
+				ilog2(acked),
+				CACHED_DEV_FLUSH_BATCH_HIST_BUCKETS - 1)]++;
+	spin_unlock_irqrestore(&bc->devio.spinlock, flags);
+
 	/*
 	 * ack pending writes upto gennum
 	 */
-	do {
-		struct work_item *wi;
-		struct bio *bio;
-		unsigned long flags;
-		int cc = 0;
-
-		processed = false;
-
-		spin_lock_irqsave(&bc->devio.spinlock, flags);
-		list_for_each_entry(wi,
-				    &bc->devio.flush_pending_list,
-				    devio_pending_list) {
-			ASSERT_WORK_ITEM(wi, bc);
-			bio = wi->wi_cloned_bio;
-			if (wi->devio_gennum <= gennum) {
-				M_ASSERT(!list_empty(&bc->devio.flush_pending_list));
-				list_del_init(&wi->devio_pending_list);
-				bc->devio.flush_pending_count--;
-				M_ASSERT(bc->devio.flush_pending_count >= 0);
-				if (bc->devio.flush_pending_count == 0)
-					M_ASSERT(list_empty(&bc->devio.flush_pending_list));
-				else
-					M_ASSERT(!list_empty(&bc->devio.flush_pending_list));
-				BT_TRACE(BT_LEVEL_TRACE1,
-					 bc, NULL, NULL, bio, NULL,
-					 "bi_sector=%lu, gennum=%llu/%llu, flush wait done, err=%d",
-					 bio->bi_iter.bi_sector,
-					 wi->devio_gennum,
-					 gennum,
-					 err);
-
-				spin_unlock_irqrestore(&bc->devio.spinlock, flags);
-
-				cache_timer_add(&bc->bc_timer_cached_device_flushes, wi->wi_ts_physio_flush);
-				cached_dev_make_request_endio(wi, bio, 0);
-
-				processed = true;
-				goto inner_out;
-			} else {
-				BT_TRACE(BT_LEVEL_TRACE1,
-					 bc, NULL, NULL, bio, NULL,
-					 "not processing bi_sector=%lu, gennum=%llu/%llu",
-					     bio->bi_iter.bi_sector,
-					 wi->devio_gennum, gennum);
-			}
-			M_ASSERT(cc++ < 10000);
-		}
-		spin_unlock_irqrestore(&bc->devio.spinlock, flags);
-
-inner_out:
-		;
-
-	} while (processed);
+	list_for_each_entry_safe(wi, next_wi, &acked_list, devio_pending_list) {
+		struct bio *bio = wi->wi_cloned_bio;
+
+		list_del_init(&wi->devio_pending_list);
+		BT_TRACE(BT_LEVEL_TRACE1,
+			 bc, NULL, NULL, bio, NULL,
+			 "bi_sector=%lu, flush_gen=%llu/%llu, flush wait done, err=%d",
+			 bio->bi_iter.bi_sector,
+			 wi->devio_flush_gen,
+			 gennum,
+			 err);
+		cache_timer_add(&bc->bc_timer_cached_device_flushes,
+				wi->wi_ts_physio_flush);
+		cached_dev_make_request_endio(wi, bio, 0);
+	}
 }
 
 /*! handles completion of pureflush request */
@@ -102,50 +151,43 @@ static void cached_devio_flush_end_bio(struct bio *bio, int err)
 {
 	unsigned long flags;
 	struct flush_meta *flush_meta = bio->bi_private;
+	struct bittern_cache *bc = flush_meta->bc;
 
-	ASSERT_BITTERN_CACHE(flush_meta->bc);
+	ASSERT_BITTERN_CACHE(bc);
 
-	spin_lock_irqsave(&flush_meta->bc->devio.spinlock, flags);
-	flush_meta->bc->devio.pure_flush_pending_count--;
-        M_ASSERT(flush_meta->bc->devio.pure_flush_pending_count >= 0);
-	spin_unlock_irqrestore(&flush_meta->bc->devio.spinlock, flags);
+	spin_lock_irqsave(&bc->devio.spinlock, flags);
+	bc->devio.pure_flush_pending_count--;
+	M_ASSERT(bc->devio.pure_flush_pending_count >= 0);
+	bc->devio.flush_inflight_count--;
+	M_ASSERT(bc->devio.flush_inflight_count >= 0);
+	spin_unlock_irqrestore(&bc->devio.spinlock, flags);
 
-	BT_TRACE(BT_LEVEL_TRACE1, flush_meta->bc, NULL, NULL, bio, NULL,
-		 "ack up to delayed flush gennum = %llu, err=%d",
+	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
+		 "ack up to flush gennum = %llu, err=%d",
 		 flush_meta->gennum,
 		 err);
 
 	bio_put(bio);
 
 #warning "add error injection here when done merging with error handling"
-	cached_devio_flush_end_bio_process(flush_meta->bc,
-					   flush_meta->gennum,
-					   err);
+	cached_devio_flush_end_bio_process(bc, flush_meta->gennum, err);
 
 	kmem_free(flush_meta, sizeof(struct flush_meta));
+
+	/* writes which completed meanwhile are waiting for the next flush */
+	cached_devio_flush_kick(bc);
 }
 
-void cached_devio_flush_delayed_worker(struct work_struct *work)
+/*!
+ * issue a pure flush if force is set and waiters are left uncovered, or
+ * if @ref __cached_devio_flush_needed says so.
+ */
+static void cached_devio_flush_issue(struct bittern_cache *bc, bool force)
 {
-	int ret;
-	struct bittern_cache *bc;
 	struct bio *bio;
 	unsigned long flags;
-	struct delayed_work *dwork = to_delayed_work(work);
 	struct flush_meta *flush_meta;
 
-	bc = container_of(dwork,
-			  struct bittern_cache,
-			  devio.flush_delayed_work);
-	ASSERT(bc != NULL);
-
-	if (bc->devio.flush_pending_count == 0 &&
-	    bc->devio.pending_count == 0) {
-		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
-			 "nothing pending, no work to do");
-		goto out;
-	}
-
 	ASSERT_BITTERN_CACHE(bc);
 
 	flush_meta = kmem_alloc(sizeof(struct flush_meta), GFP_NOIO);
@@ -187,17 +229,69 @@ void cached_devio_flush_delayed_worker(struct work_struct *work)
 	bio->bi_vcnt = 0;
 
 	spin_lock_irqsave(&bc->devio.spinlock, flags);
+	/* the state may have changed while allocating */
+	if (bc->devio.flush_gen_wanted <= bc->devio.flush_gen_issued ||
+	    (!force && !__cached_devio_flush_needed(bc))) {
+		spin_unlock_irqrestore(&bc->devio.spinlock, flags);
+		bio_put(bio);
+		kmem_free(flush_meta, sizeof(struct flush_meta));
+		return;
+	}
+	if (force)
+		bc->devio.flush_delayed_count++;
+	if (bc->devio.flush_inflight_count > 0)
+		bc->devio.flush_overlap_count++;
 	bc->devio.gennum_flush = bc->devio.gennum;
-	flush_meta->gennum = bc->devio.gennum;
+	flush_meta->gennum = ++bc->devio.flush_gen_issued;
+	bc->devio.flush_inflight_count++;
+	if (bc->devio.flush_inflight_count > bc->devio.flush_inflight_max)
+		bc->devio.flush_inflight_max = bc->devio.flush_inflight_count;
 	bc->devio.pure_flush_pending_count++;
 	bc->devio.pure_flush_total_count++;
 	spin_unlock_irqrestore(&bc->devio.spinlock, flags);
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
-		 "delayed_worker: issue pure flush gennum=%llu",
-		 flush_meta->gennum);
+		 "issue pure flush gennum=%llu force=%d",
+		 flush_meta->gennum,
+		 force);
 
 	generic_make_request(bio);
+}
+
+void cached_devio_flush_worker(struct work_struct *work)
+{
+	struct bittern_cache *bc;
+
+	bc = container_of(work, struct bittern_cache, devio.flush_work);
+	ASSERT_BITTERN_CACHE(bc);
+
+	cached_devio_flush_issue(bc, false);
+}
+
+void cached_devio_flush_delayed_worker(struct work_struct *work)
+{
+	int ret;
+	struct bittern_cache *bc;
+	struct delayed_work *dwork = to_delayed_work(work);
+
+	bc = container_of(dwork,
+			  struct bittern_cache,
+			  devio.flush_delayed_work);
+	ASSERT(bc != NULL);
+
+	/*
+	 * Flushes are normally dispatched as writes complete. This only
+	 * catches waiters left uncovered with no flush in flight.
+	 */
+	if (bc->devio.flush_gen_wanted <= bc->devio.flush_gen_issued ||
+	    bc->devio.flush_inflight_count > 0) {
+		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
+			 "nothing pending, no work to do");
+		goto out;
+	}
+
+	ASSERT_BITTERN_CACHE(bc);
+	cached_devio_flush_issue(bc, true);
 
 out:
 	ret = schedule_delayed_work(&bc->devio.flush_delayed_work,
@@ -262,7 +356,7 @@ static void cached_devio_make_request_end_bio(struct bio *bio, int err)
 
 	/*
 	 * If this is a flush, acknowledge all pending writes which
-	 * have a gennum lower that the current flush.
+	 * wait for a flush generation up to the current flush.
 	 * If not, leave the write in pending_flush state until we get
 	 * the next flush acknowledge.
 	 * In case of error ack every pending request, as there may not be
@@ -273,18 +367,26 @@ static void cached_devio_make_request_end_bio(struct bio *bio, int err)
 		 * ack previously pending writes, then ack current work_item.
 		 */
 		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
-			 "endbio: write+flush bi_sector=%lu, gennum=%llu done, err=%d",
+			 "endbio: write+flush bi_sector=%lu, gennum=%llu, flush_gen=%llu done, err=%d",
 			     bio->bi_iter.bi_sector,
 			 wi->devio_gennum,
+			 wi->devio_flush_gen,
 			 err);
 
+		if ((wi->devio_flags & (REQ_FLUSH | REQ_FUA)) != 0) {
+			bc->devio.flush_inflight_count--;
+			M_ASSERT(bc->devio.flush_inflight_count >= 0);
+		}
+
 		spin_unlock_irqrestore(&bc->devio.spinlock, flags);
 
 		/*
 		 * Ack all flush pending requests which have
-		 * @ref devio_gennum <= current flush wi->devio_gennum.
+		 * @ref devio_flush_gen <= current flush generation.
 		 */
-		cached_devio_flush_end_bio_process(bc, wi->devio_gennum, err);
+		cached_devio_flush_end_bio_process(bc,
+						   wi->devio_flush_gen,
+						   err);
 
 		/*
 		 * note in this case current work_item hasn't been added to
@@ -294,26 +396,50 @@ static void cached_devio_make_request_end_bio(struct bio *bio, int err)
 				wi->wi_ts_physio_flush);
 		cached_dev_make_request_endio(wi, bio, err);
 
-		spin_lock_irqsave(&bc->devio.spinlock, flags);
-
 	} else {
 		/*
-		 * Just wait until a flush is processed. If this is the only
-		 * write request in the queue, issue an explicit flush.
+		 * Wait for the next flush generation, which is dispatched
+		 * right away if the device is idle or no flush is in flight.
 		 */
+		wi->devio_flush_gen = bc->devio.flush_gen_issued + 1;
+		bc->devio.flush_gen_wanted = wi->devio_flush_gen;
 		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
-			 "endbio: write+flush bi_sector=%lu, gennum=%llu, waiting for flush",
+			 "endbio: write+flush bi_sector=%lu, gennum=%llu, waiting for flush_gen=%llu",
 			     bio->bi_iter.bi_sector,
-			     wi->devio_gennum);
+			     wi->devio_gennum,
+			     wi->devio_flush_gen);
 
 		list_add_tail(&wi->devio_pending_list,
 			      &bc->devio.flush_pending_list);
 		bc->devio.flush_pending_count++;
 
 		M_ASSERT(bc->devio.flush_pending_count >= 1);
+
+		spin_unlock_irqrestore(&bc->devio.spinlock, flags);
 	}
 
-	spin_unlock_irqrestore(&bc->devio.spinlock, flags);
+	/*
+	 * Either a waiter was added, or the device has one less request
+	 * in flight, or a flush has completed.
+	 */
+	cached_devio_flush_kick(bc);
+}
+
+/*!
+ * end_bio function used for pool member devices, see
+ * @ref cached_devio_make_request.
+ */
+static void cached_devio_member_end_bio(struct bio *bio, int err)
+{
+	struct work_item *wi;
+
+	ASSERT(bio != NULL);
+	wi = bio->bi_private;
+	ASSERT(wi != NULL);
+	ASSERT_WORK_ITEM(wi, wi->wi_cache);
+	M_ASSERT(bio == wi->wi_cloned_bio);
+
+	cached_dev_make_request_endio(wi, bio, err);
 }
 
 void cached_devio_make_request(struct bittern_cache *bc,
@@ -324,8 +450,23 @@ void cached_devio_make_request(struct bittern_cache *bc,
 
 	ASSERT_BITTERN_CACHE(bc);
 	ASSERT_WORK_ITEM(wi, bc);
+
+	if (cache_pool_remap_bio(bc, bio) != 0) {
+		/*
+		 * Pool member device. The gennum machinery only tracks the
+		 * pool's own cached device, so writes to members are made
+		 * durable individually.
+		 */
+		if (bio_data_dir_write(bio))
+			bio->bi_rw |= REQ_FUA;
+		bio->bi_end_io = cached_devio_member_end_bio;
+		wi->devio_flags = bio->bi_rw;
+		trace_bittern_devio_submit(bc, wi, bio, 0);
+		generic_make_request(bio);
+		return;
+	}
+
 	bio->bi_end_io = cached_devio_make_request_end_bio;
-	bio->bi_bdev = bc->devio.dm_dev->bdev;
 
 	spin_lock_irqsave(&bc->devio.spinlock, flags);
 
@@ -337,10 +478,17 @@ void cached_devio_make_request(struct bittern_cache *bc,
 
 	if (bio_data_dir_write(bio)) {
 		wi->devio_gennum = ++bc->devio.gennum;
+		wi->devio_flush_gen = 0;
 		if ((wi->devio_gennum - bc->devio.gennum_flush) >
 		    bc->devio.conf_fua_insert) {
 			bc->devio.gennum_flush = wi->devio_gennum;
 			bc->devio.flush_total_count++;
+			wi->devio_flush_gen = ++bc->devio.flush_gen_issued;
+			bc->devio.flush_inflight_count++;
+			if (bc->devio.flush_inflight_count >
+			    bc->devio.flush_inflight_max)
+				bc->devio.flush_inflight_max =
+					bc->devio.flush_inflight_count;
 			/*
 			 * Issue flush
 			 */
@@ -361,5 +509,41 @@ void cached_devio_make_request(struct bittern_cache *bc,
 
 	wi->devio_flags = bio->bi_rw;
 
+	trace_bittern_devio_submit(bc, wi, bio, 0);
 	generic_make_request(bio);
 }
+
+ssize_t cached_devio_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	unsigned int i;
+
+	DMEMIT("%s: devio: pending_count=%d flush_pending_count=%d flush_inflight_count=%d flush_inflight_max=%d\n",
+	       bc->bc_name,
+	       bc->devio.pending_count,
+	       bc->devio.flush_pending_count,
+	       bc->devio.flush_inflight_count,
+	       bc->devio.flush_inflight_max);
+	DMEMIT("%s: devio: flush_gen_issued=%llu flush_gen_wanted=%llu pure_flush_total_count=%llu flush_total_count=%llu flush_overlap_count=%llu flush_delayed_count=%llu flush_empty_count=%llu\n",
+	       bc->bc_name,
+	       bc->devio.flush_gen_issued,
+	       bc->devio.flush_gen_wanted,
+	       bc->devio.pure_flush_total_count,
+	       bc->devio.flush_total_count,
+	       bc->devio.flush_overlap_count,
+	       bc->devio.flush_delayed_count,
+	       bc->devio.flush_empty_count);
+	DMEMIT("%s: devio: flush_batch_hist:", bc->bc_name);
+	for (i = 0; i < CACHED_DEV_FLUSH_BATCH_HIST_BUCKETS; i++)
+		DMEMIT(" batches_%u=%u",
+		       1U << i,
+		       bc->devio.flush_batch_hist[i]);
+	DMEMIT("\n");
+	DMEMIT("%s: devio: flush_wait_hist:", bc->bc_name);
+	for (i = 0; i < CACHED_DEV_FLUSH_WAIT_HIST_BUCKETS; i++)
+		DMEMIT(" wait_%uus=%u",
+		       1U << i,
+		       bc->devio.flush_wait_hist[i]);
+	DMEMIT("\n");
+	return sz;
+}
@@ -61,7 +61,7 @@ void cache_dump_blocks_cache_state(struct bittern_cache *bc,
 		unsigned long cache_flags;
 		int do_print = 0;
 
-		cache_block = &bc->bc_cache_blocks[block_id - 1];
+		cache_block = cache_block_from_id(bc, block_id);
 		spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
 		ASSERT(cache_block->bcb_block_id == block_id);
 		ASSERT_CACHE_BLOCK(cache_block, bc);
@@ -302,6 +302,10 @@ int cache_dump_blocks(struct bittern_cache *bc,
 				    &bc->defer_page,
 				    "deferred_wait_page",
 				    dump_offset);
+		cache_dump_deferred(bc,
+				    &bc->defer_class,
+				    "deferred_wait_class",
+				    dump_offset);
 	} else if (strcmp(dump_op, "deferred_wait_busy") == 0)
 		cache_dump_deferred(bc,
 				    &bc->defer_busy,
@@ -312,6 +316,11 @@ int cache_dump_blocks(struct bittern_cache *bc,
 				    &bc->defer_page,
 				    "deferred_wait_page",
 				    dump_offset);
+	else if (strcmp(dump_op, "deferred_wait_class") == 0)
+		cache_dump_deferred(bc,
+				    &bc->defer_class,
+				    "deferred_wait_class",
+				    dump_offset);
 	else
 		return -EINVAL;
 	return 0;
@@ -47,6 +47,8 @@ int cache_get_clean(struct bittern_cache *bc,
 {
 	unsigned long flags, cache_flags;
 	struct cache_block *cache_block = NULL;
+	struct cache_block *bcb;
+	unsigned int scan_count;
 	int replacement_mode;
 	int block_hold_ret;
 
@@ -73,7 +75,7 @@ int cache_get_clean(struct bittern_cache *bc,
 	 */
 	if (replacement_mode == CACHE_REPLACEMENT_MODE_RANDOM) {
 		unsigned int random_value;
-		unsigned random_cache_block_id, scan_count;
+		unsigned random_cache_block_id;
 
 		ASSERT(cache_block == NULL);
 		/*
@@ -100,7 +102,7 @@ int cache_get_clean(struct bittern_cache *bc,
 		     CACHE_REPLACEMENT_MODE_RANDOM_MAX_SCANS;
 		     scan_count++) {
 			cache_block =
-			    &bc->bc_cache_blocks[random_cache_block_id - 1];
+			    cache_block_from_id(bc, random_cache_block_id);
 			ASSERT(cache_block->bcb_block_id ==
 			       random_cache_block_id);
 
@@ -114,7 +116,8 @@ int cache_get_clean(struct bittern_cache *bc,
 				 cache_block->bcb_block_id);
 			block_hold_ret = cache_block_hold(bc, cache_block);
 			if (block_hold_ret == 1
-			    && cache_block->bcb_state == S_CLEAN) {
+			    && cache_block->bcb_state == S_CLEAN
+			    && !cache_pool_block_protected(bc, cache_block)) {
 				/*
 				 * found suitable cache block.
 				 * note we need to keep the cache_block spinlock
@@ -157,11 +160,19 @@ int cache_get_clean(struct bittern_cache *bc,
 	    || replacement_mode == CACHE_REPLACEMENT_MODE_LRU) {
 		ASSERT(cache_block == NULL);
 
-		if (list_non_empty(&bc->bc_valid_entries_list))
-			cache_block =
-			    list_first_entry(&bc->bc_valid_entries_list,
-					     struct cache_block,
-					     bcb_entry);
+		/*
+		 * first block in the list, skipping the ones of pool owners
+		 * which are at their min quota. give up skipping after a
+		 * while, quotas are best effort.
+		 */
+		scan_count = 0;
+		list_for_each_entry(bcb, &bc->bc_valid_entries_list, bcb_entry) {
+			if (++scan_count >= CACHE_POOL_MIN_QUOTA_MAX_SCANS ||
+			    !cache_pool_block_protected(bc, bcb)) {
+				cache_block = bcb;
+				break;
+			}
+		}
 		/*
 		 * this should almost never happen, as we only get called when
 		 * we are below the threshold for invalid (free) blocks
@@ -207,11 +218,16 @@ int cache_get_clean(struct bittern_cache *bc,
 	 */
 	ASSERT(cache_block == NULL);
 
-	if (list_non_empty(&bc->bc_valid_entries_clean_list))
-		cache_block =
-		    list_first_entry(&bc->bc_valid_entries_clean_list,
-				     struct cache_block,
-				     bcb_entry_cleandirty);
+	scan_count = 0;
+	list_for_each_entry(bcb,
+			    &bc->bc_valid_entries_clean_list,
+			    bcb_entry_cleandirty) {
+		if (++scan_count >= CACHE_POOL_MIN_QUOTA_MAX_SCANS ||
+		    !cache_pool_block_protected(bc, bcb)) {
+			cache_block = bcb;
+			break;
+		}
+	}
 	if (cache_block == NULL) {
 		/*
 		 * cache_block not found
@@ -287,9 +303,133 @@ int cache_get_clean(struct bittern_cache *bc,
 	return CACHE_GET_RET_HIT_IDLE;
 }
 
+/*
+ * hold cache_block if it's an idle clean block which can be invalidated.
+ * called with bc_entries_lock held. returns 1 if the block is now held.
+ */
+static int cache_get_clean_batch_try(struct bittern_cache *bc,
+				     struct cache_block *cache_block)
+{
+	unsigned long cache_flags;
+	int block_hold_ret;
+
+	ASSERT_CACHE_BLOCK(cache_block, bc);
+	if (cache_block->bcb_state != S_CLEAN ||
+	    cache_pool_block_protected(bc, cache_block))
+		return 0;
+	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
+	block_hold_ret = cache_block_hold(bc, cache_block);
+	if (block_hold_ret == 1 && cache_block->bcb_state == S_CLEAN) {
+		cache_track_hash_check(bc,
+				       cache_block,
+				       cache_block->bcb_hash_data);
+		spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
+		return 1;
+	}
+	cache_block_release(bc, cache_block);
+	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
+	return 0;
+}
+
+/*
+ * batch version of cache_get_clean(), used by the invalidator thread.
+ * selects and holds up to max_blocks clean blocks with a single hold of
+ * bc_entries_lock, using the same replacement mode logic.
+ * returns the number of blocks stored in o_cache_blocks.
+ */
+unsigned int cache_get_clean_batch(struct bittern_cache *bc,
+				   struct cache_block **o_cache_blocks,
+				   unsigned int max_blocks)
+{
+	unsigned long flags;
+	struct cache_block *bcb;
+	unsigned int count = 0;
+	unsigned int scan_count;
+	int replacement_mode;
+
+	ASSERT(bc != NULL);
+	ASSERT_BITTERN_CACHE(bc);
+	ASSERT(o_cache_blocks != NULL);
+	ASSERT(max_blocks > 0);
+
+	/* see cache_get_clean() */
+	replacement_mode = bc->bc_replacement_mode;
+	ASSERT_CACHE_REPLACEMENT_MODE(replacement_mode);
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+
+	if (replacement_mode == CACHE_REPLACEMENT_MODE_RANDOM) {
+		unsigned int random_value = (unsigned int)get_random_int();
+		unsigned int total = atomic_read(&bc->bc_total_entries);
+
+		/* probes of cache_get_clean(), plus a few per block */
+		for (scan_count = 0;
+		     scan_count < CACHE_REPLACEMENT_MODE_RANDOM_MAX_SCANS +
+				  max_blocks * 4 &&
+		     count < max_blocks;
+		     scan_count++) {
+			bcb = cache_block_from_id(bc,
+						  (random_value % total) + 1);
+			if (cache_get_clean_batch_try(bc, bcb)) {
+				o_cache_blocks[count++] = bcb;
+				atomic_inc(&bc->bc_idle_invalidations);
+			}
+			random_value =
+				__cache_block_pseudo_random(random_value);
+		}
+	} else {
+		/*
+		 * FIFO and LRU, oldest blocks first. busy blocks are skipped
+		 * rather than ending the scan as in cache_get_clean().
+		 */
+		scan_count = 0;
+		list_for_each_entry(bcb, &bc->bc_valid_entries_list, bcb_entry) {
+			if (count >= max_blocks ||
+			    ++scan_count >= CACHE_POOL_MIN_QUOTA_MAX_SCANS +
+					    max_blocks)
+				break;
+			if (cache_get_clean_batch_try(bc, bcb)) {
+				o_cache_blocks[count++] = bcb;
+				atomic_inc(&bc->bc_idle_invalidations);
+			}
+		}
+	}
+
+	/*
+	 * try list of clean blocks as a last resort.
+	 * the blocks we already hold are no longer idle, so they cannot
+	 * be picked twice.
+	 */
+	scan_count = 0;
+	list_for_each_entry(bcb,
+			    &bc->bc_valid_entries_clean_list,
+			    bcb_entry_cleandirty) {
+		if (count >= max_blocks ||
+		    ++scan_count >= CACHE_POOL_MIN_QUOTA_MAX_SCANS + max_blocks)
+			break;
+		if (cache_get_clean_batch_try(bc, bcb)) {
+			o_cache_blocks[count++] = bcb;
+			atomic_inc(&bc->bc_busy_invalidations);
+		}
+	}
+
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	atomic_add(count, &bc->bc_invalidations);
+	if (count == 0)
+		atomic_inc(&bc->bc_no_invalidations_all_blocks_busy);
+	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
+		 "batch of %u/%u clean blocks (%s)",
+		 count, max_blocks,
+		 cache_replacement_mode_to_str(replacement_mode));
+
+	return count;
+}
+
 int cache_get_invalid_block_locked(struct bittern_cache *bc,
 				   sector_t cache_block_sector,
 				   int cleandirty_iflag,
+				   int io_class,
 				   struct cache_block **o_cache_block)
 {
 	unsigned long cache_flags;
@@ -299,6 +439,7 @@ int cache_get_invalid_block_locked(struct bittern_cache *bc,
 	ASSERT_BITTERN_CACHE(bc);
 	ASSERT(cleandirty_iflag == CACHE_FL_CLEAN
 	       || cleandirty_iflag == CACHE_FL_DIRTY);
+	ASSERT(io_class >= 0 && io_class < CACHE_IO_CLASSES);
 	ASSERT(o_cache_block != NULL);
 	*o_cache_block = NULL;
 
@@ -359,6 +500,13 @@ int cache_get_invalid_block_locked(struct bittern_cache *bc,
 		 * make valid no data
 		 */
 		cache_block->bcb_sector = cache_block_sector;
+		atomic_inc(&cache_pool_owner_of(bc,
+					cache_block_sector)->cpo_valid_entries);
+		cache_block->bcb_io_class = io_class;
+		atomic_inc(&bc->bc_io_classes[io_class].cic_valid_entries);
+		cache_block->bcb_write_heat = 0;
+		cache_block->bcb_hot_deferred = 0;
+		cache_block->bcb_dirty_since = jiffies_to_secs(jiffies);
 		if (cleandirty_iflag == CACHE_FL_CLEAN)
 			cache_block->bcb_state = S_CLEAN_NO_DATA;
 		else {
@@ -435,6 +583,7 @@ int cache_get_invalid_block_locked(struct bittern_cache *bc,
 int cache_get_invalid_block(struct bittern_cache *bc,
 			    sector_t cache_block_sector,
 			    int cleandirty_iflag,
+			    int io_class,
 			    struct cache_block **o_cache_block)
 {
 	int ret;
@@ -445,6 +594,7 @@ int cache_get_invalid_block(struct bittern_cache *bc,
 	ret = cache_get_invalid_block_locked(bc,
 					     cache_block_sector,
 					     cleandirty_iflag,
+					     io_class,
 					     o_cache_block);
 	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 	return ret;
@@ -467,6 +617,8 @@ enum cache_get_ret cache_get(struct bittern_cache *bc,
 	unsigned long cache_flags = 0UL; /* shut up compiler */
 	int replacement_mode;
 	int cleandirty_iflag = iflags & CACHE_FL_CLEANDIRTY_MASK;
+	int io_class = (iflags & CACHE_FL_IO_CLASS_MASK) >>
+		       CACHE_FL_IO_CLASS_SHIFT;
 	int ret;
 
 	/*
@@ -640,6 +792,7 @@ enum cache_get_ret cache_get(struct bittern_cache *bc,
 	ret = cache_get_invalid_block_locked(bc,
 					     cache_block_sector,
 					     cleandirty_iflag,
+					     io_class,
 					     &cache_block);
 	ASSERT(ret == CACHE_GET_RET_MISS_INVALID_IDLE ||
 	       ret == CACHE_GET_RET_MISS);
@@ -678,19 +831,28 @@ enum cache_get_ret cache_get(struct bittern_cache *bc,
  * if block_age is 0 it will always return a dirty block (if it exists),
  * otherwise it will only return it if the block is at least as old as
  * "block_age".
+ * if nr_shards > 1, the first dirty block of the given bgwriter shard
+ * within the first CACHE_BGWRITER_SHARD_SCAN entries is used instead.
+ * write-hot blocks (see cache_bgwriter_block_is_hot()) are moved to the
+ * tail of the dirty list and the next block is tried, -ETIME is returned
+ * if none is found within CACHE_BGWRITER_HOT_SCAN tries.
  * return values are:
  * 0 for success
  * -EBUSY for block busy
  * -ETIMER for block too young
- * -EAGAIN for dirty list empty
+ * -EAGAIN for dirty list empty (or no dirty block in the shard)
  */
 int cache_get_dirty_from_head(struct bittern_cache *bc,
 			      struct cache_block  **o_cache_block,
-			      int requested_block_age)
+			      int requested_block_age,
+			      unsigned int shard,
+			      unsigned int nr_shards)
 {
 	unsigned int block_age_secs;
 	unsigned long flags, cache_flags;
 	struct cache_block *cache_block = NULL;
+	struct cache_block *first_hot_block = NULL;
+	unsigned int hot_skips = 0;
 	int block_hold_ret;
 
 	ASSERT(bc != NULL);
@@ -701,22 +863,48 @@ int cache_get_dirty_from_head(struct bittern_cache *bc,
 	 * block age is either -1 or a valid block age
 	 */
 	ASSERT(requested_block_age >= 0);
+	ASSERT(shard < nr_shards || nr_shards <= 1);
 
 	spin_lock_irqsave(&bc->bc_entries_lock, flags);
 
-	if (list_non_empty(&bc->bc_valid_entries_dirty_list)) {
+again:
+	cache_block = NULL;
+	if (nr_shards > 1) {
+		struct cache_block *bcb;
+		unsigned int scanned = 0;
+
+		list_for_each_entry(bcb,
+				    &bc->bc_valid_entries_dirty_list,
+				    bcb_entry_cleandirty) {
+			if (scanned++ >= CACHE_BGWRITER_SHARD_SCAN)
+				break;
+			if (cache_bgwriter_shard(bc, bcb->bcb_sector,
+						 nr_shards) == shard) {
+				cache_block = bcb;
+				break;
+			}
+		}
+		if (cache_block != NULL)
+			ASSERT_CACHE_BLOCK(cache_block, bc);
+	} else if (list_non_empty(&bc->bc_valid_entries_dirty_list)) {
 		cache_block = list_first_entry(&bc->bc_valid_entries_dirty_list,
 					       struct cache_block,
 					       bcb_entry_cleandirty);
 		ASSERT(cache_block != NULL);
 		ASSERT_CACHE_BLOCK(cache_block, bc);
-	} else {
-		ASSERT(cache_block == NULL);
+	}
+
+	if (cache_block == NULL) {
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
 			 "dirty list is empty");
 		return -EAGAIN;
 	}
+	if (cache_block == first_hot_block) {
+		/* all the dirty blocks we can look at are write-hot */
+		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+		return -ETIME;
+	}
 
 	ASSERT(cache_block != NULL);
 	ASSERT_BITTERN_CACHE(bc);
@@ -756,6 +944,31 @@ int cache_get_dirty_from_head(struct bittern_cache *bc,
 		return -ETIME;
 	}
 
+	if (cache_bgwriter_block_is_hot(bc, cache_block)) {
+		/*
+		 * write-hot, keep it dirty and look at the next one.
+		 * stop once we wrap around or scanned enough blocks.
+		 */
+		BT_TRACE(BT_LEVEL_TRACE2, bc, NULL, cache_block, NULL, NULL,
+			 "dirty block is write-hot");
+		trace_bittern_bgwriter_decision(bc,
+						cache_block->bcb_sector,
+						BGWRITER_DECISION_HOT);
+		cache_block->bcb_hot_deferred = 1;
+		list_del_init(&cache_block->bcb_entry_cleandirty);
+		list_add_tail(&cache_block->bcb_entry_cleandirty,
+			      &bc->bc_valid_entries_dirty_list);
+		atomic_inc(&bc->bc_bgwriter_hot_deferred_count);
+		cache_block_release(bc, cache_block);
+		spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
+		if (first_hot_block == NULL)
+			first_hot_block = cache_block;
+		if (++hot_skips < CACHE_BGWRITER_HOT_SCAN)
+			goto again;
+		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+		return -ETIME;
+	}
+
 	ASSERT(cache_block->bcb_state == S_DIRTY);
 	ASSERT(atomic_read(&cache_block->bcb_refcount) > 0);
 
@@ -787,6 +1000,7 @@ enum cache_get_ret cache_get_clone(struct bittern_cache *bc,
 	ret = cache_get_invalid_block(bc,
 				      original_cache_block->bcb_sector,
 				      cache_fl,
+				      original_cache_block->bcb_io_class,
 				      o_cache_block);
 	ASSERT(ret == CACHE_GET_RET_MISS_INVALID_IDLE ||
 	       ret == CACHE_GET_RET_MISS);
@@ -818,12 +1032,19 @@ enum cache_get_ret cache_get_by_id(struct bittern_cache *bc,
 	ASSERT(o_cache_block != NULL);
 	ASSERT_BITTERN_CACHE(bc);
 	ASSERT(cache_block_id > 0);
-	ASSERT(cache_block_id <= atomic_read(&bc->bc_total_entries));
 
 	*o_cache_block = NULL;
 
 	spin_lock_irqsave(&bc->bc_entries_lock, flags);
-	cache_block = &bc->bc_cache_blocks[cache_block_id - 1];
+	/*
+	 * the cache may have been shrunk since the caller looked at
+	 * bc_total_entries, in which case the block no longer exists.
+	 */
+	if (cache_block_id > atomic_read(&bc->bc_total_entries)) {
+		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+		return CACHE_GET_RET_INVALID;
+	}
+	cache_block = cache_block_from_id(bc, cache_block_id);
 	ASSERT(cache_block->bcb_block_id == cache_block_id);
 	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
 
@@ -946,6 +1167,10 @@ void cache_move_to_invalid(struct bittern_cache *bc,
 	/* remove from valid list */
 	list_del_init(&cache_block->bcb_entry);
 
+	atomic_dec(&cache_pool_owner_of(bc,
+				cache_block->bcb_sector)->cpo_valid_entries);
+	atomic_dec(&bc->bc_io_classes[cache_block->bcb_io_class]
+		   .cic_valid_entries);
 	cache_block->bcb_hash_data = UINT128_ZERO;
 	cache_block->bcb_sector = SECTOR_NUMBER_INVALID;
 
@@ -974,7 +1199,19 @@ void cache_move_to_invalid(struct bittern_cache *bc,
 
 	/* remove from valid list, add to invalid list */
 	list_del_init(&cache_block->bcb_entry);
-	list_add_tail(&cache_block->bcb_entry, &bc->bc_invalid_entries_list);
+	if (bc->bc_resize_fence != 0 &&
+	    cache_block->bcb_block_id > bc->bc_resize_fence) {
+		/*
+		 * block is being evacuated by a shrink, park it instead
+		 */
+		atomic_dec(&bc->bc_invalid_entries);
+		atomic_inc(&bc->bc_resize_evacuated);
+		list_add_tail(&cache_block->bcb_entry,
+			      &bc->bc_resize_evacuated_list);
+	} else {
+		list_add_tail(&cache_block->bcb_entry,
+			      &bc->bc_invalid_entries_list);
+	}
 
 	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
 	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
@@ -58,17 +58,15 @@ void cache_invalidate_block_io_end(struct bittern_cache *bc,
 	wake_up_interruptible(&bc->bc_invalidator_wait);
 }
 
-/*! \todo does this really belong here and not in cache_getput ? */
-void cache_invalidate_block_io_start(struct bittern_cache *bc,
-				     struct cache_block *cache_block)
+/*!
+ * Start invalidation state transition.
+ * Caller holds bc_entries_lock.
+ */
+static void cache_invalidate_block_transition(struct bittern_cache *bc,
+					      struct cache_block *cache_block)
 {
-	unsigned long flags;
 	unsigned long cache_flags;
-	struct work_item *wi;
-	int val;
-	int ret;
 
-	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL, "enter");
 	ASSERT_BITTERN_CACHE(bc);
 	ASSERT_CACHE_BLOCK(cache_block, bc);
 
@@ -80,7 +78,6 @@ void cache_invalidate_block_io_start(struct bittern_cache *bc,
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL,
 		 "invalidating clean block id #%d", cache_block->bcb_block_id);
 
-	spin_lock_irqsave(&bc->bc_entries_lock, flags);
 	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
 
 	/*
@@ -96,7 +93,18 @@ void cache_invalidate_block_io_start(struct bittern_cache *bc,
 				S_DIRTY_INVALIDATE_START);
 
 	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
-	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+}
+
+/*!
+ * Allocate work_item and kick off the invalidation state machine for
+ * a block which has already been transitioned.
+ */
+static void cache_invalidate_block_submit(struct bittern_cache *bc,
+					  struct cache_block *cache_block)
+{
+	struct work_item *wi;
+	int val;
+	int ret;
 
 	/*
 	 * allocate work_item and initialize it
@@ -139,6 +147,45 @@ void cache_invalidate_block_io_start(struct bittern_cache *bc,
 	cache_state_machine(bc, wi, 0);
 }
 
+/*! \todo does this really belong here and not in cache_getput ? */
+void cache_invalidate_block_io_start(struct bittern_cache *bc,
+				     struct cache_block *cache_block)
+{
+	unsigned long flags;
+
+	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL, "enter");
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	cache_invalidate_block_transition(bc, cache_block);
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	cache_invalidate_block_submit(bc, cache_block);
+}
+
+/*!
+ * Batch version of the above. All the state transitions are done with
+ * a single hold of bc_entries_lock, then the metadata invalidations are
+ * issued back to back. Each block still completes on its own.
+ */
+static void cache_invalidate_blocks_io_start(struct bittern_cache *bc,
+					     struct cache_block **cache_blocks,
+					     unsigned int count)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
+		 "enter: count=%u", count);
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	for (i = 0; i < count; i++)
+		cache_invalidate_block_transition(bc, cache_blocks[i]);
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	for (i = 0; i < count; i++)
+		cache_invalidate_block_submit(bc, cache_blocks[i]);
+}
+
 /*!
  * This function is used as a wakeup condition by the invalidator thread.
  * The wakeup conditions are (1) there has to be work to do (2) there have
@@ -203,25 +250,45 @@ void cache_invalidate_clean_blocks(struct bittern_cache *bc)
 		 bc->bc_invalidator_no_work_count);
 
 	while (cache_invalidator_has_work_schmitt(bc)) {
-		struct cache_block *cache_block;
-		int ret;
+		struct cache_block *cache_blocks[INVALIDATOR_MAX_BATCH_SIZE];
+		unsigned int batch_size;
+		unsigned int count;
+
+		batch_size = bc->bc_invalidator_conf_batch_size;
+		if (batch_size > INVALIDATOR_MAX_BATCH_SIZE)
+			batch_size = INVALIDATOR_MAX_BATCH_SIZE;
 
-		ret = cache_get_clean(bc, &cache_block);
-		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL,
-			 "kthread_should_stop=%d, has_work=%d, pending=%d",
+		if (batch_size <= 1) {
+			int ret;
+
+			ret = cache_get_clean(bc, &cache_blocks[0]);
+			count = (ret == CACHE_GET_RET_HIT_IDLE) ? 1 : 0;
+		} else {
+			count = cache_get_clean_batch(bc,
+						      cache_blocks,
+						      batch_size);
+		}
+		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
+			 "kthread_should_stop=%d, has_work=%d, pending=%d, count=%u",
 			 kthread_should_stop(),
 			 cache_invalidator_has_work(bc),
-			 atomic_read(&bc->bc_pending_invalidate_requests));
-		if (ret == CACHE_GET_RET_HIT_IDLE) {
-			/* found a clean block, start async invalidation */
-			ASSERT(cache_block != NULL);
-			cache_invalidate_block_io_start(bc, cache_block);
-			atomic_inc(&bc->bc_invalidations_invalidator);
-			did_work = 1;
-		} else {
+			 atomic_read(&bc->bc_pending_invalidate_requests),
+			 count);
+		if (count == 0) {
 			/* no blocks, bail out */
 			break;
 		}
+
+		/* found clean blocks, start async invalidation */
+		if (count == 1)
+			cache_invalidate_block_io_start(bc, cache_blocks[0]);
+		else
+			cache_invalidate_blocks_io_start(bc,
+							 cache_blocks,
+							 count);
+		atomic_add(count, &bc->bc_invalidations_invalidator);
+		bc->bc_invalidator_batch_hist[ilog2(count)]++;
+		did_work = 1;
 	}
 	if (did_work)
 		bc->bc_invalidator_work_count++;
@@ -0,0 +1,188 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <linux/iocontext.h>
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * I/O classes.
+ *
+ * Each data request belongs to one of three classes, taken from the I/O
+ * priority of the process which submitted it (see ionice(1)): realtime
+ * requests are "high", idle requests are "low", everything else is
+ * "normal". map() copies the submitter's priority into the bio if the bio
+ * does not have one already, so the class survives the trip through the
+ * deferred queues.
+ *
+ * Each class has two quotas, both in percent:
+ *
+ * - max_pct caps the cache blocks a class can fill. A miss of a class at
+ *   its max quota bypasses the cache, exactly like a pool owner at its
+ *   max quota. Blocks are charged to the class which allocated them, and
+ *   the charge is not persisted: after a restart all blocks belong to the
+ *   normal class.
+ *
+ * - pending_pct caps the share of bc_max_pending_requests a class can
+ *   keep in flight. A request over its share waits in defer_class, which
+ *   the deferred worker handles after the other deferred queues. Requests
+ *   in defer_class are not counted as deferred requests, so they neither
+ *   hold back new requests of the other classes in map() nor look like
+ *   congestion to the bgwriter. New requests of a class queue behind the
+ *   ones already waiting, so a class is never reordered.
+ *
+ * By default only the low class is capped, so that a backup or a scrub
+ * running under "ionice -c3" cannot flush the working set out of the
+ * cache or starve the other requests of pending slots.
+ */
+
+void cache_io_class_initialize(struct bittern_cache *bc)
+{
+	unsigned int i;
+
+	for (i = 0; i < CACHE_IO_CLASSES; i++) {
+		struct cache_io_class *cic = &bc->bc_io_classes[i];
+
+		memset(cic, 0, sizeof(struct cache_io_class));
+		cic->cic_max_pct = 100;
+		cic->cic_pending_pct = 100;
+	}
+	bc->bc_io_classes[CACHE_IO_CLASS_LOW].cic_max_pct =
+					CACHE_IO_CLASS_LOW_MAX_PCT_DEFAULT;
+	bc->bc_io_classes[CACHE_IO_CLASS_LOW].cic_pending_pct =
+					CACHE_IO_CLASS_LOW_PENDING_PCT_DEFAULT;
+}
+
+/*!
+ * called once restore is complete and before any thread is started.
+ * the class of a block is not persisted, restored blocks are charged to
+ * the normal class.
+ */
+void cache_io_class_restore(struct bittern_cache *bc)
+{
+	unsigned int block_id;
+	unsigned int valid_entries = 0;
+
+	for (block_id = 1;
+	     block_id <= atomic_read(&bc->bc_total_entries);
+	     block_id++) {
+		struct cache_block *bcb = cache_block_from_id(bc, block_id);
+
+		bcb->bcb_io_class = CACHE_IO_CLASS_NORMAL;
+		if (bcb->bcb_state != S_INVALID)
+			valid_entries++;
+	}
+	atomic_set(&bc->bc_io_classes[CACHE_IO_CLASS_NORMAL].cic_valid_entries,
+		   valid_entries);
+}
+
+void cache_io_class_tag_bio(struct bio *bio)
+{
+	struct io_context *ioc = current->io_context;
+
+	if (ioprio_valid(bio_prio(bio)))
+		return;
+	if (ioc != NULL && ioprio_valid(ioc->ioprio))
+		bio_set_prio(bio, ioc->ioprio);
+}
+
+void cache_io_class_request_start(struct bittern_cache *bc,
+				  struct work_item *wi,
+				  struct bio *bio)
+{
+	wi->wi_io_class = cache_io_class_of_bio(bio);
+	atomic_inc(&bc->bc_io_classes[wi->wi_io_class].cic_pending_requests);
+}
+
+void cache_io_class_request_done(struct bittern_cache *bc,
+				 struct work_item *wi)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[wi->wi_io_class];
+
+	atomic_dec(&cic->cic_pending_requests);
+	/*
+	 * requests of this class may be waiting in the deferred queues for
+	 * this slot, and the completion path may have already kicked the
+	 * deferred worker before getting here.
+	 */
+	if (cic->cic_pending_pct < 100)
+		wakeup_deferred(bc);
+}
+
+int cache_io_class_set_quota(struct bittern_cache *bc,
+			     unsigned int io_class,
+			     int max_pct,
+			     int pending_pct)
+{
+	struct cache_io_class *cic;
+
+	M_ASSERT(io_class < CACHE_IO_CLASSES);
+	if (max_pct < 1 || max_pct > 100)
+		return -EINVAL;
+	if (pending_pct < 1 || pending_pct > 100)
+		return -EINVAL;
+	cic = &bc->bc_io_classes[io_class];
+	cic->cic_max_pct = max_pct;
+	cic->cic_pending_pct = pending_pct;
+	/* a larger share may let deferred requests go */
+	wakeup_deferred(bc);
+
+	return 0;
+}
+
+static const char *cache_io_class_names[CACHE_IO_CLASSES] = {
+	[CACHE_IO_CLASS_NORMAL] = "normal",
+	[CACHE_IO_CLASS_HIGH] = "high",
+	[CACHE_IO_CLASS_LOW] = "low",
+};
+
+ssize_t cache_io_class_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	unsigned int i;
+
+	DMEMIT("%s: io_classes: total_entries=%u max_pending_requests=%u pending_requests=%u deferred_requests=%u throttled_requests=%u\n",
+	       bc->bc_name,
+	       atomic_read(&bc->bc_total_entries),
+	       bc->bc_max_pending_requests,
+	       atomic_read(&bc->bc_pending_requests),
+	       atomic_read(&bc->bc_deferred_requests),
+	       bc->defer_class.curr_count);
+	for (i = 0; i < CACHE_IO_CLASSES; i++) {
+		struct cache_io_class *cic = &bc->bc_io_classes[i];
+
+		DMEMIT("%s: io_classes: class=%s max_pct=%u pending_pct=%u valid_entries=%u pending_requests=%u read_requests=%u write_requests=%u read_hits=%u write_hits=%u read_misses=%u write_misses=%u max_quota_bypasses=%u pending_yields=%u throttled_requests=%u\n",
+		       bc->bc_name,
+		       cache_io_class_names[i],
+		       cic->cic_max_pct,
+		       cic->cic_pending_pct,
+		       atomic_read(&cic->cic_valid_entries),
+		       atomic_read(&cic->cic_pending_requests),
+		       atomic_read(&cic->cic_read_requests),
+		       atomic_read(&cic->cic_write_requests),
+		       atomic_read(&cic->cic_read_hits),
+		       atomic_read(&cic->cic_write_hits),
+		       atomic_read(&cic->cic_read_misses),
+		       atomic_read(&cic->cic_write_misses),
+		       atomic_read(&cic->cic_max_quota_bypasses),
+		       atomic_read(&cic->cic_pending_yields),
+		       atomic_read(&cic->cic_throttled_requests));
+	}
+	return sz;
+}
@@ -0,0 +1,364 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * Binary I/O trace.
+ *
+ * When enabled, one compact event (struct cache_iotrace_event) is recorded
+ * for every N-th completed request, N being the "iotrace_sample" conf
+ * parameter. Requests are recorded when their work_item is freed or, for
+ * write hits which reuse the work_item to invalidate the original cache
+ * block, when it's reallocated. Events go into a per-cpu ring, so the only cost on the io path
+ * is filling 40 bytes with interrupts disabled on the local cpu.
+ *
+ * Each ring has a single producer (the local cpu, with interrupts disabled)
+ * and a single consumer (the debugfs reader, serialized by
+ * @ref bittern_cache::bc_iotrace_mutex), so no locks are needed between the
+ * two. The producer never overwrites events which have not been consumed
+ * yet, when a ring is full new events are dropped and counted.
+ *
+ * Rings are allocated the first time tracing is enabled and are only freed
+ * when the cache is destroyed, so that a reader can still drain them after
+ * tracing has been turned off.
+ *
+ * Events are drained by reading /sys/kernel/debug/bittern/<name>/iotrace,
+ * which returns as many whole events as fit into the read buffer, or zero if
+ * all rings are empty. Events are in per-cpu order, it's up to the reader to
+ * sort them by timestamp if needed (see tools/bc_iotrace.c).
+ */
+
+struct cache_iotrace_ring {
+	/*! next slot to be written, only written by the producer */
+	unsigned int ctr_head;
+	/*! next slot to be read, only written by the consumer */
+	unsigned int ctr_tail;
+	/*! requests seen since the last recorded event */
+	unsigned int ctr_sample_count;
+	/*! statistics, only written by the producer */
+	uint64_t ctr_recorded;
+	uint64_t ctr_drops;
+	struct cache_iotrace_event ctr_events[CACHE_IOTRACE_RING_EVENTS];
+};
+
+/*! "bittern" debugfs directory, NULL if debugfs is not available */
+static struct dentry *cache_debugfs_dir;
+
+static unsigned int cache_iotrace_outcome(struct work_item *wi)
+{
+	if (wi->wi_bypass != 0)
+		return CACHE_IOTRACE_OUTCOME_BYPASS;
+	switch (wi->wi_iotrace_transition) {
+	case TS_READ_HIT_WTWB_CLEAN:
+	case TS_READ_HIT_WB_DIRTY:
+	case TS_WRITE_HIT_WT:
+	case TS_P_WRITE_HIT_WT:
+	case TS_WRITE_HIT_WB_C2_DIRTY:
+	case TS_P_WRITE_HIT_WB_C2_DIRTY:
+	case TS_P_WRITE_HIT_WB_DIRTY:
+	case TS_WRITE_HIT_WB_DIRTY:
+		return CACHE_IOTRACE_OUTCOME_HIT;
+	case TS_READ_MISS_WTWB_CLEAN:
+	case TS_WRITE_MISS_WT:
+	case TS_WRITE_MISS_WB:
+	case TS_P_WRITE_MISS_WT:
+	case TS_P_WRITE_MISS_WB:
+		return CACHE_IOTRACE_OUTCOME_MISS;
+	case TS_WRITEBACK_WB:
+	case TS_WRITEBACK_INV_WB:
+		return CACHE_IOTRACE_OUTCOME_WRITEBACK;
+	case TS_CLEAN_INVALIDATION_WTWB:
+	case TS_DIRTY_INVALIDATION_WB:
+		return CACHE_IOTRACE_OUTCOME_INVALIDATE;
+	case TS_VERIFY_CLEAN_WTWB:
+		return CACHE_IOTRACE_OUTCOME_VERIFY;
+	case TS_NONE:
+	case __TS_NUM:
+		break;
+	}
+	return CACHE_IOTRACE_OUTCOME_NONE;
+}
+
+static inline uint32_t cache_iotrace_usecs(uint64_t from, uint64_t to)
+{
+	if (from == 0 || to <= from)
+		return 0;
+	return (uint32_t)div_u64(to - from, 1000);
+}
+
+void __cache_iotrace_record(struct bittern_cache *bc, struct work_item *wi)
+{
+	struct cache_iotrace_ring **rings;
+	struct cache_iotrace_ring *ring;
+	struct cache_iotrace_event *te;
+	unsigned long flags;
+	unsigned int head;
+	uint64_t now;
+	int cpu;
+
+	rings = ACCESS_ONCE(bc->bc_iotrace_rings);
+	if (rings == NULL)
+		return;
+	/* pairs with smp_wmb() in cache_iotrace_set_sample() */
+	smp_read_barrier_depends();
+
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	ring = rings[cpu];
+
+	if (++ring->ctr_sample_count < ACCESS_ONCE(bc->bc_iotrace_sample))
+		goto out;
+	ring->ctr_sample_count = 0;
+
+	head = ring->ctr_head;
+	if (head - ACCESS_ONCE(ring->ctr_tail) >= CACHE_IOTRACE_RING_EVENTS) {
+		ring->ctr_drops++;
+		goto out;
+	}
+	/* make sure we don't fill the slot before the consumer is done */
+	smp_mb();
+
+	now = current_kernel_time_nsec();
+	te = &ring->ctr_events[head & (CACHE_IOTRACE_RING_EVENTS - 1)];
+	te->te_ts_started = wi->wi_ts_started;
+	te->te_queue_usecs = cache_iotrace_usecs(wi->wi_ts_started,
+						 wi->wi_ts_physio);
+	te->te_service_usecs = cache_iotrace_usecs(wi->wi_ts_started, now);
+	if (wi->wi_iotrace_size != 0) {
+		/* user request, the bio may have been acked already */
+		te->te_sector = wi->wi_iotrace_sector;
+		te->te_size = wi->wi_iotrace_size;
+	} else {
+		te->te_sector = wi->wi_op_sector;
+		te->te_size = PAGE_SIZE;
+	}
+	te->te_pid = wi->wi_iotrace_pid;
+	te->te_cpu = cpu;
+	te->te_dir = data_dir_read(wi->wi_op_rw) ? CACHE_IOTRACE_DIR_READ :
+						   CACHE_IOTRACE_DIR_WRITE;
+	te->te_outcome = cache_iotrace_outcome(wi);
+	te->te_transition = wi->wi_iotrace_transition;
+	te->te_reserved[0] = 0;
+	te->te_reserved[1] = 0;
+	te->te_reserved[2] = 0;
+
+	/* the event must be visible before the head is */
+	smp_wmb();
+	ACCESS_ONCE(ring->ctr_head) = head + 1;
+	ring->ctr_recorded++;
+out:
+	local_irq_restore(flags);
+}
+
+static ssize_t cache_iotrace_read(struct file *file,
+				  char __user *ubuf,
+				  size_t count,
+				  loff_t *ppos)
+{
+	struct bittern_cache *bc = file->private_data;
+	const size_t esize = sizeof(struct cache_iotrace_event);
+	size_t copied = 0;
+	int cpu;
+
+	ASSERT_BITTERN_CACHE(bc);
+	if (count < esize)
+		return -EINVAL;
+
+	mutex_lock(&bc->bc_iotrace_mutex);
+	if (bc->bc_iotrace_rings == NULL)
+		goto out;
+	for_each_possible_cpu(cpu) {
+		struct cache_iotrace_ring *ring = bc->bc_iotrace_rings[cpu];
+		unsigned int tail = ring->ctr_tail;
+		unsigned int head = ACCESS_ONCE(ring->ctr_head);
+
+		/* read the head before the events it covers */
+		smp_rmb();
+		while (tail != head && copied + esize <= count) {
+			struct cache_iotrace_event *te;
+
+			te = &ring->ctr_events[tail &
+					       (CACHE_IOTRACE_RING_EVENTS - 1)];
+			if (copy_to_user(ubuf + copied, te, esize) != 0) {
+				mutex_unlock(&bc->bc_iotrace_mutex);
+				return -EFAULT;
+			}
+			copied += esize;
+			tail++;
+		}
+		/* done reading the slots before handing them back */
+		smp_mb();
+		ACCESS_ONCE(ring->ctr_tail) = tail;
+		if (copied + esize > count)
+			break;
+	}
+out:
+	mutex_unlock(&bc->bc_iotrace_mutex);
+	*ppos += copied;
+	return copied;
+}
+
+static const struct file_operations cache_iotrace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = cache_iotrace_read,
+	.llseek = noop_llseek,
+};
+
+static void cache_iotrace_free_rings(struct cache_iotrace_ring **rings)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		vfree(rings[cpu]);
+	vfree(rings);
+}
+
+int cache_iotrace_set_sample(struct bittern_cache *bc, unsigned int sample)
+{
+	struct cache_iotrace_ring **rings;
+	int cpu;
+
+	if (sample > CACHE_IOTRACE_SAMPLE_MAX)
+		return -EINVAL;
+
+	mutex_lock(&bc->bc_iotrace_mutex);
+	if (sample != 0 && bc->bc_iotrace_rings == NULL) {
+		rings = vzalloc(sizeof(struct cache_iotrace_ring *) *
+				nr_cpu_ids);
+		if (rings == NULL)
+			goto enomem;
+		for_each_possible_cpu(cpu) {
+			rings[cpu] = vzalloc_node(
+					sizeof(struct cache_iotrace_ring),
+					cpu_to_node(cpu));
+			if (rings[cpu] == NULL) {
+				cache_iotrace_free_rings(rings);
+				goto enomem;
+			}
+		}
+		/* publish the rings before enabling tracing */
+		smp_wmb();
+		bc->bc_iotrace_rings = rings;
+	}
+	bc->bc_iotrace_sample = sample;
+	mutex_unlock(&bc->bc_iotrace_mutex);
+
+	printk_info("%s: iotrace_sample=%u\n", bc->bc_name, sample);
+	return 0;
+
+enomem:
+	mutex_unlock(&bc->bc_iotrace_mutex);
+	printk_err("%s: cannot allocate iotrace rings\n", bc->bc_name);
+	return -ENOMEM;
+}
+
+ssize_t cache_iotrace_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	uint64_t recorded = 0, drops = 0, pending = 0;
+	int cpu;
+
+	mutex_lock(&bc->bc_iotrace_mutex);
+	if (bc->bc_iotrace_rings != NULL) {
+		for_each_possible_cpu(cpu) {
+			struct cache_iotrace_ring *ring;
+
+			ring = bc->bc_iotrace_rings[cpu];
+			recorded += ring->ctr_recorded;
+			drops += ring->ctr_drops;
+			pending += ACCESS_ONCE(ring->ctr_head) -
+				   ring->ctr_tail;
+		}
+	}
+	mutex_unlock(&bc->bc_iotrace_mutex);
+
+	DMEMIT("%s: iotrace: version=%d sample=%u ring_events=%u event_size=%lu debugfs=%d\n",
+	       bc->bc_name,
+	       CACHE_IOTRACE_VERSION,
+	       bc->bc_iotrace_sample,
+	       CACHE_IOTRACE_RING_EVENTS,
+	       (unsigned long)sizeof(struct cache_iotrace_event),
+	       bc->bc_iotrace_dentry != NULL);
+	DMEMIT("%s: iotrace: recorded=%llu drops=%llu pending=%llu\n",
+	       bc->bc_name,
+	       recorded,
+	       drops,
+	       pending);
+	return sz;
+}
+
+void cache_iotrace_initialize(struct bittern_cache *bc)
+{
+	struct dentry *dentry;
+
+	mutex_init(&bc->bc_iotrace_mutex);
+	bc->bc_iotrace_sample = 0;
+	bc->bc_iotrace_rings = NULL;
+	bc->bc_iotrace_dentry = NULL;
+
+	if (cache_debugfs_dir == NULL)
+		return;
+	dentry = debugfs_create_dir(bc->bc_name, cache_debugfs_dir);
+	if (IS_ERR_OR_NULL(dentry)) {
+		printk_err("%s: cannot create debugfs directory\n",
+			   bc->bc_name);
+		return;
+	}
+	if (IS_ERR_OR_NULL(debugfs_create_file("iotrace", 0400, dentry, bc,
+					       &cache_iotrace_fops))) {
+		printk_err("%s: cannot create debugfs iotrace file\n",
+			   bc->bc_name);
+		debugfs_remove_recursive(dentry);
+		return;
+	}
+	bc->bc_iotrace_dentry = dentry;
+}
+
+void cache_iotrace_deinitialize(struct bittern_cache *bc)
+{
+	if (bc->bc_iotrace_dentry != NULL) {
+		debugfs_remove_recursive(bc->bc_iotrace_dentry);
+		bc->bc_iotrace_dentry = NULL;
+	}
+	bc->bc_iotrace_sample = 0;
+	if (bc->bc_iotrace_rings != NULL) {
+		cache_iotrace_free_rings(bc->bc_iotrace_rings);
+		bc->bc_iotrace_rings = NULL;
+	}
+}
+
+void cache_iotrace_module_init(void)
+{
+	cache_debugfs_dir = debugfs_create_dir("bittern", NULL);
+	if (IS_ERR_OR_NULL(cache_debugfs_dir)) {
+		printk_info("debugfs not available, iotrace disabled\n");
+		cache_debugfs_dir = NULL;
+	}
+}
+
+void cache_iotrace_module_exit(void)
+{
+	debugfs_remove_recursive(cache_debugfs_dir);
+	cache_debugfs_dir = NULL;
+}
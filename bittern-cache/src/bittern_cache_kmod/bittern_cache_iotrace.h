@@ -0,0 +1,84 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#ifndef BITTERN_CACHE_IOTRACE_H
+#define BITTERN_CACHE_IOTRACE_H
+
+/*!
+ * Binary I/O trace event format.
+ *
+ * This header is shared between the kernel module and the userland trace
+ * reader (tools/bc_iotrace.c), so it must not depend on any kernel header.
+ * Events are read from debugfs in the native byte order of the host which
+ * generated them. Any change to the layout requires bumping
+ * @ref CACHE_IOTRACE_VERSION .
+ */
+#define CACHE_IOTRACE_VERSION	1
+
+/*! outcome of a traced request */
+#define CACHE_IOTRACE_OUTCOME_NONE		0
+/*! user request, cache hit */
+#define CACHE_IOTRACE_OUTCOME_HIT		1
+/*! user request, cache miss */
+#define CACHE_IOTRACE_OUTCOME_MISS		2
+/*! user request, bypassed to the cached device */
+#define CACHE_IOTRACE_OUTCOME_BYPASS		3
+/*! bittern initiated writeback */
+#define CACHE_IOTRACE_OUTCOME_WRITEBACK		4
+/*! bittern initiated invalidation */
+#define CACHE_IOTRACE_OUTCOME_INVALIDATE	5
+/*! bittern initiated verify */
+#define CACHE_IOTRACE_OUTCOME_VERIFY		6
+
+/*! request direction */
+#define CACHE_IOTRACE_DIR_READ		0
+#define CACHE_IOTRACE_DIR_WRITE		1
+
+/*!
+ * One trace event, 40 bytes. One event is recorded when a request completes.
+ * All timestamps are derived from the kernel monotonic nanosecond clock used
+ * by the rest of bittern (current_kernel_time_nsec()).
+ */
+struct cache_iotrace_event {
+	/*! time the request was received, in nanoseconds */
+	uint64_t te_ts_started;
+	/*! first sector of the request on the cached device */
+	uint64_t te_sector;
+	/*!
+	 * queue time, that is microseconds between the request being received
+	 * and its physical io being started, zero if no physical io was done.
+	 */
+	uint32_t te_queue_usecs;
+	/*! microseconds between the request being received and completed */
+	uint32_t te_service_usecs;
+	/*! request size in bytes */
+	uint32_t te_size;
+	/*! pid of the submitter, zero for bittern initiated requests */
+	uint32_t te_pid;
+	/*! cpu the request completed on */
+	uint16_t te_cpu;
+	/*! @ref CACHE_IOTRACE_DIR_READ or @ref CACHE_IOTRACE_DIR_WRITE */
+	uint8_t te_dir;
+	/*! one of the CACHE_IOTRACE_OUTCOME_ values */
+	uint8_t te_outcome;
+	/*! state machine path, enum cache_transition */
+	uint8_t te_transition;
+	uint8_t te_reserved[3];
+};
+
+#endif /* BITTERN_CACHE_IOTRACE_H */
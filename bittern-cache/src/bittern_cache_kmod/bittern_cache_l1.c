@@ -0,0 +1,279 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * DRAM front tier (L1).
+ *
+ * A bounded set of page copies of clean cache blocks, kept in DRAM and
+ * looked up before going to the cache device on a clean read hit. Entries
+ * are created when a read miss or a clean read hit completes, and are
+ * replaced in LRU order once the configured size is reached.
+ *
+ * Only clean blocks are cached, so an entry is never the only copy of the
+ * data. Coherency is kept by dropping the entry of a cache block whenever
+ * a transaction other than a read hit or a verify starts on it (see
+ * cache_state_transition_initial()), which covers write hits, writebacks
+ * and invalidations. Lookups also check the block sector, in case the
+ * block was reused.
+ *
+ * Entries are reference counted, so an entry can be dropped while a read
+ * hit is still copying from it.
+ */
+
+static inline struct hlist_head *cache_l1_bucket(struct bittern_cache *bc,
+						 unsigned int block_id)
+{
+	return &bc->bc_l1_hash[block_id & (CACHE_L1_HASH_BUCKETS - 1)];
+}
+
+/*! caller holds bc_l1_lock */
+static struct cache_l1_entry *__cache_l1_lookup(struct bittern_cache *bc,
+						unsigned int block_id)
+{
+	struct cache_l1_entry *l1e;
+
+	hlist_for_each_entry(l1e, cache_l1_bucket(bc, block_id),
+			     l1e_hash_node) {
+		if (l1e->l1e_block_id == block_id)
+			return l1e;
+	}
+	return NULL;
+}
+
+/*!
+ * removes entry from the index, caller holds bc_l1_lock.
+ * the index reference is moved to the victim list, so that the entry
+ * can be freed after the lock is released.
+ */
+static void __cache_l1_unlink(struct bittern_cache *bc,
+			      struct cache_l1_entry *l1e,
+			      struct list_head *victims)
+{
+	hlist_del_init(&l1e->l1e_hash_node);
+	list_del_init(&l1e->l1e_lru_node);
+	list_add_tail(&l1e->l1e_lru_node, victims);
+	atomic_dec(&bc->bc_l1_entries);
+	M_ASSERT(atomic_read(&bc->bc_l1_entries) >= 0);
+}
+
+/*! caller holds bc_l1_lock */
+static void __cache_l1_evict(struct bittern_cache *bc,
+			     struct list_head *victims)
+{
+	while ((unsigned int)atomic_read(&bc->bc_l1_entries) >
+	       bc->bc_l1_max_entries) {
+		struct cache_l1_entry *l1e;
+
+		M_ASSERT(!list_empty(&bc->bc_l1_lru));
+		l1e = list_first_entry(&bc->bc_l1_lru,
+				       struct cache_l1_entry,
+				       l1e_lru_node);
+		__cache_l1_unlink(bc, l1e, victims);
+		atomic_inc(&bc->bc_l1_evictions);
+	}
+}
+
+static void cache_l1_put_victims(struct bittern_cache *bc,
+				 struct list_head *victims)
+{
+	while (!list_empty(victims)) {
+		struct cache_l1_entry *l1e;
+
+		l1e = list_first_entry(victims,
+				       struct cache_l1_entry,
+				       l1e_lru_node);
+		list_del_init(&l1e->l1e_lru_node);
+		cache_l1_put(bc, l1e);
+	}
+}
+
+void cache_l1_put(struct bittern_cache *bc, struct cache_l1_entry *l1e)
+{
+	M_ASSERT(atomic_read(&l1e->l1e_refcount) > 0);
+	if (atomic_dec_and_test(&l1e->l1e_refcount)) {
+		ASSERT(hlist_unhashed(&l1e->l1e_hash_node));
+		kmem_cache_free(bc->bc_kmem_map, l1e->l1e_vaddr);
+		kmem_free(l1e, sizeof(struct cache_l1_entry));
+	}
+}
+
+struct cache_l1_entry *cache_l1_get(struct bittern_cache *bc,
+				    struct cache_block *cache_block)
+{
+	struct cache_l1_entry *l1e;
+	unsigned long flags;
+	LIST_HEAD(victims);
+
+	if (bc->bc_l1_max_entries == 0)
+		return NULL;
+	if (atomic_read(&bc->bc_l1_entries) == 0) {
+		atomic_inc(&bc->bc_l1_misses);
+		return NULL;
+	}
+
+	spin_lock_irqsave(&bc->bc_l1_lock, flags);
+	l1e = __cache_l1_lookup(bc, cache_block->bcb_block_id);
+	if (l1e != NULL && l1e->l1e_sector != cache_block->bcb_sector) {
+		/* stale, block has been reused */
+		__cache_l1_unlink(bc, l1e, &victims);
+		atomic_inc(&bc->bc_l1_invalidations);
+		l1e = NULL;
+	}
+	if (l1e != NULL) {
+		atomic_inc(&l1e->l1e_refcount);
+		list_move_tail(&l1e->l1e_lru_node, &bc->bc_l1_lru);
+		atomic_inc(&bc->bc_l1_hits);
+	} else {
+		atomic_inc(&bc->bc_l1_misses);
+	}
+	spin_unlock_irqrestore(&bc->bc_l1_lock, flags);
+
+	cache_l1_put_victims(bc, &victims);
+
+	return l1e;
+}
+
+void cache_l1_insert(struct bittern_cache *bc,
+		     struct cache_block *cache_block,
+		     void *buffer)
+{
+	struct cache_l1_entry *l1e, *old;
+	unsigned long flags;
+	LIST_HEAD(victims);
+
+	ASSERT(buffer != NULL);
+	if (bc->bc_l1_max_entries == 0)
+		return;
+
+	/*
+	 * this is an optimization, do not dip into reserves and do not
+	 * block if memory is tight.
+	 */
+	l1e = kmem_alloc(sizeof(struct cache_l1_entry),
+			 GFP_NOWAIT | __GFP_NOWARN);
+	if (l1e == NULL) {
+		atomic_inc(&bc->bc_l1_alloc_failures);
+		return;
+	}
+	l1e->l1e_vaddr = kmem_cache_alloc(bc->bc_kmem_map,
+					  GFP_NOWAIT | __GFP_NOWARN);
+	if (l1e->l1e_vaddr == NULL) {
+		kmem_free(l1e, sizeof(struct cache_l1_entry));
+		atomic_inc(&bc->bc_l1_alloc_failures);
+		return;
+	}
+	INIT_HLIST_NODE(&l1e->l1e_hash_node);
+	INIT_LIST_HEAD(&l1e->l1e_lru_node);
+	l1e->l1e_block_id = cache_block->bcb_block_id;
+	l1e->l1e_sector = cache_block->bcb_sector;
+	atomic_set(&l1e->l1e_refcount, 1);
+	memcpy(l1e->l1e_vaddr, buffer, PAGE_SIZE);
+
+	spin_lock_irqsave(&bc->bc_l1_lock, flags);
+	old = __cache_l1_lookup(bc, l1e->l1e_block_id);
+	if (old != NULL)
+		__cache_l1_unlink(bc, old, &victims);
+	hlist_add_head(&l1e->l1e_hash_node,
+		       cache_l1_bucket(bc, l1e->l1e_block_id));
+	list_add_tail(&l1e->l1e_lru_node, &bc->bc_l1_lru);
+	atomic_inc(&bc->bc_l1_entries);
+	atomic_inc(&bc->bc_l1_inserts);
+	__cache_l1_evict(bc, &victims);
+	spin_unlock_irqrestore(&bc->bc_l1_lock, flags);
+
+	cache_l1_put_victims(bc, &victims);
+}
+
+void __cache_l1_drop(struct bittern_cache *bc, unsigned int block_id)
+{
+	struct cache_l1_entry *l1e;
+	unsigned long flags;
+	LIST_HEAD(victims);
+
+	spin_lock_irqsave(&bc->bc_l1_lock, flags);
+	l1e = __cache_l1_lookup(bc, block_id);
+	if (l1e != NULL) {
+		__cache_l1_unlink(bc, l1e, &victims);
+		atomic_inc(&bc->bc_l1_invalidations);
+	}
+	spin_unlock_irqrestore(&bc->bc_l1_lock, flags);
+
+	cache_l1_put_victims(bc, &victims);
+}
+
+int cache_l1_set_max_mbytes(struct bittern_cache *bc, unsigned int max_mbytes)
+{
+	unsigned long flags;
+	LIST_HEAD(victims);
+
+	M_ASSERT(max_mbytes <= CACHE_L1_MAX_MBYTES_MAX);
+
+	spin_lock_irqsave(&bc->bc_l1_lock, flags);
+	bc->bc_l1_max_mbytes = max_mbytes;
+	bc->bc_l1_max_entries = (unsigned int)(((uint64_t)max_mbytes *
+						1024ULL * 1024ULL) /
+					       PAGE_SIZE);
+	__cache_l1_evict(bc, &victims);
+	spin_unlock_irqrestore(&bc->bc_l1_lock, flags);
+
+	cache_l1_put_victims(bc, &victims);
+
+	printk_info("%s: l1_max_mbytes=%u l1_max_entries=%u\n",
+		    bc->bc_name,
+		    bc->bc_l1_max_mbytes,
+		    bc->bc_l1_max_entries);
+	return 0;
+}
+
+int cache_l1_initialize(struct bittern_cache *bc)
+{
+	spin_lock_init(&bc->bc_l1_lock);
+	INIT_LIST_HEAD(&bc->bc_l1_lru);
+	atomic_set(&bc->bc_l1_entries, 0);
+	atomic_set(&bc->bc_l1_hits, 0);
+	atomic_set(&bc->bc_l1_misses, 0);
+	atomic_set(&bc->bc_l1_inserts, 0);
+	atomic_set(&bc->bc_l1_evictions, 0);
+	atomic_set(&bc->bc_l1_invalidations, 0);
+	atomic_set(&bc->bc_l1_alloc_failures, 0);
+	cache_timer_init(&bc->bc_timer_read_l1_hits);
+	bc->bc_l1_max_mbytes = 0;
+	bc->bc_l1_max_entries = 0;
+
+	bc->bc_l1_hash = vzalloc(sizeof(struct hlist_head) *
+				 CACHE_L1_HASH_BUCKETS);
+	if (bc->bc_l1_hash == NULL)
+		return -ENOMEM;
+
+	return cache_l1_set_max_mbytes(bc, CACHE_L1_MAX_MBYTES_DEFAULT);
+}
+
+void cache_l1_deinitialize(struct bittern_cache *bc)
+{
+	if (bc->bc_l1_hash == NULL)
+		return;
+	/* evicts all entries */
+	cache_l1_set_max_mbytes(bc, 0);
+	M_ASSERT(atomic_read(&bc->bc_l1_entries) == 0);
+	M_ASSERT(list_empty(&bc->bc_l1_lru));
+	vfree(bc->bc_l1_hash);
+	bc->bc_l1_hash = NULL;
+}
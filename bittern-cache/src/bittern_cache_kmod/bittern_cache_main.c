@@ -108,7 +108,10 @@ void __bio_copy_from_cache(struct work_item *wi,
 	       bio_sector_to_cache_block_sector(bio));
 
 	bc = bc; /* quiet compiler about unused variable (used in dev build) */
-	cache_vaddr = pmem_context_data_vaddr(&wi->wi_pmem_ctx);
+	if (wi->wi_l1_entry != NULL)
+		cache_vaddr = wi->wi_l1_entry->l1e_vaddr;
+	else
+		cache_vaddr = pmem_context_data_vaddr(&wi->wi_pmem_ctx);
 
 	/*
 	 * for non-page aligned reads, we'll have to add this offset to memcpy.
@@ -425,6 +428,9 @@ void cache_state_machine(struct bittern_cache *bc,
 		 err);
 	M_ASSERT_FIXME(err == 0);
 
+	if (cache_block->bcb_cache_transition != TS_NONE)
+		wi->wi_iotrace_transition = cache_block->bcb_cache_transition;
+
 	switch (cache_block->bcb_state) {
 		/*
 		 * read hit (wt/wb-clean) :
@@ -1286,6 +1292,10 @@ void cache_handle_write_hit_wb(struct bittern_cache *bc,
 					S_DIRTY_P_WRITE_HIT_CPF_O_CACHE_START);
 		}
 	}
+	cache_bgwriter_write_hit(bc,
+				 original_cache_block,
+				 cloned_cache_block,
+				 original_cache_block_state == S_DIRTY);
 	/* add/move to the tail of the dirty list */
 	list_del_init(&cloned_cache_block->bcb_entry_cleandirty);
 	list_add_tail(&cloned_cache_block->bcb_entry_cleandirty,
@@ -1687,7 +1697,7 @@ void cache_map_workfunc_handle_bypass(struct bittern_cache *bc, struct bio *bio)
 	 */
 	cloned_bio = bio_clone(bio, GFP_NOIO);
 	M_ASSERT_FIXME(cloned_bio != NULL);
-	cloned_bio->bi_bdev = bc->devio.dm_dev->bdev;
+	cache_pool_remap_bio(bc, cloned_bio);
 	cloned_bio->bi_end_io = cached_dev_bypass_endio;
 	cloned_bio->bi_private = wi;
 	wi->wi_cloned_bio = cloned_bio;
@@ -2073,6 +2083,10 @@ int cache_map_workfunc(struct bittern_cache *bc,
 	int cache_get_flags;
 	int do_bypass;
 	bool do_writeback;
+	bool do_admit = true;
+	struct cache_pool_owner *cpo;
+	int io_class;
+	struct cache_io_class *cic;
 
 	BT_TRACE(BT_LEVEL_TRACE2, bc, NULL, NULL, bio, NULL, "enter");
 	ASSERT_BITTERN_CACHE(bc);
@@ -2141,6 +2155,39 @@ int cache_map_workfunc(struct bittern_cache *bc,
 	do_bypass = seq_bypass_is_sequential(bc, bio);
 	ASSERT(do_bypass == 0 || do_bypass == 1);
 
+	/*
+	 * In shared pool mode, an owner which is at its max quota does not
+	 * get any new cache blocks. Hits are still served from cache.
+	 */
+	cpo = cache_pool_owner_of(bc, bio->bi_iter.bi_sector);
+	if (do_bypass == 0 &&
+	    cache_pool_over_max_quota(bc, bio->bi_iter.bi_sector)) {
+		atomic_inc(&cpo->cpo_max_quota_bypasses);
+		do_bypass = 1;
+	}
+
+	/*
+	 * Likewise, an I/O class at its max quota only gets hits.
+	 */
+	io_class = cache_io_class_of_bio(bio);
+	cic = &bc->bc_io_classes[io_class];
+	if (do_bypass == 0 && cache_io_class_over_max_quota(bc, io_class)) {
+		atomic_inc(&cic->cic_max_quota_bypasses);
+		do_bypass = 1;
+	}
+
+	/*
+	 * The admission filter only lets misses on frequently accessed
+	 * blocks allocate a new cache block, the others bypass the cache.
+	 * Hits are still served from cache. As with sequential detection,
+	 * deferred requests are accounted again when they are requeued.
+	 */
+	if (do_bypass == 0) {
+		do_admit = cache_admit_filter(bc, bio);
+		if (!do_admit)
+			do_bypass = 1;
+	}
+
 	/*
 	 * Cache operating mode can change mid-flight, so copy its value.
 	 * It's important for the operating mode to be stable within the
@@ -2156,7 +2203,7 @@ int cache_map_workfunc(struct bittern_cache *bc,
 	 */
 	cache_get_flags = CACHE_FL_HIT;
 	if (do_bypass == 0) {
-		cache_get_flags |= CACHE_FL_MISS;
+		cache_get_flags |= CACHE_FL_MISS | CACHE_FL_IO_CLASS(io_class);
 		if (do_writeback != 0 && bio_data_dir(bio) == WRITE)
 			cache_get_flags |= CACHE_FL_DIRTY;
 		else
@@ -2184,6 +2231,13 @@ int cache_map_workfunc(struct bittern_cache *bc,
 		       cache_block->bcb_state == S_DIRTY);
 		ASSERT(cache_block->bcb_cache_transition ==
 		       TS_NONE);
+		if (bio_data_dir(bio) == WRITE) {
+			atomic_inc(&cpo->cpo_write_hits);
+			atomic_inc(&cic->cic_write_hits);
+		} else {
+			atomic_inc(&cpo->cpo_read_hits);
+			atomic_inc(&cic->cic_read_hits);
+		}
 
 		return cache_map_workfunc_hit(bc,
 					      cache_block,
@@ -2208,6 +2262,18 @@ int cache_map_workfunc(struct bittern_cache *bc,
 		 */
 		ASSERT(cache_block != NULL);
 		ASSERT_CACHE_BLOCK(cache_block, bc);
+		ASSERT(do_admit);
+		if (bio_data_dir(bio) == WRITE) {
+			atomic_inc(&cpo->cpo_write_misses);
+			atomic_inc(&cic->cic_write_misses);
+			if (bc->bc_admit_write.admit_threshold != 0)
+				atomic_inc(&bc->bc_admit_write.admit_count);
+		} else {
+			atomic_inc(&cpo->cpo_read_misses);
+			atomic_inc(&cic->cic_read_misses);
+			if (bc->bc_admit_read.admit_threshold != 0)
+				atomic_inc(&bc->bc_admit_read.admit_count);
+		}
 		cache_map_workfunc_miss(bc, cache_block, bio, do_writeback);
 		return 1;
 
@@ -2220,6 +2286,17 @@ int cache_map_workfunc(struct bittern_cache *bc,
 		 */
 		ASSERT(cache_block == NULL);
 		if (do_bypass) {
+			if (bio_data_dir(bio) == WRITE) {
+				atomic_inc(&cpo->cpo_write_misses);
+				atomic_inc(&cic->cic_write_misses);
+				if (!do_admit)
+					atomic_inc(&bc->bc_admit_write.reject_count);
+			} else {
+				atomic_inc(&cpo->cpo_read_misses);
+				atomic_inc(&cic->cic_read_misses);
+				if (!do_admit)
+					atomic_inc(&bc->bc_admit_read.reject_count);
+			}
 			cache_map_workfunc_handle_bypass(bc, bio);
 			return 1;
 		}
@@ -2253,6 +2330,15 @@ int bittern_cache_map(struct dm_target *ti, struct bio *bio)
 {
 	struct bittern_cache *bc = ti->private;
 
+	return __bittern_cache_map(bc, bio);
+}
+
+/*!
+ * Pool member targets come in here directly, with the member id already
+ * encoded in the sector number.
+ */
+int __bittern_cache_map(struct bittern_cache *bc, struct bio *bio)
+{
 	ASSERT_BITTERN_CACHE(bc);
 
 	ASSERT((bio->bi_rw & REQ_WRITE_SAME) == 0);
@@ -2270,21 +2356,34 @@ int bittern_cache_map(struct dm_target *ti, struct bio *bio)
 		atomic_inc(&bc->bc_flush_requests);
 		atomic_inc(&bc->bc_pure_flush_requests);
 	} else {
+		struct cache_io_class *cic;
+
 		ASSERT(bio_is_data_request(bio));
+		cache_io_class_tag_bio(bio);
+		cic = &bc->bc_io_classes[cache_io_class_of_bio(bio)];
 		if ((bio->bi_rw & REQ_FLUSH) != 0)
 			atomic_inc(&bc->bc_flush_requests);
-		if (bio_data_dir(bio) == WRITE)
+		if (bio_data_dir(bio) == WRITE) {
 			atomic_inc(&bc->bc_write_requests);
-		else
+			atomic_inc(&cache_pool_owner_of(bc,
+				bio->bi_iter.bi_sector)->cpo_write_requests);
+			atomic_inc(&cic->cic_write_requests);
+		} else {
 			atomic_inc(&bc->bc_read_requests);
+			atomic_inc(&cache_pool_owner_of(bc,
+				bio->bi_iter.bi_sector)->cpo_read_requests);
+			atomic_inc(&cic->cic_read_requests);
+		}
 	}
 
 	/*
 	 * defer to queued queue if pending queue is too high,
 	 * or if any of the deferred queues are non-empty (so to avoid request
-	 * starvation).
+	 * starvation). requests held back by their I/O class quota do not
+	 * count here, they only hold back the requests of their own class.
 	 */
-	if (!can_schedule_map_request(bc) || atomic_read(&bc->bc_deferred_requests) > 0) {
+	if (!can_schedule_map_request(bc) ||
+	    atomic_read(&bc->bc_deferred_requests) > 0) {
 		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
 			 "queue-to-deferred (can_schedule=%u, pending=%u, deferred=%u)",
 			 can_schedule_map_request(bc),
@@ -2303,6 +2402,20 @@ int bittern_cache_map(struct dm_target *ti, struct bio *bio)
 		return DM_MAPIO_SUBMITTED;
 	}
 
+	/*
+	 * the request's I/O class has used up its share of the pending
+	 * queue, or older requests of the same class are still waiting.
+	 */
+	if (bio_is_data_request(bio) &&
+	    cache_io_class_must_wait(bc, cache_io_class_of_bio(bio))) {
+		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
+			 "queue-to-deferred-class (class=%d, pending=%u)",
+			 cache_io_class_of_bio(bio),
+			 atomic_read(&bc->bc_pending_requests));
+		queue_to_deferred(bc, &bc->defer_class, bio, NULL);
+		return DM_MAPIO_SUBMITTED;
+	}
+
 	/*
 	 * submit the request as normal.
 	 * it's possible that cache_map_workfunc may have to defer it,
@@ -2322,15 +2435,17 @@ void wakeup_deferred(struct bittern_cache *bc)
 	unsigned long flags;
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
-		 "deferred_requests=%d, defer_busy.curr_count=%d, defer_page.curr_count=%d",
+		 "deferred_requests=%d, defer_busy.curr_count=%d, defer_page.curr_count=%d, defer_class.curr_count=%d",
 		 atomic_read(&bc->bc_deferred_requests),
 		 bc->defer_busy.curr_count,
-		 bc->defer_page.curr_count);
+		 bc->defer_page.curr_count,
+		 bc->defer_class.curr_count);
 
 	spin_lock_irqsave(&bc->defer_lock, flags);
 
 	if (bc->defer_busy.curr_count != 0 ||
-	    bc->defer_page.curr_count != 0)
+	    bc->defer_page.curr_count != 0 ||
+	    bc->defer_class.curr_count != 0)
 		queue_work(bc->defer_wq, &bc->defer_work);
 
 	spin_unlock_irqrestore(&bc->defer_lock, flags);
@@ -2344,6 +2459,9 @@ void wakeup_deferred(struct bittern_cache *bc)
  * that the block is busy. In this latter case it needs to avoid waking
  * up itself again to avoid a infinite loop, which is why the old_queue
  * needs to be passed as parameter.
+ * Requests queued to defer_class are only accounted in the per-class
+ * cic_throttled_requests, and not in the deferred request counters: they
+ * wait for a pending slot of their own class, not for a cache resource.
  */
 void queue_to_deferred(struct bittern_cache *bc,
 		       struct deferred_queue *queue,
@@ -2353,9 +2471,12 @@ void queue_to_deferred(struct bittern_cache *bc,
 	unsigned long flags;
 	int val;
 
-	ASSERT(queue == &bc->defer_busy || queue == &bc->defer_page);
+	ASSERT(queue == &bc->defer_busy ||
+	       queue == &bc->defer_page ||
+	       queue == &bc->defer_class);
 	ASSERT(old_queue == &bc->defer_busy ||
 	       old_queue == &bc->defer_page ||
+	       old_queue == &bc->defer_class ||
 	       old_queue == NULL);
 
 	spin_lock_irqsave(&bc->defer_lock, flags);
@@ -2363,21 +2484,30 @@ void queue_to_deferred(struct bittern_cache *bc,
 	queue->tstamp = current_kernel_time_nsec();
 	/* bio_list_add adds to tail */
 	bio_list_add(&queue->list, bio);
-	atomic_inc(&bc->bc_total_deferred_requests);
-	val = atomic_inc_return(&bc->bc_deferred_requests);
-	atomic_set_if_higher(&bc->bc_highest_deferred_requests, val);
+	if (queue == &bc->defer_class) {
+		atomic_inc(&bc->bc_io_classes[cache_io_class_of_bio(bio)]
+			   .cic_throttled_requests);
+		val = atomic_read(&bc->bc_deferred_requests);
+	} else {
+		atomic_inc(&bc->bc_total_deferred_requests);
+		val = atomic_inc_return(&bc->bc_deferred_requests);
+		atomic_set_if_higher(&bc->bc_highest_deferred_requests, val);
+	}
 	queue->curr_count++;
 	if (queue->curr_count > queue->max_count)
 		queue->max_count = queue->curr_count;
 
 	spin_unlock_irqrestore(&bc->defer_lock, flags);
 
+	trace_bittern_defer(bc, bio, deferred_queue_name(bc, queue),
+			    old_queue != NULL, val);
+
 	if (queue != old_queue)
 		queue_work(bc->defer_wq, &bc->defer_work);
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
 		 "%s",
-		 (queue == &bc->defer_busy ? "busy" : "page"));
+		 deferred_queue_name(bc, queue));
 }
 
 struct bio *dequeue_from_deferred(struct bittern_cache *bc,
@@ -2387,16 +2517,25 @@ struct bio *dequeue_from_deferred(struct bittern_cache *bc,
 	struct bio *bio = NULL;
 
 	ASSERT(queue == &bc->defer_busy ||
-	       queue == &bc->defer_page);
+	       queue == &bc->defer_page ||
+	       queue == &bc->defer_class);
 
 	spin_lock_irqsave(&bc->defer_lock, flags);
 
 	if (bio_list_non_empty(&queue->list)) {
 		bio = bio_list_pop(&queue->list);
 		ASSERT(bio != NULL);
-		ASSERT(atomic_read(&bc->bc_deferred_requests) > 0);
 		queue->curr_count--;
-		atomic_dec(&bc->bc_deferred_requests);
+		if (queue == &bc->defer_class) {
+			struct cache_io_class *cic;
+
+			cic = &bc->bc_io_classes[cache_io_class_of_bio(bio)];
+			ASSERT(atomic_read(&cic->cic_throttled_requests) > 0);
+			atomic_dec(&cic->cic_throttled_requests);
+		} else {
+			ASSERT(atomic_read(&bc->bc_deferred_requests) > 0);
+			atomic_dec(&bc->bc_deferred_requests);
+		}
 		if (queue->curr_count == 0)
 			ASSERT(bio_list_empty(&queue->list));
 	} else {
@@ -2407,7 +2546,7 @@ struct bio *dequeue_from_deferred(struct bittern_cache *bc,
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
 		 "%s",
-		 (queue == &bc->defer_busy ? "busy" : "page"));
+		 deferred_queue_name(bc, queue));
 	return bio;
 }
 
@@ -2422,19 +2561,25 @@ bool deferred_has_work(struct bittern_cache *bc,
 	return has_requests && can_schedule_map_request(bc);
 }
 
-/*! handle one or more deferred requests on a given queue */
+/*!
+ * handle one deferred request on a given queue.
+ * returns 1 if the request was processed, 0 if there was none or if it was
+ * requeued, -1 if it was requeued to yield its pending slot.
+ */
 int __handle_deferred(struct bittern_cache *bc, struct deferred_queue *queue)
 {
 	int ret;
 	struct bio *bio;
 
-	ASSERT(queue == &bc->defer_busy || queue == &bc->defer_page);
+	ASSERT(queue == &bc->defer_busy ||
+	       queue == &bc->defer_page ||
+	       queue == &bc->defer_class);
 
 	bio = dequeue_from_deferred(bc, queue);
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, bio, NULL,
 		 "wait_%s: curr_c=%u, max_c=%u",
-		 (queue == &bc->defer_busy ? "busy" : "page"),
+		 deferred_queue_name(bc, queue),
 		 queue->curr_count,
 		 queue->max_count);
 
@@ -2443,6 +2588,22 @@ int __handle_deferred(struct bittern_cache *bc, struct deferred_queue *queue)
 		return 0;
 	}
 
+	/*
+	 * A request whose I/O class has used up its share of the pending
+	 * queue goes to the tail of defer_class, so that requests of other
+	 * classes can go first. This is not a new deferral, the request is
+	 * only accounted in its class.
+	 */
+	if (bio_is_data_request(bio) &&
+	    (queue == &bc->defer_class ?
+	     cache_io_class_over_pending(bc, cache_io_class_of_bio(bio)) :
+	     cache_io_class_must_wait(bc, cache_io_class_of_bio(bio)))) {
+		atomic_inc(&bc->bc_io_classes[cache_io_class_of_bio(bio)]
+			   .cic_pending_yields);
+		queue_to_deferred(bc, &bc->defer_class, bio, queue);
+		return -1;
+	}
+
 	/*
 	 * Now try resubmit the request. It's possible that it will be requeued
 	 * again. In the latter case, make sure we don't wake up ourselves
@@ -2452,7 +2613,7 @@ int __handle_deferred(struct bittern_cache *bc, struct deferred_queue *queue)
 
 	BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
 		 "wait_%s: curr_c=%u, max_c=%u, ret=%d",
-		 (queue == &bc->defer_busy ? "busy" : "pp"),
+		 deferred_queue_name(bc, queue),
 		 queue->curr_count,
 		 queue->max_count,
 		 ret);
@@ -2471,6 +2632,7 @@ int handle_deferred(struct bittern_cache *bc, struct deferred_queue *queue)
 {
 	unsigned long flags;
 	int cc, count = 0;
+	unsigned int yields = 0;
 
 	ASSERT(bc != NULL);
 	ASSERT_BITTERN_CACHE(bc);
@@ -2492,6 +2654,19 @@ int handle_deferred(struct bittern_cache *bc, struct deferred_queue *queue)
 		ASSERT_BITTERN_CACHE(bc);
 
 		cc = __handle_deferred(bc, queue);
+		if (cc < 0) {
+			/*
+			 * the request yielded its pending slot. if it was
+			 * moved to defer_class, keep going with this queue,
+			 * otherwise stop once every request in defer_class
+			 * had a chance to go.
+			 */
+			if (queue != &bc->defer_class)
+				continue;
+			if (++yields >= queue->curr_count)
+				break;
+			continue;
+		}
 		count += cc;
 		if (cc == 0)
 			break;
@@ -2521,12 +2696,14 @@ void cache_deferred_worker(struct work_struct *work)
 	ASSERT_BITTERN_CACHE(bc);
 
 	/*
-	 * Handle both deferred queues. Busy blocks have higher priority
+	 * Handle all deferred queues. Busy blocks have higher priority
 	 * as they are blocked by an existing request and not by a specific
-	 * resource.
+	 * resource. Requests held back by their I/O class go last.
 	 */
 
 	handle_deferred(bc, &bc->defer_busy);
 
 	handle_deferred(bc, &bc->defer_page);
+
+	handle_deferred(bc, &bc->defer_class);
 }
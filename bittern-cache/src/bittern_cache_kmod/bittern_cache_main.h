@@ -31,11 +31,16 @@
 /* if set, caller wants dirty block on allocate
  * this or DIRTY is mandatory if MISS is set */
 #define CACHE_FL_DIRTY	0x8
+/* I/O class a block allocated on miss is charged to */
+#define CACHE_FL_IO_CLASS_SHIFT		4
+#define CACHE_FL_IO_CLASS_MASK		(0x3 << CACHE_FL_IO_CLASS_SHIFT)
+#define CACHE_FL_IO_CLASS(__io_class)	((__io_class) << CACHE_FL_IO_CLASS_SHIFT)
 
 #define CACHE_FL_MASK  (CACHE_FL_HIT | \
 			CACHE_FL_MISS | \
 			CACHE_FL_CLEAN | \
-			CACHE_FL_DIRTY)
+			CACHE_FL_DIRTY | \
+			CACHE_FL_IO_CLASS_MASK)
 
 #define CACHE_FL_CLEANDIRTY_MASK         (CACHE_FL_CLEAN | CACHE_FL_DIRTY)
 
@@ -79,16 +84,28 @@ extern enum cache_get_ret cache_get(struct bittern_cache *bc,
 				    const int iflags,
 				    struct cache_block **o_cache_block);
 /*!
- * used by bgwriter thread to get a dirty block to write out to cached device
+ * used by bgwriter threads to get a dirty block to write out to cached device.
+ * with nr_shards > 1 only dirty blocks in the given bgwriter shard are
+ * returned, see @ref cache_bgwriter_shard .
  */
 extern int cache_get_dirty_from_head(struct bittern_cache *bc,
 				     struct cache_block **o_cache_block,
-				     int requested_block_age);
+				     int requested_block_age,
+				     unsigned int shard,
+				     unsigned int nr_shards);
 /*!
  * used by invalidator thread to get a clean block to invalidate
  */
 extern int cache_get_clean(struct bittern_cache *bc,
 			   struct cache_block **o_cache_block);
+/*!
+ * used by invalidator thread to get up to max_blocks clean blocks to
+ * invalidate with a single hold of bc_entries_lock.
+ * returns the number of blocks held and stored in o_cache_blocks.
+ */
+extern unsigned int cache_get_clean_batch(struct bittern_cache *bc,
+					  struct cache_block **o_cache_blocks,
+					  unsigned int max_blocks);
 /*!
  * Clone a cache block into a new one.
  * "is_dirty" determines if the cloned block should be S_CLEAN or S_DIRTY.
@@ -206,6 +223,9 @@ extern int __cache_validate_state_transition(struct bittern_cache *bc,
 						  (__s_to));		\
 	ASSERT(__p_from == (__bcb)->bcb_cache_transition);		\
 	ASSERT(__s_from == (__bcb)->bcb_state);				\
+	trace_bittern_state_transition((__bc), (__bcb),		\
+				       (__p_from), (__s_from),		\
+				       (__p_to), (__s_to));		\
 	(__bcb)->bcb_cache_transition = (__p_to);			\
 	(__bcb)->bcb_state = (__s_to);					\
 	ASSERT(__ret == 0);						\
@@ -221,6 +241,11 @@ extern int __cache_validate_state_transition(struct bittern_cache *bc,
 		__bcb->bcb_state == S_DIRTY_NO_DATA ||			\
 		__bcb->bcb_state == S_CLEAN ||				\
 		__bcb->bcb_state == S_DIRTY);				\
+	/* anything but a read drops the DRAM copy */			\
+	if (__p_to != TS_READ_HIT_WTWB_CLEAN &&				\
+	    __p_to != TS_READ_HIT_WB_DIRTY &&				\
+	    __p_to != TS_VERIFY_CLEAN_WTWB)				\
+		cache_l1_drop(__bc, __bcb);				\
 	__cache_state_transition(__bc,					\
 				 __bcb,					\
 				 __bcb->bcb_cache_transition,		\
@@ -353,6 +378,17 @@ extern void queue_to_deferred(struct bittern_cache *bc,
 extern struct bio *dequeue_from_deferred(struct bittern_cache *bc,
 					       struct deferred_queue *queue);
 
+static inline const char *deferred_queue_name(struct bittern_cache *bc,
+					      struct deferred_queue *queue)
+{
+	if (queue == &bc->defer_busy)
+		return "busy";
+	if (queue == &bc->defer_page)
+		return "page";
+	ASSERT(queue == &bc->defer_class);
+	return "class";
+}
+
 static inline bool bio_is_pureflush_request(struct bio *bio)
 {
 	if ((bio->bi_rw & REQ_FLUSH) != 0 && bio->bi_iter.bi_size == 0)
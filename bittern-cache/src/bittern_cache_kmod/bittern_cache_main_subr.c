@@ -826,6 +826,7 @@ struct work_item *work_item_allocate(struct bittern_cache *bc,
 				     int wi_flags)
 {
 	struct work_item *wi;
+	int nid = numa_node_id();
 
 	ASSERT_BITTERN_CACHE(bc);
 	if (cache_block != NULL)
@@ -840,9 +841,13 @@ struct work_item *work_item_allocate(struct bittern_cache *bc,
 	ASSERT((wi_flags & (WI_FLAG_XID_NEW | WI_FLAG_XID_USE_CACHE_BLOCK)) !=
 	       (WI_FLAG_XID_NEW | WI_FLAG_XID_USE_CACHE_BLOCK));
 
-	wi = kmem_zalloc(sizeof(struct work_item), GFP_NOIO);
+	/* on the submitter's node, see bittern_cache_numa.c */
+	wi = kmem_zalloc_node(sizeof(struct work_item), GFP_NOIO, nid);
 	if (wi == NULL)
 		return NULL;
+	wi->wi_numa_node = nid;
+	if (nid < CACHE_NUMA_MAX_NODES)
+		atomic_inc(&bc->bc_numa_nodes[nid].cnn_wi_allocs);
 
 	wi->wi_magic1 = WI_MAGIC1;
 	wi->wi_magic2 = WI_MAGIC2;
@@ -852,6 +857,10 @@ struct work_item *work_item_allocate(struct bittern_cache *bc,
 	wi->wi_flags = wi_flags;
 	if (wi_flags & WI_FLAG_BIO_CLONED) {
 		ASSERT(bio != NULL);
+		wi->wi_iotrace_sector = bio->bi_iter.bi_sector;
+		wi->wi_iotrace_size = bio->bi_iter.bi_size;
+		wi->wi_iotrace_pid = current->pid;
+		cache_io_class_request_start(bc, wi, bio);
 	} else {
 		ASSERT((wi_flags & WI_FLAG_BIO_NOT_CLONED) != 0);
 		ASSERT(bio == NULL);
@@ -900,12 +909,24 @@ void work_item_reallocate(struct bittern_cache *bc,
 	ASSERT(wi != NULL);
 	ASSERT_WORK_ITEM(wi, bc);
 
+	ASSERT(wi->wi_l1_entry == NULL);
+
+	/* the user request this work_item was allocated for is done */
+	cache_iotrace_record(bc, wi);
+	trace_bittern_request_done(bc, wi);
+	if (wi->wi_flags & WI_FLAG_BIO_CLONED)
+		cache_io_class_request_done(bc, wi);
+	wi->wi_iotrace_size = 0;
+	wi->wi_iotrace_pid = 0;
+	wi->wi_iotrace_transition = TS_NONE;
+
 	wi->wi_cache_block = cache_block;
 	wi->wi_original_cache_block = NULL;
 	wi->wi_original_bio = bio;
 	wi->wi_flags = wi_flags;
 	if (wi_flags & WI_FLAG_BIO_CLONED) {
 		ASSERT(bio != NULL);
+		cache_io_class_request_start(bc, wi, bio);
 	} else {
 		ASSERT((wi_flags & WI_FLAG_BIO_NOT_CLONED) != 0);
 		ASSERT(bio == NULL);
@@ -928,13 +949,25 @@ void work_item_reallocate(struct bittern_cache *bc,
 
 void work_item_free(struct bittern_cache *bc, struct work_item *wi)
 {
+	int nid;
+
 	ASSERT_BITTERN_CACHE(bc);
 	ASSERT_WORK_ITEM(wi, bc);
 
 	work_item_del_pending_io(bc, wi);
 
+	cache_iotrace_record(bc, wi);
+	trace_bittern_request_done(bc, wi);
+	if (wi->wi_flags & WI_FLAG_BIO_CLONED)
+		cache_io_class_request_done(bc, wi);
+
+	ASSERT(wi->wi_l1_entry == NULL);
 	pmem_context_destroy(bc, &wi->wi_pmem_ctx);
 
+	nid = wi->wi_numa_node;
+	if (nid != numa_node_id() && nid < CACHE_NUMA_MAX_NODES)
+		atomic_inc(&bc->bc_numa_nodes[nid].cnn_wi_remote_frees);
+
 	kmem_free(wi, sizeof(struct work_item));
 }
 
@@ -1044,6 +1077,8 @@ void cached_dev_make_request_endio(struct work_item *wi,
 	M_ASSERT(wi->wi_original_bio != NULL);
 	ASSERT(original_bio == wi->wi_original_bio);
 
+	trace_bittern_devio_complete(bc, wi, bio, err);
+
 	if (bio_data_dir(bio) == READ)
 		cache_timer_add(&bc->bc_timer_cached_device_reads,
 				wi->wi_ts_physio);
@@ -1202,7 +1237,8 @@ static void cached_dev_make_request_worker(struct work_struct *work)
 /*!
  * This function indirectly calls generic_make_request. Because call to
  * generic_make_request() cannot be done in softirq, we defer it to a
- * work_queue in such case.
+ * work_queue in such case. In process context the request is submitted
+ * directly, which saves a context switch and a cross-cpu wakeup.
  */
 void cached_dev_make_request_defer(struct bittern_cache *bc,
 				   struct work_item *wi,
@@ -1223,6 +1259,12 @@ void cached_dev_make_request_defer(struct bittern_cache *bc,
 		     datadir,
 		     set_original_bio);
 
+	if (cache_can_submit_direct(bc)) {
+		atomic_inc(&bc->bc_make_request_direct_count);
+		cached_dev_do_make_request(bc, wi, datadir, set_original_bio);
+		return;
+	}
+
 	atomic_inc(&bc->bc_make_request_wq_count);
 	wi->wi_ts_workqueue = current_kernel_time_nsec();
 
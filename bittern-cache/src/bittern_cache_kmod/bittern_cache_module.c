@@ -19,6 +19,10 @@
 #include "bittern_cache.h"
 #include "bittern_cache_module.h"
 
+/* instantiate the tracepoints, see bittern_cache_trace.h */
+#define CREATE_TRACE_POINTS
+#include "bittern_cache_trace.h"
+
 /*!
  * these rules are meant to allow to external scripts and commands
  * to easily parse most of the /sys/fs/ entries with the same code.
@@ -185,6 +189,64 @@ static int show_bgwriter_conf_cluster_size(struct bittern_cache *bc)
 	return bc->bc_bgwriter_conf_cluster_size;
 }
 
+static int set_bgwriter_conf_workers(struct bittern_cache *bc, int value)
+{
+	bc->bc_bgwriter_conf_workers = value;
+	return 0;
+}
+
+static int show_bgwriter_conf_workers(struct bittern_cache *bc)
+{
+	return bc->bc_bgwriter_conf_workers;
+}
+
+static int set_bgwriter_conf_latency_target_us(struct bittern_cache *bc,
+					       int value)
+{
+	bc->bc_bgwriter_conf_latency_target_us = value;
+	return 0;
+}
+
+static int show_bgwriter_conf_latency_target_us(struct bittern_cache *bc)
+{
+	return bc->bc_bgwriter_conf_latency_target_us;
+}
+
+static int set_bgwriter_conf_hot_writes(struct bittern_cache *bc, int value)
+{
+	bc->bc_bgwriter_conf_hot_writes = value;
+	return 0;
+}
+
+static int show_bgwriter_conf_hot_writes(struct bittern_cache *bc)
+{
+	return bc->bc_bgwriter_conf_hot_writes;
+}
+
+static int set_bgwriter_conf_hot_max_age_secs(struct bittern_cache *bc,
+					      int value)
+{
+	bc->bc_bgwriter_conf_hot_max_age_secs = value;
+	return 0;
+}
+
+static int show_bgwriter_conf_hot_max_age_secs(struct bittern_cache *bc)
+{
+	return bc->bc_bgwriter_conf_hot_max_age_secs;
+}
+
+static int set_bgwriter_conf_hot_max_dirty_pct(struct bittern_cache *bc,
+					       int value)
+{
+	bc->bc_bgwriter_conf_hot_max_dirty_pct = value;
+	return 0;
+}
+
+static int show_bgwriter_conf_hot_max_dirty_pct(struct bittern_cache *bc)
+{
+	return bc->bc_bgwriter_conf_hot_max_dirty_pct;
+}
+
 static int cache_set_enable_extra_checksum(struct bittern_cache *bc, int value)
 {
 #if !defined(ENABLE_TRACK_CRC32C)
@@ -207,6 +269,65 @@ static int show_cache_min_invalid(struct bittern_cache *bc)
 	return bc->bc_invalidator_conf_min_invalid_count;
 }
 
+static int set_invalidator_conf_batch_size(struct bittern_cache *bc,
+					   int value)
+{
+	bc->bc_invalidator_conf_batch_size = value;
+	return 0;
+}
+
+static int show_invalidator_conf_batch_size(struct bittern_cache *bc)
+{
+	return bc->bc_invalidator_conf_batch_size;
+}
+
+static int show_numa_node(struct bittern_cache *bc)
+{
+	return bc->bc_numa_node;
+}
+
+static int set_direct_submit_enabled(struct bittern_cache *bc, int value)
+{
+	bc->bc_direct_submit_enabled = value;
+	return 0;
+}
+
+static int show_direct_submit_enabled(struct bittern_cache *bc)
+{
+	return bc->bc_direct_submit_enabled;
+}
+
+static int set_one_io_commit_enabled(struct bittern_cache *bc, int value)
+{
+	bc->bc_one_io_commit_enabled = value;
+	return 0;
+}
+
+static int show_one_io_commit_enabled(struct bittern_cache *bc)
+{
+	return bc->bc_one_io_commit_enabled;
+}
+
+static int set_mlog_enabled(struct bittern_cache *bc, int value)
+{
+	int ret;
+
+	bc->bc_mlog_enabled = value;
+	if (value == 0) {
+		pmem_mlog_stop(bc);
+		return 0;
+	}
+	ret = pmem_mlog_start(bc);
+	if (ret < 0)
+		bc->bc_mlog_enabled = 0;
+	return ret;
+}
+
+static int show_mlog_enabled(struct bittern_cache *bc)
+{
+	return bc->bc_mlog_enabled;
+}
+
 static int param_set_trace(struct bittern_cache *bc, int value)
 {
 #if !defined(DISABLE_BT_TRACE)
@@ -341,6 +462,35 @@ static int param_get_verifier_scan_delay_ms(struct bittern_cache *bc)
 	return bc->bc_verifier_scan_delay_ms;
 }
 
+static int param_set_verifier_max_iops(struct bittern_cache *bc, int value)
+{
+	ASSERT(value >= 0 && value <= CACHE_VERIFIER_MAX_IOPS_MAX);
+	ASSERT(bc->bc_verifier_task != NULL);
+	bc->bc_verifier_max_iops = value;
+	wake_up_interruptible(&bc->bc_verifier_wait);
+	return 0;
+}
+
+static int param_get_verifier_max_iops(struct bittern_cache *bc)
+{
+	return bc->bc_verifier_max_iops;
+}
+
+static int param_set_verifier_scan_target_secs(struct bittern_cache *bc,
+					       int value)
+{
+	ASSERT(value >= 0 && value <= CACHE_VERIFIER_SCAN_TARGET_SECS_MAX);
+	ASSERT(bc->bc_verifier_task != NULL);
+	bc->bc_verifier_scan_target_secs = value;
+	wake_up_interruptible(&bc->bc_verifier_wait);
+	return 0;
+}
+
+static int param_get_verifier_scan_target_secs(struct bittern_cache *bc)
+{
+	return bc->bc_verifier_scan_target_secs;
+}
+
 static int param_set_verifier_bugon_on_errors(struct bittern_cache *bc,
 					      int value)
 {
@@ -362,6 +512,161 @@ static int control_invalidate_cache(struct bittern_cache *bc, int value)
 	return 0;
 }
 
+/*! start online resize to value mbytes, zero means the whole device */
+static int control_resize(struct bittern_cache *bc, int value)
+{
+	return cache_resize_start(bc, (uint64_t)value * 1024ULL * 1024ULL);
+}
+
+/*! shared pool quotas of the pool's own cached device (owner 0) */
+static int param_set_pool_min_pct(struct bittern_cache *bc, int value)
+{
+	return cache_pool_set_quota(bc,
+				    0,
+				    value,
+				    bc->bc_pool_owners[0].cpo_max_pct);
+}
+
+static int param_get_pool_min_pct(struct bittern_cache *bc)
+{
+	return bc->bc_pool_owners[0].cpo_min_pct;
+}
+
+static int param_set_pool_max_pct(struct bittern_cache *bc, int value)
+{
+	return cache_pool_set_quota(bc,
+				    0,
+				    bc->bc_pool_owners[0].cpo_min_pct,
+				    value);
+}
+
+static int param_get_pool_max_pct(struct bittern_cache *bc)
+{
+	return bc->bc_pool_owners[0].cpo_max_pct;
+}
+
+/*!
+ * I/O class quotas, in percent of the cache blocks (max) and of the max
+ * pending requests (pending), see bittern_cache_ioclass.c
+ */
+static int param_set_io_class_high_max_pct(struct bittern_cache *bc,
+					   int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_HIGH];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_HIGH,
+					value,
+					cic->cic_pending_pct);
+}
+
+static int param_get_io_class_high_max_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_HIGH].cic_max_pct;
+}
+
+static int param_set_io_class_high_pending_pct(struct bittern_cache *bc,
+					       int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_HIGH];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_HIGH,
+					cic->cic_max_pct,
+					value);
+}
+
+static int param_get_io_class_high_pending_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_HIGH].cic_pending_pct;
+}
+
+static int param_set_io_class_normal_max_pct(struct bittern_cache *bc,
+					     int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_NORMAL];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_NORMAL,
+					value,
+					cic->cic_pending_pct);
+}
+
+static int param_get_io_class_normal_max_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_NORMAL].cic_max_pct;
+}
+
+static int param_set_io_class_normal_pending_pct(struct bittern_cache *bc,
+						 int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_NORMAL];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_NORMAL,
+					cic->cic_max_pct,
+					value);
+}
+
+static int param_get_io_class_normal_pending_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_NORMAL].cic_pending_pct;
+}
+
+static int param_set_io_class_low_max_pct(struct bittern_cache *bc,
+					  int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_LOW];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_LOW,
+					value,
+					cic->cic_pending_pct);
+}
+
+static int param_get_io_class_low_max_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_LOW].cic_max_pct;
+}
+
+static int param_set_io_class_low_pending_pct(struct bittern_cache *bc,
+					      int value)
+{
+	struct cache_io_class *cic = &bc->bc_io_classes[CACHE_IO_CLASS_LOW];
+
+	return cache_io_class_set_quota(bc,
+					CACHE_IO_CLASS_LOW,
+					cic->cic_max_pct,
+					value);
+}
+
+static int param_get_io_class_low_pending_pct(struct bittern_cache *bc)
+{
+	return bc->bc_io_classes[CACHE_IO_CLASS_LOW].cic_pending_pct;
+}
+
+/*! DRAM front tier size, zero disables it */
+static int param_set_l1_max_mbytes(struct bittern_cache *bc, int value)
+{
+	return cache_l1_set_max_mbytes(bc, value);
+}
+
+static int param_get_l1_max_mbytes(struct bittern_cache *bc)
+{
+	return bc->bc_l1_max_mbytes;
+}
+
+/*! binary I/O trace, records one every N requests, zero disables it */
+static int param_set_iotrace_sample(struct bittern_cache *bc, int value)
+{
+	return cache_iotrace_set_sample(bc, value);
+}
+
+static int param_get_iotrace_sample(struct bittern_cache *bc)
+{
+	return bc->bc_iotrace_sample;
+}
+
 static int control_zero_stats(struct bittern_cache *bc, int value)
 {
 	cache_zero_stats(bc);
@@ -474,6 +779,52 @@ struct cache_conf_param_entry cache_conf_param_list[] = {
 		.cache_conf_setup_function = set_bgwriter_conf_cluster_size,
 		.cache_conf_show_function = show_bgwriter_conf_cluster_size,
 	},
+	{
+		.cache_conf_name = "bgwriter_conf_workers",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = CACHE_BGWRITER_MIN_WORKERS,
+		.cache_conf_max = CACHE_BGWRITER_MAX_WORKERS,
+		.cache_conf_setup_function = set_bgwriter_conf_workers,
+		.cache_conf_show_function = show_bgwriter_conf_workers,
+	},
+	{
+		.cache_conf_name = "bgwriter_conf_latency_target_us",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = CACHE_BGWRITER_MIN_LATENCY_TARGET_US,
+		.cache_conf_max = CACHE_BGWRITER_MAX_LATENCY_TARGET_US,
+		.cache_conf_setup_function =
+				set_bgwriter_conf_latency_target_us,
+		.cache_conf_show_function =
+				show_bgwriter_conf_latency_target_us,
+	},
+	{
+		.cache_conf_name = "bgwriter_conf_hot_writes",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_BGWRITER_MAX_HOT_WRITES,
+		.cache_conf_setup_function = set_bgwriter_conf_hot_writes,
+		.cache_conf_show_function = show_bgwriter_conf_hot_writes,
+	},
+	{
+		.cache_conf_name = "bgwriter_conf_hot_max_age_secs",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = CACHE_BGWRITER_MIN_HOT_MAX_AGE_SECS,
+		.cache_conf_max = CACHE_BGWRITER_MAX_HOT_MAX_AGE_SECS,
+		.cache_conf_setup_function =
+				set_bgwriter_conf_hot_max_age_secs,
+		.cache_conf_show_function =
+				show_bgwriter_conf_hot_max_age_secs,
+	},
+	{
+		.cache_conf_name = "bgwriter_conf_hot_max_dirty_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = CACHE_BGWRITER_MIN_HOT_MAX_DIRTY_PCT,
+		.cache_conf_max = CACHE_BGWRITER_MAX_HOT_MAX_DIRTY_PCT,
+		.cache_conf_setup_function =
+				set_bgwriter_conf_hot_max_dirty_pct,
+		.cache_conf_show_function =
+				show_bgwriter_conf_hot_max_dirty_pct,
+	},
 	{
 		.cache_conf_name = "bgwriter_conf_policy",
 		.cache_conf_type = CONF_TYPE_STR,
@@ -491,6 +842,61 @@ struct cache_conf_param_entry cache_conf_param_list[] = {
 		.cache_conf_setup_function = cache_calculate_min_invalid,
 		.cache_conf_show_function = show_cache_min_invalid,
 	},
+	/*
+	 * invalidator batch size
+	 */
+	{
+		.cache_conf_name = "invalidator_conf_batch_size",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = INVALIDATOR_MIN_BATCH_SIZE,
+		.cache_conf_max = INVALIDATOR_MAX_BATCH_SIZE,
+		.cache_conf_setup_function = set_invalidator_conf_batch_size,
+		.cache_conf_show_function = show_invalidator_conf_batch_size,
+	},
+	/*
+	 * direct submission to cached device and pmem block device
+	 */
+	{
+		.cache_conf_name = "direct_submit_enabled",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = 1,
+		.cache_conf_setup_function = set_direct_submit_enabled,
+		.cache_conf_show_function = show_direct_submit_enabled,
+	},
+	/*
+	 * data and metadata of a block written with one request
+	 */
+	{
+		.cache_conf_name = "one_io_commit_enabled",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = 1,
+		.cache_conf_setup_function = set_one_io_commit_enabled,
+		.cache_conf_show_function = show_one_io_commit_enabled,
+	},
+	/*
+	 * metadata-only updates batched in the metadata intent log
+	 */
+	{
+		.cache_conf_name = "mlog_enabled",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = 1,
+		.cache_conf_setup_function = set_mlog_enabled,
+		.cache_conf_show_function = show_mlog_enabled,
+	},
+	/*
+	 * node kernel threads are bound to, -1 for none
+	 */
+	{
+		.cache_conf_name = "numa_node",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = NUMA_NO_NODE,
+		.cache_conf_max = MAX_NUMNODES - 1,
+		.cache_conf_setup_function = cache_numa_set_node,
+		.cache_conf_show_function = show_numa_node,
+	},
 	/*
 	 * extra checksum check
 	 */
@@ -556,6 +962,25 @@ struct cache_conf_param_entry cache_conf_param_list[] = {
 		.cache_conf_setup_function = set_write_bypass_timeout,
 		.cache_conf_show_function = write_bypass_timeout,
 	},
+	/*
+	 * miss admission filter parameters
+	 */
+	{
+		.cache_conf_name = "read_admit_threshold",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_ADMIT_COUNTER_MAX,
+		.cache_conf_setup_function = set_read_admit_threshold,
+		.cache_conf_show_function = read_admit_threshold,
+	},
+	{
+		.cache_conf_name = "write_admit_threshold",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_ADMIT_COUNTER_MAX,
+		.cache_conf_setup_function = set_write_admit_threshold,
+		.cache_conf_show_function = write_admit_threshold,
+	},
 	/*
 	 * tracemask
 	 */
@@ -642,6 +1067,114 @@ struct cache_conf_param_entry cache_conf_param_list[] = {
 		.cache_conf_setup_function = param_set_verifier_bugon_on_errors,
 		.cache_conf_show_function = param_get_verifier_bugon_on_errors,
 	},
+	{
+		.cache_conf_name = "verifier_max_iops",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_VERIFIER_MAX_IOPS_MAX,
+		.cache_conf_setup_function = param_set_verifier_max_iops,
+		.cache_conf_show_function = param_get_verifier_max_iops,
+	},
+	{
+		.cache_conf_name = "verifier_scan_target_secs",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_VERIFIER_SCAN_TARGET_SECS_MAX,
+		.cache_conf_setup_function = param_set_verifier_scan_target_secs,
+		.cache_conf_show_function = param_get_verifier_scan_target_secs,
+	},
+	/*
+	 * shared pool quotas
+	 */
+	{
+		.cache_conf_name = "pool_min_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_POOL_MAX_MIN_PCT_SUM,
+		.cache_conf_setup_function = param_set_pool_min_pct,
+		.cache_conf_show_function = param_get_pool_min_pct,
+	},
+	{
+		.cache_conf_name = "pool_max_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_pool_max_pct,
+		.cache_conf_show_function = param_get_pool_max_pct,
+	},
+	/*
+	 * I/O class quotas
+	 */
+	{
+		.cache_conf_name = "io_class_high_max_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_high_max_pct,
+		.cache_conf_show_function = param_get_io_class_high_max_pct,
+	},
+	{
+		.cache_conf_name = "io_class_high_pending_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_high_pending_pct,
+		.cache_conf_show_function = param_get_io_class_high_pending_pct,
+	},
+	{
+		.cache_conf_name = "io_class_normal_max_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_normal_max_pct,
+		.cache_conf_show_function = param_get_io_class_normal_max_pct,
+	},
+	{
+		.cache_conf_name = "io_class_normal_pending_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_normal_pending_pct,
+		.cache_conf_show_function = param_get_io_class_normal_pending_pct,
+	},
+	{
+		.cache_conf_name = "io_class_low_max_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_low_max_pct,
+		.cache_conf_show_function = param_get_io_class_low_max_pct,
+	},
+	{
+		.cache_conf_name = "io_class_low_pending_pct",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 1,
+		.cache_conf_max = 100,
+		.cache_conf_setup_function = param_set_io_class_low_pending_pct,
+		.cache_conf_show_function = param_get_io_class_low_pending_pct,
+	},
+	/*
+	 * DRAM front tier
+	 */
+	{
+		.cache_conf_name = "l1_max_mbytes",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_L1_MAX_MBYTES_MAX,
+		.cache_conf_setup_function = param_set_l1_max_mbytes,
+		.cache_conf_show_function = param_get_l1_max_mbytes,
+	},
+	/*
+	 * binary I/O trace
+	 */
+	{
+		.cache_conf_name = "iotrace_sample",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = CACHE_IOTRACE_SAMPLE_MAX,
+		.cache_conf_setup_function = param_set_iotrace_sample,
+		.cache_conf_show_function = param_get_iotrace_sample,
+	},
 	/*
 	 * error state
 	 */
@@ -663,6 +1196,16 @@ struct cache_conf_param_entry cache_conf_param_list[] = {
 		.cache_conf_max = 0,
 		.cache_conf_setup_function = control_invalidate_cache,
 	},
+	/*
+	 * control function -- online resize.
+	 */
+	{
+		.cache_conf_name = "resize_mbytes",
+		.cache_conf_type = CONF_TYPE_INT,
+		.cache_conf_min = 0,
+		.cache_conf_max = 0x7fffffff,
+		.cache_conf_setup_function = control_resize,
+	},
 	/*
 	 * control function -- zero stats (not really implemented).
 	 */
@@ -788,6 +1331,17 @@ ssize_t cache_op_show_conf(struct bittern_cache *bc, char *result)
 	return sz;
 }
 
+/*!
+ * estimate of the workqueue latency saved by direct submissions, assuming
+ * each of them would have waited as long as the average deferred request.
+ */
+static unsigned long long cache_direct_saved_usecs(atomic_t *direct_count,
+						   struct cache_timer *wq_timer)
+{
+	return (unsigned long long)atomic_read(direct_count) *
+	       wq_timer->bct_avg_nsec / 1000ULL;
+}
+
 ssize_t cache_op_show_stats_extra(struct bittern_cache *bc,
 					  char *result)
 {
@@ -907,10 +1461,16 @@ ssize_t cache_op_show_stats_extra(struct bittern_cache *bc,
 	       atomic_read(&bc->bc_dirty_write_clone_alloc_ok),
 	       atomic_read(&bc->bc_dirty_write_clone_alloc_fail),
 	       list_empty(&bc->bc_pending_requests_list));
-	DMEMIT("%s: stats_extra: make_request_count=%u make_request_wq_count=%u\n",
+	DMEMIT("%s: stats_extra: make_request_count=%u make_request_wq_count=%u "
+	       "make_request_direct_count=%u "
+	       "make_request_direct_saved_usecs=%llu "
+	       "\n",
 	       bc->bc_name,
 	       atomic_read(&bc->bc_make_request_count),
-	       atomic_read(&bc->bc_make_request_wq_count));
+	       atomic_read(&bc->bc_make_request_wq_count),
+	       atomic_read(&bc->bc_make_request_direct_count),
+	       cache_direct_saved_usecs(&bc->bc_make_request_direct_count,
+					&bc->bc_make_request_wq_timer));
 	DMEMIT("%s: stats_extra: dev_pending_count=%d dev_flush_pending_count=%d dev_pure_flush_pending_count=%d\n",
 	       bc->bc_name,
 	       bc->devio.pending_count,
@@ -944,6 +1504,16 @@ ssize_t cache_op_show_stats_extra(struct bittern_cache *bc,
 	       bc->defer_page.work_count,
 	       bc->defer_page.no_work_count,
 	       T_FMT_ARGS(bc, defer_page.timer));
+	DMEMIT("%s: stats_extra: defer_class_curr_count=%u defer_class_requeue_count=%u defer_class_max_count=%u\n",
+	       bc->bc_name,
+	       bc->defer_class.curr_count,
+	       bc->defer_class.requeue_count,
+	       bc->defer_class.max_count);
+	DMEMIT("%s: stats_extra: defer_class_work_count=%u defer_class_no_work_count=%u " T_FMT_STRING("defer_class_timer") "\n",
+	       bc->bc_name,
+	       bc->defer_class.work_count,
+	       bc->defer_class.no_work_count,
+	       T_FMT_ARGS(bc, defer_class.timer));
 	return sz;
 }
 
@@ -1028,7 +1598,7 @@ ssize_t cache_op_show_pmem_stats(struct bittern_cache *bc,
 	size_t sz = 0, maxlen = PAGE_SIZE;
 	struct pmem_info *ps = &bc->bc_papi.papi_stats;
 
-	DMEMIT("%s: pmem_stats: restore_header_valid=%u restore_header0_valid=%u restore_header1_valid=%u restore_corrupt_metadata_blocks=%u restore_valid_clean_metadata_blocks=%u restore_valid_dirty_metadata_blocks=%u restore_invalid_metadata_blocks=%u restore_pending_metadata_blocks=%u restore_invalid_data_blocks=%u restore_valid_clean_data_blocks=%u restore_valid_dirty_data_blocks=%u restore_hash_corrupt_metadata_blocks=%u restore_hash_corrupt_data_blocks=%u\n",
+	DMEMIT("%s: pmem_stats: restore_header_valid=%u restore_header0_valid=%u restore_header1_valid=%u restore_corrupt_metadata_blocks=%u restore_valid_clean_metadata_blocks=%u restore_valid_dirty_metadata_blocks=%u restore_invalid_metadata_blocks=%u restore_pending_metadata_blocks=%u restore_invalid_data_blocks=%u restore_valid_clean_data_blocks=%u restore_valid_dirty_data_blocks=%u restore_hash_corrupt_metadata_blocks=%u restore_hash_corrupt_data_blocks=%u restore_snapshot_valid=%u restore_snapshot_blocks=%u restore_torn_one_io_blocks=%u restore_mlog_pages=%u restore_mlog_records=%u restore_mlog_replayed_blocks=%u\n",
 	       bc->bc_name,
 	       ps->restore_header_valid,
 	       ps->restore_header0_valid,
@@ -1042,7 +1612,13 @@ ssize_t cache_op_show_pmem_stats(struct bittern_cache *bc,
 	       ps->restore_valid_clean_data_blocks,
 	       ps->restore_valid_dirty_data_blocks,
 	       ps->restore_hash_corrupt_metadata_blocks,
-	       ps->restore_hash_corrupt_data_blocks);
+	       ps->restore_hash_corrupt_data_blocks,
+	       ps->restore_snapshot_valid,
+	       ps->restore_snapshot_blocks,
+	       ps->restore_torn_one_io_blocks,
+	       ps->restore_mlog_pages,
+	       ps->restore_mlog_records,
+	       ps->restore_mlog_replayed_blocks);
 	DMEMIT("%s: pmem_stats: "
 	       "data_get_put_page_pending_count=%u "
 	       "data_get_page_read_count=%u "
@@ -1050,6 +1626,7 @@ ssize_t cache_op_show_pmem_stats(struct bittern_cache *bc,
 	       "data_get_page_write_count=%u "
 	       "data_put_page_write_count=%u "
 	       "data_put_page_write_metadata_count=%u "
+	       "data_put_page_write_one_io_count=%u "
 	       "data_convert_page_read_to_write_count=%u "
 	       "data_clone_read_page_to_write_page_count=%u\n",
 	       bc->bc_name,
@@ -1059,6 +1636,7 @@ ssize_t cache_op_show_pmem_stats(struct bittern_cache *bc,
 	       atomic_read(&ps->data_get_page_write_count),
 	       atomic_read(&ps->data_put_page_write_count),
 	       atomic_read(&ps->data_put_page_write_metadata_count),
+	       atomic_read(&ps->data_put_page_write_one_io_count),
 	       atomic_read(&ps->data_convert_page_read_to_write_count),
 	       atomic_read(&ps->data_clone_read_page_to_write_page_count));
 	DMEMIT("%s: pmem_stats: "
@@ -1080,9 +1658,15 @@ ssize_t cache_op_show_pmem_stats(struct bittern_cache *bc,
 	       atomic_read(&ps->pmem_read_4k_pending),
 	       atomic_read(&ps->pmem_write_4k_count),
 	       atomic_read(&ps->pmem_write_4k_pending));
-	DMEMIT("%s: pmem_stats: pmem_make_req_wq_count=%u\n",
+	DMEMIT("%s: pmem_stats: pmem_make_req_wq_count=%u "
+	       "pmem_make_req_direct_count=%u "
+	       "pmem_make_req_direct_saved_usecs=%llu "
+	       "\n",
 	       bc->bc_name,
-	       atomic_read(&ps->pmem_make_req_wq_count));
+	       atomic_read(&ps->pmem_make_req_wq_count),
+	       atomic_read(&ps->pmem_make_req_direct_count),
+	       cache_direct_saved_usecs(&ps->pmem_make_req_direct_count,
+					&ps->pmem_make_req_wq_timer));
 
 	return sz;
 }
@@ -1232,6 +1816,9 @@ ssize_t cache_op_show_verifier(struct bittern_cache *bc, char *result)
 	size_t sz = 0, maxlen = PAGE_SIZE;
 	unsigned long s_started = 0, s_completed = 0, s_elapsed = 0;
 	unsigned long s_last_block = 0;
+	unsigned int total = atomic_read(&bc->bc_total_entries);
+	unsigned int position = bc->bc_verifier_scan_position;
+	uint64_t scan_ms = 0, blocks_per_sec = 0, eta_ms = 0;
 
 	if (bc->bc_verifier_scan_started != 0 &&
 	    bc->bc_verifier_scan_completed != 0) {
@@ -1245,6 +1832,14 @@ ssize_t cache_op_show_verifier(struct bittern_cache *bc, char *result)
 	} else if (bc->bc_verifier_scan_started != 0) {
 		s_started = jiffies - bc->bc_verifier_scan_started;
 		s_last_block = jiffies - bc->bc_verifier_scan_last_block;
+		/* scan in progress, estimate when it completes */
+		scan_ms = jiffies_to_msecs(s_started);
+		if (scan_ms > 0 && position > 0 && position <= total) {
+			blocks_per_sec = div_u64((uint64_t)position * 1000ULL,
+						 scan_ms);
+			eta_ms = div_u64((uint64_t)(total - position) * scan_ms,
+					 position);
+		}
 	}
 
 	DMEMIT("%s: verifier: running=%d one_shot=%d task=%p delay_ms=%d bug_on_verify_errors=%d\n",
@@ -1271,6 +1866,93 @@ ssize_t cache_op_show_verifier(struct bittern_cache *bc, char *result)
 	       jiffies_to_msecs(s_last_block),
 	       jiffies_to_msecs(s_completed),
 	       jiffies_to_msecs(s_elapsed));
+	DMEMIT("%s: verifier: max_iops=%d scan_target_secs=%d batch_blocks=%d scan_position=%u total_entries=%u scan_progress_pct=%u scan_blocks_per_sec=%llu scan_eta=%llums device_reads=%llu device_read_errors=%llu\n",
+	       bc->bc_name,
+	       bc->bc_verifier_max_iops,
+	       bc->bc_verifier_scan_target_secs,
+	       CACHE_VERIFIER_BATCH_BLOCKS,
+	       position,
+	       total,
+	       total > 0 ? (unsigned int)div_u64((uint64_t)position * 100ULL,
+						  total) : 0,
+	       blocks_per_sec,
+	       eta_ms,
+	       bc->bc_verifier_device_reads,
+	       bc->bc_verifier_device_read_errors);
+	return sz;
+}
+
+ssize_t cache_op_show_l1(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+
+	DMEMIT("%s: l1: max_mbytes=%u max_entries=%u entries=%d\n",
+	       bc->bc_name,
+	       bc->bc_l1_max_mbytes,
+	       bc->bc_l1_max_entries,
+	       atomic_read(&bc->bc_l1_entries));
+	DMEMIT("%s: l1: " S_PCT_FMT_STRING("hits")
+	       "misses=%u "
+	       T_PCT_FMT_STRING("read_requests_hits")
+	       "\n",
+	       bc->bc_name,
+	       S_PCT_ARGS(bc->bc_l1_misses, bc->bc_l1_hits),
+	       atomic_read(&bc->bc_l1_misses),
+	       T_PCT_ARGS(bc->bc_read_requests, bc->bc_l1_hits));
+	DMEMIT("%s: l1: inserts=%u evictions=%u invalidations=%u alloc_failures=%u\n",
+	       bc->bc_name,
+	       atomic_read(&bc->bc_l1_inserts),
+	       atomic_read(&bc->bc_l1_evictions),
+	       atomic_read(&bc->bc_l1_invalidations),
+	       atomic_read(&bc->bc_l1_alloc_failures));
+	DMEMIT("%s: l1: " T_FMT_STRING("read_l1_hits") " "
+	       T_FMT_STRING("read_clean_hits") "\n",
+	       bc->bc_name,
+	       T_FMT_ARGS(bc, bc_timer_read_l1_hits),
+	       T_FMT_ARGS(bc, bc_timer_read_clean_hits));
+	return sz;
+}
+
+ssize_t cache_op_show_mlog(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	unsigned int i;
+
+	DMEMIT("%s: mlog: enabled=%d started=%d open=%d epoch=%llu offset=%llu pages=%u head_seq=%llu written_seq=%llu tail_seq=%llu\n",
+	       bc->bc_name,
+	       bc->bc_mlog_enabled,
+	       ml->ml_started,
+	       ml->ml_open,
+	       ml->ml_epoch,
+	       ml->ml_offset_bytes,
+	       ml->ml_pages,
+	       ml->ml_head_seq,
+	       ml->ml_written_seq,
+	       ml->ml_tail_seq);
+	DMEMIT("%s: mlog: appends=%u page_writes=%u full_fallbacks=%u busy_fallbacks=%u write_errors=%u\n",
+	       bc->bc_name,
+	       atomic_read(&ml->ml_appends),
+	       atomic_read(&ml->ml_page_writes),
+	       atomic_read(&ml->ml_full_fallbacks),
+	       atomic_read(&ml->ml_busy_fallbacks),
+	       atomic_read(&ml->ml_write_errors));
+	DMEMIT("%s: mlog:", bc->bc_name);
+	for (i = 0; i < PMEM_MLOG_BATCH_HIST_BUCKETS; i++)
+		DMEMIT(" records_%u=%u", 1U << i, ml->ml_batch_hist[i]);
+	DMEMIT("\n");
+	DMEMIT("%s: mlog: checkpoints=%u checkpoint_pages=%u checkpoint_blocks=%u checkpoint_busy_retries=%u checkpoint_errors=%u\n",
+	       bc->bc_name,
+	       ml->ml_checkpoints,
+	       ml->ml_checkpoint_pages,
+	       ml->ml_checkpoint_blocks,
+	       ml->ml_checkpoint_busy_retries,
+	       ml->ml_checkpoint_errors);
+	DMEMIT("%s: mlog: " T_FMT_STRING("page_writes") " "
+	       T_FMT_STRING("checkpoints") "\n",
+	       bc->bc_name,
+	       T_FMT_ARGS(ml, ml_write_timer),
+	       T_FMT_ARGS(ml, ml_checkpoint_timer));
 	return sz;
 }
 
@@ -1335,7 +2017,7 @@ ssize_t cache_op_show_kthreads(struct bittern_cache *bc, char *result)
 	       "bgwriter_work_count=%u "
 	       "\n",
 	       bc->bc_name,
-	       KT_FMT_ARGS(bc, "bgwriter_task", bc_bgwriter_task),
+	       KT_FMT_ARGS(bc, "bgwriter_task", bc_bgwriter_workers[0].bgw_task),
 	       bc->bc_bgwriter_no_work_count, bc->bc_bgwriter_work_count);
 	DMEMIT("%s: kthreads: "
 	       KT_FMT_STRING
@@ -1343,6 +2025,25 @@ ssize_t cache_op_show_kthreads(struct bittern_cache *bc, char *result)
 	       bc->bc_name,
 	       KT_FMT_ARGS(bc, "invalidator_task", bc_invalidator_task),
 	       bc->bc_invalidator_no_work_count, bc->bc_invalidator_work_count);
+	DMEMIT("%s: kthreads: invalidator_batches: "
+	       "conf_batch_size=%u "
+	       "batches_1=%u "
+	       "batches_2=%u "
+	       "batches_4=%u "
+	       "batches_8=%u "
+	       "batches_16=%u "
+	       "batches_32=%u "
+	       "batches_64=%u "
+	       "\n",
+	       bc->bc_name,
+	       bc->bc_invalidator_conf_batch_size,
+	       bc->bc_invalidator_batch_hist[0],
+	       bc->bc_invalidator_batch_hist[1],
+	       bc->bc_invalidator_batch_hist[2],
+	       bc->bc_invalidator_batch_hist[3],
+	       bc->bc_invalidator_batch_hist[4],
+	       bc->bc_invalidator_batch_hist[5],
+	       bc->bc_invalidator_batch_hist[6]);
 	return sz;
 }
 
@@ -1350,6 +2051,7 @@ ssize_t cache_op_show_bgwriter(struct bittern_cache *bc, char *result)
 {
 	size_t sz = 0, maxlen = PAGE_SIZE;
 	unsigned int cc, avg_cluster_size, avg_cluster_size_sum;
+	unsigned int i;
 
 	DMEMIT("%s: bgwriter: "
 	       "conf_flush_on_exit=%u "
@@ -1357,13 +2059,15 @@ ssize_t cache_op_show_bgwriter(struct bittern_cache *bc, char *result)
 	       "conf_max_queue_depth_pct=%u "
 	       "conf_cluster_size=%u "
 	       "conf_policy=%s "
+	       "conf_workers=%u "
 	       "\n",
 	       bc->bc_name,
 	       bc->bc_bgwriter_conf_flush_on_exit,
 	       bc->bc_bgwriter_conf_greedyness,
 	       bc->bc_bgwriter_conf_max_queue_depth_pct,
 	       bc->bc_bgwriter_conf_cluster_size,
-	       cache_bgwriter_policy(bc));
+	       cache_bgwriter_policy(bc),
+	       bc->bc_bgwriter_conf_workers);
 	DMEMIT("%s: bgwriter: "
 	       "curr_queue_depth=%u "
 	       "curr_max_queue_depth=%u "
@@ -1407,6 +2111,13 @@ ssize_t cache_op_show_bgwriter(struct bittern_cache *bc, char *result)
 	       bc->bc_bgwriter_queue_full_count,
 	       bc->bc_bgwriter_too_young_count,
 	       bc->bc_bgwriter_ready_count);
+	DMEMIT("%s: bgwriter: conf_hot_writes=%u conf_hot_max_age_secs=%u conf_hot_max_dirty_pct=%u hot_deferred_count=%u hot_writebacks_saved=%u\n",
+	       bc->bc_name,
+	       bc->bc_bgwriter_conf_hot_writes,
+	       bc->bc_bgwriter_conf_hot_max_age_secs,
+	       bc->bc_bgwriter_conf_hot_max_dirty_pct,
+	       atomic_read(&bc->bc_bgwriter_hot_deferred_count),
+	       atomic_read(&bc->bc_bgwriter_hot_writebacks_saved));
 	DMEMIT("%s: bgwriter: " "curr_policy_0=%lu " "curr_policy_1=%lu "
 	       "curr_policy_2=%lu " "curr_policy_3=%lu " "\n", bc->bc_name,
 	       bc->bc_bgwriter_curr_policy[0], bc->bc_bgwriter_curr_policy[1],
@@ -1415,6 +2126,35 @@ ssize_t cache_op_show_bgwriter(struct bittern_cache *bc, char *result)
 	       "curr_policy_6=%lu " "curr_policy_7=%lu " "\n", bc->bc_name,
 	       bc->bc_bgwriter_curr_policy[4], bc->bc_bgwriter_curr_policy[5],
 	       bc->bc_bgwriter_curr_policy[6], bc->bc_bgwriter_curr_policy[7]);
+	for (i = 0; i < bc->bc_bgwriter_nr_workers; i++) {
+		struct cache_bgwriter_worker *bgw = &bc->bc_bgwriter_workers[i];
+
+		DMEMIT("%s: bgwriter: worker_%u: "
+		       "task=0x%llx "
+		       "nr_shards=%u "
+		       "writebacks=%u "
+		       "writebacks_per_sec=%u "
+		       "clusters=%u "
+		       "loop_count=%lu "
+		       "no_work_count=%u "
+		       "no_shard_work_count=%u "
+		       "idle_count=%u "
+		       "\n",
+		       bc->bc_name,
+		       bgw->bgw_id,
+		       (uint64_t)bgw->bgw_task,
+		       bgw->bgw_nr_shards,
+		       bgw->bgw_writebacks,
+		       bgw->bgw_writebacks_per_sec,
+		       bgw->bgw_clusters,
+		       bgw->bgw_loop_count,
+		       bgw->bgw_no_work_count,
+		       bgw->bgw_no_shard_work_count,
+		       bgw->bgw_idle_count);
+	}
+	sz += cache_bgwriter_op_show_policy_state(bc,
+						  result + sz,
+						  maxlen - sz);
 	return sz;
 }
 
@@ -1445,6 +2185,7 @@ ssize_t cache_op_show_timers(struct bittern_cache *bc, char *result)
 	       T_FMT_STRING("write_clean_hits") " "
 	       T_FMT_STRING("read_dirty_hits") " "
 	       T_FMT_STRING("write_dirty_hits") " "
+	       T_FMT_STRING("read_l1_hits") " "
 	       "\n",
 	       bc->bc_name,
 	       T_FMT_ARGS(bc, bc_timer_write_dirty_misses),
@@ -1452,7 +2193,8 @@ ssize_t cache_op_show_timers(struct bittern_cache *bc, char *result)
 	       T_FMT_ARGS(bc, bc_timer_read_clean_hits),
 	       T_FMT_ARGS(bc, bc_timer_write_clean_hits),
 	       T_FMT_ARGS(bc, bc_timer_read_dirty_hits),
-	       T_FMT_ARGS(bc, bc_timer_write_dirty_hits));
+	       T_FMT_ARGS(bc, bc_timer_write_dirty_hits),
+	       T_FMT_ARGS(bc, bc_timer_read_l1_hits));
 	DMEMIT("%s: timers: "
 	       T_FMT_STRING("writebacks") " "
 	       T_FMT_STRING("invalidations") " "
@@ -1573,6 +2315,7 @@ ssize_t cache_op_show_cache_states(struct bittern_cache *bc,
 ssize_t cache_op_show_pmem_api(struct bittern_cache *bc, char *result)
 {
 	size_t sz = 0, maxlen = PAGE_SIZE;
+	unsigned int i;
 
 	DMEMIT("%s: pmem_api: interface=%p name=%s page_size_transfer_only=%d cache_layout=%c\n",
 	       bc->bc_name,
@@ -1580,14 +2323,26 @@ ssize_t cache_op_show_pmem_api(struct bittern_cache *bc, char *result)
 	       pmem_api_name(bc),
 	       pmem_page_size_transfer_only(bc),
 	       pmem_cache_layout(bc));
-	DMEMIT("%s: pmem_api: bdev=0x%llx make_request_wq=0x%llx bdev_size_bytes=%lu bdev_size_mbytes=%lu bdev_actual_size_bytes=%lu bdev_actual_size_mbytes=%lu\n",
+	DMEMIT("%s: pmem_api: bdev=0x%llx stripe_count=%u bdev_size_bytes=%lu bdev_size_mbytes=%lu bdev_actual_size_bytes=%lu bdev_actual_size_mbytes=%lu\n",
 	       bc->bc_name,
 	       (uint64_t)bc->bc_papi.papi_bdev,
-	       (uint64_t)bc->bc_papi.papi_make_request_wq,
+	       bc->bc_papi.papi_stripe_count,
 	       bc->bc_papi.papi_bdev_size_bytes,
 	       bc->bc_papi.papi_bdev_size_bytes / (1024UL * 1024UL),
 	       bc->bc_papi.papi_bdev_actual_size_bytes,
 	       bc->bc_papi.papi_bdev_actual_size_bytes / (1024UL * 1024UL));
+	for (i = 0; i < bc->bc_papi.papi_stripe_count; i++) {
+		struct pmem_stripe *ps = &bc->bc_papi.papi_stripes[i];
+
+		DMEMIT("%s: pmem_api: stripe=%u bdev=0x%llx make_request_wq=0x%llx bdev_size_bytes=%lu bdev_size_mbytes=%lu make_req_count=%u\n",
+		       bc->bc_name,
+		       i,
+		       (uint64_t)ps->ps_bdev,
+		       (uint64_t)ps->ps_make_request_wq,
+		       ps->ps_bdev_size_bytes,
+		       ps->ps_bdev_size_bytes / (1024UL * 1024UL),
+		       atomic_read(&ps->ps_make_req_count));
+	}
 
 	return sz;
 }
@@ -1626,6 +2381,30 @@ ssize_t cache_op_show(struct kobject *kobj, struct attribute *attr, char *buf)
 	if (strncmp(attr->name, "verifier", 8) == 0)
 		return cache_op_show_verifier(bc, buf);
 
+	if (strncmp(attr->name, "resize", 6) == 0)
+		return cache_resize_op_show(bc, buf);
+
+	if (strncmp(attr->name, "pool", 4) == 0)
+		return cache_pool_op_show(bc, buf);
+
+	if (strncmp(attr->name, "numa", 4) == 0)
+		return cache_numa_op_show(bc, buf);
+
+	if (strncmp(attr->name, "io_classes", 10) == 0)
+		return cache_io_class_op_show(bc, buf);
+
+	if (strncmp(attr->name, "devio", 5) == 0)
+		return cached_devio_op_show(bc, buf);
+
+	if (strncmp(attr->name, "l1", 2) == 0)
+		return cache_op_show_l1(bc, buf);
+
+	if (strncmp(attr->name, "mlog", 4) == 0)
+		return cache_op_show_mlog(bc, buf);
+
+	if (strncmp(attr->name, "iotrace", 7) == 0)
+		return cache_iotrace_op_show(bc, buf);
+
 	if (strncmp(attr->name, "replacement", 11) == 0)
 		return cache_op_show_replacement(bc, buf);
 
@@ -1638,6 +2417,9 @@ ssize_t cache_op_show(struct kobject *kobj, struct attribute *attr, char *buf)
 	if (strncmp(attr->name, "sequential", 10) == 0)
 		return seq_bypass_stats(bc, buf, PAGE_SIZE);
 
+	if (strncmp(attr->name, "admission", 9) == 0)
+		return cache_admit_stats(bc, buf, PAGE_SIZE);
+
 	if (strncmp(attr->name, "kthreads", 8) == 0)
 		return cache_op_show_kthreads(bc, buf);
 
@@ -1780,6 +2562,46 @@ struct attribute cache_sysfs_verifier = {
 	.mode = 0444,
 };
 
+struct attribute cache_sysfs_resize = {
+	.name = "resize",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_pool = {
+	.name = "pool",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_numa = {
+	.name = "numa",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_io_classes = {
+	.name = "io_classes",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_devio = {
+	.name = "devio",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_l1 = {
+	.name = "l1",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_mlog = {
+	.name = "mlog",
+	.mode = 0444,
+};
+
+struct attribute cache_sysfs_iotrace = {
+	.name = "iotrace",
+	.mode = 0444,
+};
+
 struct attribute cache_sysfs_replacement = {
 	.name = "replacement",
 	.mode = 0444,
@@ -1800,6 +2622,11 @@ struct attribute cache_sysfs_sequential = {
 	.mode = 0444,
 };
 
+struct attribute cache_sysfs_admission = {
+	.name = "admission",
+	.mode = 0444,
+};
+
 struct attribute cache_sysfs_kthreads = {
 	.name = "kthreads",
 	.mode = 0444,
@@ -1845,10 +2672,19 @@ struct attribute *cache_stats_files[] = {
 	&cache_sysfs_build_info,
 	&cache_sysfs_trace,
 	&cache_sysfs_verifier,
+	&cache_sysfs_resize,
+	&cache_sysfs_pool,
+	&cache_sysfs_numa,
+	&cache_sysfs_io_classes,
+	&cache_sysfs_devio,
+	&cache_sysfs_l1,
+	&cache_sysfs_mlog,
+	&cache_sysfs_iotrace,
 	&cache_sysfs_replacement,
 	&cache_sysfs_cache_mode,
 	&cache_sysfs_redblack_info,
 	&cache_sysfs_sequential,
+	&cache_sysfs_admission,
 	&cache_sysfs_kthreads,
 	&cache_sysfs_timers,
 	&cache_sysfs_bgwriter,
@@ -1884,6 +2720,10 @@ int cache_sysfs_add(struct bittern_cache *bc)
 
 	ret = kobject_add(&bc->bc_kobj, cache_kobj, bc->bc_name);
 	printk_info("kobject_add=%d\n", ret);
+	if (ret != 0)
+		return ret;
+	ret = cache_snapshot_sysfs_add(bc);
+	printk_info("cache_snapshot_sysfs_add=%d\n", ret);
 	return ret;
 }
 
@@ -1942,6 +2782,16 @@ int bittern_cache_iterate_devices(struct dm_target *ti,
 	return (*fn) (ti, bc->devio.dm_dev, 0, ti->len, data);
 }
 
+void cache_set_io_limits(struct queue_limits *lim)
+{
+	blk_limits_io_min(lim, 512);
+	blk_limits_io_opt(lim, PAGE_SIZE);
+	/* blk_limits_max_hw_sectors(lim, SECTORS_PER_CACHE_BLOCK); */
+	lim->discard_alignment = PAGE_SIZE;
+	lim->max_discard_sectors = SECTORS_PER_CACHE_BLOCK * 256;
+	lim->discard_granularity = SECTORS_PER_CACHE_BLOCK;
+}
+
 void bittern_cache_io_hints(struct dm_target *ti, struct queue_limits *lim)
 {
 	struct bittern_cache *bc = ti->private;
@@ -1962,12 +2812,7 @@ void bittern_cache_io_hints(struct dm_target *ti, struct queue_limits *lim)
 
 	printk_info("bc=%p: %s: setting limits\n", bc, bc->bc_name);
 
-	blk_limits_io_min(lim, 512);
-	blk_limits_io_opt(lim, PAGE_SIZE);
-	/* blk_limits_max_hw_sectors(lim, SECTORS_PER_CACHE_BLOCK); */
-	lim->discard_alignment = PAGE_SIZE;
-	lim->max_discard_sectors = SECTORS_PER_CACHE_BLOCK * 256;
-	lim->discard_granularity = SECTORS_PER_CACHE_BLOCK;
+	cache_set_io_limits(lim);
 
 	printk_info("bc=%p: %s: done setting limits\n", bc, bc->bc_name);
 
@@ -2068,16 +2913,27 @@ int __init dm_cache_init(void)
 		return ret;
 	}
 
+	ret = dm_register_target(&cache_pool_member_target);
+	if (ret < 0) {
+		printk_err("error: pool member register failed %d\n", ret);
+		dm_unregister_target(&cache_target);
+		return ret;
+	}
+
 	printk_info("register ok\n");
 
 	cache_kobj = kobject_create_and_add("bittern", fs_kobj);
 	printk_info("bcache_kobj=%p\n", cache_kobj);
 	if (cache_kobj == NULL) {
 		printk_err("failed to allocate bittern kobj\n");
+		dm_unregister_target(&cache_pool_member_target);
 		dm_unregister_target(&cache_target);
 		return -ENOMEM;
 	}
 
+	/* not fatal, iotrace is simply not available without debugfs */
+	cache_iotrace_module_init();
+
 	printk_info("sizeof (struct bittern_cache) = %lu\n",
 		    (unsigned long)sizeof(struct bittern_cache));
 	printk_info("sizeof (struct cache_block) = %lu\n",
@@ -2101,6 +2957,9 @@ void __exit dm_cache_exit(void)
 	printk_info("bcache_kobj=%p\n", cache_kobj);
 	kobject_put(cache_kobj);
 
+	cache_iotrace_module_exit();
+
+	dm_unregister_target(&cache_pool_member_target);
 	dm_unregister_target(&cache_target);
 
 	printk_info("kmem_buffers_in_use=%u\n", kmem_buffers_in_use());
@@ -44,4 +44,74 @@ extern int cache_calculate_min_invalid(struct bittern_cache *bc,
 
 extern int cache_message(struct bittern_cache *bc, int argc, char **argv);
 
+extern void cache_block_initialize(struct bittern_cache *bc,
+				   unsigned block_id,
+				   struct cache_block *bcb);
+extern void cache_block_add(struct bittern_cache *bc,
+			    struct cache_block *bcb);
+
+/*! allocate in-memory cache block chunks needed for cache_blocks entries */
+extern int cache_blocks_alloc_chunks(struct bittern_cache *bc,
+				     uint64_t cache_blocks);
+/*!
+ * free in-memory cache block chunks not needed for cache_blocks entries.
+ * if cache_blocks is zero, also free the chunk directory.
+ */
+extern void cache_blocks_free_chunks(struct bittern_cache *bc,
+				     uint64_t cache_blocks);
+
+/*! online resize */
+extern int cache_resize_initialize(struct bittern_cache *bc);
+extern void cache_resize_deinitialize(struct bittern_cache *bc);
+extern int cache_resize_start(struct bittern_cache *bc,
+			      uint64_t cache_size_bytes);
+extern ssize_t cache_resize_op_show(struct bittern_cache *bc, char *result);
+
+/*! NUMA placement */
+extern int cache_numa_device_node(struct bittern_cache *bc);
+extern int cache_numa_chunk_node(unsigned int chunk);
+extern void cache_numa_account_chunk(struct bittern_cache *bc,
+				     struct cache_block *chunk,
+				     int delta);
+extern int cache_numa_set_node(struct bittern_cache *bc, int node);
+extern ssize_t cache_numa_op_show(struct bittern_cache *bc, char *result);
+
+/*! shared pool mode */
+extern struct target_type cache_pool_member_target;
+extern int cache_pool_initialize(struct bittern_cache *bc);
+extern void cache_pool_register(struct bittern_cache *bc);
+extern void cache_pool_unregister(struct bittern_cache *bc);
+extern void cache_pool_restore_owners(struct bittern_cache *bc);
+extern int cache_pool_set_quota(struct bittern_cache *bc,
+				unsigned int owner,
+				int min_pct,
+				int max_pct);
+extern ssize_t cache_pool_op_show(struct bittern_cache *bc, char *result);
+/*! I/O classes */
+extern void cache_io_class_initialize(struct bittern_cache *bc);
+extern void cache_io_class_restore(struct bittern_cache *bc);
+extern int cache_io_class_set_quota(struct bittern_cache *bc,
+				    unsigned int io_class,
+				    int max_pct,
+				    int pending_pct);
+extern ssize_t cache_io_class_op_show(struct bittern_cache *bc, char *result);
+/*! DRAM front tier */
+extern int cache_l1_initialize(struct bittern_cache *bc);
+extern void cache_l1_deinitialize(struct bittern_cache *bc);
+extern int cache_l1_set_max_mbytes(struct bittern_cache *bc,
+				   unsigned int max_mbytes);
+/*! binary I/O trace */
+extern void cache_iotrace_module_init(void);
+extern void cache_iotrace_module_exit(void);
+extern void cache_iotrace_initialize(struct bittern_cache *bc);
+extern void cache_iotrace_deinitialize(struct bittern_cache *bc);
+extern int cache_iotrace_set_sample(struct bittern_cache *bc,
+				    unsigned int sample);
+extern ssize_t cache_iotrace_op_show(struct bittern_cache *bc, char *result);
+/*! binary statistics snapshot */
+extern void cache_snapshot_fill(struct bittern_cache *bc, void *buf);
+extern int cache_snapshot_sysfs_add(struct bittern_cache *bc);
+/*! queue limits shared by the cache target and pool member targets */
+extern void cache_set_io_limits(struct queue_limits *lim);
+
 #endif /* BITTERN_CACHE_MODULE_H */
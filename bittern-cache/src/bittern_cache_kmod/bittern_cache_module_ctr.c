@@ -61,15 +61,15 @@ int cache_calculate_min_invalid(struct bittern_cache *bc, int min_invalid_count)
 	return 0;
 }
 
-static void __cache_block_initialize(struct bittern_cache *bc,
-				     unsigned block_id,
-				     struct cache_block *bcb)
+void cache_block_initialize(struct bittern_cache *bc,
+			    unsigned block_id,
+			    struct cache_block *bcb)
 {
 	__ASSERT_BITTERN_CACHE(bc);
 	M_ASSERT(bcb != NULL);
 	M_ASSERT(block_id >= 1);
 	M_ASSERT(block_id <= bc->bc_papi.papi_hdr.lm_cache_blocks);
-	M_ASSERT(bcb == &bc->bc_cache_blocks[block_id - 1]);
+	M_ASSERT(bcb == cache_block_from_id(bc, block_id));
 	memset(bcb, 0, sizeof(struct cache_block));
 	bcb->bcb_block_id = block_id;
 	bcb->bcb_magic1 = BCB_MAGIC1;
@@ -124,7 +124,7 @@ static void __cache_block_invalidate(struct bittern_cache *bc,
 	M_ASSERT(RB_EMPTY_NODE(&bcb->bcb_rb_node));
 }
 
-static void __cache_block_add(struct bittern_cache *bc, struct cache_block *bcb)
+void cache_block_add(struct bittern_cache *bc, struct cache_block *bcb)
 {
 	M_ASSERT(bcb->bcb_state == S_INVALID ||
 		 bcb->bcb_state == S_CLEAN ||
@@ -178,19 +178,27 @@ static void __cache_block_add(struct bittern_cache *bc, struct cache_block *bcb)
 	atomic_inc(&bc->bc_total_entries);
 }
 
+/*
+ * restore one block from its metadata, or from its index snapshot record
+ * if psr is not NULL.
+ */
 int cache_ctr_restore_block(struct bittern_cache *bc,
 			    unsigned int block_id,
-			    struct cache_block *bcb)
+			    struct cache_block *bcb,
+			    const struct pmem_snapshot_record *psr)
 {
 	struct cache_block *old_bcb;
 	unsigned int old_block_id;
 	int ret;
 	unsigned long flags;
 
-	__cache_block_initialize(bc, block_id, bcb);
+	cache_block_initialize(bc, block_id, bcb);
 
 	ASSERT(block_id == bcb->bcb_block_id);
-	ret = pmem_block_restore(bc, bcb);
+	if (psr != NULL)
+		ret = pmem_snapshot_block_restore(bc, bcb, psr);
+	else
+		ret = pmem_block_restore(bc, bcb);
 	if (ret < 0) {
 		/*
 		 * Data corruption -- we'll need to fail the whole restore.
@@ -212,7 +220,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 
 		M_ASSERT(bcb->bcb_state == S_INVALID);
 		M_ASSERT(is_sector_number_invalid(bcb->bcb_sector));
-		__cache_block_add(bc, bcb);
+		cache_block_add(bc, bcb);
 
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 
@@ -236,7 +244,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 		 * Entry is invalid, all done here.
 		 */
 
-		__cache_block_add(bc, bcb);
+		cache_block_add(bc, bcb);
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 
 		printk_debug_ratelimited("cache entry #%d is invalid, nothing to restore\n",
@@ -268,7 +276,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 		 * No old cache block, it's all good here.
 		 */
 
-		__cache_block_add(bc, bcb);
+		cache_block_add(bc, bcb);
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 
 		printk_debug_ratelimited("cache entry id=#%u, sector=%lu, state=%d(%s) restored\n",
@@ -309,7 +317,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 	 */
 	if (bcb->bcb_xid == old_bcb->bcb_xid) {
 
-		__cache_block_add(bc, bcb);
+		cache_block_add(bc, bcb);
 		__cache_block_invalidate(bc, bcb);
 
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
@@ -339,7 +347,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 	 */
 	if (bcb->bcb_xid < old_bcb->bcb_xid) {
 
-		__cache_block_add(bc, bcb);
+		cache_block_add(bc, bcb);
 		__cache_block_invalidate(bc, bcb);
 
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
@@ -361,7 +369,7 @@ int cache_ctr_restore_block(struct bittern_cache *bc,
 	 */
 
 	__cache_block_invalidate(bc, old_bcb);
-	__cache_block_add(bc, bcb);
+	cache_block_add(bc, bcb);
 
 	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 
@@ -382,10 +390,10 @@ enum cache_device_op {
 int cache_ctr_restore_or_init_block(struct bittern_cache *bc,
 				    unsigned int block_id,
 				    enum cache_device_op cache_operation,
-				    const char *cache_operation_str)
+				    const char *cache_operation_str,
+				    const struct pmem_snapshot_record *psr)
 {
-	/* block_id starts from 1, array starts from 0 */
-	struct cache_block *bcb = &bc->bc_cache_blocks[block_id - 1];
+	struct cache_block *bcb = cache_block_from_id(bc, block_id);
 	unsigned long flags;
 	int ret;
 
@@ -393,7 +401,7 @@ int cache_ctr_restore_or_init_block(struct bittern_cache *bc,
 		/*
 		 * Cache restore
 		 */
-		ret = cache_ctr_restore_block(bc, block_id, bcb);
+		ret = cache_ctr_restore_block(bc, block_id, bcb, psr);
 		if (ret < 0)
 			return ret;
 	} else {
@@ -406,8 +414,8 @@ int cache_ctr_restore_or_init_block(struct bittern_cache *bc,
 
 		spin_lock_irqsave(&bc->bc_entries_lock, flags);
 
-		__cache_block_initialize(bc, block_id, bcb);
-		__cache_block_add(bc, bcb);
+		cache_block_initialize(bc, block_id, bcb);
+		cache_block_add(bc, bcb);
 
 		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
 
@@ -500,7 +508,8 @@ void cache_ctr_restore_or_init(struct bittern_cache *bc,
 		ret = cache_ctr_restore_or_init_block(bc,
 						      block_id,
 						      r_wq->cache_op,
-						      r_wq->cache_op_str);
+						      r_wq->cache_op_str,
+						      NULL);
 		if (ret != 0) {
 			printk_err("cache entry %u:%u '%s' failed: ret=%d (corrupt/bad data)\n",
 				   block_id,
@@ -552,6 +561,77 @@ void cache_ctr_restore_or_init_wq(struct work_struct *work)
 		    r_wq->ret);
 }
 
+/*
+ * Rebuild the in-memory index from the snapshot written at clean shutdown,
+ * with one sequential pass over the snapshot area instead of reading the
+ * metadata and data of every block.
+ * Returns 0 if restored, 1 if there is no usable snapshot and all blocks
+ * need to be scanned, negative errno on error.
+ */
+static int cache_ctr_restore_snapshot(struct bittern_cache *bc,
+				      char *cache_operation_str,
+				      unsigned int *out_restored)
+{
+	struct pmem_header *pm = &bc->bc_papi.papi_hdr;
+	struct pmem_snapshot_record *psr;
+	unsigned int block_id, i;
+	uint64_t page;
+	int valid, ret;
+
+	valid = pmem_snapshot_verify(bc);
+	printk_info("%s: index snapshot: valid=%d\n", bc->bc_name, valid);
+
+	/*
+	 * used or not, the snapshot is stale as soon as the cache gets
+	 * modified, so make sure it's never trusted again.
+	 */
+	ret = pmem_header_clean_shutdown_clear(bc);
+	if (ret < 0) {
+		printk_err("%s: cannot clear clean shutdown marker, ret=%d\n",
+			   bc->bc_name,
+			   ret);
+		return ret;
+	}
+	if (valid != 0)
+		return 1;
+
+	psr = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	if (psr == NULL) {
+		printk_err("%s: kmem_alloc kmem_map failed\n", bc->bc_name);
+		return -ENOMEM;
+	}
+
+	block_id = 1;
+	for (page = 0; block_id <= pm->lm_cache_blocks; page++) {
+		ret = pmem_snapshot_read_page(bc, page, psr);
+		if (ret < 0)
+			goto out;
+		for (i = 0;
+		     i < PMEM_SNAPSHOT_RECORDS_PER_PAGE &&
+		     block_id <= pm->lm_cache_blocks;
+		     i++, block_id++) {
+			ret = cache_ctr_restore_or_init_block(bc,
+							      block_id,
+							      CACHE_DEVICE_OP_RESTORE,
+							      cache_operation_str,
+							      &psr[i]);
+			if (ret < 0) {
+				printk_err("cache entry %u '%s' from snapshot failed: ret=%d (corrupt/bad data)\n",
+					   block_id,
+					   cache_operation_str,
+					   ret);
+				goto out;
+			}
+		}
+	}
+	bc->bc_papi.papi_stats.restore_snapshot_valid = 1;
+	*out_restored = block_id - 1;
+
+out:
+	kmem_cache_free(bc->bc_kmem_map, psr);
+	return ret;
+}
+
 int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
 					 char *cache_operation_str,
 					 enum cache_device_op cache_operation)
@@ -571,13 +651,29 @@ int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
 	 * Fill it with garbage so when we can verify all blocks have been
 	 * initialized after parallel restore/init.
 	 */
-	memset(bc->bc_cache_blocks,
-	       0xac,
-	       (sizeof(struct cache_block) *
-		bc->bc_papi.papi_hdr.lm_cache_blocks));
+	for (i = 0; i < bc->bc_cache_blocks_chunks; i++)
+		memset(bc->bc_cache_blocks[i],
+		       0xac,
+		       sizeof(struct cache_block) * CACHE_BLOCKS_PER_CHUNK);
 
 	tstamp = current_kernel_time_nsec();
 
+	if (cache_operation == CACHE_DEVICE_OP_RESTORE) {
+		ret = cache_ctr_restore_snapshot(bc,
+						 cache_operation_str,
+						 &total_restored);
+		if (ret <= 0)
+			goto done;
+		/*
+		 * no clean shutdown, the metadata intent log may have block
+		 * states newer than the metadata blocks.
+		 */
+		ret = pmem_mlog_replay_load(bc);
+		if (ret < 0)
+			goto done;
+		ret = 0;
+	}
+
 	workqueues = kmem_zalloc(RESTORE_WORKQUEUES_SIZE_BYTES, GFP_NOIO);
 	if (workqueues == NULL) {
 		printk_err("%s: cannot allocate workqueue array\n",
@@ -647,6 +743,7 @@ int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
 
 	kmem_free(workqueues, RESTORE_WORKQUEUES_SIZE_BYTES);
 
+done:
 	tstamp_end = current_kernel_time_nsec();
 
 	printk_info("restore_or_init_workqueues: '%s': workqueues=%d: %llu milliseconds\n",
@@ -671,7 +768,7 @@ int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
 	for (block_id = 1;
 	     block_id <= bc->bc_papi.papi_hdr.lm_cache_blocks;
 	     block_id++) {
-		struct cache_block *bcb = &bc->bc_cache_blocks[block_id - 1];
+		struct cache_block *bcb = cache_block_from_id(bc, block_id);
 
 		__ASSERT_CACHE_BLOCK(bcb, bc);
 		M_ASSERT(bcb->bcb_state == S_INVALID ||
@@ -685,6 +782,18 @@ int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
 		  atomic_read(&bc->bc_valid_entries_clean) +
 		  atomic_read(&bc->bc_valid_entries_dirty)));
 
+	ret = pmem_mlog_replay_done(bc);
+	if (ret < 0) {
+		printk_err("%s: cannot close metadata intent log, ret=%d
+",
+			   bc->bc_name,
+			   ret);
+		return ret;
+	}
+
+	cache_pool_restore_owners(bc);
+	cache_io_class_restore(bc);
+
 	return 0;
 }
 
@@ -702,6 +811,10 @@ int cache_ctr_restore_or_init_workqueues(struct bittern_cache *bc,
  * the cache size is 1024 mbytes, of type NVDIMM, which has a device path of
  * /dev/adrbd0
  *
+ * The cache device blockdev path can also be a comma separated list of up
+ * to PMEM_MAX_STRIPES devices, in which case the cache is striped across
+ * them. The same list, in the same order, must be given on restore.
+ *
  */
 int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -711,6 +824,8 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char *cache_device_blockdev_path;
 	char *cache_operation_str;
 	enum cache_device_op cache_operation;
+	char *cache_device_path;
+	struct block_device *cache_bdevs[PMEM_MAX_STRIPES];
 
 	printk_info("argc %d\n", argc);
 	for (i = 0; i < argc; i++)
@@ -793,18 +908,6 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	 */
 	cache_sysfs_init(bc);
 
-	ret = dm_get_device(ti,
-			    cache_device_blockdev_path,
-			    FMODE_READ | FMODE_WRITE | FMODE_EXCL,
-			    &bc->bc_cache_dev);
-	if (ret != 0) {
-		printk_err("cache device lookup %s failed: ret=%d\n",
-			   cache_device_blockdev_path,
-			   ret);
-		ti->error = "cache device lookup failed";
-		goto bad_0;
-	}
-
 	/*
 	 * FIXME: need to make these string names in bittern_cache struct
 	 * consistent with arg names
@@ -815,6 +918,37 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	strlcpy(bc->bc_cache_device_name,
 		cache_device_blockdev_path,
 		sizeof(bc->bc_cache_device_name));
+
+	/*
+	 * one cache device, or a comma separated list of devices to
+	 * stripe the cache across.
+	 */
+	while ((cache_device_path = strsep(&cache_device_blockdev_path,
+					   ",")) != NULL) {
+		if (bc->bc_cache_dev_count == PMEM_MAX_STRIPES) {
+			printk_err("too many cache devices (max is %d)\n",
+				   PMEM_MAX_STRIPES);
+			ti->error = "too many cache devices";
+			ret = -EINVAL;
+			goto bad_0;
+		}
+		ret = dm_get_device(ti,
+				    cache_device_path,
+				    FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				    &bc->bc_cache_devs[bc->bc_cache_dev_count]);
+		if (ret != 0) {
+			printk_err("cache device lookup %s failed: ret=%d\n",
+				   cache_device_path,
+				   ret);
+			ti->error = "cache device lookup failed";
+			goto bad_0;
+		}
+		cache_bdevs[bc->bc_cache_dev_count] =
+				bc->bc_cache_devs[bc->bc_cache_dev_count]->bdev;
+		bc->bc_cache_dev_count++;
+	}
+	M_ASSERT(bc->bc_cache_dev_count > 0);
+	printk_info("%u cache device(s)\n", bc->bc_cache_dev_count);
 	strlcpy(bc->bc_cached_device_name,
 		cached_device_name,
 		sizeof(bc->bc_cached_device_name));
@@ -939,6 +1073,7 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	cache_timer_init(&bc->bc_timer_resource_alloc_writes);
 	cache_timer_init(&bc->defer_busy.timer);
 	cache_timer_init(&bc->defer_page.timer);
+	cache_timer_init(&bc->defer_class.timer);
 
 	bc->devio.conf_worker_delay = CACHED_DEV_WORKER_DELAY_DEFAULT;
 	bc->devio.conf_fua_insert = CACHED_DEV_FUA_INSERT_DEFAULT;
@@ -946,6 +1081,7 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	INIT_LIST_HEAD(&bc->devio.pending_list);
 	INIT_LIST_HEAD(&bc->devio.flush_pending_list);
 	INIT_DELAYED_WORK(&bc->devio.flush_delayed_work, cached_devio_flush_delayed_worker);
+	INIT_WORK(&bc->devio.flush_work, cached_devio_flush_worker);
 	bc->devio.flush_wq = alloc_workqueue("b_dvf:%s",
 					      WQ_UNBOUND,
 					      1,
@@ -960,18 +1096,30 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 
 	pmem_info_initialize(bc);
 
-	ret = pmem_allocate(bc, bc->bc_cache_dev->bdev);
+	ret = pmem_allocate(bc, cache_bdevs, bc->bc_cache_dev_count);
 	if (ret != 0) {
 		ti->error = "cannot allocate pmem resource";
 		goto bad_0;
 	}
 
+	/* kernel threads run close to the cache device by default */
+	bc->bc_numa_device_node = cache_numa_device_node(bc);
+	bc->bc_numa_node = bc->bc_numa_device_node;
+	printk_info("numa: online_nodes=%u, device_node=%d\n",
+		    num_online_nodes(), bc->bc_numa_device_node);
+
 	ret = seq_bypass_initialize(bc);
 	if (ret != 0) {
 		ti->error = "cannot allocate seq_bypass resources";
 		goto bad_1;
 	}
 
+	ret = cache_admit_initialize(bc);
+	if (ret != 0) {
+		ti->error = "cannot allocate admission filter resources";
+		goto bad_1;
+	}
+
 	ret = dm_get_device(ti,
 			    cached_device_name,
 			    FMODE_EXCL | FMODE_READ | FMODE_WRITE,
@@ -1004,6 +1152,13 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		    bc->bc_cached_device_size_bytes,
 		    bc->bc_cached_device_size_mbytes);
 
+	ret = cache_pool_initialize(bc);
+	if (ret < 0) {
+		ti->error = "cannot initialize shared pool";
+		goto bad_1;
+	}
+	cache_io_class_initialize(bc);
+
 #ifdef ENABLE_TRACK_CRC32C
 	bc->bc_tracked_hashes_num = bc->bc_cached_device_size_bytes / PAGE_SIZE;
 	printk_info("need %lu entries to track crc32c checksums on cached device\n",
@@ -1075,6 +1230,7 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	spin_lock_init(&bc->defer_lock);
 	bio_list_init(&bc->defer_busy.list);
 	bio_list_init(&bc->defer_page.list);
+	bio_list_init(&bc->defer_class.list);
 	bc->defer_wq = alloc_workqueue("dfr_wk:%s", WQ_UNBOUND, 1, bc->bc_name);
 	if (bc->defer_wq == NULL) {
 		ti->error = "cannot allocate dfr_wk workqueue";
@@ -1123,15 +1279,16 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	printk_info("bc->bc_papi.papi_hdr.lm_mcb_size_bytes=%llu\n",
 		    bc->bc_papi.papi_hdr.lm_mcb_size_bytes);
 
-	bc->bc_cache_blocks = vmalloc(sizeof(struct cache_block) *
-				      bc->bc_papi.papi_hdr.lm_cache_blocks);
+	ret = cache_blocks_alloc_chunks(bc,
+					bc->bc_papi.papi_hdr.lm_cache_blocks);
 
 	printk_info("vmalloc: bc->bc_cache_blocks = %p\n", bc->bc_cache_blocks);
-	printk_info("vmalloc: bc->bc_cache_blocks = %llu bytes\n",
-		    sizeof(struct cache_block) *
-		    bc->bc_papi.papi_hdr.lm_cache_blocks);
+	printk_info("vmalloc: bc->bc_cache_blocks = %u chunks, %llu bytes\n",
+		    bc->bc_cache_blocks_chunks,
+		    sizeof(struct cache_block) * CACHE_BLOCKS_PER_CHUNK *
+		    (uint64_t)bc->bc_cache_blocks_chunks);
 
-	if (bc->bc_cache_blocks == NULL) {
+	if (ret < 0) {
 		ti->error = "cannot allocate memory for cache_blocks";
 		printk_err("error : %s\n", ti->error);
 		goto bad_1;
@@ -1157,6 +1314,8 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	bc->bc_verifier_task = NULL;
 	bc->bc_verifier_scan_delay_ms =
 				CACHE_VERIFIER_BLOCK_SCAN_DELAY_DEFAULT_MS;
+	bc->bc_verifier_max_iops = 0;
+	bc->bc_verifier_scan_target_secs = 0;
 	bc->bc_verifier_bug_on_verify_errors = 1;
 	init_waitqueue_head(&bc->bc_verifier_wait);
 
@@ -1174,6 +1333,21 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	bc->bc_bgwriter_conf_greedyness = 0;
 	bc->bc_bgwriter_conf_max_queue_depth_pct =
 		CACHE_BGWRITER_DEFAULT_QUEUE_DEPTH_PCT;
+	bc->bc_bgwriter_conf_workers = CACHE_BGWRITER_DEFAULT_WORKERS;
+	bc->bc_bgwriter_conf_latency_target_us =
+		CACHE_BGWRITER_DEFAULT_LATENCY_TARGET_US;
+	bc->bc_bgwriter_conf_hot_writes = CACHE_BGWRITER_DEFAULT_HOT_WRITES;
+	bc->bc_bgwriter_conf_hot_max_age_secs =
+		CACHE_BGWRITER_DEFAULT_HOT_MAX_AGE_SECS;
+	bc->bc_bgwriter_conf_hot_max_dirty_pct =
+		CACHE_BGWRITER_DEFAULT_HOT_MAX_DIRTY_PCT;
+	atomic_set(&bc->bc_bgwriter_hot_deferred_count, 0);
+	atomic_set(&bc->bc_bgwriter_hot_writebacks_saved, 0);
+	for (i = 0; i < CACHE_BGWRITER_MAX_WORKERS; i++) {
+		bc->bc_bgwriter_workers[i].bgw_cache = bc;
+		bc->bc_bgwriter_workers[i].bgw_id = i;
+		bc->bc_bgwriter_workers[i].bgw_nr_shards = 1;
+	}
 	M_ASSERT(bc->bc_max_pending_requests > 0);
 	init_waitqueue_head(&bc->bc_bgwriter_wait);
 
@@ -1181,6 +1355,7 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 
 	init_waitqueue_head(&bc->bc_invalidator_wait);
 	cache_calculate_min_invalid(bc, INVALIDATOR_DEFAULT_INVALID_COUNT);
+	bc->bc_invalidator_conf_batch_size = INVALIDATOR_DEFAULT_BATCH_SIZE;
 
 	printk_info("initializing workqueues\n");
 	/*
@@ -1196,6 +1371,20 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	M_ASSERT_FIXME(bc->bc_make_request_wq != NULL);
 	cache_timer_init(&bc->bc_make_request_wq_timer);
 	atomic_set(&bc->bc_make_request_wq_count, 0);
+	atomic_set(&bc->bc_make_request_direct_count, 0);
+	bc->bc_direct_submit_enabled = 1;
+	bc->bc_one_io_commit_enabled = 1;
+	bc->bc_mlog_enabled = 0;
+
+	ret = cache_resize_initialize(bc);
+	M_ASSERT_FIXME(ret == 0);
+
+	ret = cache_l1_initialize(bc);
+	M_ASSERT_FIXME(ret == 0);
+
+	pmem_mlog_initialize(bc);
+
+	cache_iotrace_initialize(bc);
 
 	ret = schedule_delayed_work(&bc->devio.flush_delayed_work, msecs_to_jiffies(1));
 	ASSERT(ret == 1);
@@ -1264,6 +1453,9 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		 (atomic_read(&bc->bc_valid_entries) +
 		  atomic_read(&bc->bc_invalid_entries)));
 
+	/* interrupted data/metadata writes have all been rolled back */
+	pmem_one_io_restore_done(bc);
+
 	printk_info("updating pmem headers\n");
 	ret = pmem_header_update(bc, 1);
 	M_ASSERT(ret == 0);
@@ -1316,37 +1508,56 @@ int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	 */
 	printk_info("starting off kernel threads\n");
 
-	bc->bc_verifier_task = kthread_create(cache_block_verifier_kthread,
-					      bc,
-					      "b_vrf/%s",
-					      bc->bc_name);
+	bc->bc_verifier_task = kthread_create_on_node(
+						cache_block_verifier_kthread,
+						bc,
+						bc->bc_numa_node,
+						"b_vrf/%s",
+						bc->bc_name);
 	M_ASSERT_FIXME(bc->bc_verifier_task != NULL);
 	printk_info("verifier instantiated, task=%p\n", bc->bc_verifier_task);
+	cache_numa_bind_task(bc, bc->bc_verifier_task);
 	wake_up_process(bc->bc_verifier_task);
 
-	bc->bc_bgwriter_task = kthread_create(cache_bgwriter_kthread,
-					      bc,
-					      "b_bgw/%s",
-					      bc->bc_name);
-	M_ASSERT_FIXME(bc->bc_bgwriter_task != NULL);
-	printk_info("bgwriter instantiated, task=%p\n", bc->bc_bgwriter_task);
-	wake_up_process(bc->bc_bgwriter_task);
-
-	bc->bc_invalidator_task = kthread_create(cache_invalidator_kthread,
-						 bc,
-						 "b_inv/%s",
-						 bc->bc_name);
+	/* the other bgwriter workers are started by the first one */
+	bc->bc_bgwriter_nr_workers = 1;
+	bc->bc_bgwriter_workers[0].bgw_task =
+			kthread_create_on_node(cache_bgwriter_kthread,
+					       &bc->bc_bgwriter_workers[0],
+					       bc->bc_numa_node,
+					       "b_bgw/%s",
+					       bc->bc_name);
+	M_ASSERT_FIXME(bc->bc_bgwriter_workers[0].bgw_task != NULL);
+	printk_info("bgwriter instantiated, task=%p\n",
+		    bc->bc_bgwriter_workers[0].bgw_task);
+	cache_numa_bind_task(bc, bc->bc_bgwriter_workers[0].bgw_task);
+	wake_up_process(bc->bc_bgwriter_workers[0].bgw_task);
+
+	bc->bc_invalidator_task = kthread_create_on_node(
+						cache_invalidator_kthread,
+						bc,
+						bc->bc_numa_node,
+						"b_inv/%s",
+						bc->bc_name);
 	M_ASSERT_FIXME(bc->bc_invalidator_task != NULL);
 	printk_info("invalidator instantiated, task=%p\n",
 		    bc->bc_invalidator_task);
+	cache_numa_bind_task(bc, bc->bc_invalidator_task);
 	wake_up_process(bc->bc_invalidator_task);
 
+	/* members can join now */
+	cache_pool_register(bc);
+
 	printk_info("exit\n");
 
 	return 0;
 
 	/*! \todo this can be made common with _dtr() code */
 bad_2:
+	cache_iotrace_deinitialize(bc);
+	pmem_mlog_deinitialize(bc);
+	cache_l1_deinitialize(bc);
+	cache_resize_deinitialize(bc);
 	if (bc->bc_make_request_wq != NULL) {
 		printk_info("destroying make_request workqueue\n");
 		flush_workqueue(bc->bc_make_request_wq);
@@ -1375,6 +1586,7 @@ bad_1:
 	printk_info("done mem_info_deinitialize()\n");
 
 	seq_bypass_deinitialize(bc);
+	cache_admit_deinitialize(bc);
 
 bad_0:
 	printk_err("error: %s\n", ti->error);
@@ -1389,12 +1601,12 @@ bad_0:
 		printk_err("dm_put_device devio.dm_dev\n");
 		dm_put_device(ti, bc->devio.dm_dev);
 	}
-	if (bc->bc_cache_dev != NULL) {
-		printk_err("dm_put_device for cache\n");
-		dm_put_device(ti, bc->bc_cache_dev);
+	for (i = 0; i < bc->bc_cache_dev_count; i++) {
+		printk_err("dm_put_device for cache #%d\n", i);
+		dm_put_device(ti, bc->bc_cache_devs[i]);
 	}
 	if (bc->bc_cache_blocks != NULL)
-		vfree(bc->bc_cache_blocks);
+		cache_blocks_free_chunks(bc, 0);
 #ifdef ENABLE_TRACK_CRC32C
 	if (bc->bc_tracked_hashes != NULL)
 		vfree(bc->bc_tracked_hashes);
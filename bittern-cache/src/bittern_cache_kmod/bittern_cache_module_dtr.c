@@ -32,6 +32,17 @@ void cache_dtr_pre(struct dm_target *ti)
 	printk_info("enter\n");
 	printk_info("bc = %p\n", bc);
 	printk_info("bc->bc_magic1 = 0x%x\n", bc->bc_magic1);
+	/*
+	 * no more pool members can join. existing ones hold the pool
+	 * device open, so there are none left by now.
+	 */
+	cache_pool_unregister(bc);
+	/*
+	 * abort resize first, this also puts back any evacuated blocks
+	 */
+	printk_info("stopping resize\n");
+	cache_resize_deinitialize(bc);
+
 	ASSERT_BITTERN_CACHE(bc);
 
 	M_ASSERT(bc->bc_papi.papi_hdr.lm_cache_blocks ==
@@ -51,6 +62,7 @@ void cache_dtr_pre(struct dm_target *ti)
 	printk_info("bc_deferred_requests=%d\n",
 		    atomic_read(&bc->bc_deferred_requests));
 	M_ASSERT(atomic_read(&bc->bc_deferred_requests) == 0);
+	M_ASSERT(bc->defer_class.curr_count == 0);
 
 	printk_info("stopping invalidator task (task=%p)\n",
 		    bc->bc_invalidator_task);
@@ -59,11 +71,13 @@ void cache_dtr_pre(struct dm_target *ti)
 	printk_info("stopped invalidator task (task=%p): ret=%d\n",
 		    bc->bc_invalidator_task, ret);
 
-	printk_info("stopping bgwriter task (task=%p)\n", bc->bc_bgwriter_task);
-	ret = kthread_stop(bc->bc_bgwriter_task);
-	M_ASSERT(bc->bc_bgwriter_task == NULL);
+	/* the first bgwriter worker stops all the others */
+	printk_info("stopping bgwriter task (task=%p)\n",
+		    bc->bc_bgwriter_workers[0].bgw_task);
+	ret = kthread_stop(bc->bc_bgwriter_workers[0].bgw_task);
+	M_ASSERT(bc->bc_bgwriter_workers[0].bgw_task == NULL);
 	printk_info("stopped bgwriter task (task=%p): ret=%d\n",
-		    bc->bc_bgwriter_task, ret);
+		    bc->bc_bgwriter_workers[0].bgw_task, ret);
 
 	/* there can be no pending deferred requests anymore */
 	M_ASSERT(atomic_read(&bc->bc_deferred_requests) == 0);
@@ -73,13 +87,16 @@ void cache_dtr_pre(struct dm_target *ti)
 	printk_info("destroying deferred workqueue\n");
 	destroy_workqueue(bc->defer_wq);
 
-	printk_info("deferred_queues(%u/%u)\n",
+	printk_info("deferred_queues(%u/%u/%u)\n",
 		    bc->defer_busy.curr_count,
-		    bc->defer_page.curr_count);
+		    bc->defer_page.curr_count,
+		    bc->defer_class.curr_count);
 	M_ASSERT(bc->defer_busy.curr_count == 0);
 	M_ASSERT(bio_list_empty(&bc->defer_busy.list));
 	M_ASSERT(bc->defer_page.curr_count == 0);
 	M_ASSERT(bio_list_empty(&bc->defer_page.list));
+	M_ASSERT(bc->defer_class.curr_count == 0);
+	M_ASSERT(bio_list_empty(&bc->defer_class.list));
 	printk_info("deferred_requests=%u\n",
 		    atomic_read(&bc->bc_deferred_requests));
 	M_ASSERT(atomic_read(&bc->bc_deferred_requests) == 0);
@@ -130,6 +147,21 @@ void cache_dtr_pre(struct dm_target *ti)
 
 	M_ASSERT(bc->bc_magic1 == BC_MAGIC1);
 
+	/*
+	 * the snapshot goes where the metadata intent log is, so the log
+	 * needs to be checkpointed and closed first.
+	 */
+	printk_info("stopping metadata intent log\n");
+	pmem_mlog_stop(bc);
+
+	/*
+	 * all I/O has been quiesced, the in-memory index won't change anymore.
+	 * failing to save the snapshot only costs a full scan on restore.
+	 */
+	printk_info("saving index snapshot\n");
+	ret = pmem_header_clean_shutdown(bc);
+	printk_info("done saving index snapshot: ret=%d\n", ret);
+
 	printk_info("updating pmem headers\n");
 	ret = pmem_header_update(bc, 1);
 	printk_info("done updating pmem headers\n");
@@ -137,6 +169,7 @@ void cache_dtr_pre(struct dm_target *ti)
 
 	printk_info("cancelling dev_flush delayed_work\n");
 	cancel_delayed_work(&bc->devio.flush_delayed_work);
+	cancel_work_sync(&bc->devio.flush_work);
 	printk_info("flushing dev_flush workqueue\n");
 	M_ASSERT(bc->devio.flush_wq != NULL);
 	flush_workqueue(bc->devio.flush_wq);
@@ -167,6 +200,12 @@ void cache_dtr(struct dm_target *ti)
 
 	printk_info("bc = %p\n", bc);
 	printk_info("bc->bc_magic1 = 0x%x\n", bc->bc_magic1);
+	/*
+	 * abort resize first, this also puts back any evacuated blocks
+	 */
+	printk_info("stopping resize\n");
+	cache_resize_deinitialize(bc);
+
 	ASSERT_BITTERN_CACHE(bc);
 
 	M_ASSERT(bc->bc_papi.papi_hdr.lm_cache_blocks ==
@@ -177,7 +216,8 @@ void cache_dtr(struct dm_target *ti)
 	memset(entries_state_map, 0xff, atomic_read(&bc->bc_total_entries) + 1);
 
 	ASSERT_BITTERN_CACHE(bc);
-	ASSERT(bc->bc_cache_dev->bdev == bc->bc_papi.papi_bdev);
+	ASSERT(bc->bc_cache_devs[0]->bdev == bc->bc_papi.papi_bdev);
+	ASSERT(bc->bc_cache_dev_count == bc->bc_papi.papi_stripe_count);
 
 	bc_total_entries = atomic_read(&bc->bc_total_entries);
 
@@ -312,8 +352,7 @@ void cache_dtr(struct dm_target *ti)
 			 entries_state_map[i] == S_CLEAN ||
 			 entries_state_map[i] == S_DIRTY);
 		if (entries_state_map[i] == 0xff) {
-			/* block_id starts from 1, array starts from 0 */
-			struct cache_block *bcb = &bc->bc_cache_blocks[i - 1];
+			struct cache_block *bcb = cache_block_from_id(bc, i);
 
 			printk_err("orphan entry cache block_id=#%d, bcb_sector=%lu, state=%d(%s), refcount=%d, hash_data=" UINT128_FMT "\n",
 				    bcb->bcb_block_id,
@@ -355,6 +394,17 @@ void cache_dtr(struct dm_target *ti)
 
 	/* deinitialize seq_bypass */
 	seq_bypass_deinitialize(bc);
+	cache_admit_deinitialize(bc);
+
+	printk_info("mlog deinitialize\n");
+	pmem_mlog_deinitialize(bc);
+
+	/* free the DRAM front tier, its buffers come from bc_kmem_map */
+	printk_info("l1 deinitialize\n");
+	cache_l1_deinitialize(bc);
+
+	printk_info("iotrace deinitialize\n");
+	cache_iotrace_deinitialize(bc);
 
 	printk_info("pmem_deallocate\n");
 	pmem_deallocate(bc);
@@ -371,8 +421,10 @@ void cache_dtr(struct dm_target *ti)
 	printk_info("dm_put_device devio.dm_dev\n");
 	dm_put_device(ti, bc->devio.dm_dev);
 
-	printk_info("dm_put_device bc_cache_dev\n");
-	dm_put_device(ti, bc->bc_cache_dev);
+	for (i = 0; i < bc->bc_cache_dev_count; i++) {
+		printk_info("dm_put_device bc_cache_devs[%d]\n", i);
+		dm_put_device(ti, bc->bc_cache_devs[i]);
+	}
 
 #ifdef ENABLE_TRACK_CRC32C
 	M_ASSERT(bc->bc_tracked_hashes != NULL);
@@ -388,7 +440,7 @@ void cache_dtr(struct dm_target *ti)
 
 	printk_info("vfree(bc->bc_cache_blocks)\n");
 	M_ASSERT(bc->bc_cache_blocks != NULL);
-	vfree(bc->bc_cache_blocks);
+	cache_blocks_free_chunks(bc, 0);
 
 	printk_info("vfree(bc)\n");
 	M_ASSERT(bc != NULL);
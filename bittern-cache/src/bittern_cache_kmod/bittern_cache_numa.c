@@ -0,0 +1,148 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * NUMA placement.
+ *
+ * Cache block lookups are spread evenly over the whole cache, so the
+ * chunks of the in-memory cache block array are interleaved over the
+ * online nodes, one chunk per node in turn. This way no single node
+ * carries all of the metadata traffic.
+ *
+ * Work items are allocated on the node of the cpu which submits the
+ * request. They are mostly touched by the submitter and by the completion
+ * path, which the block layer usually runs on the submitting cpu.
+ *
+ * The kernel threads (verifier, bgwriter workers, invalidator) are bound
+ * to the cpus of the node closest to the cache device, which is found by
+ * walking up the device tree of the first cache device. They can be bound
+ * to another node, or unbound, with the "numa_node" conf param.
+ */
+
+/*! node of the first device in the device tree of bdev which has one */
+static int cache_numa_bdev_node(struct block_device *bdev)
+{
+	struct device *dev;
+
+	if (bdev == NULL || bdev->bd_disk == NULL)
+		return NUMA_NO_NODE;
+	for (dev = disk_to_dev(bdev->bd_disk); dev != NULL; dev = dev->parent)
+		if (dev_to_node(dev) != NUMA_NO_NODE)
+			return dev_to_node(dev);
+	return NUMA_NO_NODE;
+}
+
+int cache_numa_device_node(struct bittern_cache *bc)
+{
+	/* with striped cache devices, the first one decides */
+	return cache_numa_bdev_node(bc->bc_papi.papi_stripes[0].ps_bdev);
+}
+
+int cache_numa_chunk_node(unsigned int chunk)
+{
+	unsigned int nr_nodes = num_online_nodes();
+	unsigned int n;
+	int nid;
+
+	if (nr_nodes <= 1)
+		return NUMA_NO_NODE;
+	n = chunk % nr_nodes;
+	for_each_online_node(nid) {
+		if (n-- == 0)
+			return nid;
+	}
+	return NUMA_NO_NODE;
+}
+
+void cache_numa_account_chunk(struct bittern_cache *bc,
+			      struct cache_block *chunk,
+			      int delta)
+{
+	int nid;
+
+	/* the node actually used, vmalloc_node() can fall back */
+	nid = page_to_nid(vmalloc_to_page(chunk));
+	if (nid >= 0 && nid < CACHE_NUMA_MAX_NODES)
+		atomic_add(delta, &bc->bc_numa_nodes[nid].cnn_chunks);
+}
+
+void cache_numa_bind_task(struct bittern_cache *bc, struct task_struct *task)
+{
+	int node = bc->bc_numa_node;
+	int ret;
+
+	if (task == NULL)
+		return;
+	/* a memory only node has no cpus to bind to */
+	if (node == NUMA_NO_NODE || cpumask_empty(cpumask_of_node(node)))
+		ret = set_cpus_allowed_ptr(task, cpu_possible_mask);
+	else
+		ret = set_cpus_allowed_ptr(task, cpumask_of_node(node));
+	if (ret != 0)
+		printk_warning("%s: cannot bind task %p to node %d: %d\n",
+			       bc->bc_name, task, node, ret);
+}
+
+int cache_numa_set_node(struct bittern_cache *bc, int node)
+{
+	unsigned int i;
+
+	if (node != NUMA_NO_NODE &&
+	    (node < 0 || node >= MAX_NUMNODES || !node_online(node)))
+		return -EINVAL;
+
+	bc->bc_numa_node = node;
+	printk_info("%s: binding kernel threads to node %d\n",
+		    bc->bc_name, node);
+
+	cache_numa_bind_task(bc, bc->bc_verifier_task);
+	cache_numa_bind_task(bc, bc->bc_invalidator_task);
+	for (i = 0; i < bc->bc_bgwriter_nr_workers; i++)
+		cache_numa_bind_task(bc, bc->bc_bgwriter_workers[i].bgw_task);
+
+	return 0;
+}
+
+ssize_t cache_numa_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	int nid;
+
+	DMEMIT("%s: numa: online_nodes=%u device_node=%d numa_node=%d\n",
+	       bc->bc_name,
+	       num_online_nodes(),
+	       bc->bc_numa_device_node,
+	       bc->bc_numa_node);
+	for_each_online_node(nid) {
+		struct cache_numa_node *cnn;
+
+		if (nid >= CACHE_NUMA_MAX_NODES)
+			break;
+		cnn = &bc->bc_numa_nodes[nid];
+		DMEMIT("%s: numa: node_%d: chunks=%u wi_allocs=%u wi_remote_frees=%u\n",
+		       bc->bc_name,
+		       nid,
+		       atomic_read(&cnn->cnn_chunks),
+		       atomic_read(&cnn->cnn_wi_allocs),
+		       atomic_read(&cnn->cnn_wi_remote_frees));
+	}
+	return sz;
+}
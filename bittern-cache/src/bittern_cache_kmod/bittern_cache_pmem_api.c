@@ -39,6 +39,10 @@ void pmem_info_initialize(struct bittern_cache *bc)
 	ps->restore_valid_dirty_data_blocks = 0;
 	ps->restore_hash_corrupt_metadata_blocks = 0;
 	ps->restore_hash_corrupt_data_blocks = 0;
+	ps->restore_torn_one_io_blocks = 0;
+	ps->restore_mlog_pages = 0;
+	ps->restore_mlog_records = 0;
+	ps->restore_mlog_replayed_blocks = 0;
 	atomic_set(&ps->metadata_read_async_count, 0);
 	atomic_set(&ps->metadata_write_async_count, 0);
 	atomic_set(&ps->data_get_put_page_pending_count, 0);
@@ -47,6 +51,7 @@ void pmem_info_initialize(struct bittern_cache *bc)
 	atomic_set(&ps->data_get_page_write_count, 0);
 	atomic_set(&ps->data_put_page_write_count, 0);
 	atomic_set(&ps->data_put_page_write_metadata_count, 0);
+	atomic_set(&ps->data_put_page_write_one_io_count, 0);
 	atomic_set(&ps->data_convert_page_read_to_write_count, 0);
 	atomic_set(&ps->data_clone_read_page_to_write_page_count, 0);
 	cache_timer_init(&ps->metadata_read_async_timer);
@@ -72,6 +77,7 @@ void pmem_info_initialize(struct bittern_cache *bc)
 	cache_timer_init(&ps->pmem_write_4k_timer);
 	atomic_set(&ps->pmem_make_req_wq_count, 0);
 	cache_timer_init(&ps->pmem_make_req_wq_timer);
+	atomic_set(&ps->pmem_make_req_direct_count, 0);
 	printk_info("%p: done\n", bc);
 }
 
@@ -191,6 +197,25 @@ void pmem_context_destroy(struct bittern_cache *bc,
 	}
 }
 
+/*! size of the index snapshot area for the given number of cache blocks */
+static uint64_t pmem_snapshot_size_bytes(uint64_t cache_blocks)
+{
+	return round_up(cache_blocks * sizeof(struct pmem_snapshot_record),
+			(uint64_t)PAGE_SIZE);
+}
+
+/*!
+ * Number of cache blocks which fit in data_metadata_size bytes with the
+ * interleaved layout. Room is left past the last block for the index
+ * snapshot written at clean shutdown, which costs 64 bytes per block.
+ */
+static uint64_t pmem_interleaved_cache_blocks(uint64_t data_metadata_size)
+{
+	if (data_metadata_size <= PAGE_SIZE)
+		return 0;
+	return (data_metadata_size - PAGE_SIZE) /
+	       ((uint64_t)PAGE_SIZE * 2 + sizeof(struct pmem_snapshot_record));
+}
 
 void pmem_initialize_pmem_header_sizes(struct bittern_cache *bc,
 				       uint64_t device_cache_size_bytes)
@@ -287,7 +312,7 @@ void pmem_initialize_pmem_header_sizes(struct bittern_cache *bc,
 		pm->lm_mcb_size_bytes = PAGE_SIZE;
 		printk_info("pm->lm_mcb_size_bytes = %llu\n",
 			    pm->lm_mcb_size_bytes);
-		cache_blocks = data_metadata_size / ((uint64_t)PAGE_SIZE * 2);
+		cache_blocks = pmem_interleaved_cache_blocks(data_metadata_size);
 		pm->lm_cache_blocks = cache_blocks;
 		printk_info("pm->lm_cache_blocks = %llu\n",
 			    pm->lm_cache_blocks);
@@ -670,6 +695,18 @@ int pmem_header_restore(struct bittern_cache *bc)
 		}
 	}
 
+	if (max_t(uint64_t, pm->lm_stripe_count, 1) != pa->papi_stripe_count) {
+		printk_err("stripe count mismatch %llu/%u\n",
+			   max_t(uint64_t, pm->lm_stripe_count, 1),
+			   pa->papi_stripe_count);
+		return -EINVAL;
+	}
+	ret = pmem_stripe_verify_block(bc, pm);
+	if (ret != 0) {
+		printk_err("stripe verification failed, ret=%d\n", ret);
+		return ret;
+	}
+
 	ASSERT(pa->papi_bdev_size_bytes > 0);
 	ASSERT(pa->papi_bdev != NULL);
 	if (pm->lm_cache_size_bytes < pa->papi_bdev_size_bytes) {
@@ -700,6 +737,17 @@ int pmem_header_restore(struct bittern_cache *bc)
 
 	__pmem_assert_offsets(bc);
 
+	/*
+	 * writes of the restored epoch may have been interrupted, so the
+	 * acked epoch cannot move until all blocks have been restored.
+	 */
+	pa->papi_one_io_epoch = pm->lm_one_io_epoch + 1;
+	pa->papi_one_io_restore_acked_epoch = pm->lm_one_io_acked_epoch;
+	pa->papi_one_io_restoring = true;
+	printk_info("one_io_epoch=%llu, one_io_acked_epoch=%llu\n",
+		    pm->lm_one_io_epoch,
+		    pm->lm_one_io_acked_epoch);
+
 	printk_info("cache '%s' on '%s' restore ok, %llu cache blocks\n",
 			pm->lm_name,
 			pm->lm_device_name,
@@ -710,6 +758,49 @@ int pmem_header_restore(struct bittern_cache *bc)
 	return 0;
 }
 
+/*!
+ * Read the epoch recorded by a @ref MCBM_MAGIC_ONE_IO write of this block.
+ * Returns 0 and sets *out_epoch to 0 if the record is not valid.
+ */
+static int pmem_block_one_io_epoch(struct bittern_cache *bc,
+				   const struct pmem_block_metadata *pmbm,
+				   uint64_t *out_epoch)
+{
+	struct pmem_block_one_io_record *pbor;
+	void *buffer_vaddr;
+	int ret;
+
+	*out_epoch = 0;
+	if (bc->bc_papi.papi_hdr.lm_cache_layout != CACHE_LAYOUT_INTERLEAVED)
+		return 0;
+
+	buffer_vaddr = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	if (buffer_vaddr == NULL) {
+		printk_err("%s: kmem_alloc kmem_map failed\n", bc->bc_name);
+		return -ENOMEM;
+	}
+	ret = pmem_read_sync(bc,
+		__cache_block_id_2_metadata_pmem_offset(bc, pmbm->pmbm_block_id),
+		buffer_vaddr,
+		PAGE_SIZE);
+	if (ret != 0) {
+		ASSERT(ret < 0);
+		printk_err("%s: pmem_read_sync failed, ret=%d\n",
+			   bc->bc_name,
+			   ret);
+		kmem_cache_free(bc->bc_kmem_map, buffer_vaddr);
+		return ret;
+	}
+	pbor = (struct pmem_block_one_io_record *)
+		((struct pmem_block_metadata *)buffer_vaddr + 1);
+	if (pbor->pbor_magic == MCBM_ONE_IO_RECORD_MAGIC &&
+	    pbor->pbor_block_id == pmbm->pmbm_block_id &&
+	    pbor->pbor_xid == pmbm->pmbm_xid)
+		*out_epoch = pbor->pbor_epoch;
+	kmem_cache_free(bc->bc_kmem_map, buffer_vaddr);
+	return 0;
+}
+
 /*
  * return values:
  * - negative errno values for unrecoverable data corruption.
@@ -726,6 +817,7 @@ int pmem_block_restore(struct bittern_cache *bc,
 	struct page *buffer_page;
 	struct pmem_api *pa = &bc->bc_papi;
 	int block_id;
+	unsigned int owner;
 
 	ASSERT(bc != NULL);
 	ASSERT(pa->papi_bdev_size_bytes > 0);
@@ -769,7 +861,8 @@ int pmem_block_restore(struct bittern_cache *bc,
 	/*
 	 * this can only happen if pmem is corrupt
 	 */
-	if (pmbm->pmbm_magic != MCBM_MAGIC) {
+	if (pmbm->pmbm_magic != MCBM_MAGIC &&
+	    pmbm->pmbm_magic != MCBM_MAGIC_ONE_IO) {
 		pa->papi_stats.restore_corrupt_metadata_blocks++;
 		printk_err("block id #%u: error: magic number(s) mismatch, magic=0x%x/0x%x\n",
 			   block_id,
@@ -809,6 +902,15 @@ int pmem_block_restore(struct bittern_cache *bc,
 		return -EHWPOISON;
 	}
 
+	/*
+	 * the metadata intent log may have a newer state for this block
+	 */
+	ret = pmem_mlog_replay_block(bc, pmbm);
+	if (ret < 0) {
+		kmem_free(pmbm, sizeof(struct pmem_block_metadata));
+		return ret;
+	}
+
 	if (pmbm->pmbm_status == S_INVALID) {
 		printk_info_ratelimited("block id #%u: warning: metadata cache status is %u(%s), nothing to restore\n",
 					block_id,
@@ -850,6 +952,22 @@ int pmem_block_restore(struct bittern_cache *bc,
 	ASSERT(block_id == pmbm->pmbm_block_id);
 	ASSERT(is_sector_cache_aligned(pmbm->pmbm_device_sector));
 
+	/*
+	 * shared pool owner. the owner field used to be padding, so it can
+	 * only be checked against the sector for pool member blocks.
+	 */
+	owner = cache_pool_sector_owner(pmbm->pmbm_device_sector);
+	if (owner >= CACHE_POOL_MAX_OWNERS ||
+	    (owner != 0 && pmbm->pmbm_owner != owner)) {
+		printk_err("block id #%u: pool owner mismatch: sector=%llu, owner=%u\n",
+			   block_id,
+			   pmbm->pmbm_device_sector,
+			   pmbm->pmbm_owner);
+		pa->papi_stats.restore_corrupt_metadata_blocks++;
+		kmem_free(pmbm, sizeof(struct pmem_block_metadata));
+		return -EHWPOISON;
+	}
+
 	buffer_vaddr = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
 	/*TODO_ADD_ERROR_INJECTION*/
 	if (buffer_vaddr == NULL) {
@@ -890,6 +1008,39 @@ int pmem_block_restore(struct bittern_cache *bc,
 
 	kmem_cache_free(bc->bc_kmem_map, buffer_vaddr);
 
+	if (uint128_ne(hash_data, pmbm->pmbm_hash_data) &&
+	    pmbm->pmbm_magic == MCBM_MAGIC_ONE_IO) {
+		uint64_t epoch;
+
+		ret = pmem_block_one_io_epoch(bc, pmbm, &epoch);
+		if (ret < 0) {
+			kmem_free(pmbm, sizeof(struct pmem_block_metadata));
+			return ret;
+		}
+		if (epoch > pa->papi_one_io_restore_acked_epoch) {
+			/*
+			 * data and metadata were written by the same request,
+			 * which had not completed when the header was last
+			 * written, so the crash may have hit before all of it
+			 * made it to the device. roll it back.
+			 */
+			printk_warning("block id #%u: data hash mismatch on data/metadata write, epoch=%llu, transaction rolled back\n",
+				       block_id,
+				       epoch);
+			pa->papi_stats.restore_torn_one_io_blocks++;
+			kmem_free(pmbm, sizeof(struct pmem_block_metadata));
+			return 0;
+		}
+		/*
+		 * the write had completed, or its record is missing:
+		 * this is data corruption.
+		 */
+		printk_err("block id #%u: data hash mismatch on completed data/metadata write, epoch=%llu, acked_epoch=%llu\n",
+			   block_id,
+			   epoch,
+			   pa->papi_one_io_restore_acked_epoch);
+	}
+
 	if (uint128_ne(hash_data, pmbm->pmbm_hash_data)) {
 		printk_err("block id #%u: data hash mismatch: stored_hash_data=" UINT128_FMT ", computed_hash_data" UINT128_FMT "\n",
 			   block_id,
@@ -981,6 +1132,12 @@ int pmem_header_initialize(struct bittern_cache *bc)
 
 	pm->lm_xid_first = 1ULL;
 	pm->lm_xid_current = 1ULL;
+	pm->lm_stripe_count = pa->papi_stripe_count;
+	pm->lm_one_io_epoch = 1ULL;
+	pm->lm_one_io_acked_epoch = 0ULL;
+	pa->papi_one_io_epoch = pm->lm_one_io_epoch;
+	pa->papi_one_io_restoring = false;
+	printk_info("pm->lm_stripe_count=%llu\n", pm->lm_stripe_count);
 
 	__pmem_assert_offsets(bc);
 
@@ -1068,6 +1225,7 @@ int pmem_metadata_initialize(struct bittern_cache *bc, unsigned int block_id)
 	pmbm->pmbm_block_id = block_id;
 	pmbm->pmbm_status = S_INVALID;
 	pmbm->pmbm_device_sector = -1;
+	pmbm->pmbm_owner = 0;
 	pmbm->pmbm_xid = 0;
 	pmbm->pmbm_hash_data = UINT128_ZERO;
 	pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
@@ -1099,7 +1257,41 @@ int pmem_metadata_initialize(struct bittern_cache *bc, unsigned int block_id)
 	return 0;
 }
 
-int pmem_header_update(struct bittern_cache *bc, int update_both)
+/*!
+ * Advance the epoch of one request data/metadata writes if all the writes
+ * of the previous epoch have completed. The previous epoch is then
+ * recorded as acked by the header update which is about to be written.
+ */
+static void pmem_one_io_advance(struct pmem_api *pa)
+{
+	unsigned long flags;
+	uint64_t epoch;
+
+	spin_lock_irqsave(&pa->papi_one_io_lock, flags);
+	epoch = pa->papi_one_io_epoch;
+	if (!pa->papi_one_io_restoring &&
+	    pa->papi_one_io_inflight[(epoch - 1) & 1] == 0) {
+		pa->papi_hdr.lm_one_io_acked_epoch = epoch - 1;
+		pa->papi_one_io_epoch = ++epoch;
+	}
+	pa->papi_hdr.lm_one_io_epoch = epoch;
+	spin_unlock_irqrestore(&pa->papi_one_io_lock, flags);
+}
+
+void pmem_one_io_restore_done(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pa->papi_one_io_lock, flags);
+	pa->papi_one_io_restoring = false;
+	spin_unlock_irqrestore(&pa->papi_one_io_lock, flags);
+}
+
+/*! update header, caller needs to hold papi_hdr_mutex */
+static int __pmem_header_update(struct bittern_cache *bc,
+				int update_both,
+				bool force)
 {
 	int ret;
 	struct pmem_api *pa = &bc->bc_papi;
@@ -1109,13 +1301,15 @@ int pmem_header_update(struct bittern_cache *bc, int update_both)
 	ASSERT(pa->papi_bdev_size_bytes > 0);
 	ASSERT(pa->papi_bdev != NULL);
 	ASSERT(sizeof(struct pmem_header) == PAGE_SIZE);
+	ASSERT(mutex_is_locked(&pa->papi_hdr_mutex));
 
 	M_ASSERT(pa->papi_hdr.lm_xid_current <= cache_xid_get(bc));
 
-	if (pa->papi_hdr.lm_xid_current == cache_xid_get(bc))
+	if (pa->papi_hdr.lm_xid_current == cache_xid_get(bc) && !force)
 		return 0;
 
 	pa->papi_hdr.lm_xid_current = cache_xid_get(bc);
+	pmem_one_io_advance(pa);
 
 	if (pa->papi_hdr_updated_last == 1 || update_both) {
 		/*
@@ -1166,6 +1360,480 @@ int pmem_header_update(struct bittern_cache *bc, int update_both)
 	return 0;
 }
 
+int pmem_header_update(struct bittern_cache *bc, int update_both)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	int ret;
+
+	mutex_lock(&pa->papi_hdr_mutex);
+	ret = __pmem_header_update(bc, update_both, false);
+	mutex_unlock(&pa->papi_hdr_mutex);
+
+	return ret;
+}
+
+/*! chain the hash of one snapshot page into the running snapshot hash */
+static uint128_t pmem_snapshot_hash_page(uint128_t hash, const void *page)
+{
+	uint128_t h[2];
+
+	h[0] = hash;
+	h[1] = murmurhash3_128(page, PAGE_SIZE);
+	return murmurhash3_128(h, sizeof(h));
+}
+
+int pmem_header_clean_shutdown(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	struct pmem_snapshot_record *psr;
+	uint64_t cache_blocks = pm->lm_cache_blocks;
+	uint64_t offset = pm->lm_cache_size_bytes;
+	uint128_t hash = UINT128_ZERO;
+	unsigned int block_id, i;
+	int ret = 0;
+
+	ASSERT(sizeof(struct pmem_snapshot_record) == 64);
+	ASSERT(PMEM_SNAPSHOT_RECORDS_PER_PAGE * 64 == PAGE_SIZE);
+	M_ASSERT((offset % PAGE_SIZE) == 0);
+
+	if (offset + pmem_snapshot_size_bytes(cache_blocks) >
+	    pa->papi_bdev_size_bytes) {
+		printk_info("%s: no room for index snapshot, next restore will scan all blocks\n",
+			    bc->bc_name);
+		return 0;
+	}
+
+	psr = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (psr == NULL) {
+		printk_err("%s: kmem_alloc kmem_map failed\n", bc->bc_name);
+		return -ENOMEM;
+	}
+
+	i = 0;
+	for (block_id = 1; block_id <= cache_blocks; block_id++) {
+		struct cache_block *bcb = cache_block_from_id(bc, block_id);
+
+		M_ASSERT(bcb->bcb_state == S_INVALID ||
+			 bcb->bcb_state == S_CLEAN ||
+			 bcb->bcb_state == S_DIRTY);
+		if (i == 0)
+			memset(psr, 0, PAGE_SIZE);
+		psr[i].psr_block_id = block_id;
+		psr[i].psr_status = bcb->bcb_state;
+		psr[i].psr_device_sector = bcb->bcb_sector;
+		psr[i].psr_xid = bcb->bcb_xid;
+		psr[i].psr_hash_data = bcb->bcb_hash_data;
+		if (++i < PMEM_SNAPSHOT_RECORDS_PER_PAGE &&
+		    block_id < cache_blocks)
+			continue;
+
+		hash = pmem_snapshot_hash_page(hash, psr);
+		ret = pmem_write_sync(bc, offset, psr, PAGE_SIZE);
+		/*TODO_ADD_ERROR_INJECTION*/
+		if (ret != 0) {
+			ASSERT(ret < 0);
+			printk_err("%s: pmem_write_sync snapshot failed, ret=%d\n",
+				   bc->bc_name,
+				   ret);
+			break;
+		}
+		offset += PAGE_SIZE;
+		i = 0;
+	}
+
+	kmem_cache_free(bc->bc_kmem_map, psr);
+	if (ret != 0)
+		return ret;
+
+	/*
+	 * the snapshot is on the cache device, now mark the cache as cleanly
+	 * shut down. the header update is forced, the xid might not have
+	 * changed since the last update.
+	 */
+	mutex_lock(&pa->papi_hdr_mutex);
+	pm->lm_snapshot_offset_bytes = pm->lm_cache_size_bytes;
+	pm->lm_snapshot_blocks = cache_blocks;
+	pm->lm_snapshot_hash = hash;
+	pm->lm_clean_shutdown_xid = cache_xid_get(bc);
+	ret = __pmem_header_update(bc, 1, true);
+	mutex_unlock(&pa->papi_hdr_mutex);
+
+	printk_info("%s: index snapshot of %llu blocks saved at offset %llu, clean_shutdown_xid=%llu: ret=%d\n",
+		    bc->bc_name,
+		    pm->lm_snapshot_blocks,
+		    pm->lm_snapshot_offset_bytes,
+		    pm->lm_clean_shutdown_xid,
+		    ret);
+	return ret;
+}
+
+int pmem_header_clean_shutdown_clear(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	int ret;
+
+	if (pm->lm_clean_shutdown_xid == 0)
+		return 0;
+
+	mutex_lock(&pa->papi_hdr_mutex);
+	pm->lm_clean_shutdown_xid = 0;
+	pm->lm_snapshot_offset_bytes = 0;
+	pm->lm_snapshot_blocks = 0;
+	pm->lm_snapshot_hash = UINT128_ZERO;
+	ret = __pmem_header_update(bc, 1, true);
+	mutex_unlock(&pa->papi_hdr_mutex);
+
+	return ret;
+}
+
+int pmem_header_mlog_open(struct bittern_cache *bc,
+			  uint64_t offset_bytes,
+			  uint64_t pages,
+			  uint64_t *out_epoch)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	int ret;
+
+	mutex_lock(&pa->papi_hdr_mutex);
+	pm->lm_mlog_last_epoch++;
+	pm->lm_mlog_epoch = pm->lm_mlog_last_epoch;
+	pm->lm_mlog_offset_bytes = offset_bytes;
+	pm->lm_mlog_pages = pages;
+	*out_epoch = pm->lm_mlog_epoch;
+	ret = __pmem_header_update(bc, 1, true);
+	mutex_unlock(&pa->papi_hdr_mutex);
+
+	return ret;
+}
+
+int pmem_header_mlog_close(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	int ret;
+
+	if (pm->lm_mlog_epoch == 0)
+		return 0;
+
+	mutex_lock(&pa->papi_hdr_mutex);
+	pm->lm_mlog_epoch = 0;
+	ret = __pmem_header_update(bc, 1, true);
+	mutex_unlock(&pa->papi_hdr_mutex);
+
+	return ret;
+}
+
+int pmem_snapshot_read_page(struct bittern_cache *bc,
+			    uint64_t page,
+			    struct pmem_snapshot_record *psr)
+{
+	struct pmem_header *pm = &bc->bc_papi.papi_hdr;
+	int ret;
+
+	ASSERT(page * PAGE_SIZE <
+	       pmem_snapshot_size_bytes(pm->lm_snapshot_blocks));
+	ret = pmem_read_sync(bc,
+			     pm->lm_snapshot_offset_bytes + page * PAGE_SIZE,
+			     psr,
+			     PAGE_SIZE);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (ret != 0) {
+		ASSERT(ret < 0);
+		printk_err("%s: pmem_read_sync snapshot page %llu failed, ret=%d\n",
+			   bc->bc_name,
+			   page,
+			   ret);
+	}
+	return ret;
+}
+
+int pmem_snapshot_verify(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	struct pmem_snapshot_record *psr;
+	uint128_t hash = UINT128_ZERO;
+	unsigned int block_id, i;
+	uint64_t page;
+	int ret = 0;
+
+	if (pm->lm_clean_shutdown_xid == 0 ||
+	    pm->lm_clean_shutdown_xid != pm->lm_xid_current) {
+		printk_info("%s: no clean shutdown, clean_shutdown_xid=%llu, xid_current=%llu\n",
+			    bc->bc_name,
+			    pm->lm_clean_shutdown_xid,
+			    pm->lm_xid_current);
+		return -ENOENT;
+	}
+	if (pm->lm_snapshot_blocks != pm->lm_cache_blocks ||
+	    pm->lm_snapshot_offset_bytes < pm->lm_cache_size_bytes ||
+	    (pm->lm_snapshot_offset_bytes % PAGE_SIZE) != 0 ||
+	    pm->lm_snapshot_offset_bytes +
+	    pmem_snapshot_size_bytes(pm->lm_snapshot_blocks) >
+	    pa->papi_bdev_size_bytes) {
+		printk_err("%s: index snapshot geometry mismatch, offset=%llu, blocks=%llu/%llu\n",
+			   bc->bc_name,
+			   pm->lm_snapshot_offset_bytes,
+			   pm->lm_snapshot_blocks,
+			   pm->lm_cache_blocks);
+		return -EINVAL;
+	}
+
+	psr = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (psr == NULL) {
+		printk_err("%s: kmem_alloc kmem_map failed\n", bc->bc_name);
+		return -ENOMEM;
+	}
+
+	/*
+	 * besides the hash, check every record here, so that once we start
+	 * adding blocks to the in-memory index we won't need to back out.
+	 */
+	block_id = 1;
+	for (page = 0; block_id <= pm->lm_cache_blocks; page++) {
+		ret = pmem_snapshot_read_page(bc, page, psr);
+		if (ret != 0)
+			goto out;
+		hash = pmem_snapshot_hash_page(hash, psr);
+		for (i = 0;
+		     i < PMEM_SNAPSHOT_RECORDS_PER_PAGE &&
+		     block_id <= pm->lm_cache_blocks;
+		     i++, block_id++) {
+			if (psr[i].psr_block_id != block_id ||
+			    (psr[i].psr_status != S_INVALID &&
+			     psr[i].psr_status != S_CLEAN &&
+			     psr[i].psr_status != S_DIRTY) ||
+			    (psr[i].psr_status != S_INVALID &&
+			     !is_sector_cache_aligned(psr[i].psr_device_sector))) {
+				printk_err("%s: index snapshot block id #%u: bad record, block_id=%u, status=%u, sector=%llu\n",
+					   bc->bc_name,
+					   block_id,
+					   psr[i].psr_block_id,
+					   psr[i].psr_status,
+					   psr[i].psr_device_sector);
+				ret = -EBADMSG;
+				goto out;
+			}
+		}
+	}
+
+	if (uint128_ne(hash, pm->lm_snapshot_hash)) {
+		printk_err("%s: index snapshot hash mismatch: stored_hash=" UINT128_FMT ", computed_hash=" UINT128_FMT "\n",
+			   bc->bc_name,
+			   UINT128_ARG(pm->lm_snapshot_hash),
+			   UINT128_ARG(hash));
+		ret = -EBADMSG;
+	}
+
+out:
+	kmem_cache_free(bc->bc_kmem_map, psr);
+	return ret;
+}
+
+int pmem_snapshot_block_restore(struct bittern_cache *bc,
+				struct cache_block *cache_block,
+				const struct pmem_snapshot_record *psr)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+
+	ASSERT(cache_block != NULL);
+	/* records have been checked by pmem_snapshot_verify() */
+	if (psr->psr_block_id != cache_block->bcb_block_id) {
+		printk_err("block id #%u: index snapshot record mismatch, block_id=%u\n",
+			   cache_block->bcb_block_id,
+			   psr->psr_block_id);
+		return -EHWPOISON;
+	}
+
+	pa->papi_stats.restore_snapshot_blocks++;
+	if (psr->psr_status == S_INVALID)
+		return 1;
+
+	ASSERT(psr->psr_status == S_CLEAN || psr->psr_status == S_DIRTY);
+	cache_block->bcb_sector = psr->psr_device_sector;
+	cache_block->bcb_state = psr->psr_status;
+	cache_block->bcb_xid = psr->psr_xid;
+	cache_block->bcb_hash_data = psr->psr_hash_data;
+	ASSERT(is_sector_number_valid(cache_block->bcb_sector));
+
+	return 1;
+}
+
+int pmem_resize_cache_blocks(struct bittern_cache *bc,
+			     uint64_t cache_size_bytes,
+			     uint64_t *out_cache_blocks)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	size_t bdev_size_bytes;
+	uint64_t data_metadata_size;
+
+	ASSERT(out_cache_blocks != NULL);
+	*out_cache_blocks = 0;
+
+	/*
+	 * In the sequential layout the metadata area is sized by the
+	 * number of cache blocks, so it cannot change without moving
+	 * all the data blocks.
+	 */
+	if (pm->lm_cache_layout != CACHE_LAYOUT_INTERLEAVED)
+		return -EOPNOTSUPP;
+
+	/*
+	 * Pick up the current size of the cache device, it might have
+	 * grown since we started. We never use less than we already had.
+	 */
+	bdev_size_bytes = pmem_stripe_size_bytes_block(bc);
+	if (bdev_size_bytes > pa->papi_bdev_size_bytes) {
+		unsigned int i;
+
+		printk_info("%s: cache device grew from %lu to %lu bytes\n",
+			    bc->bc_name,
+			    pa->papi_bdev_size_bytes,
+			    bdev_size_bytes);
+		pa->papi_bdev_size_bytes = bdev_size_bytes;
+		pa->papi_bdev_actual_size_bytes = 0;
+		for (i = 0; i < pa->papi_stripe_count; i++)
+			pa->papi_bdev_actual_size_bytes +=
+				pa->papi_stripes[i].ps_bdev_size_bytes;
+	}
+
+	if (cache_size_bytes == 0)
+		cache_size_bytes = pa->papi_bdev_size_bytes;
+	if (cache_size_bytes > pa->papi_bdev_size_bytes)
+		return -ENOSPC;
+	if (cache_size_bytes < __CACHE_SIZE_ABSOLUTE_MIN)
+		return -EINVAL;
+
+	/* same rounding as in pmem_initialize_pmem_header_sizes() */
+	data_metadata_size = round_down(cache_size_bytes,
+					CACHE_NAND_FLASH_ERASE_BLOCK_SIZE);
+	data_metadata_size -= CACHE_MEM_FIRST_OFFSET_BYTES;
+	*out_cache_blocks = pmem_interleaved_cache_blocks(data_metadata_size);
+	if (*out_cache_blocks == 0 ||
+	    *out_cache_blocks >= (uint64_t)INT_MAX)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Initialize the metadata of blocks (old_cache_blocks, cache_blocks].
+ * Offsets are computed against a copy of the header which already has
+ * the new size, as the offset helpers check the block id against it.
+ */
+static int __pmem_resize_metadata_initialize(struct bittern_cache *bc,
+					     uint64_t old_cache_blocks,
+					     uint64_t cache_blocks)
+{
+	struct pmem_header *pm = &bc->bc_papi.papi_hdr;
+	struct pmem_header *pm_new;
+	struct pmem_block_metadata *pmbm;
+	uint64_t block_id;
+	int ret = 0;
+
+	pm_new = kmem_alloc(sizeof(struct pmem_header), GFP_NOIO);
+	pmbm = kmem_zalloc(sizeof(struct pmem_block_metadata), GFP_NOIO);
+	if (pm_new == NULL || pmbm == NULL) {
+		printk_err("%s: cannot allocate resize buffers\n",
+			   bc->bc_name);
+		ret = -ENOMEM;
+		goto out;
+	}
+	memcpy(pm_new, pm, sizeof(struct pmem_header));
+	pm_new->lm_cache_blocks = cache_blocks;
+	pm_new->lm_cache_size_bytes = pm->lm_first_offset_bytes +
+				      cache_blocks * ((uint64_t)PAGE_SIZE * 2);
+
+	for (block_id = old_cache_blocks + 1;
+	     block_id <= cache_blocks;
+	     block_id++) {
+		memset(pmbm, 0, sizeof(struct pmem_block_metadata));
+		pmbm->pmbm_magic = MCBM_MAGIC;
+		pmbm->pmbm_block_id = block_id;
+		pmbm->pmbm_status = S_INVALID;
+		pmbm->pmbm_device_sector = -1;
+		pmbm->pmbm_owner = 0;
+		pmbm->pmbm_xid = 0;
+		pmbm->pmbm_hash_data = UINT128_ZERO;
+		pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
+					PMEM_BLOCK_METADATA_HASHING_SIZE);
+		ret = pmem_write_sync(bc,
+			__cache_block_id_2_metadata_pmem_offset_p(pm_new,
+								  block_id),
+			pmbm,
+			sizeof(struct pmem_block_metadata));
+		/*TODO_ADD_ERROR_INJECTION*/
+		if (ret != 0) {
+			ASSERT(ret < 0);
+			printk_err("%s: pmem_write_sync block_id=%llu failed, ret=%d\n",
+				   bc->bc_name,
+				   block_id,
+				   ret);
+			break;
+		}
+	}
+
+out:
+	if (pmbm != NULL)
+		kmem_free(pmbm, sizeof(struct pmem_block_metadata));
+	if (pm_new != NULL)
+		kmem_free(pm_new, sizeof(struct pmem_header));
+	return ret;
+}
+
+int pmem_header_resize(struct bittern_cache *bc, uint64_t cache_blocks)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	uint64_t old_cache_blocks = pm->lm_cache_blocks;
+	uint64_t old_cache_size_bytes = pm->lm_cache_size_bytes;
+	int ret;
+
+	M_ASSERT(pm->lm_cache_layout == CACHE_LAYOUT_INTERLEAVED);
+	M_ASSERT(cache_blocks > 0);
+	M_ASSERT(pm->lm_first_offset_bytes + cache_blocks *
+		 ((uint64_t)PAGE_SIZE * 2) <= pa->papi_bdev_size_bytes);
+
+	mutex_lock(&pa->papi_hdr_mutex);
+
+	/*
+	 * when growing, the new metadata needs to be valid before the
+	 * header says the blocks exist, otherwise a crash in between
+	 * would make restore trip over garbage.
+	 */
+	if (cache_blocks > pm->lm_cache_blocks) {
+		ret = __pmem_resize_metadata_initialize(bc,
+							pm->lm_cache_blocks,
+							cache_blocks);
+		if (ret != 0)
+			goto out;
+	}
+
+	/*
+	 * write both header copies, so that whichever one restore picks
+	 * has the new size.
+	 */
+	pm->lm_cache_blocks = cache_blocks;
+	pm->lm_cache_size_bytes = pm->lm_first_offset_bytes +
+				  cache_blocks * ((uint64_t)PAGE_SIZE * 2);
+	cache_xid_inc(bc);
+	ret = __pmem_header_update(bc, 1, true);
+	if (ret != 0) {
+		pm->lm_cache_blocks = old_cache_blocks;
+		pm->lm_cache_size_bytes = old_cache_size_bytes;
+	}
+
+out:
+	mutex_unlock(&pa->papi_hdr_mutex);
+	return ret;
+}
+
 static void pmem_header_update_worker(struct work_struct *work)
 {
 	struct delayed_work *dwork = to_delayed_work(work);
@@ -1224,13 +1892,20 @@ const struct cache_papi_interface *__pmem_api_interface(struct pmem_api *pa)
 }
 
 /*! allocate PMEM resources */
-int pmem_allocate(struct bittern_cache *bc, struct block_device *blockdev)
+int pmem_allocate(struct bittern_cache *bc,
+		  struct block_device **blockdevs,
+		  unsigned int stripe_count)
 {
 	const struct cache_papi_interface *pp;
 	int ret;
 	struct pmem_api *pa = &bc->bc_papi;
+	struct block_device *blockdev = blockdevs[0];
 
 	ASSERT(pa->papi_interface == NULL);
+	ASSERT(stripe_count >= 1 && stripe_count <= PMEM_MAX_STRIPES);
+
+	mutex_init(&pa->papi_hdr_mutex);
+	spin_lock_init(&pa->papi_one_io_lock);
 
 	bc->bc_pmem_update_workqueue = alloc_workqueue("b_pu/%s",
 					       WQ_MEM_RECLAIM,
@@ -1243,18 +1918,22 @@ int pmem_allocate(struct bittern_cache *bc, struct block_device *blockdev)
 	}
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 0, 0)
-	/* direct_access() calling convention changed in 4.0 */
-	if (blockdev->bd_disk->fops->direct_access != NULL) {
+	/*
+	 * direct_access() calling convention changed in 4.0.
+	 * striping is only implemented by the blockdev-based pmem API.
+	 */
+	if (stripe_count == 1 &&
+	    blockdev->bd_disk->fops->direct_access != NULL) {
 		printk_info("%s: detected direct_access-based pmem API implementation\n",
 			    bc->bc_name);
-		ret = pmem_allocate_papi_mem(bc, blockdev);
+		ret = pmem_allocate_papi_mem(bc, blockdevs, stripe_count);
 		pp = &cache_papi_mem;
 	} else
 #endif /* LINUX_VERSION_CODE >= 4.0.0 */
 	{
 		printk_info("%s: detected blockdev-based pmem API implementation\n",
 			    bc->bc_name);
-		ret = pmem_allocate_papi_block(bc, blockdev);
+		ret = pmem_allocate_papi_block(bc, blockdevs, stripe_count);
 		pp = &cache_papi_block;
 	}
 
@@ -27,9 +27,13 @@
 #include "bittern_cache_pmem_header.h"
 #include "bittern_cache_states.h"
 
-/*! allocate PMEM resources */
+/*!
+ * allocate PMEM resources.
+ * if more than one block device is given, the cache is striped across them.
+ */
 extern int pmem_allocate(struct bittern_cache *bc,
-			 struct block_device *blockdev);
+			 struct block_device **blockdevs,
+			 unsigned int stripe_count);
 
 /* deallocate PMEM resources */
 extern void pmem_deallocate(struct bittern_cache *bc);
@@ -76,6 +80,92 @@ extern int pmem_block_restore(struct bittern_cache *bc,
  * synchronously update header
  */
 extern int pmem_header_update(struct bittern_cache *bc, int update_both);
+/*!
+ * called once all blocks have been restored, lets the epoch of
+ * @ref MCBM_MAGIC_ONE_IO writes advance again.
+ */
+extern void pmem_one_io_restore_done(struct bittern_cache *bc);
+
+/*!
+ * Write the index snapshot past the end of the cache, then mark the cache
+ * as cleanly shut down in both header copies. Caller needs to make sure
+ * there is no more I/O going on. If the cache device has no room for the
+ * snapshot, nothing is written and the next restore scans all blocks.
+ */
+extern int pmem_header_clean_shutdown(struct bittern_cache *bc);
+/*!
+ * Clear the clean shutdown marker in both header copies, so that the index
+ * snapshot cannot be used anymore once the cache has been modified.
+ */
+extern int pmem_header_clean_shutdown_clear(struct bittern_cache *bc);
+/*!
+ * Check that the cache was cleanly shut down and that the index snapshot
+ * is intact. Returns 0 if the snapshot can be used, negative errno otherwise.
+ */
+extern int pmem_snapshot_verify(struct bittern_cache *bc);
+/*! read one page of index snapshot records */
+extern int pmem_snapshot_read_page(struct bittern_cache *bc,
+				   uint64_t page,
+				   struct pmem_snapshot_record *psr);
+/*!
+ * Index snapshot version of pmem_block_restore(), same return values.
+ */
+extern int pmem_snapshot_block_restore(struct bittern_cache *bc,
+				       struct cache_block *in_out_cache_block,
+				       const struct pmem_snapshot_record *psr);
+/*!
+ * Open a new metadata intent log epoch in both header copies, or close
+ * the current one (see bittern_cache_pmem_mlog.c).
+ */
+extern int pmem_header_mlog_open(struct bittern_cache *bc,
+				 uint64_t offset_bytes,
+				 uint64_t pages,
+				 uint64_t *out_epoch);
+extern int pmem_header_mlog_close(struct bittern_cache *bc);
+
+/*! metadata intent log, see bittern_cache_pmem_mlog.c */
+extern void pmem_mlog_initialize(struct bittern_cache *bc);
+extern void pmem_mlog_deinitialize(struct bittern_cache *bc);
+extern int pmem_mlog_start(struct bittern_cache *bc);
+extern void pmem_mlog_stop(struct bittern_cache *bc);
+/*!
+ * Queue the metadata-only update described by pmem_ctx to the intent log.
+ * Returns false if the log cannot take it, in which case the caller
+ * writes the metadata block.
+ */
+extern bool pmem_mlog_append(struct bittern_cache *bc,
+			     struct cache_block *cache_block,
+			     struct pmem_context *pmem_ctx);
+/*!
+ * Read the intent log left by a crash, so that pmem_block_restore() can
+ * pick up block states newer than the ones in the metadata blocks.
+ */
+extern int pmem_mlog_replay_load(struct bittern_cache *bc);
+/*!
+ * Called by pmem_block_restore() with the metadata block contents.
+ * If the log has a newer state for the block, the metadata is replaced
+ * with it and written back to the metadata block. Returns 1 if replaced,
+ * 0 if not, negative errno on error.
+ */
+extern int pmem_mlog_replay_block(struct bittern_cache *bc,
+				  struct pmem_block_metadata *pmbm);
+/*! all blocks have been restored, forget the log left by the crash */
+extern int pmem_mlog_replay_done(struct bittern_cache *bc);
+
+/*!
+ * compute the number of cache blocks for an online resize to
+ * cache_size_bytes (zero means the whole cache device).
+ * returns -EOPNOTSUPP if the cache layout cannot be resized.
+ */
+extern int pmem_resize_cache_blocks(struct bittern_cache *bc,
+				    uint64_t cache_size_bytes,
+				    uint64_t *out_cache_blocks);
+/*!
+ * synchronously change the number of cache blocks in the header.
+ * when growing, also initializes the metadata of the new blocks.
+ */
+extern int pmem_header_resize(struct bittern_cache *bc,
+			      uint64_t cache_blocks);
 
 /*!
  * callback function prototype
@@ -197,6 +287,15 @@ struct pmem_context {
 	sector_t bi_sector;
 	/*! ctx_endio is passed as context for make request */
 	void (*ctx_endio)(struct pmem_context *ctx, int err);
+	/*!
+	 * metadata page written right after the data page in the same
+	 * request, see @ref MCBM_MAGIC_ONE_IO. NULL for single page requests.
+	 */
+	void *bi_metadata_vaddr;
+	/*! entry in the metadata intent log wait lists */
+	struct list_head bi_mlog_entry;
+	/*! epoch of the write if bi_metadata_vaddr is set */
+	uint64_t bi_one_io_epoch;
 	/*! timer */
 	uint64_t bi_started;
 };
@@ -339,6 +438,12 @@ struct pmem_info {
 	uint32_t restore_valid_dirty_data_blocks;
 	uint32_t restore_hash_corrupt_metadata_blocks;
 	uint32_t restore_hash_corrupt_data_blocks;
+	uint32_t restore_snapshot_valid;
+	uint32_t restore_snapshot_blocks;
+	uint32_t restore_torn_one_io_blocks;
+	uint32_t restore_mlog_pages;
+	uint32_t restore_mlog_records;
+	uint32_t restore_mlog_replayed_blocks;
 
 	atomic_t metadata_read_async_count;
 	atomic_t metadata_write_async_count;
@@ -348,6 +453,7 @@ struct pmem_info {
 	atomic_t data_get_page_write_count;
 	atomic_t data_put_page_write_count;
 	atomic_t data_put_page_write_metadata_count;
+	atomic_t data_put_page_write_one_io_count;
 	atomic_t data_convert_page_read_to_write_count;
 	atomic_t data_clone_read_page_to_write_page_count;
 
@@ -377,6 +483,7 @@ struct pmem_info {
 
 	atomic_t pmem_make_req_wq_count;
 	struct cache_timer pmem_make_req_wq_timer;
+	atomic_t pmem_make_req_direct_count;
 };
 
 /*!
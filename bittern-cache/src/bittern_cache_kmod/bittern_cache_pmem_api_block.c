@@ -19,32 +19,152 @@
 
 #define PMEM_BLOCKDEV_ASYNC_CONTEXT_MAGIC1	0xf10c7c31
 
+/*
+ * Striping.
+ *
+ * A cache can be striped across up to PMEM_MAX_STRIPES block devices.
+ * The upper layers keep using the logical interleaved layout offsets as
+ * if there was only one device, and this layer maps them to a stripe:
+ *
+ * - The two header copies (i.e. anything below lm_first_offset_bytes) are
+ *   replicated on every stripe. Header writes go to all stripes, header
+ *   reads are served by stripe 0.
+ * - Data/metadata pairs are distributed round robin by block id, so that
+ *   each cache block has both its data and its metadata on the same
+ *   stripe, and consecutive block ids land on different devices.
+ *
+ * Each stripe has its own make_request workqueue, so that submissions to
+ * one device never wait behind submissions to another one.
+ */
+
+/*! map logical pmem offset to stripe and stripe relative offset */
+static unsigned int pmem_stripe_map(struct pmem_api *pa,
+				    uint64_t pmem_offset,
+				    uint64_t *stripe_offset)
+{
+	const uint64_t pair_size = (uint64_t)PAGE_SIZE * 2;
+	uint64_t rel_offset;
+	uint64_t pair;
+	unsigned int stripe;
+
+	ASSERT(pa->papi_stripe_count >= 1);
+	ASSERT(pa->papi_stripe_count <= PMEM_MAX_STRIPES);
+	if (pa->papi_stripe_count == 1 ||
+	    pmem_offset < CACHE_MEM_FIRST_OFFSET_BYTES) {
+		*stripe_offset = pmem_offset;
+		return 0;
+	}
+	rel_offset = pmem_offset - CACHE_MEM_FIRST_OFFSET_BYTES;
+	pair = div_u64(rel_offset, pair_size);
+	stripe = do_div(pair, pa->papi_stripe_count);
+	*stripe_offset = CACHE_MEM_FIRST_OFFSET_BYTES +
+			 pair * pair_size +
+			 (rel_offset & (pair_size - 1));
+	ASSERT(stripe < pa->papi_stripe_count);
+	ASSERT(*stripe_offset + PAGE_SIZE <=
+	       pa->papi_stripes[stripe].ps_bdev_size_bytes);
+	return stripe;
+}
+
+/*!
+ * logical size of the cache given the size of the smallest stripe.
+ * with a single stripe this is just the device size.
+ */
+static size_t pmem_stripe_logical_size(unsigned int stripe_count,
+				       size_t min_bdev_size_bytes)
+{
+	const uint64_t pair_size = (uint64_t)PAGE_SIZE * 2;
+	uint64_t pairs;
+
+	if (stripe_count == 1)
+		return min_bdev_size_bytes;
+	if (min_bdev_size_bytes <= CACHE_MEM_FIRST_OFFSET_BYTES)
+		return 0;
+	pairs = div_u64(round_down(min_bdev_size_bytes,
+				   CACHE_NAND_FLASH_ERASE_BLOCK_SIZE) -
+			CACHE_MEM_FIRST_OFFSET_BYTES,
+			pair_size);
+	return CACHE_MEM_FIRST_OFFSET_BYTES +
+	       pairs * stripe_count * pair_size;
+}
+
+size_t pmem_stripe_size_bytes_block(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	size_t min_bdev_size_bytes = 0;
+	unsigned int i;
+
+	for (i = 0; i < pa->papi_stripe_count; i++) {
+		struct pmem_stripe *ps = &pa->papi_stripes[i];
+		size_t bdev_size_bytes = i_size_read(ps->ps_bdev->bd_inode);
+
+		/* we never use less than we already had */
+		if (bdev_size_bytes > ps->ps_bdev_size_bytes)
+			ps->ps_bdev_size_bytes = bdev_size_bytes;
+		if (i == 0 || ps->ps_bdev_size_bytes < min_bdev_size_bytes)
+			min_bdev_size_bytes = ps->ps_bdev_size_bytes;
+	}
+	return pmem_stripe_logical_size(pa->papi_stripe_count,
+					min_bdev_size_bytes);
+}
+
 /*
  * pmem allocate/deallocate functions
  */
 int pmem_allocate_papi_block(struct bittern_cache *bc,
-			     struct block_device *blockdev)
+			     struct block_device **blockdevs,
+			     unsigned int stripe_count)
 {
 	struct pmem_api *pa = &bc->bc_papi;
-	size_t blockdev_size_bytes;
-
-	printk_info("%s: partition: %p\n", bc->bc_name, blockdev->bd_part);
-	M_ASSERT(blockdev->bd_part != NULL);
-	printk_info("%s: device has %lu sectors\n",
-		    bc->bc_name,
-		    blockdev->bd_part->nr_sects);
-	blockdev_size_bytes = blockdev->bd_part->nr_sects * SECTOR_SIZE;
+	size_t min_blockdev_size_bytes = 0;
+	size_t total_blockdev_size_bytes = 0;
+	unsigned int i;
+
+	M_ASSERT(stripe_count >= 1 && stripe_count <= PMEM_MAX_STRIPES);
+
+	for (i = 0; i < stripe_count; i++) {
+		struct block_device *blockdev = blockdevs[i];
+		size_t blockdev_size_bytes;
+
+		printk_info("%s: stripe #%u: partition: %p\n",
+			    bc->bc_name, i, blockdev->bd_part);
+		M_ASSERT(blockdev->bd_part != NULL);
+		printk_info("%s: stripe #%u: device has %lu sectors\n",
+			    bc->bc_name,
+			    i,
+			    blockdev->bd_part->nr_sects);
+		blockdev_size_bytes = blockdev->bd_part->nr_sects * SECTOR_SIZE;
+
+		printk_info("%s: stripe #%u: device size %lu(%lumb)\n",
+			    bc->bc_name,
+			    i,
+			    blockdev_size_bytes,
+			    blockdev_size_bytes / (1024 * 1024));
+
+		pa->papi_stripes[i].ps_bdev = blockdev;
+		pa->papi_stripes[i].ps_bdev_size_bytes = blockdev_size_bytes;
+		atomic_set(&pa->papi_stripes[i].ps_make_req_count, 0);
+		if (i == 0 || blockdev_size_bytes < min_blockdev_size_bytes)
+			min_blockdev_size_bytes = blockdev_size_bytes;
+		total_blockdev_size_bytes += blockdev_size_bytes;
+	}
 
-	printk_info("%s: device size %lu(%lumb)\n",
+	pa->papi_stripe_count = stripe_count;
+	pa->papi_bdev = blockdevs[0];
+	pa->papi_bdev_size_bytes =
+		pmem_stripe_logical_size(stripe_count, min_blockdev_size_bytes);
+	pa->papi_bdev_actual_size_bytes = total_blockdev_size_bytes;
+	if (pa->papi_bdev_size_bytes == 0) {
+		printk_err("%s: stripe devices are too small\n", bc->bc_name);
+		return -EINVAL;
+	}
+	printk_info("%s: %u stripe(s), logical size %lu(%lumb)\n",
 		    bc->bc_name,
-		    blockdev_size_bytes,
-		    blockdev_size_bytes / (1024 * 1024));
+		    stripe_count,
+		    pa->papi_bdev_size_bytes,
+		    pa->papi_bdev_size_bytes / (1024 * 1024));
 
-	pa->papi_bdev = blockdev;
-	pa->papi_bdev_size_bytes = blockdev_size_bytes;
-	pa->papi_bdev_actual_size_bytes = blockdev_size_bytes;
-
-	printk_info("%s: initializing workqueue\n", bc->bc_name);
+	printk_info("%s: initializing workqueues\n", bc->bc_name);
 	/*
 	 * TODO:
 	 * these alloc_workqueue params are the same as create_workqueue().
@@ -52,14 +172,26 @@ int pmem_allocate_papi_block(struct bittern_cache *bc,
 	 * (testing with WQ_HIGHPRI set shows perf degradation of about 7%).
 	 * NOTE we are no longer using WQ_SYSFS, as the namespace is not unique.
 	 */
-	pa->papi_make_request_wq = alloc_workqueue("b_wkq_blk:%s",
-						   WQ_MEM_RECLAIM,
-						   1,
-						   bc->bc_name);
-	/*TODO_ADD_ERROR_INJECTION*/
-	if (pa->papi_make_request_wq == NULL) {
-		printk_err("%s: alloc workqueue failed\n", bc->bc_name);
-		return -ENOMEM;
+	for (i = 0; i < stripe_count; i++) {
+		struct pmem_stripe *ps = &pa->papi_stripes[i];
+
+		ps->ps_make_request_wq = alloc_workqueue("b_wkq_blk:%s:%u",
+							 WQ_MEM_RECLAIM,
+							 1,
+							 bc->bc_name,
+							 i);
+		/*TODO_ADD_ERROR_INJECTION*/
+		if (ps->ps_make_request_wq == NULL) {
+			printk_err("%s: alloc workqueue for stripe #%u failed\n",
+				   bc->bc_name,
+				   i);
+			while (i-- > 0) {
+				ps = &pa->papi_stripes[i];
+				destroy_workqueue(ps->ps_make_request_wq);
+				ps->ps_make_request_wq = NULL;
+			}
+			return -ENOMEM;
+		}
 	}
 
 	return 0;
@@ -67,15 +199,27 @@ int pmem_allocate_papi_block(struct bittern_cache *bc,
 
 void pmem_deallocate_papi_block(struct bittern_cache *bc)
 {
-	printk_info("%s: bc->bc_papi.papi_bdev=%p\n",
-		    bc->bc_name,
-		    bc->bc_papi.papi_bdev);
-
-	printk_info("%s: flushing make_request workqueue\n", bc->bc_name);
-	M_ASSERT(bc->bc_papi.papi_make_request_wq != NULL);
-	flush_workqueue(bc->bc_papi.papi_make_request_wq);
-	printk_info("%s: destroying make_request workqueue\n", bc->bc_name);
-	destroy_workqueue(bc->bc_papi.papi_make_request_wq);
+	struct pmem_api *pa = &bc->bc_papi;
+	unsigned int i;
+
+	for (i = 0; i < pa->papi_stripe_count; i++) {
+		struct pmem_stripe *ps = &pa->papi_stripes[i];
+
+		printk_info("%s: stripe #%u: bdev=%p\n",
+			    bc->bc_name,
+			    i,
+			    ps->ps_bdev);
+		printk_info("%s: stripe #%u: flushing make_request workqueue\n",
+			    bc->bc_name,
+			    i);
+		M_ASSERT(ps->ps_make_request_wq != NULL);
+		flush_workqueue(ps->ps_make_request_wq);
+		printk_info("%s: stripe #%u: destroying make_request workqueue\n",
+			    bc->bc_name,
+			    i);
+		destroy_workqueue(ps->ps_make_request_wq);
+		ps->ps_make_request_wq = NULL;
+	}
 }
 
 /*
@@ -105,6 +249,71 @@ void pmem_rw_sync_block_endio(struct bio *bio, int err)
 	bio_put(bio);
 }
 
+/*
+ * synchronously transfer one page to or from the given stripe.
+ */
+static int pmem_rw_sync_block_page(struct bittern_cache *bc,
+				   struct block_device *bdev,
+				   uint64_t stripe_offset,
+				   struct page *buffer_page,
+				   int datadir)
+{
+	struct pmem_rw_sync_block_ctx *ctx;
+	struct bio *bio;
+	int ret;
+
+	/*
+	 * setup bio context, alloc bio and start io
+	 * */
+	ctx = kmem_alloc(sizeof(struct pmem_rw_sync_block_ctx), GFP_NOIO);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (ctx == NULL) {
+		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
+			     "cannot allocate synchronous context");
+		printk_err("%s: cannot allocate synchronous context\n",
+			   bc->bc_name);
+		return -ENOMEM;
+	}
+	ctx->papi_ctx_magic = PMEM_RW_PAPI_CTX_MAGIC;
+	sema_init(&ctx->papi_ctx_sema, 0);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (bio == NULL) {
+		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
+			     "cannot allocate bio struct");
+		printk_err("%s: cannot allocate bio struct\n", bc->bc_name);
+		kmem_free(ctx, sizeof(struct pmem_rw_sync_block_ctx));
+		return -ENOMEM;
+	}
+	ctx->papi_ctx_bio = bio;
+	if (datadir == WRITE)
+		bio_set_data_dir_write(bio);
+	else
+		bio_set_data_dir_read(bio);
+	bio->bi_iter.bi_idx = 0;
+	bio->bi_iter.bi_sector = stripe_offset / SECTOR_SIZE;
+	bio->bi_iter.bi_size = PAGE_SIZE;
+	bio->bi_bdev = bdev;
+	bio->bi_end_io = pmem_rw_sync_block_endio;
+	bio->bi_private = (void *)ctx;
+	bio->bi_io_vec[0].bv_page = buffer_page;
+	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
+	bio->bi_io_vec[0].bv_offset = 0;
+	bio->bi_vcnt = 1;
+
+	generic_make_request(bio);
+
+	/*
+	 * wait completion
+	 */
+	down(&ctx->papi_ctx_sema);
+
+	ret = ctx->papi_ctx_err;
+	kmem_free(ctx, sizeof(struct pmem_rw_sync_block_ctx));
+	return ret;
+}
+
 /*
  * sync read from cache.
  * this API does double buffering.
@@ -115,12 +324,12 @@ int pmem_read_sync_block(struct bittern_cache *bc,
 			 size_t size)
 {
 	int ret;
-	struct pmem_rw_sync_block_ctx *ctx = NULL;
 	void *buffer_vaddr = NULL;
 	struct page *buffer_page;
 	uint64_t ts_started;
 	struct pmem_api *pa = &bc->bc_papi;
-	struct bio *bio;
+	unsigned int stripe;
+	uint64_t stripe_offset;
 
 	ASSERT(bc != NULL);
 	ASSERT(size > 0 && size <= PAGE_SIZE);
@@ -158,52 +367,12 @@ int pmem_read_sync_block(struct bittern_cache *bc,
 	buffer_page = virtual_to_page(buffer_vaddr);
 	M_ASSERT(buffer_page != NULL);
 
-	/*
-	 * setup bio context, alloc bio and start io
-	 * */
-	ctx = kmem_alloc(sizeof(struct pmem_rw_sync_block_ctx), GFP_NOIO);
-	/*TODO_ADD_ERROR_INJECTION*/
-	if (ctx == NULL) {
-		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
-			     "cannot allocate synchronous context");
-		printk_err("%s: cannot allocate synchronous context\n",
-			   bc->bc_name);
-		ret = -ENOMEM;
-		goto done;
-	}
-	ctx->papi_ctx_magic = PMEM_RW_PAPI_CTX_MAGIC;
-	sema_init(&ctx->papi_ctx_sema, 0);
-
-	bio = bio_alloc(GFP_NOIO, 1);
-	/*TODO_ADD_ERROR_INJECTION*/
-	if (bio == NULL) {
-		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
-			     "cannot allocate bio struct");
-		printk_err("%s: cannot allocate bio struct\n", bc->bc_name);
-		ret = -ENOMEM;
-		goto done;
-	}
-	ctx->papi_ctx_bio = bio;
-	bio_set_data_dir_read(bio);
-	bio->bi_iter.bi_idx = 0;
-	bio->bi_iter.bi_sector = from_pmem_offset / SECTOR_SIZE;
-	bio->bi_iter.bi_size = PAGE_SIZE;
-	bio->bi_bdev = pa->papi_bdev;
-	bio->bi_end_io = pmem_rw_sync_block_endio;
-	bio->bi_private = (void *)ctx;
-	bio->bi_io_vec[0].bv_page = buffer_page;
-	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
-	bio->bi_io_vec[0].bv_offset = 0;
-	bio->bi_vcnt = 1;
-
-	generic_make_request(bio);
-
-	/*
-	 * wait completion
-	 */
-	down(&ctx->papi_ctx_sema);
-
-	ret = ctx->papi_ctx_err;
+	stripe = pmem_stripe_map(pa, from_pmem_offset, &stripe_offset);
+	ret = pmem_rw_sync_block_page(bc,
+				      pa->papi_stripes[stripe].ps_bdev,
+				      stripe_offset,
+				      buffer_page,
+				      READ);
 	BT_DEV_TRACE(BT_LEVEL_TRACE2, bc, NULL, NULL, NULL, NULL,
 		     "from_pmem_offset=%llu, to_buffer=%p, size=%lu: ret=%d",
 		     from_pmem_offset, to_buffer, size, ret);
@@ -211,9 +380,6 @@ int pmem_read_sync_block(struct bittern_cache *bc,
 	memcpy(to_buffer, buffer_vaddr, size);
 
 done:
-	if (ctx != NULL)
-		kmem_free(ctx, sizeof(struct pmem_rw_sync_block_ctx));
-
 	if (buffer_vaddr != NULL)
 		kmem_cache_free(bc->bc_kmem_map, buffer_vaddr);
 
@@ -238,12 +404,12 @@ int pmem_write_sync_block(struct bittern_cache *bc,
 			  size_t size)
 {
 	int ret;
-	struct pmem_rw_sync_block_ctx *ctx = NULL;
 	void *buffer_vaddr = NULL;
 	struct page *buffer_page;
 	uint64_t ts_started;
 	struct pmem_api *pa = &bc->bc_papi;
-	struct bio *bio;
+	unsigned int stripe;
+	uint64_t stripe_offset;
 
 	ASSERT(bc != NULL);
 	ASSERT(size > 0 && size <= PAGE_SIZE);
@@ -291,60 +457,30 @@ int pmem_write_sync_block(struct bittern_cache *bc,
 
 	memcpy(buffer_vaddr, from_buffer, size);
 
-	/*
-	 * setup bio context, alloc bio and start io
-	 * */
-	ctx = kmem_alloc(sizeof(struct pmem_rw_sync_block_ctx), GFP_NOIO);
-	/*TODO_ADD_ERROR_INJECTION*/
-	if (ctx == NULL) {
-		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
-			     "cannot allocate synchronous context");
-		printk_err("%s: cannot allocate synchronous context\n",
-			   bc->bc_name);
-		ret = -ENOMEM;
-		goto done;
-	}
-	ctx->papi_ctx_magic = PMEM_RW_PAPI_CTX_MAGIC;
-	sema_init(&ctx->papi_ctx_sema, 0);
-
-	bio = bio_alloc(GFP_NOIO, 1);
-	/*TODO_ADD_ERROR_INJECTION*/
-	if (bio == NULL) {
-		BT_DEV_TRACE(BT_LEVEL_ERROR, bc, NULL, NULL, NULL, NULL,
-			     "cannot allocate bio struct");
-		printk_err("%s: cannot allocate bio struct\n", bc->bc_name);
-		ret = -ENOMEM;
-		goto done;
+	if (to_pmem_offset < CACHE_MEM_FIRST_OFFSET_BYTES) {
+		/* header copies are replicated on every stripe */
+		for (stripe = 0; stripe < pa->papi_stripe_count; stripe++) {
+			ret = pmem_rw_sync_block_page(bc,
+					pa->papi_stripes[stripe].ps_bdev,
+					to_pmem_offset,
+					buffer_page,
+					WRITE);
+			if (ret != 0)
+				break;
+		}
+	} else {
+		stripe = pmem_stripe_map(pa, to_pmem_offset, &stripe_offset);
+		ret = pmem_rw_sync_block_page(bc,
+					      pa->papi_stripes[stripe].ps_bdev,
+					      stripe_offset,
+					      buffer_page,
+					      WRITE);
 	}
-	ctx->papi_ctx_bio = bio;
-	bio_set_data_dir_write(bio);
-	bio->bi_iter.bi_idx = 0;
-	bio->bi_iter.bi_sector = to_pmem_offset / SECTOR_SIZE;
-	bio->bi_iter.bi_size = PAGE_SIZE;
-	bio->bi_bdev = pa->papi_bdev;
-	bio->bi_end_io = pmem_rw_sync_block_endio;
-	bio->bi_private = (void *)ctx;
-	bio->bi_io_vec[0].bv_page = buffer_page;
-	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
-	bio->bi_io_vec[0].bv_offset = 0;
-	bio->bi_vcnt = 1;
-
-	generic_make_request(bio);
-
-	/*
-	 * wait completion
-	 */
-	down(&ctx->papi_ctx_sema);
-
-	ret = ctx->papi_ctx_err;
 	BT_DEV_TRACE(BT_LEVEL_TRACE2, bc, NULL, NULL, NULL, NULL,
 		     "to_pmem_offset=%llu, from_buffer=%p, size=%lu: ret=%d",
 		     to_pmem_offset, from_buffer, size, ret);
 
 done:
-	if (ctx != NULL)
-		kmem_free(ctx, sizeof(struct pmem_rw_sync_block_ctx));
-
 	if (buffer_vaddr != NULL)
 		kmem_cache_free(bc->bc_kmem_map, buffer_vaddr);
 
@@ -360,6 +496,72 @@ done:
 	return ret;
 }
 
+/*
+ * Check that all the stripes belong to the same cache, and that they are
+ * given in the same order they had when the cache was created.
+ * The header copies are replicated on all stripes, so every stripe must
+ * have a valid header with the same cache uuid as the restored one.
+ */
+int pmem_stripe_verify_block(struct bittern_cache *bc,
+			     struct pmem_header *pm)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *stripe_pm;
+	struct page *buffer_page;
+	unsigned int stripe;
+	uint128_t hash;
+	int ret = 0;
+
+	if (pa->papi_stripe_count == 1)
+		return 0;
+
+	stripe_pm = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	if (stripe_pm == NULL) {
+		printk_err("%s: cannot allocate header buffer\n", bc->bc_name);
+		return -ENOMEM;
+	}
+	ASSERT(PAGE_ALIGNED(stripe_pm));
+	buffer_page = virtual_to_page(stripe_pm);
+	M_ASSERT(buffer_page != NULL);
+
+	for (stripe = 1; stripe < pa->papi_stripe_count; stripe++) {
+		ret = pmem_rw_sync_block_page(bc,
+					      pa->papi_stripes[stripe].ps_bdev,
+					      CACHE_MEM_HEADER_0_OFFSET_BYTES,
+					      buffer_page,
+					      READ);
+		if (ret != 0) {
+			printk_err("%s: stripe #%u: header read failed, ret=%d\n",
+				   bc->bc_name,
+				   stripe,
+				   ret);
+			break;
+		}
+		hash = murmurhash3_128(stripe_pm, PMEM_HEADER_HASHING_SIZE);
+		if (stripe_pm->lm_magic != LM_MAGIC ||
+		    uint128_ne(hash, stripe_pm->lm_hash)) {
+			printk_err("%s: stripe #%u: no valid header\n",
+				   bc->bc_name,
+				   stripe);
+			ret = -EINVAL;
+			break;
+		}
+		if (memcmp(stripe_pm->lm_uuid, pm->lm_uuid,
+			   sizeof(pm->lm_uuid)) != 0) {
+			printk_err("%s: stripe #%u: belongs to cache %pUb, expected %pUb\n",
+				   bc->bc_name,
+				   stripe,
+				   stripe_pm->lm_uuid,
+				   pm->lm_uuid);
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	kmem_cache_free(bc->bc_kmem_map, stripe_pm);
+	return ret;
+}
+
 static void pmem_do_make_request_block_endbio(struct bio *bio, int err)
 {
 	struct pmem_context *pmem_ctx;
@@ -375,6 +577,11 @@ static void pmem_do_make_request_block_endbio(struct bio *bio, int err)
 	ASSERT(ctx->ma_bio == bio);
 	bio_put(bio);
 
+	trace_bittern_pmem_complete(ctx->ma_bc,
+				    pmem_ctx->bi_sector,
+				    pmem_ctx->bi_datadir == WRITE,
+				    err);
+
 	M_ASSERT(pmem_ctx->ctx_endio != NULL);
 	(*pmem_ctx->ctx_endio)(pmem_ctx, err);
 }
@@ -387,6 +594,9 @@ void pmem_do_make_request_block(struct bittern_cache *bc,
 	struct data_buffer_info *dbi_data = &pmem_ctx->dbi;
 	struct pmem_api *pa;
 	struct bio *bio;
+	unsigned int stripe;
+	uint64_t stripe_offset;
+	unsigned int nr_pages;
 
 	ASSERT(pmem_ctx->magic1 == PMEM_CONTEXT_MAGIC1);
 	ASSERT(pmem_ctx->magic2 == PMEM_CONTEXT_MAGIC2);
@@ -413,7 +623,10 @@ void pmem_do_make_request_block(struct bittern_cache *bc,
 	M_ASSERT(!in_irq());
 	M_ASSERT(!in_softirq());
 
-	bio = bio_alloc(GFP_NOIO, 1);
+	/* data page, plus the metadata page right after it if any */
+	nr_pages = (pmem_ctx->bi_metadata_vaddr != NULL) ? 2 : 1;
+
+	bio = bio_alloc(GFP_NOIO, nr_pages);
 	/*TODO_ADD_ERROR_INJECTION*/
 	if (bio == NULL) {
 		printk_err("%s: failed to allocate bio struct\n", bc->bc_name);
@@ -431,10 +644,16 @@ void pmem_do_make_request_block(struct bittern_cache *bc,
 		bio_set_data_dir_write(bio);
 	else
 		bio_set_data_dir_read(bio);
+	/* async requests never target the (replicated) header */
+	ASSERT(pmem_ctx->bi_sector * SECTOR_SIZE >=
+	       CACHE_MEM_FIRST_OFFSET_BYTES);
+	stripe = pmem_stripe_map(pa,
+				 pmem_ctx->bi_sector * SECTOR_SIZE,
+				 &stripe_offset);
 	bio->bi_iter.bi_idx = 0;
-	bio->bi_iter.bi_sector = pmem_ctx->bi_sector;
-	bio->bi_iter.bi_size = PAGE_SIZE;
-	bio->bi_bdev = pa->papi_bdev;
+	bio->bi_iter.bi_sector = stripe_offset / SECTOR_SIZE;
+	bio->bi_iter.bi_size = PAGE_SIZE * nr_pages;
+	bio->bi_bdev = pa->papi_stripes[stripe].ps_bdev;
 	ASSERT(pmem_ctx->ctx_endio != NULL);
 	bio->bi_end_io = pmem_do_make_request_block_endbio;
 
@@ -442,8 +661,24 @@ void pmem_do_make_request_block(struct bittern_cache *bc,
 	bio->bi_io_vec[0].bv_page = dbi_data->di_page;
 	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
 	bio->bi_io_vec[0].bv_offset = 0;
-	bio->bi_vcnt = 1;
+	if (nr_pages == 2) {
+		/* a data/metadata pair never straddles stripes */
+		ASSERT(pmem_ctx->bi_datadir == WRITE);
+		ASSERT(pmem_stripe_map(pa,
+				       pmem_ctx->bi_sector * SECTOR_SIZE +
+				       PAGE_SIZE,
+				       &stripe_offset) == stripe);
+		bio->bi_io_vec[1].bv_page =
+			virtual_to_page(pmem_ctx->bi_metadata_vaddr);
+		bio->bi_io_vec[1].bv_len = PAGE_SIZE;
+		bio->bi_io_vec[1].bv_offset = 0;
+	}
+	bio->bi_vcnt = nr_pages;
 
+	trace_bittern_pmem_submit(bc,
+				  pmem_ctx->bi_sector,
+				  pmem_ctx->bi_datadir == WRITE,
+				  0);
 	generic_make_request(bio);
 }
 
@@ -481,13 +716,16 @@ void pmem_make_request_worker_block(struct work_struct *work)
 /*!
  * This function indirectly calls generic_make_request. Because call to
  * generic_make_request() cannot be done in softirq, we defer it to a
- * work_queue in such case.
+ * work_queue in such case. In process context the request is submitted
+ * directly.
  */
 void pmem_make_request_defer_block(struct bittern_cache *bc,
 				   struct pmem_context *pmem_ctx)
 {
 	struct async_context *ctx = &pmem_ctx->async_ctx;
 	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_stripe *ps;
+	uint64_t stripe_offset;
 	int ret;
 
 	ASSERT(pmem_ctx->magic1 == PMEM_CONTEXT_MAGIC1);
@@ -504,12 +742,22 @@ void pmem_make_request_defer_block(struct bittern_cache *bc,
 		     pmem_ctx,
 		     &ctx->ma_work);
 
+	if (cache_can_submit_direct(bc)) {
+		atomic_inc(&pa->papi_stats.pmem_make_req_direct_count);
+		pmem_do_make_request_block(bc, pmem_ctx);
+		return;
+	}
+
 	atomic_inc(&pa->papi_stats.pmem_make_req_wq_count);
 	pmem_ctx->bi_started = current_kernel_time_nsec();
 
-	/* defer to worker thread, which will start io */
+	/* defer to the worker thread of the stripe, which will start io */
+	ps = &pa->papi_stripes[pmem_stripe_map(pa,
+					       pmem_ctx->bi_sector * SECTOR_SIZE,
+					       &stripe_offset)];
+	atomic_inc(&ps->ps_make_req_count);
 	INIT_WORK(&ctx->ma_work, pmem_make_request_worker_block);
-	ret = queue_work(pa->papi_make_request_wq, &ctx->ma_work);
+	ret = queue_work(ps->ps_make_request_wq, &ctx->ma_work);
 	M_ASSERT(ret == 1);
 }
 
@@ -566,6 +814,34 @@ static void pmem_metadata_async_write_endio(struct pmem_context *pmem_ctx,
 			       err);
 }
 
+/*!
+ * fill the metadata of a metadata-only update. only the struct itself is
+ * written, callers zero out the rest of the page if needed.
+ */
+void pmem_fill_metadata_block(struct bittern_cache *bc,
+			      struct cache_block *cache_block,
+			      struct pmem_block_metadata *pmbm,
+			      enum cache_state metadata_update_state)
+{
+	memset(pmbm, 0, sizeof(struct pmem_block_metadata));
+	pmbm->pmbm_magic = MCBM_MAGIC;
+	pmbm->pmbm_block_id = cache_block->bcb_block_id;
+	pmbm->pmbm_status = metadata_update_state;
+	if (metadata_update_state == S_INVALID) {
+		pmbm->pmbm_device_sector = -1;
+		pmbm->pmbm_owner = 0;
+	} else {
+		ASSERT(is_sector_number_valid(cache_block->bcb_sector));
+		pmbm->pmbm_device_sector = cache_block->bcb_sector;
+		pmbm->pmbm_owner =
+			cache_pool_sector_owner(cache_block->bcb_sector);
+	}
+	pmbm->pmbm_xid = cache_block->bcb_xid;
+	pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
+	pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
+					   PMEM_BLOCK_METADATA_HASHING_SIZE);
+}
+
 void pmem_metadata_async_write_block(struct bittern_cache *bc,
 				     struct cache_block *cache_block,
 				     struct pmem_context *pmem_ctx,
@@ -606,6 +882,26 @@ void pmem_metadata_async_write_block(struct bittern_cache *bc,
 	       metadata_update_state == S_CLEAN ||
 	       metadata_update_state == S_DIRTY);
 
+	/*
+	 * setup context descriptor.
+	 */
+	ASSERT(ctx != NULL);
+	ctx->ma_magic1 = ASYNC_CONTEXT_MAGIC1;
+	ctx->ma_magic2 = ASYNC_CONTEXT_MAGIC2;
+	ctx->ma_bc = bc;
+	ctx->ma_cache_block = cache_block;
+	ctx->ma_callback_context = callback_context;
+	ctx->ma_callback_function = callback_function;
+	ctx->ma_datadir = WRITE;
+	ctx->ma_start_timer = current_kernel_time_nsec();
+	ctx->ma_metadata_state = metadata_update_state;
+
+	/*
+	 * batched with the updates of other blocks if the intent log is on
+	 */
+	if (pmem_mlog_append(bc, cache_block, pmem_ctx))
+		return;
+
 	/* required because we use the page to hold the metadata buffer */
 	ASSERT(dbi_data->di_buffer_vmalloc_buffer != NULL);
 	ASSERT(PAGE_ALIGNED(dbi_data->di_buffer_vmalloc_buffer));
@@ -625,33 +921,7 @@ void pmem_metadata_async_write_block(struct bittern_cache *bc,
 	memset(dbi_data->di_buffer, 0, PAGE_SIZE);
 
 	pmbm = (struct pmem_block_metadata *)(dbi_data->di_buffer);
-	pmbm->pmbm_magic = MCBM_MAGIC;
-	pmbm->pmbm_block_id = block_id;
-	pmbm->pmbm_status = metadata_update_state;
-	if (metadata_update_state == S_INVALID) {
-		pmbm->pmbm_device_sector = -1;
-	} else {
-		ASSERT(is_sector_number_valid(cache_block->bcb_sector));
-		pmbm->pmbm_device_sector = cache_block->bcb_sector;
-	}
-	pmbm->pmbm_xid = cache_block->bcb_xid;
-	pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
-	pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
-					   PMEM_BLOCK_METADATA_HASHING_SIZE);
-
-	/*
-	 * setup context descriptor and start async transfer.
-	 */
-	ASSERT(ctx != NULL);
-	ctx->ma_magic1 = ASYNC_CONTEXT_MAGIC1;
-	ctx->ma_magic2 = ASYNC_CONTEXT_MAGIC2;
-	ctx->ma_bc = bc;
-	ctx->ma_cache_block = cache_block;
-	ctx->ma_callback_context = callback_context;
-	ctx->ma_callback_function = callback_function;
-	ctx->ma_datadir = WRITE;
-	ctx->ma_start_timer = current_kernel_time_nsec();
-	ctx->ma_metadata_state = metadata_update_state;
+	pmem_fill_metadata_block(bc, cache_block, pmbm, metadata_update_state);
 
 	to_pmem_offset = __cache_block_id_2_metadata_pmem_offset(bc, block_id);
 
@@ -1038,6 +1308,38 @@ void pmem_data_get_page_write_block(struct bittern_cache *bc,
 	cache_timer_add(&pa->papi_stats.data_get_page_write_timer, ts_started);
 }
 
+/*!
+ * fill the metadata page written after a data write,
+ * the whole page is zeroed out to prevent information leak.
+ */
+static void pmem_fill_data_metadata(struct bittern_cache *bc,
+				    struct cache_block *cache_block,
+				    struct pmem_block_metadata *pmbm,
+				    uint32_t magic,
+				    enum cache_state metadata_update_state)
+{
+	/*
+	 * when writing data, it only makes sense to update metadata
+	 * to VALID_CLEAN or VALID_DIRTY
+	 */
+	ASSERT(metadata_update_state == S_CLEAN ||
+	       metadata_update_state == S_DIRTY);
+	ASSERT(is_sector_number_valid(cache_block->bcb_sector));
+	ASSERT(bc->bc_papi.papi_hdr.lm_mcb_size_bytes == PAGE_SIZE);
+
+	memset(pmbm, 0, PAGE_SIZE);
+
+	pmbm->pmbm_magic = magic;
+	pmbm->pmbm_block_id = cache_block->bcb_block_id;
+	pmbm->pmbm_status = metadata_update_state;
+	pmbm->pmbm_device_sector = cache_block->bcb_sector;
+	pmbm->pmbm_owner = cache_pool_sector_owner(cache_block->bcb_sector);
+	pmbm->pmbm_xid = cache_block->bcb_xid;
+	pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
+	pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
+					PMEM_BLOCK_METADATA_HASHING_SIZE);
+}
+
 /*
  * callback function for pmem_data_put_page_write_done()
  * this callback serves the identical purpose as
@@ -1182,27 +1484,12 @@ static void pmem_data_put_page_write_endio(struct pmem_context *pmem_ctx,
 	ASSERT(dbi_data->di_buffer != NULL);
 	ASSERT(dbi_data->di_page != NULL);
 	ASSERT(pmbm != NULL);
-	ASSERT(pa->papi_hdr.lm_mcb_size_bytes == PAGE_SIZE);
-
-	/*
-	 * when writing data, it only makes sense to update metadata
-	 * to VALID_CLEAN or VALID_DIRTY
-	 */
-	ASSERT(ctx->ma_metadata_state == S_CLEAN ||
-	       ctx->ma_metadata_state == S_DIRTY);
-	ASSERT(is_sector_number_valid(cache_block->bcb_sector));
-
-	/* zero out the whole buffer to prevent information leak */
-	memset(dbi_data->di_buffer, 0, PAGE_SIZE);
 
-	pmbm->pmbm_magic = MCBM_MAGIC;
-	pmbm->pmbm_block_id = cache_block->bcb_block_id;
-	pmbm->pmbm_status = ctx->ma_metadata_state;
-	pmbm->pmbm_device_sector = cache_block->bcb_sector;
-	pmbm->pmbm_xid = cache_block->bcb_xid;
-	pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
-	pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
-					PMEM_BLOCK_METADATA_HASHING_SIZE);
+	pmem_fill_data_metadata(bc,
+				cache_block,
+				pmbm,
+				MCBM_MAGIC,
+				ctx->ma_metadata_state);
 
 	ctx->ma_start_timer_2 = ts_started;
 	atomic_inc(&pa->papi_stats.data_put_page_write_metadata_count);
@@ -1219,6 +1506,114 @@ static void pmem_data_put_page_write_endio(struct pmem_context *pmem_ctx,
 	pmem_make_request_defer_block(bc, pmem_ctx);
 }
 
+/*
+ * callback function for pmem_data_put_page_write() when data and metadata
+ * went out with one request. there is nothing left to write.
+ */
+static
+void pmem_data_put_page_write_one_io_endio(struct pmem_context *pmem_ctx,
+					   int err)
+{
+	struct async_context *ctx;
+	struct bittern_cache *bc;
+	struct cache_block *cache_block;
+	struct data_buffer_info *dbi_data;
+	void *f_callback_context;
+	pmem_callback_t f_callback_function;
+	struct pmem_api *pa;
+
+	M_ASSERT(pmem_ctx->magic1 == PMEM_CONTEXT_MAGIC1);
+	M_ASSERT(pmem_ctx->magic2 == PMEM_CONTEXT_MAGIC2);
+	dbi_data = &pmem_ctx->dbi;
+	ctx = &pmem_ctx->async_ctx;
+
+	M_ASSERT(ctx->ma_magic1 == ASYNC_CONTEXT_MAGIC1);
+	ASSERT(ctx->ma_magic2 == ASYNC_CONTEXT_MAGIC2);
+	bc = ctx->ma_bc;
+	ASSERT(bc != NULL);
+	pa = &bc->bc_papi;
+	cache_block = ctx->ma_cache_block;
+	ASSERT(cache_block != NULL);
+	f_callback_context = ctx->ma_callback_context;
+	f_callback_function = ctx->ma_callback_function;
+	BT_DEV_TRACE(BT_LEVEL_TRACE1, bc, NULL, NULL, NULL, NULL,
+		     "callback_context=%p, callback_function=%p, ma_metadata_state=%d(%s), err=%d",
+		     f_callback_context, f_callback_function,
+		     ctx->ma_metadata_state,
+		     cache_state_to_str(ctx->ma_metadata_state), err);
+
+	ASSERT_BITTERN_CACHE(bc);
+	ASSERT_CACHE_BLOCK(cache_block, bc);
+	ASSERT((dbi_data->di_flags & CACHE_DI_FLAGS_DOUBLE_BUFFERING) != 0);
+	ASSERT((dbi_data->di_flags & CACHE_DI_FLAGS_PMEM_WRITE) != 0);
+	ASSERT(f_callback_function != NULL);
+	ASSERT(f_callback_context != NULL);
+	ASSERT_PMEM_DBI_DOUBLE_BUFFERING(dbi_data);
+	ASSERT(pmem_ctx->bi_metadata_vaddr != NULL);
+
+	if (err != 0)
+		printk_err("%s: put_page failed err=%d\n", bc->bc_name, err);
+
+	pmem_one_io_done(pa, pmem_ctx->bi_one_io_epoch);
+	kmem_cache_free(bc->bc_kmem_map, pmem_ctx->bi_metadata_vaddr);
+	pmem_ctx->bi_metadata_vaddr = NULL;
+
+	cache_timer_add(&pa->papi_stats.data_put_page_write_async_timer,
+			ctx->ma_start_timer);
+
+	/*
+	 * mark async context as free
+	 */
+	pmem_clear_dbi(dbi_data);
+
+	/*
+	 * just call the higher level callback
+	 */
+	(*f_callback_function)(bc,
+			       cache_block,
+			       pmem_ctx,
+			       f_callback_context,
+			       err);
+}
+
+/*!
+ * Set up a put_page_write() request which also carries the metadata page.
+ * Only done if enabled, and if we can get a page without waiting, as this
+ * can be called from softirq context. Otherwise the metadata is written
+ * after the data as usual.
+ */
+static bool pmem_data_put_page_write_one_io(struct bittern_cache *bc,
+					    struct cache_block *cache_block,
+					    struct pmem_context *pmem_ctx,
+					    enum cache_state metadata_update_state)
+{
+	struct pmem_block_metadata *pmbm;
+	struct pmem_block_one_io_record *pbor;
+
+	ASSERT(pmem_ctx->bi_metadata_vaddr == NULL);
+	ASSERT(bc->bc_papi.papi_hdr.lm_cache_layout ==
+	       CACHE_LAYOUT_INTERLEAVED);
+	if (!bc->bc_one_io_commit_enabled)
+		return false;
+	pmbm = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOWAIT | __GFP_NOWARN);
+	if (pmbm == NULL)
+		return false;
+	ASSERT(PAGE_ALIGNED(pmbm));
+	pmem_fill_data_metadata(bc,
+				cache_block,
+				pmbm,
+				MCBM_MAGIC_ONE_IO,
+				metadata_update_state);
+	pmem_ctx->bi_one_io_epoch = pmem_one_io_start(&bc->bc_papi);
+	pbor = (struct pmem_block_one_io_record *)(pmbm + 1);
+	pbor->pbor_magic = MCBM_ONE_IO_RECORD_MAGIC;
+	pbor->pbor_block_id = pmbm->pmbm_block_id;
+	pbor->pbor_xid = pmbm->pmbm_xid;
+	pbor->pbor_epoch = pmem_ctx->bi_one_io_epoch;
+	pmem_ctx->bi_metadata_vaddr = pmbm;
+	return true;
+}
+
 /* put_page_write */
 /*
  * async write accessors (get_page_write()/put_page_write())
@@ -1306,14 +1701,22 @@ void pmem_data_put_page_write_block(struct bittern_cache *bc,
 	ctx->ma_start_timer = ts_started;
 	ctx->ma_metadata_state = metadata_update_state;
 
-	to_pmem_offset = __cache_block_id_2_data_pmem_offset(bc, block_id),
+	to_pmem_offset = __cache_block_id_2_data_pmem_offset(bc, block_id);
 
 	/*
 	 * defer request to a worker thread
 	 */
 	pmem_ctx->bi_datadir = WRITE;
 	pmem_ctx->bi_sector = to_pmem_offset / SECTOR_SIZE;
-	pmem_ctx->ctx_endio = pmem_data_put_page_write_endio;
+	if (pmem_data_put_page_write_one_io(bc,
+					    cache_block,
+					    pmem_ctx,
+					    metadata_update_state)) {
+		atomic_inc(&pa->papi_stats.data_put_page_write_one_io_count);
+		pmem_ctx->ctx_endio = pmem_data_put_page_write_one_io_endio;
+	} else {
+		pmem_ctx->ctx_endio = pmem_data_put_page_write_endio;
+	}
 	pmem_make_request_defer_block(bc, pmem_ctx);
 
 	cache_timer_add(&pa->papi_stats.data_put_page_write_timer, ts_started);
@@ -29,7 +29,8 @@ extern int pmem_write_sync(struct bittern_cache *bc,
 
 typedef int
 (*pmem_allocate_f)(struct bittern_cache *bc,
-		   struct block_device *blockdev);
+		   struct block_device **blockdevs,
+		   unsigned int stripe_count);
 typedef void
 (*pmem_deallocate_f)(struct bittern_cache *bc);
 typedef int
@@ -129,7 +130,8 @@ struct cache_papi_interface {
  */
 extern const struct cache_papi_interface cache_papi_mem;
 extern int pmem_allocate_papi_mem(struct bittern_cache *bc,
-				  struct block_device *blockdev);
+				  struct block_device **blockdevs,
+				  unsigned int stripe_count);
 
 /*!
  * Block PMEM_API.
@@ -139,7 +141,25 @@ extern int pmem_allocate_papi_mem(struct bittern_cache *bc,
  */
 extern const struct cache_papi_interface cache_papi_block;
 extern int pmem_allocate_papi_block(struct bittern_cache *bc,
-				    struct block_device *blockdev);
+				    struct block_device **blockdevs,
+				    unsigned int stripe_count);
+/*!
+ * verify that all the stripes of a striped cache belong to the
+ * cache described by the restored header.
+ */
+extern int pmem_stripe_verify_block(struct bittern_cache *bc,
+				    struct pmem_header *pm);
+/*!
+ * returns the current logical size of the (possibly striped)
+ * cache devices, picking up any device growth.
+ */
+extern size_t pmem_stripe_size_bytes_block(struct bittern_cache *bc);
+extern void pmem_make_request_defer_block(struct bittern_cache *bc,
+					  struct pmem_context *pmem_ctx);
+extern void pmem_fill_metadata_block(struct bittern_cache *bc,
+				     struct cache_block *cache_block,
+				     struct pmem_block_metadata *pmbm,
+				     enum cache_state metadata_update_state);
 
 /*!
  * convert block id to metadata byte offset into the cache device
@@ -349,3 +369,32 @@ static inline void __pmem_clear_dbi(struct data_buffer_info *dbi, int flags)
 		__pmem_clear_dbi(__dbi, CACHE_DI_FLAGS_DOUBLE_BUFFERING)
 #define pmem_clear_dbi(__dbi)					\
 		__pmem_clear_dbi(__dbi, 0)
+
+/*!
+ * Start a data/metadata write tagged with @ref MCBM_MAGIC_ONE_IO,
+ * returns the epoch it is issued in.
+ */
+static inline uint64_t pmem_one_io_start(struct pmem_api *pa)
+{
+	unsigned long flags;
+	uint64_t epoch;
+
+	spin_lock_irqsave(&pa->papi_one_io_lock, flags);
+	epoch = pa->papi_one_io_epoch;
+	pa->papi_one_io_inflight[epoch & 1]++;
+	spin_unlock_irqrestore(&pa->papi_one_io_lock, flags);
+	return epoch;
+}
+
+/*! Completion of a write started with @ref pmem_one_io_start */
+static inline void pmem_one_io_done(struct pmem_api *pa, uint64_t epoch)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pa->papi_one_io_lock, flags);
+	ASSERT(epoch == pa->papi_one_io_epoch ||
+	       epoch + 1 == pa->papi_one_io_epoch);
+	ASSERT(pa->papi_one_io_inflight[epoch & 1] > 0);
+	pa->papi_one_io_inflight[epoch & 1]--;
+	spin_unlock_irqrestore(&pa->papi_one_io_lock, flags);
+}
@@ -23,11 +23,15 @@
  * pmem allocate/deallocate functions
  */
 int pmem_allocate_papi_mem(struct bittern_cache *bc,
-			   struct block_device *blockdev)
+			   struct block_device **blockdevs,
+			   unsigned int stripe_count)
 {
 	struct pmem_api *pa = &bc->bc_papi;
+	struct block_device *blockdev = blockdevs[0];
 	size_t blockdev_size_bytes;
 
+	/* striped caches always use the block pmem_api */
+	M_ASSERT(stripe_count == 1);
 	ASSERT(blockdev->bd_disk->fops->direct_access != NULL);
 
 	blockdev_size_bytes = blockdev->bd_part->nr_sects * SECTOR_SIZE;
@@ -35,6 +39,9 @@ int pmem_allocate_papi_mem(struct bittern_cache *bc,
 	printk_info("memory device size %lu\n", blockdev_size_bytes);
 
 	pa->papi_bdev = blockdev;
+	pa->papi_stripe_count = 1;
+	pa->papi_stripes[0].ps_bdev = blockdev;
+	pa->papi_stripes[0].ps_bdev_size_bytes = blockdev_size_bytes;
 	pa->papi_bdev_size_bytes = blockdev_size_bytes;
 	pa->papi_bdev_actual_size_bytes = blockdev_size_bytes;
 
@@ -195,9 +202,12 @@ void pmem_metadata_async_write_mem(struct bittern_cache *bc,
 	pmbm->pmbm_status = metadata_update_state;
 	if (metadata_update_state == S_INVALID) {
 		pmbm->pmbm_device_sector = -1;
+		pmbm->pmbm_owner = 0;
 	} else {
 		ASSERT(is_sector_number_valid(cache_block->bcb_sector));
 		pmbm->pmbm_device_sector = cache_block->bcb_sector;
+		pmbm->pmbm_owner =
+			cache_pool_sector_owner(cache_block->bcb_sector);
 	}
 	pmbm->pmbm_xid = cache_block->bcb_xid;
 	pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
@@ -718,6 +728,8 @@ void pmem_data_put_page_write_mem(struct bittern_cache *bc,
 		pmbm->pmbm_block_id = block_id;
 		pmbm->pmbm_status = metadata_update_state;
 		pmbm->pmbm_device_sector = cache_block->bcb_sector;
+		pmbm->pmbm_owner =
+			cache_pool_sector_owner(cache_block->bcb_sector);
 		pmbm->pmbm_xid = cache_block->bcb_xid;
 		pmbm->pmbm_hash_data = cache_block->bcb_hash_data;
 		pmbm->pmbm_hash_metadata = murmurhash3_128(pmbm,
@@ -215,7 +215,47 @@ struct pmem_header {
 	 *      lm_spare[62];
 	 *
 	 */
-	uint64_t lm_spare[64];
+	/*!
+	 * number of cache devices the cache is striped across.
+	 * zero (older caches) means one.
+	 * the header is replicated on each of them.
+	 */
+	uint64_t lm_stripe_count;
+	/*!
+	 * xid at which the cache was cleanly shut down, zero otherwise.
+	 * only meaningful if it matches lm_xid_current, it's cleared
+	 * on disk as soon as the cache is restored.
+	 */
+	uint64_t lm_clean_shutdown_xid;
+	/*!
+	 * index snapshot written at clean shutdown, one
+	 * @ref pmem_snapshot_record per cache block, stored past
+	 * lm_cache_size_bytes. zero offset means no snapshot.
+	 */
+	uint64_t lm_snapshot_offset_bytes;
+	uint64_t lm_snapshot_blocks;
+	/*! hash of the whole snapshot, one page at a time */
+	uint128_t lm_snapshot_hash;
+	/*!
+	 * metadata intent log, stored past lm_cache_size_bytes.
+	 * lm_mlog_epoch is non-zero while the log may hold block states
+	 * newer than the metadata blocks. lm_mlog_last_epoch only ever
+	 * grows, so that pages of earlier epochs are never replayed.
+	 */
+	uint64_t lm_mlog_epoch;
+	uint64_t lm_mlog_last_epoch;
+	uint64_t lm_mlog_offset_bytes;
+	uint64_t lm_mlog_pages;
+	/*!
+	 * epochs of the data/metadata writes tagged with
+	 * @ref MCBM_MAGIC_ONE_IO, see @ref pmem_block_one_io_record.
+	 * lm_one_io_epoch is the epoch in use when the header was written,
+	 * all such writes issued in epochs up to lm_one_io_acked_epoch had
+	 * completed by then.
+	 */
+	uint64_t lm_one_io_epoch;
+	uint64_t lm_one_io_acked_epoch;
+	uint64_t lm_spare[52];
 
 	/*!
 	 * Hash of this struct.
@@ -265,6 +305,22 @@ struct pmem_header {
 
 #define MCBM_MAGIC	0xf10c8a0f
 
+/*!
+ * Magic of a block metadata written in the same I/O as its data.
+ * In the interleaved layout the data page of a block is immediately
+ * followed by its metadata page, so a data write and its metadata update
+ * can go out as one two page request. The device does not write the two
+ * pages atomically, so on restore a data hash mismatch on such a block
+ * can mean the write was interrupted. The block is only rolled back if
+ * its @ref pmem_block_one_io_record shows the write may not have completed
+ * when the header was last written, otherwise it is reported as corrupt.
+ * Any later metadata-only update writes back @ref MCBM_MAGIC.
+ */
+#define MCBM_MAGIC_ONE_IO	0xf10c8a1f
+
+/*! magic of @ref pmem_block_one_io_record */
+#define MCBM_ONE_IO_RECORD_MAGIC	0xf10c8a2f
+
 /*!
  * PMEM version of cache block metadata.
  * actual size is currently 40 bytes,
@@ -279,12 +335,20 @@ struct pmem_block_metadata {
 	 * blocks.
 	 */
 	uint32_t pmbm_block_id;
-	/*! offset 8: cached device sector number */
+	/*!
+	 * offset 8: cached device sector number.
+	 * in shared pool mode the owner id is encoded in the high bits.
+	 */
 	uint64_t pmbm_device_sector;
 	/*! offset 16: matches in memory xid */
 	uint64_t pmbm_xid;
 	/*! offset 24: cache status @ref pmem_cache_state */
 	uint32_t pmbm_status;
+	/*!
+	 * offset 28: shared pool owner id, 0 is the pool's own cached device.
+	 * this used to be padding, so it's only checked for non-zero owners.
+	 */
+	uint32_t pmbm_owner;
 	/*! offset 32: crc32c of the data cache block */
 	uint128_t pmbm_hash_data;
 	/*!
@@ -299,6 +363,84 @@ struct pmem_block_metadata {
 #define PMEM_BLOCK_METADATA_HASHING_SIZE	\
 		offsetof(struct pmem_block_metadata, pmbm_hash_metadata)
 
+/*!
+ * Stored right after @ref pmem_block_metadata in the metadata page of a
+ * @ref MCBM_MAGIC_ONE_IO write, in the same sector. It records the epoch
+ * the write was issued in, so that restore can tell an interrupted write
+ * (epoch newer than lm_one_io_acked_epoch) from corruption of a write
+ * which had completed.
+ */
+struct pmem_block_one_io_record {
+	/*! offset 0: @ref MCBM_ONE_IO_RECORD_MAGIC */
+	uint32_t pbor_magic;
+	/*! offset 4: block id, same as pmbm_block_id */
+	uint32_t pbor_block_id;
+	/*! offset 8: xid, same as pmbm_xid */
+	uint64_t pbor_xid;
+	/*! offset 16: epoch the write was issued in */
+	uint64_t pbor_epoch;
+	/*! offset 24: padding */
+	uint64_t pbor_pad;
+};
+
+/*!
+ * One record of the index snapshot written at clean shutdown.
+ * It holds exactly what the full restore scan would extract from the
+ * cache block metadata, so that a clean restart can rebuild the in-memory
+ * index with a sequential read of the snapshot area instead of reading
+ * every metadata and data block.
+ */
+struct pmem_snapshot_record {
+	/*! offset 0: block id, first index value is 1 */
+	uint32_t psr_block_id;
+	/*! offset 4: cache status @ref pmem_cache_state */
+	uint32_t psr_status;
+	/*! offset 8: cached device sector number */
+	uint64_t psr_device_sector;
+	/*! offset 16: matches in memory xid */
+	uint64_t psr_xid;
+	/*! offset 24: padding */
+	uint64_t psr_pad;
+	/*! offset 32: hash of the data cache block */
+	uint128_t psr_hash_data;
+	/*! offset 48: padding up to 64 bytes */
+	uint8_t psr_spare[16];
+} __aligned(64);
+
+/*! snapshot records per page, records never straddle a page */
+#define PMEM_SNAPSHOT_RECORDS_PER_PAGE		\
+		(4096 / sizeof(struct pmem_snapshot_record))
+
+#define PMEM_MLOG_MAGIC	0xf10c1a9e
+
+/*!
+ * Header of one page of the metadata intent log, followed by up to
+ * @ref PMEM_MLOG_RECORDS_PER_PAGE block metadata records. Each record is
+ * exactly what a metadata-only update would have written to the metadata
+ * block of its cache block.
+ */
+struct pmem_mlog_page_header {
+	/*! offset 0: magic */
+	uint32_t mlph_magic;
+	/*! offset 4: number of records in this page */
+	uint32_t mlph_nr_records;
+	/*! offset 8: log epoch, see lm_mlog_epoch */
+	uint64_t mlph_epoch;
+	/*! offset 16: page sequence number within the epoch */
+	uint64_t mlph_seq;
+	/*! offset 24: cache UUID, same as lm_uuid */
+	uint8_t mlph_uuid[16];
+	/*! offset 40: padding */
+	uint64_t mlph_pad;
+	/*! offset 48: hash of the whole page, computed with this field zeroed */
+	uint128_t mlph_hash;
+} __aligned(64);
+
+/*! block metadata records per metadata intent log page */
+#define PMEM_MLOG_RECORDS_PER_PAGE		\
+		((4096 - sizeof(struct pmem_mlog_page_header)) /	\
+		 sizeof(struct pmem_block_metadata))
+
 /*!
  * Valid persistent cache states.
  * Every other state is considered transient and rolled back on recovery.
@@ -0,0 +1,855 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+
+#include "bittern_cache.h"
+#include "bittern_cache_pmem_api_internal.h"
+
+/*
+ * Metadata intent log.
+ *
+ * Invalidations and writebacks only change the state of a cache block,
+ * yet each of them costs a random one page write to the metadata block of
+ * the cache block. With the log enabled, these metadata-only updates are
+ * appended to a ring of pages past the end of the cache instead (the area
+ * the index snapshot uses at clean shutdown), so that the updates of many
+ * blocks go to the cache device with one sequential page write:
+ *
+ * - An update is added to the page being filled, and completes when that
+ *   page is on the cache device. While a page is being written the next
+ *   one fills up, so under load each page write carries a batch of
+ *   updates, and with no load an update costs one write as before.
+ *
+ * - When PMEM_MLOG_CHECKPOINT_PCT of the ring is in use, a checkpoint
+ *   writes the current state of the blocks found in the written pages to
+ *   their metadata blocks, after which those pages can be reused.
+ *
+ * - If the ring is full, or if the page being filled is full, the update
+ *   is written to the metadata block as usual.
+ *
+ * Each record is exactly the struct pmem_block_metadata a metadata-only
+ * update would have written to the metadata block, so restore checks it
+ * the same way. A record replaces the metadata block contents if its xid
+ * is larger, or if the xid is the same and the state is further along:
+ * metadata-only updates keep the xid of the block, and within one xid the
+ * state only goes from dirty to clean to invalid. Every other change of a
+ * block is a data write, which gets a new and larger xid and goes to the
+ * metadata block directly. Hence neither pages nor records need to be
+ * ordered on replay, and pages left over from earlier laps of the ring
+ * always lose against newer state.
+ *
+ * Pages carry the log epoch, which changes every time the log is started,
+ * so that pages of earlier runs are never replayed. The log is
+ * checkpointed and closed before the index snapshot is saved and before
+ * an online resize, as both reuse the space past the end of the cache.
+ * Only block cache devices with the interleaved layout are supported.
+ */
+
+/*! ring slot of page seq */
+static unsigned int pmem_mlog_slot(struct pmem_mlog *ml, uint64_t seq)
+{
+	return do_div(seq, ml->ml_pages);
+}
+
+static int pmem_mlog_state_rank(uint32_t status)
+{
+	switch (status) {
+	case S_DIRTY:
+		return 0;
+	case S_CLEAN:
+		return 1;
+	case S_INVALID:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+/*! true if log record rec has a newer state than pmbm */
+static bool pmem_mlog_is_newer(const struct pmem_block_metadata *rec,
+			       const struct pmem_block_metadata *pmbm)
+{
+	if (rec->pmbm_xid != pmbm->pmbm_xid)
+		return rec->pmbm_xid > pmbm->pmbm_xid;
+	return pmem_mlog_state_rank(rec->pmbm_status) >
+	       pmem_mlog_state_rank(pmbm->pmbm_status);
+}
+
+/*!
+ * start writing the page being filled, unless a page is already being
+ * written. called with ml_lock held. returns true if the caller needs to
+ * call pmem_mlog_write_page() for page *out_seq.
+ */
+static bool __pmem_mlog_dispatch(struct bittern_cache *bc,
+				 struct pmem_mlog *ml,
+				 uint64_t *out_seq)
+{
+	struct pmem_mlog_page_header *mlph;
+	unsigned int bucket;
+
+	if (ml->ml_write_inflight || ml->ml_head_records == 0)
+		return false;
+
+	mlph = ml->ml_page[ml->ml_head_seq & 1];
+	mlph->mlph_magic = PMEM_MLOG_MAGIC;
+	mlph->mlph_nr_records = ml->ml_head_records;
+	mlph->mlph_epoch = ml->ml_epoch;
+	mlph->mlph_seq = ml->ml_head_seq;
+	memcpy(mlph->mlph_uuid, bc->bc_papi.papi_hdr.lm_uuid,
+	       sizeof(mlph->mlph_uuid));
+
+	bucket = min_t(unsigned int,
+		       ilog2(ml->ml_head_records),
+		       PMEM_MLOG_BATCH_HIST_BUCKETS - 1);
+	ml->ml_batch_hist[bucket]++;
+
+	list_splice_init(&ml->ml_head_waiters, &ml->ml_inflight_waiters);
+	ml->ml_write_inflight = true;
+	ml->ml_write_started = current_kernel_time_nsec();
+	*out_seq = ml->ml_head_seq;
+	ml->ml_head_seq++;
+	ml->ml_head_records = 0;
+	return true;
+}
+
+/*! called with ml_lock held */
+static bool __pmem_mlog_needs_checkpoint(struct pmem_mlog *ml)
+{
+	return (ml->ml_head_seq - ml->ml_tail_seq) * 100 >=
+	       (uint64_t)ml->ml_pages * PMEM_MLOG_CHECKPOINT_PCT;
+}
+
+static
+void pmem_mlog_write_page_endio(struct pmem_context *pmem_ctx, int err);
+
+static void pmem_mlog_write_page(struct bittern_cache *bc, uint64_t seq)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	struct pmem_context *pmem_ctx = &ml->ml_pmem_ctx[seq & 1];
+	struct pmem_mlog_page_header *mlph = ml->ml_page[seq & 1];
+	uint64_t offset;
+
+	/* the page is ours until the write completes */
+	mlph->mlph_hash = UINT128_ZERO;
+	mlph->mlph_hash = murmurhash3_128(mlph, PAGE_SIZE);
+
+	offset = ml->ml_offset_bytes +
+		 (uint64_t)pmem_mlog_slot(ml, seq) * PAGE_SIZE;
+	pmem_ctx->dbi.di_page = virtual_to_page(mlph);
+	pmem_ctx->bi_datadir = WRITE;
+	pmem_ctx->bi_sector = offset / SECTOR_SIZE;
+	pmem_ctx->ctx_endio = pmem_mlog_write_page_endio;
+	pmem_make_request_defer_block(bc, pmem_ctx);
+}
+
+static void pmem_mlog_write_page_endio(struct pmem_context *pmem_ctx,
+				       int err)
+{
+	struct bittern_cache *bc = pmem_ctx->async_ctx.ma_bc;
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_mlog *ml = &pa->papi_mlog;
+	struct pmem_context *waiter, *next;
+	LIST_HEAD(waiters);
+	unsigned long flags;
+	uint64_t seq;
+	bool dispatch;
+
+	M_ASSERT(pmem_ctx->magic1 == PMEM_CONTEXT_MAGIC1);
+	M_ASSERT(pmem_ctx->magic2 == PMEM_CONTEXT_MAGIC2);
+	ASSERT_BITTERN_CACHE(bc);
+
+	atomic_inc(&ml->ml_page_writes);
+	cache_timer_add(&ml->ml_write_timer, ml->ml_write_started);
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	M_ASSERT(ml->ml_write_inflight);
+	ml->ml_write_inflight = false;
+	ml->ml_written_seq = ml->ml_head_seq;
+	list_splice_init(&ml->ml_inflight_waiters, &waiters);
+	if (err != 0) {
+		/* stop appending, updates go to the metadata blocks */
+		ml->ml_open = false;
+	}
+	dispatch = __pmem_mlog_dispatch(bc, ml, &seq);
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+
+	if (err != 0) {
+		atomic_inc(&ml->ml_write_errors);
+		printk_err_ratelimited("%s: metadata intent log write failed, log closed: err=%d\n",
+				       bc->bc_name,
+				       err);
+	}
+	if (dispatch)
+		pmem_mlog_write_page(bc, seq);
+	wake_up(&ml->ml_wait);
+
+	list_for_each_entry_safe(waiter, next, &waiters, bi_mlog_entry) {
+		struct async_context *ctx = &waiter->async_ctx;
+
+		list_del_init(&waiter->bi_mlog_entry);
+		ASSERT(ctx->ma_magic1 == ASYNC_CONTEXT_MAGIC1);
+		ASSERT(ctx->ma_magic2 == ASYNC_CONTEXT_MAGIC2);
+		cache_timer_add(&pa->papi_stats.metadata_write_async_timer,
+				ctx->ma_start_timer);
+		(*ctx->ma_callback_function)(bc,
+					     ctx->ma_cache_block,
+					     waiter,
+					     ctx->ma_callback_context,
+					     err);
+	}
+}
+
+bool pmem_mlog_append(struct bittern_cache *bc,
+		      struct cache_block *cache_block,
+		      struct pmem_context *pmem_ctx)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	struct pmem_block_metadata *pmbm;
+	uint32_t *block_ids;
+	unsigned long flags;
+	uint64_t seq;
+	bool dispatch, checkpoint;
+
+	/* the log is off by default, don't bother with the lock */
+	if (!ml->ml_open)
+		return false;
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	if (!ml->ml_open) {
+		spin_unlock_irqrestore(&ml->ml_lock, flags);
+		return false;
+	}
+	if (ml->ml_head_seq - ml->ml_tail_seq >= ml->ml_pages) {
+		/* ring is full until the checkpoint is done */
+		spin_unlock_irqrestore(&ml->ml_lock, flags);
+		atomic_inc(&ml->ml_full_fallbacks);
+		queue_work(ml->ml_wq, &ml->ml_checkpoint_work);
+		return false;
+	}
+	if (ml->ml_head_records == PMEM_MLOG_RECORDS_PER_PAGE) {
+		/* full, and the previous page is still being written */
+		ASSERT(ml->ml_write_inflight);
+		spin_unlock_irqrestore(&ml->ml_lock, flags);
+		atomic_inc(&ml->ml_busy_fallbacks);
+		return false;
+	}
+
+	block_ids = &ml->ml_block_ids[pmem_mlog_slot(ml, ml->ml_head_seq) *
+				      PMEM_MLOG_RECORDS_PER_PAGE];
+	if (ml->ml_head_records == 0) {
+		/* first record, zero out to prevent information leak */
+		memset(ml->ml_page[ml->ml_head_seq & 1], 0, PAGE_SIZE);
+		memset(block_ids,
+		       0,
+		       PMEM_MLOG_RECORDS_PER_PAGE * sizeof(uint32_t));
+	}
+	pmbm = (struct pmem_block_metadata *)
+		((struct pmem_mlog_page_header *)
+		 ml->ml_page[ml->ml_head_seq & 1] + 1);
+	pmem_fill_metadata_block(bc,
+				 cache_block,
+				 &pmbm[ml->ml_head_records],
+				 pmem_ctx->async_ctx.ma_metadata_state);
+	block_ids[ml->ml_head_records] = cache_block->bcb_block_id;
+	ml->ml_head_records++;
+	list_add_tail(&pmem_ctx->bi_mlog_entry, &ml->ml_head_waiters);
+
+	dispatch = __pmem_mlog_dispatch(bc, ml, &seq);
+	checkpoint = dispatch && __pmem_mlog_needs_checkpoint(ml);
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+
+	atomic_inc(&ml->ml_appends);
+	if (dispatch)
+		pmem_mlog_write_page(bc, seq);
+	if (checkpoint)
+		queue_work(ml->ml_wq, &ml->ml_checkpoint_work);
+	return true;
+}
+
+/*!
+ * hold a cache block regardless of its state.
+ * returns 1 if held, 0 if busy, -ENOENT if the block no longer exists.
+ */
+static int pmem_mlog_hold_block(struct bittern_cache *bc,
+				unsigned int block_id,
+				struct cache_block **o_cache_block)
+{
+	struct cache_block *cache_block;
+	unsigned long flags, cache_flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	if (block_id > atomic_read(&bc->bc_total_entries)) {
+		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+		return -ENOENT;
+	}
+	cache_block = cache_block_from_id(bc, block_id);
+	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
+	if (cache_block_hold(bc, cache_block) == 1) {
+		*o_cache_block = cache_block;
+		ret = 1;
+	} else {
+		cache_block_release(bc, cache_block);
+	}
+	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+	return ret;
+}
+
+/*! write the current state of a block to its metadata block */
+static int pmem_mlog_checkpoint_block(struct bittern_cache *bc,
+				      unsigned int block_id)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	struct pmem_block_metadata pmbm;
+	struct cache_block *cache_block;
+	int ret;
+
+	/*
+	 * a block is held for the whole duration of a transaction, so once
+	 * we hold it its state is stable, and it's at least as new as any
+	 * record of the block in the pages being checkpointed.
+	 */
+	while ((ret = pmem_mlog_hold_block(bc, block_id, &cache_block)) == 0) {
+		ml->ml_checkpoint_busy_retries++;
+		msleep(1);
+	}
+	if (ret < 0)
+		return 0;
+
+	M_ASSERT(cache_block->bcb_state == S_INVALID ||
+		 cache_block->bcb_state == S_CLEAN ||
+		 cache_block->bcb_state == S_DIRTY);
+	pmem_fill_metadata_block(bc,
+				 cache_block,
+				 &pmbm,
+				 cache_block->bcb_state);
+	ret = pmem_write_sync(bc,
+			__cache_block_id_2_metadata_pmem_offset(bc, block_id),
+			&pmbm,
+			sizeof(struct pmem_block_metadata));
+	cache_block_release(bc, cache_block);
+	return ret;
+}
+
+static int pmem_mlog_block_id_cmp(const void *a, const void *b)
+{
+	const uint32_t *id_a = a;
+	const uint32_t *id_b = b;
+
+	if (*id_a < *id_b)
+		return -1;
+	if (*id_a > *id_b)
+		return 1;
+	return 0;
+}
+
+/*!
+ * checkpoint all the pages written so far, so that they can be reused.
+ * called with ml_mutex held.
+ */
+static int __pmem_mlog_checkpoint(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	uint64_t tail_seq, written_seq, seq, tstamp;
+	unsigned int i, nr_ids, nr_blocks;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	tail_seq = ml->ml_tail_seq;
+	written_seq = ml->ml_written_seq;
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+	if (tail_seq == written_seq)
+		return 0;
+
+	tstamp = current_kernel_time_nsec();
+
+	/*
+	 * the slots of written pages are not touched by appends until the
+	 * tail moves past them.
+	 */
+	nr_ids = 0;
+	for (seq = tail_seq; seq < written_seq; seq++) {
+		uint32_t *block_ids;
+
+		block_ids = &ml->ml_block_ids[pmem_mlog_slot(ml, seq) *
+					      PMEM_MLOG_RECORDS_PER_PAGE];
+		for (i = 0; i < PMEM_MLOG_RECORDS_PER_PAGE; i++)
+			if (block_ids[i] != 0)
+				ml->ml_ckpt_block_ids[nr_ids++] = block_ids[i];
+	}
+	sort(ml->ml_ckpt_block_ids,
+	     nr_ids,
+	     sizeof(uint32_t),
+	     pmem_mlog_block_id_cmp,
+	     NULL);
+
+	/* one write per block, in block id order */
+	nr_blocks = 0;
+	for (i = 0; i < nr_ids; i++) {
+		if (i > 0 &&
+		    ml->ml_ckpt_block_ids[i] == ml->ml_ckpt_block_ids[i - 1])
+			continue;
+		ret = pmem_mlog_checkpoint_block(bc, ml->ml_ckpt_block_ids[i]);
+		if (ret < 0)
+			break;
+		nr_blocks++;
+	}
+
+	ml->ml_checkpoints++;
+	ml->ml_checkpoint_blocks += nr_blocks;
+	if (ret < 0) {
+		ml->ml_checkpoint_errors++;
+		printk_err("%s: metadata intent log checkpoint failed: ret=%d\n",
+			   bc->bc_name,
+			   ret);
+		return ret;
+	}
+	ml->ml_checkpoint_pages += written_seq - tail_seq;
+	cache_timer_add(&ml->ml_checkpoint_timer, tstamp);
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	ml->ml_tail_seq = written_seq;
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+	return 0;
+}
+
+static void pmem_mlog_checkpoint_worker(struct work_struct *work)
+{
+	struct pmem_mlog *ml;
+	struct bittern_cache *bc;
+
+	ml = container_of(work, struct pmem_mlog, ml_checkpoint_work);
+	bc = container_of(ml, struct bittern_cache, bc_papi.papi_mlog);
+	ASSERT_BITTERN_CACHE(bc);
+
+	mutex_lock(&ml->ml_mutex);
+	if (ml->ml_started)
+		__pmem_mlog_checkpoint(bc);
+	mutex_unlock(&ml->ml_mutex);
+}
+
+void pmem_mlog_initialize(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+
+	memset(ml, 0, sizeof(struct pmem_mlog));
+	spin_lock_init(&ml->ml_lock);
+	mutex_init(&ml->ml_mutex);
+	mutex_init(&ml->ml_state_mutex);
+	INIT_LIST_HEAD(&ml->ml_head_waiters);
+	INIT_LIST_HEAD(&ml->ml_inflight_waiters);
+	init_waitqueue_head(&ml->ml_wait);
+	INIT_WORK(&ml->ml_checkpoint_work, pmem_mlog_checkpoint_worker);
+	cache_timer_init(&ml->ml_write_timer);
+	cache_timer_init(&ml->ml_checkpoint_timer);
+	ml->ml_wq = alloc_workqueue("b_mlg:%s",
+				    WQ_MEM_RECLAIM,
+				    1,
+				    bc->bc_name);
+	M_ASSERT_FIXME(ml->ml_wq != NULL);
+}
+
+static void pmem_mlog_free_buffers(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		if (ml->ml_page[i] != NULL)
+			kmem_cache_free(bc->bc_kmem_map, ml->ml_page[i]);
+		ml->ml_page[i] = NULL;
+	}
+	vfree(ml->ml_block_ids);
+	ml->ml_block_ids = NULL;
+	vfree(ml->ml_ckpt_block_ids);
+	ml->ml_ckpt_block_ids = NULL;
+}
+
+void pmem_mlog_deinitialize(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+
+	pmem_mlog_stop(bc);
+	vfree(ml->ml_replay);
+	ml->ml_replay = NULL;
+	if (ml->ml_wq != NULL) {
+		destroy_workqueue(ml->ml_wq);
+		ml->ml_wq = NULL;
+	}
+}
+
+int pmem_mlog_start(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	struct pmem_mlog *ml = &pa->papi_mlog;
+	uint64_t offset = pm->lm_cache_size_bytes;
+	uint64_t pages = 0;
+	size_t ids_size;
+	unsigned long flags;
+	unsigned int i;
+	int ret = 0;
+
+	if (!bc->bc_mlog_enabled)
+		return 0;
+	if (pa->papi_interface != &cache_papi_block ||
+	    pmem_cache_layout(bc) != CACHE_LAYOUT_INTERLEAVED)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&ml->ml_state_mutex);
+	if (ml->ml_started)
+		goto out;
+	/* the resize worker restarts the log when done */
+	if (atomic_read(&bc->bc_resize_active) != 0) {
+		ret = -EBUSY;
+		goto out;
+	}
+	/* a failed checkpoint left records behind, restore will replay them */
+	if (pm->lm_mlog_epoch != 0) {
+		printk_err("%s: metadata intent log epoch %llu still open\n",
+			   bc->bc_name,
+			   pm->lm_mlog_epoch);
+		ret = -EIO;
+		goto out;
+	}
+
+	M_ASSERT((offset % PAGE_SIZE) == 0);
+	if (offset < pa->papi_bdev_size_bytes)
+		pages = min_t(uint64_t,
+			      PMEM_MLOG_PAGES,
+			      (pa->papi_bdev_size_bytes - offset) / PAGE_SIZE);
+	if (pages < PMEM_MLOG_PAGES_MIN) {
+		printk_info("%s: no room for metadata intent log\n",
+			    bc->bc_name);
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	ids_size = pages * PMEM_MLOG_RECORDS_PER_PAGE * sizeof(uint32_t);
+	ml->ml_block_ids = vzalloc(ids_size);
+	ml->ml_ckpt_block_ids = vzalloc(ids_size);
+	ml->ml_page[0] = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	ml->ml_page[1] = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (ml->ml_block_ids == NULL || ml->ml_ckpt_block_ids == NULL ||
+	    ml->ml_page[0] == NULL || ml->ml_page[1] == NULL) {
+		printk_err("%s: cannot allocate metadata intent log buffers\n",
+			   bc->bc_name);
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	for (i = 0; i < 2; i++) {
+		struct pmem_context *pmem_ctx = &ml->ml_pmem_ctx[i];
+
+		pmem_context_initialize(pmem_ctx);
+		pmem_ctx->async_ctx.ma_magic1 = ASYNC_CONTEXT_MAGIC1;
+		pmem_ctx->async_ctx.ma_magic2 = ASYNC_CONTEXT_MAGIC2;
+		pmem_ctx->async_ctx.ma_bc = bc;
+	}
+
+	ret = pmem_header_mlog_open(bc, offset, pages, &ml->ml_epoch);
+	if (ret < 0) {
+		printk_err("%s: cannot open metadata intent log: ret=%d\n",
+			   bc->bc_name,
+			   ret);
+		goto out_free;
+	}
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	ml->ml_offset_bytes = offset;
+	ml->ml_pages = pages;
+	ml->ml_head_seq = 0;
+	ml->ml_written_seq = 0;
+	ml->ml_tail_seq = 0;
+	ml->ml_head_records = 0;
+	ml->ml_open = true;
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+	ml->ml_started = true;
+
+	printk_info("%s: metadata intent log started: epoch=%llu, offset=%llu, pages=%llu\n",
+		    bc->bc_name,
+		    ml->ml_epoch,
+		    offset,
+		    pages);
+	goto out;
+
+out_free:
+	pmem_mlog_free_buffers(bc);
+out:
+	mutex_unlock(&ml->ml_state_mutex);
+	return ret;
+}
+
+static bool pmem_mlog_idle(struct pmem_mlog *ml)
+{
+	unsigned long flags;
+	bool idle;
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	idle = !ml->ml_write_inflight && ml->ml_head_records == 0;
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+	return idle;
+}
+
+void pmem_mlog_stop(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+	unsigned long flags;
+	int ret;
+
+	mutex_lock(&ml->ml_state_mutex);
+	if (!ml->ml_started) {
+		mutex_unlock(&ml->ml_state_mutex);
+		return;
+	}
+
+	spin_lock_irqsave(&ml->ml_lock, flags);
+	ml->ml_open = false;
+	spin_unlock_irqrestore(&ml->ml_lock, flags);
+
+	/* the page being written completes the page being filled */
+	wait_event(ml->ml_wait, pmem_mlog_idle(ml));
+	cancel_work_sync(&ml->ml_checkpoint_work);
+
+	mutex_lock(&ml->ml_mutex);
+	ret = __pmem_mlog_checkpoint(bc);
+	mutex_unlock(&ml->ml_mutex);
+	if (ret == 0)
+		ret = pmem_header_mlog_close(bc);
+	else
+		printk_err("%s: metadata intent log left open for restore\n",
+			   bc->bc_name);
+
+	pmem_mlog_free_buffers(bc);
+	ml->ml_started = false;
+	mutex_unlock(&ml->ml_state_mutex);
+
+	printk_info("%s: metadata intent log stopped: ret=%d\n",
+		    bc->bc_name,
+		    ret);
+}
+
+static bool pmem_mlog_page_valid(struct bittern_cache *bc,
+				 struct pmem_mlog_page_header *mlph)
+{
+	struct pmem_header *pm = &bc->bc_papi.papi_hdr;
+	uint128_t hash;
+
+	if (mlph->mlph_magic != PMEM_MLOG_MAGIC ||
+	    mlph->mlph_epoch != pm->lm_mlog_epoch ||
+	    memcmp(mlph->mlph_uuid, pm->lm_uuid, sizeof(mlph->mlph_uuid)) ||
+	    mlph->mlph_nr_records > PMEM_MLOG_RECORDS_PER_PAGE)
+		return false;
+	hash = mlph->mlph_hash;
+	mlph->mlph_hash = UINT128_ZERO;
+	mlph->mlph_hash = murmurhash3_128(mlph, PAGE_SIZE);
+	return uint128_eq(hash, mlph->mlph_hash);
+}
+
+static bool pmem_mlog_record_valid(struct bittern_cache *bc,
+				   struct pmem_block_metadata *pmbm)
+{
+	uint128_t hash_metadata;
+
+	hash_metadata = murmurhash3_128(pmbm, PMEM_BLOCK_METADATA_HASHING_SIZE);
+	return pmbm->pmbm_magic == MCBM_MAGIC &&
+	       uint128_eq(hash_metadata, pmbm->pmbm_hash_metadata) &&
+	       pmbm->pmbm_block_id >= 1 &&
+	       pmbm->pmbm_block_id <= bc->bc_papi.papi_hdr.lm_cache_blocks &&
+	       pmem_mlog_state_rank(pmbm->pmbm_status) >= 0;
+}
+
+static int pmem_mlog_record_cmp(const void *a, const void *b)
+{
+	const struct pmem_block_metadata *pmbm_a = a;
+	const struct pmem_block_metadata *pmbm_b = b;
+
+	return pmem_mlog_block_id_cmp(&pmbm_a->pmbm_block_id,
+				      &pmbm_b->pmbm_block_id);
+}
+
+int pmem_mlog_replay_load(struct bittern_cache *bc)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_header *pm = &pa->papi_hdr;
+	struct pmem_mlog *ml = &pa->papi_mlog;
+	struct pmem_mlog_page_header *mlph;
+	struct pmem_block_metadata *pmbm;
+	unsigned int i, j, n;
+	uint64_t page;
+	int ret = 0;
+
+	if (pm->lm_mlog_epoch == 0)
+		return 0;
+
+	printk_info("%s: metadata intent log: epoch=%llu, offset=%llu, pages=%llu\n",
+		    bc->bc_name,
+		    pm->lm_mlog_epoch,
+		    pm->lm_mlog_offset_bytes,
+		    pm->lm_mlog_pages);
+	if (pa->papi_interface != &cache_papi_block ||
+	    pm->lm_mlog_offset_bytes < pm->lm_cache_size_bytes ||
+	    (pm->lm_mlog_offset_bytes % PAGE_SIZE) != 0 ||
+	    pm->lm_mlog_pages == 0 ||
+	    pm->lm_mlog_pages > PMEM_MLOG_PAGES ||
+	    pm->lm_mlog_offset_bytes + pm->lm_mlog_pages * PAGE_SIZE >
+	    pa->papi_bdev_size_bytes) {
+		printk_err("%s: metadata intent log geometry is invalid\n",
+			   bc->bc_name);
+		return -EINVAL;
+	}
+
+	ml->ml_replay = vmalloc(pm->lm_mlog_pages *
+				PMEM_MLOG_RECORDS_PER_PAGE *
+				sizeof(struct pmem_block_metadata));
+	mlph = kmem_cache_alloc(bc->bc_kmem_map, GFP_NOIO);
+	/*TODO_ADD_ERROR_INJECTION*/
+	if (ml->ml_replay == NULL || mlph == NULL) {
+		printk_err("%s: cannot allocate metadata intent log buffers\n",
+			   bc->bc_name);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	n = 0;
+	for (page = 0; page < pm->lm_mlog_pages; page++) {
+		ret = pmem_read_sync(bc,
+				     pm->lm_mlog_offset_bytes + page * PAGE_SIZE,
+				     mlph,
+				     PAGE_SIZE);
+		if (ret < 0) {
+			printk_err("%s: pmem_read_sync failed, ret=%d\n",
+				   bc->bc_name,
+				   ret);
+			goto out;
+		}
+		/* never written in this epoch, or torn */
+		if (!pmem_mlog_page_valid(bc, mlph))
+			continue;
+		pa->papi_stats.restore_mlog_pages++;
+		pmbm = (struct pmem_block_metadata *)(mlph + 1);
+		for (i = 0; i < mlph->mlph_nr_records; i++) {
+			/* the page hash is good, this can only be a bug */
+			if (!pmem_mlog_record_valid(bc, &pmbm[i])) {
+				printk_err("%s: metadata intent log page %llu record %u is corrupt\n",
+					   bc->bc_name,
+					   page,
+					   i);
+				ret = -EHWPOISON;
+				goto out;
+			}
+			ml->ml_replay[n++] = pmbm[i];
+		}
+	}
+	pa->papi_stats.restore_mlog_records = n;
+
+	/* keep the newest record of each block */
+	sort(ml->ml_replay,
+	     n,
+	     sizeof(struct pmem_block_metadata),
+	     pmem_mlog_record_cmp,
+	     NULL);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 &&
+		    ml->ml_replay[j - 1].pmbm_block_id ==
+		    ml->ml_replay[i].pmbm_block_id) {
+			if (pmem_mlog_is_newer(&ml->ml_replay[i],
+					       &ml->ml_replay[j - 1]))
+				ml->ml_replay[j - 1] = ml->ml_replay[i];
+			continue;
+		}
+		ml->ml_replay[j++] = ml->ml_replay[i];
+	}
+	ml->ml_replay_count = j;
+
+	printk_info("%s: metadata intent log: pages=%u, records=%u, blocks=%u\n",
+		    bc->bc_name,
+		    pa->papi_stats.restore_mlog_pages,
+		    n,
+		    ml->ml_replay_count);
+
+out:
+	if (mlph != NULL)
+		kmem_cache_free(bc->bc_kmem_map, mlph);
+	if (ret < 0) {
+		vfree(ml->ml_replay);
+		ml->ml_replay = NULL;
+	}
+	return ret;
+}
+
+static int pmem_mlog_replay_key_cmp(const void *key, const void *elt)
+{
+	const struct pmem_block_metadata *pmbm = elt;
+
+	return pmem_mlog_block_id_cmp(key, &pmbm->pmbm_block_id);
+}
+
+int pmem_mlog_replay_block(struct bittern_cache *bc,
+			   struct pmem_block_metadata *pmbm)
+{
+	struct pmem_api *pa = &bc->bc_papi;
+	struct pmem_mlog *ml = &pa->papi_mlog;
+	struct pmem_block_metadata *rec;
+	int ret;
+
+	if (ml->ml_replay == NULL)
+		return 0;
+	rec = bsearch(&pmbm->pmbm_block_id,
+		      ml->ml_replay,
+		      ml->ml_replay_count,
+		      sizeof(struct pmem_block_metadata),
+		      pmem_mlog_replay_key_cmp);
+	if (rec == NULL || !pmem_mlog_is_newer(rec, pmbm))
+		return 0;
+
+	printk_info_ratelimited("block id #%u: metadata intent log: xid=%llu, status=%u(%s)\n",
+				rec->pmbm_block_id,
+				rec->pmbm_xid,
+				rec->pmbm_status,
+				cache_state_to_str(rec->pmbm_status));
+	*pmbm = *rec;
+	ret = pmem_write_sync(bc,
+		__cache_block_id_2_metadata_pmem_offset(bc,
+							pmbm->pmbm_block_id),
+		pmbm,
+		sizeof(struct pmem_block_metadata));
+	if (ret < 0) {
+		printk_err("%s: pmem_write_sync failed, ret=%d\n",
+			   bc->bc_name,
+			   ret);
+		return ret;
+	}
+	pa->papi_stats.restore_mlog_replayed_blocks++;
+	return 1;
+}
+
+int pmem_mlog_replay_done(struct bittern_cache *bc)
+{
+	struct pmem_mlog *ml = &bc->bc_papi.papi_mlog;
+
+	vfree(ml->ml_replay);
+	ml->ml_replay = NULL;
+	ml->ml_replay_count = 0;
+	/* every block has the state of the log now */
+	return pmem_header_mlog_close(bc);
+}
@@ -0,0 +1,664 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * Shared pool mode.
+ *
+ * Every bittern cache is also a pool. Other cached devices can join it
+ * with a "bittern_cache_member" dm target, each member is its own dm
+ * device. Members do not have a cache device of their own, they share
+ * the cache blocks, the replacement policy, the bgwriter and the
+ * invalidator of the pool.
+ *
+ * Requests coming from a member are tagged with the member id in the
+ * high bits of the sector number (see @ref cache_pool_sector_make), so
+ * the same cached device sector of two different devices maps to two
+ * different cache blocks, and the owner of each block is recorded in
+ * its persistent metadata. The id is decoded right before issuing I/O to
+ * the cached device.
+ *
+ * Per-owner quotas are expressed as a percentage of the total number of
+ * cache blocks. When an owner is at its max quota, its misses bypass the
+ * cache. When it is at its min quota, the invalidator does not pick its
+ * clean blocks for replacement.
+ *
+ * Members keep the pool device open, so the pool cannot be removed
+ * while it has members. When a member goes away, all of its blocks are
+ * written back and invalidated. After a crash, the dirty blocks of a
+ * member are restored together with the pool and kept off the dirty list
+ * until the member joins again with the same id.
+ */
+
+/*! all pools, protected by @ref cache_pool_mutex */
+static LIST_HEAD(cache_pool_list);
+static DEFINE_MUTEX(cache_pool_mutex);
+
+int cache_pool_initialize(struct bittern_cache *bc)
+{
+	unsigned int i;
+
+	if (bc->bc_ti->len > CACHE_POOL_SECTOR_MASK) {
+		printk_err("%s: cached device is too large for pool mode\n",
+			   bc->bc_name);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < CACHE_POOL_MAX_OWNERS; i++) {
+		struct cache_pool_owner *cpo = &bc->bc_pool_owners[i];
+
+		memset(cpo, 0, sizeof(struct cache_pool_owner));
+		cpo->cpo_bc = bc;
+		cpo->cpo_id = i;
+		cpo->cpo_min_pct = 0;
+		cpo->cpo_max_pct = 100;
+	}
+	bc->bc_pool_owners[0].cpo_dm_dev = bc->devio.dm_dev;
+	strlcpy(bc->bc_pool_owners[0].cpo_device_name,
+		bc->bc_cached_device_name,
+		sizeof(bc->bc_pool_owners[0].cpo_device_name));
+	bc->bc_pool_members = 0;
+	INIT_LIST_HEAD(&bc->bc_pool_orphan_list);
+	atomic_set(&bc->bc_pool_orphan_dirty, 0);
+	INIT_LIST_HEAD(&bc->bc_pool_list);
+
+	return 0;
+}
+
+void cache_pool_register(struct bittern_cache *bc)
+{
+	mutex_lock(&cache_pool_mutex);
+	list_add_tail(&bc->bc_pool_list, &cache_pool_list);
+	mutex_unlock(&cache_pool_mutex);
+}
+
+void cache_pool_unregister(struct bittern_cache *bc)
+{
+	mutex_lock(&cache_pool_mutex);
+	/* members hold the pool device open, dm cannot remove it before */
+	M_ASSERT(bc->bc_pool_members == 0);
+	list_del_init(&bc->bc_pool_list);
+	mutex_unlock(&cache_pool_mutex);
+}
+
+/*!
+ * called once restore is complete and before any thread is started.
+ * counts valid blocks per owner and parks the dirty blocks of members,
+ * none of which can be attached at this point.
+ */
+void cache_pool_restore_owners(struct bittern_cache *bc)
+{
+	unsigned int block_id;
+	unsigned int i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	for (block_id = 1;
+	     block_id <= atomic_read(&bc->bc_total_entries);
+	     block_id++) {
+		struct cache_block *bcb = cache_block_from_id(bc, block_id);
+		struct cache_pool_owner *cpo;
+
+		if (bcb->bcb_state == S_INVALID)
+			continue;
+		M_ASSERT(bcb->bcb_state == S_CLEAN ||
+			 bcb->bcb_state == S_DIRTY);
+		cpo = cache_pool_owner_of(bc, bcb->bcb_sector);
+		atomic_inc(&cpo->cpo_valid_entries);
+		if (cpo->cpo_id == 0 || bcb->bcb_state != S_DIRTY)
+			continue;
+		atomic_inc(&cpo->cpo_orphan_dirty);
+		atomic_inc(&bc->bc_pool_orphan_dirty);
+		list_move_tail(&bcb->bcb_entry_cleandirty,
+			       &bc->bc_pool_orphan_list);
+	}
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	for (i = 1; i < CACHE_POOL_MAX_OWNERS; i++) {
+		struct cache_pool_owner *cpo = &bc->bc_pool_owners[i];
+
+		if (atomic_read(&cpo->cpo_valid_entries) == 0)
+			continue;
+		printk_info("%s: pool member %u has %u restored blocks (%u dirty), waiting for it to join\n",
+			    bc->bc_name,
+			    cpo->cpo_id,
+			    atomic_read(&cpo->cpo_valid_entries),
+			    atomic_read(&cpo->cpo_orphan_dirty));
+	}
+}
+
+/*! put the orphaned dirty blocks of a member which just joined back */
+static void cache_pool_adopt_orphans(struct bittern_cache *bc,
+				     struct cache_pool_owner *cpo)
+{
+	struct cache_block *bcb, *next_bcb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	list_for_each_entry_safe(bcb,
+				 next_bcb,
+				 &bc->bc_pool_orphan_list,
+				 bcb_entry_cleandirty) {
+		if (cache_pool_sector_owner(bcb->bcb_sector) != cpo->cpo_id)
+			continue;
+		list_move_tail(&bcb->bcb_entry_cleandirty,
+			       &bc->bc_valid_entries_dirty_list);
+		atomic_dec(&cpo->cpo_orphan_dirty);
+		atomic_dec(&bc->bc_pool_orphan_dirty);
+	}
+	M_ASSERT(atomic_read(&cpo->cpo_orphan_dirty) == 0);
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	wake_up_interruptible(&bc->bc_bgwriter_wait);
+}
+
+/*!
+ * park the idle dirty blocks of a member which is going away without
+ * having been able to write them back (cache in error state).
+ */
+static void cache_pool_orphan_blocks(struct bittern_cache *bc,
+				     struct cache_pool_owner *cpo)
+{
+	struct cache_block *bcb, *next_bcb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	list_for_each_entry_safe(bcb,
+				 next_bcb,
+				 &bc->bc_valid_entries_dirty_list,
+				 bcb_entry_cleandirty) {
+		if (cache_pool_sector_owner(bcb->bcb_sector) != cpo->cpo_id)
+			continue;
+		list_move_tail(&bcb->bcb_entry_cleandirty,
+			       &bc->bc_pool_orphan_list);
+		atomic_inc(&cpo->cpo_orphan_dirty);
+		atomic_inc(&bc->bc_pool_orphan_dirty);
+	}
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+}
+
+unsigned int cache_pool_remap_bio(struct bittern_cache *bc, struct bio *bio)
+{
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct dm_dev *dm_dev = cache_pool_owner_dev(bc, sector);
+
+	M_ASSERT(dm_dev != NULL);
+	bio->bi_bdev = dm_dev->bdev;
+	bio->bi_iter.bi_sector = cache_pool_sector_device(sector);
+	return cache_pool_sector_owner(sector);
+}
+
+/*!
+ * set quotas for an owner. the sum of all min quotas is capped so that
+ * there are always unprotected blocks for the replacement policy to use.
+ * caller holds @ref cache_pool_mutex.
+ */
+static int __cache_pool_set_quota(struct bittern_cache *bc,
+				  unsigned int owner,
+				  int min_pct,
+				  int max_pct)
+{
+	unsigned int i, min_sum = 0;
+
+	M_ASSERT(owner < CACHE_POOL_MAX_OWNERS);
+	if (min_pct < 0 || max_pct > 100 || min_pct > max_pct)
+		return -EINVAL;
+
+	for (i = 0; i < CACHE_POOL_MAX_OWNERS; i++)
+		if (i != owner)
+			min_sum += bc->bc_pool_owners[i].cpo_min_pct;
+	if (min_sum + min_pct > CACHE_POOL_MAX_MIN_PCT_SUM) {
+		printk_err("%s: pool: sum of min quotas %u%% exceeds %u%%\n",
+			   bc->bc_name,
+			   min_sum + min_pct,
+			   CACHE_POOL_MAX_MIN_PCT_SUM);
+		return -EINVAL;
+	}
+	bc->bc_pool_owners[owner].cpo_min_pct = min_pct;
+	bc->bc_pool_owners[owner].cpo_max_pct = max_pct;
+
+	return 0;
+}
+
+int cache_pool_set_quota(struct bittern_cache *bc,
+			 unsigned int owner,
+			 int min_pct,
+			 int max_pct)
+{
+	int ret;
+
+	mutex_lock(&cache_pool_mutex);
+	ret = __cache_pool_set_quota(bc, owner, min_pct, max_pct);
+	mutex_unlock(&cache_pool_mutex);
+
+	return ret;
+}
+
+/*!
+ * one pass over all blocks: write back the dirty blocks owned by the
+ * member and invalidate the clean ones. busy blocks are retried on the
+ * next pass.
+ */
+static void cache_pool_evacuate_pass(struct bittern_cache *bc,
+				     struct cache_pool_owner *cpo)
+{
+	unsigned int block_id;
+
+	for (block_id = 1;
+	     block_id <= atomic_read(&bc->bc_total_entries);
+	     block_id++) {
+		struct cache_block *cache_block;
+		sector_t sector, sector_hint;
+		int ret;
+
+		if (block_id % CACHE_POOL_EVACUATE_BATCH_BLOCKS == 0)
+			schedule();
+
+		ret = cache_get_by_id(bc, block_id, &cache_block);
+		ASSERT_CACHE_GET_RET(ret);
+		if (ret != CACHE_GET_RET_HIT_IDLE)
+			continue;
+
+		ASSERT(cache_block != NULL);
+		ASSERT_CACHE_BLOCK(cache_block, bc);
+		if (cache_pool_sector_owner(cache_block->bcb_sector) !=
+		    cpo->cpo_id) {
+			cache_put(bc, cache_block, 1);
+			continue;
+		}
+		if (cache_block->bcb_state == S_CLEAN) {
+			cache_invalidate_clean_block(bc, cache_block);
+			cpo->cpo_evacuate_invalidations++;
+			continue;
+		}
+
+		ASSERT(cache_block->bcb_state == S_DIRTY);
+		sector = cache_block->bcb_sector;
+		cache_put(bc, cache_block, 1);
+		ret = cache_bgwriter_wait_for_resources(bc, true);
+		ASSERT(ret == 0);
+		ret = cache_bgwriter_io_start_one(bc, sector, &sector_hint);
+		ASSERT(ret == 0 || ret == 1);
+		if (ret == 1)
+			cpo->cpo_evacuate_writebacks++;
+	}
+}
+
+static void cache_pool_evacuate(struct bittern_cache *bc,
+				struct cache_pool_owner *cpo)
+{
+	printk_info("%s: pool member %u: evacuating %u blocks\n",
+		    bc->bc_name,
+		    cpo->cpo_id,
+		    atomic_read(&cpo->cpo_valid_entries));
+
+	while (atomic_read(&cpo->cpo_valid_entries) > 0) {
+		if (bc->error_state != ES_NOERROR) {
+			printk_err("%s: pool member %u: cache in error state, leaving %u blocks behind\n",
+				   bc->bc_name,
+				   cpo->cpo_id,
+				   atomic_read(&cpo->cpo_valid_entries));
+			cache_pool_orphan_blocks(bc, cpo);
+			break;
+		}
+		cache_pool_evacuate_pass(bc, cpo);
+		msleep(CACHE_POOL_EVACUATE_PASS_DELAY_MS);
+	}
+
+	printk_info("%s: pool member %u: evacuation done, writebacks=%llu invalidations=%llu\n",
+		    bc->bc_name,
+		    cpo->cpo_id,
+		    cpo->cpo_evacuate_writebacks,
+		    cpo->cpo_evacuate_invalidations);
+}
+
+/*! find the pool whose dm device is bdev. caller holds cache_pool_mutex */
+static struct bittern_cache *cache_pool_lookup(struct block_device *bdev)
+{
+	struct bittern_cache *bc;
+
+	list_for_each_entry(bc, &cache_pool_list, bc_pool_list) {
+		struct mapped_device *md = dm_table_get_md(bc->bc_ti->table);
+
+		if (dm_disk(md) == bdev->bd_disk)
+			return bc;
+	}
+	return NULL;
+}
+
+/*
+ * Mapping parameters:
+ *    <pool_device> <device_being_cached> <member_id> [<min_pct> <max_pct>]
+ *
+ * Example:
+ *
+ * /dev/mapper/bitcache0 /dev/sdd1 1 10 50
+ *
+ * The above arguments tell bittern to cache /dev/sdd1 in the pool of
+ * bitcache0 as member 1, using at least 10% and at most 50% of the pool
+ * cache blocks. The member id must stay the same across restarts.
+ */
+static int cache_pool_member_ctr(struct dm_target *ti,
+				 unsigned int argc,
+				 char **argv)
+{
+	struct block_device *pool_bdev;
+	struct bittern_cache *bc;
+	struct cache_pool_owner *cpo;
+	struct dm_dev *dm_dev;
+	unsigned int member_id;
+	int min_pct = 0, max_pct = 100;
+	unsigned long flags;
+	int ret;
+
+	if (argc != 3 && argc != 5) {
+		ti->error = "requires 3 or 5 arguments";
+		return -EINVAL;
+	}
+	if (kstrtouint(argv[2], 0, &member_id) != 0 ||
+	    member_id == 0 ||
+	    member_id >= CACHE_POOL_MAX_OWNERS) {
+		ti->error = "invalid member id";
+		return -EINVAL;
+	}
+	if (argc == 5 &&
+	    (kstrtoint(argv[3], 0, &min_pct) != 0 ||
+	     kstrtoint(argv[4], 0, &max_pct) != 0)) {
+		ti->error = "invalid quota";
+		return -EINVAL;
+	}
+	if (ti->begin != 0) {
+		ti->error = "non-zero begin is not supported";
+		return -EINVAL;
+	}
+	if ((ti->len % SECTORS_PER_CACHE_BLOCK) != 0) {
+		ti->error =
+		    "cached device size is not a multiple of cache block size";
+		return -EINVAL;
+	}
+	if (ti->len > CACHE_POOL_SECTOR_MASK) {
+		ti->error = "cached device is too large";
+		return -EINVAL;
+	}
+
+	/*
+	 * hold the pool device open, this keeps dm from removing the
+	 * pool while we are a member.
+	 */
+	pool_bdev = blkdev_get_by_path(argv[0], FMODE_READ, NULL);
+	if (IS_ERR(pool_bdev)) {
+		ti->error = "pool device lookup failed";
+		return PTR_ERR(pool_bdev);
+	}
+
+	mutex_lock(&cache_pool_mutex);
+
+	bc = cache_pool_lookup(pool_bdev);
+	if (bc == NULL) {
+		ti->error = "not a bittern cache";
+		ret = -ENODEV;
+		goto bad_0;
+	}
+	ASSERT_BITTERN_CACHE(bc);
+	if (bc->error_state != ES_NOERROR) {
+		ti->error = "pool is in error state";
+		ret = -EIO;
+		goto bad_0;
+	}
+	cpo = &bc->bc_pool_owners[member_id];
+	if (cpo->cpo_dm_dev != NULL) {
+		ti->error = "member id already in use";
+		ret = -EBUSY;
+		goto bad_0;
+	}
+
+	ret = dm_get_device(ti,
+			    argv[1],
+			    FMODE_EXCL | FMODE_READ | FMODE_WRITE,
+			    &dm_dev);
+	if (ret != 0) {
+		ti->error = "cached device lookup failed";
+		goto bad_0;
+	}
+
+	ret = __cache_pool_set_quota(bc, member_id, min_pct, max_pct);
+	if (ret != 0) {
+		ti->error = "invalid quota";
+		goto bad_1;
+	}
+
+	atomic_set(&cpo->cpo_read_requests, 0);
+	atomic_set(&cpo->cpo_write_requests, 0);
+	atomic_set(&cpo->cpo_read_hits, 0);
+	atomic_set(&cpo->cpo_write_hits, 0);
+	atomic_set(&cpo->cpo_read_misses, 0);
+	atomic_set(&cpo->cpo_write_misses, 0);
+	atomic_set(&cpo->cpo_max_quota_bypasses, 0);
+	atomic_set(&cpo->cpo_min_quota_skips, 0);
+	cpo->cpo_evacuate_writebacks = 0;
+	cpo->cpo_evacuate_invalidations = 0;
+	strlcpy(cpo->cpo_device_name, argv[1], sizeof(cpo->cpo_device_name));
+	cpo->cpo_ti = ti;
+	cpo->cpo_pool_bdev = pool_bdev;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	cpo->cpo_dm_dev = dm_dev;
+	bc->bc_pool_members++;
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	cache_pool_adopt_orphans(bc, cpo);
+
+	mutex_unlock(&cache_pool_mutex);
+
+	ti->flush_supported = true;
+	ti->num_flush_bios = 1;
+	ti->private = cpo;
+
+	printk_info("%s: pool member %u joined: device=%s min_pct=%d max_pct=%d restored_blocks=%u\n",
+		    bc->bc_name,
+		    member_id,
+		    cpo->cpo_device_name,
+		    min_pct,
+		    max_pct,
+		    atomic_read(&cpo->cpo_valid_entries));
+
+	return 0;
+
+bad_1:
+	dm_put_device(ti, dm_dev);
+bad_0:
+	mutex_unlock(&cache_pool_mutex);
+	blkdev_put(pool_bdev, FMODE_READ);
+	printk_err("error: %s\n", ti->error);
+	return ret;
+}
+
+static void cache_pool_member_dtr(struct dm_target *ti)
+{
+	struct cache_pool_owner *cpo = ti->private;
+	struct bittern_cache *bc = cpo->cpo_bc;
+	struct block_device *pool_bdev = cpo->cpo_pool_bdev;
+	struct dm_dev *dm_dev = cpo->cpo_dm_dev;
+	unsigned long flags;
+
+	ASSERT_BITTERN_CACHE(bc);
+	M_ASSERT(cpo->cpo_ti == ti);
+
+	/*
+	 * dm does not call map() anymore, so nothing can bring new blocks
+	 * in for this member.
+	 */
+	cache_pool_evacuate(bc, cpo);
+
+	mutex_lock(&cache_pool_mutex);
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	cpo->cpo_dm_dev = NULL;
+	M_ASSERT(bc->bc_pool_members > 0);
+	bc->bc_pool_members--;
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+	cpo->cpo_ti = NULL;
+	cpo->cpo_pool_bdev = NULL;
+	cpo->cpo_min_pct = 0;
+	cpo->cpo_max_pct = 100;
+	mutex_unlock(&cache_pool_mutex);
+
+	printk_info("%s: pool member %u left\n", bc->bc_name, cpo->cpo_id);
+
+	dm_put_device(ti, dm_dev);
+	/* must be last, the pool can go away after this */
+	blkdev_put(pool_bdev, FMODE_READ);
+}
+
+static int cache_pool_member_map(struct dm_target *ti, struct bio *bio)
+{
+	struct cache_pool_owner *cpo = ti->private;
+
+	bio->bi_iter.bi_sector =
+		cache_pool_sector_make(cpo->cpo_id,
+				       dm_target_offset(ti,
+							bio->bi_iter.bi_sector));
+	return __bittern_cache_map(cpo->cpo_bc, bio);
+}
+
+static void cache_pool_member_status(struct dm_target *ti,
+				     status_type_t type,
+				     unsigned status_flags,
+				     char *result,
+				     unsigned maxlen)
+{
+	struct cache_pool_owner *cpo = ti->private;
+	int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%u %u %u %u %u %u %u %u %u",
+		       atomic_read(&cpo->cpo_valid_entries),
+		       atomic_read(&cpo->cpo_read_requests),
+		       atomic_read(&cpo->cpo_write_requests),
+		       atomic_read(&cpo->cpo_read_hits),
+		       atomic_read(&cpo->cpo_write_hits),
+		       atomic_read(&cpo->cpo_read_misses),
+		       atomic_read(&cpo->cpo_write_misses),
+		       atomic_read(&cpo->cpo_max_quota_bypasses),
+		       atomic_read(&cpo->cpo_min_quota_skips));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %u %u %u",
+		       cpo->cpo_bc->bc_name,
+		       cpo->cpo_device_name,
+		       cpo->cpo_id,
+		       cpo->cpo_min_pct,
+		       cpo->cpo_max_pct);
+		break;
+	}
+}
+
+/*! supports "min_pct <value>" and "max_pct <value>" */
+static int cache_pool_member_message(struct dm_target *ti,
+				     unsigned int argc,
+				     char **argv)
+{
+	struct cache_pool_owner *cpo = ti->private;
+	int min_pct = cpo->cpo_min_pct, max_pct = cpo->cpo_max_pct;
+	int value;
+
+	if (argc != 2) {
+		printk_err("cache_pool_member_message: two arguments expected\n");
+		return -EINVAL;
+	}
+	if (kstrtos32(argv[1], 0, &value) != 0)
+		return -EINVAL;
+	if (strcmp(argv[0], "min_pct") == 0)
+		min_pct = value;
+	else if (strcmp(argv[0], "max_pct") == 0)
+		max_pct = value;
+	else
+		return -EINVAL;
+
+	return cache_pool_set_quota(cpo->cpo_bc, cpo->cpo_id, min_pct, max_pct);
+}
+
+static int cache_pool_member_iterate_devices(struct dm_target *ti,
+					     iterate_devices_callout_fn fn,
+					     void *data)
+{
+	struct cache_pool_owner *cpo = ti->private;
+
+	return (*fn) (ti, cpo->cpo_dm_dev, 0, ti->len, data);
+}
+
+static void cache_pool_member_io_hints(struct dm_target *ti,
+				       struct queue_limits *lim)
+{
+	cache_set_io_limits(lim);
+}
+
+struct target_type cache_pool_member_target = {
+	.name = "bittern_cache_member",
+	.version = {0, 0, 1},
+	.module = THIS_MODULE,
+	.ctr = cache_pool_member_ctr,
+	.dtr = cache_pool_member_dtr,
+	.status = cache_pool_member_status,
+	.message = cache_pool_member_message,
+	.map = cache_pool_member_map,
+	.iterate_devices = cache_pool_member_iterate_devices,
+	.io_hints = cache_pool_member_io_hints,
+};
+
+ssize_t cache_pool_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	unsigned int i;
+
+	DMEMIT("%s: pool: members=%u total_entries=%u orphan_dirty=%u\n",
+	       bc->bc_name,
+	       bc->bc_pool_members,
+	       atomic_read(&bc->bc_total_entries),
+	       atomic_read(&bc->bc_pool_orphan_dirty));
+	for (i = 0; i < CACHE_POOL_MAX_OWNERS; i++) {
+		struct cache_pool_owner *cpo = &bc->bc_pool_owners[i];
+
+		if (cpo->cpo_dm_dev == NULL &&
+		    atomic_read(&cpo->cpo_valid_entries) == 0)
+			continue;
+		DMEMIT("%s: pool: member=%u attached=%d device=%s min_pct=%u max_pct=%u valid_entries=%u orphan_dirty=%u read_requests=%u write_requests=%u read_hits=%u write_hits=%u read_misses=%u write_misses=%u max_quota_bypasses=%u min_quota_skips=%u evacuate_writebacks=%llu evacuate_invalidations=%llu\n",
+		       bc->bc_name,
+		       cpo->cpo_id,
+		       cpo->cpo_dm_dev != NULL,
+		       cpo->cpo_device_name,
+		       cpo->cpo_min_pct,
+		       cpo->cpo_max_pct,
+		       atomic_read(&cpo->cpo_valid_entries),
+		       atomic_read(&cpo->cpo_orphan_dirty),
+		       atomic_read(&cpo->cpo_read_requests),
+		       atomic_read(&cpo->cpo_write_requests),
+		       atomic_read(&cpo->cpo_read_hits),
+		       atomic_read(&cpo->cpo_write_hits),
+		       atomic_read(&cpo->cpo_read_misses),
+		       atomic_read(&cpo->cpo_write_misses),
+		       atomic_read(&cpo->cpo_max_quota_bypasses),
+		       atomic_read(&cpo->cpo_min_quota_skips),
+		       cpo->cpo_evacuate_writebacks,
+		       cpo->cpo_evacuate_invalidations);
+	}
+	return sz;
+}
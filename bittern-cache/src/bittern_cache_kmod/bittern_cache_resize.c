@@ -0,0 +1,525 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * Online cache resize.
+ *
+ * Growing allocates more in-memory cache block chunks, initializes the
+ * metadata of the new blocks on the cache device, updates the pmem header
+ * and then adds the new blocks to the invalid list. This is done one batch
+ * at a time, so the new blocks become usable while the rest of them is
+ * still being initialized.
+ *
+ * Shrinking sets a fence at the new size. Blocks past the fence are
+ * written back if dirty, then invalidated. As they become invalid,
+ * cache_move_to_invalid() parks them in the evacuated list instead of the
+ * invalid list, so they never get reused. Once all of them are parked, the
+ * header and the block count are updated and the unused chunks are freed.
+ *
+ * Only the interleaved layout can be resized, the sequential layout sizes
+ * its metadata area by the number of cache blocks.
+ */
+
+int cache_blocks_alloc_chunks(struct bittern_cache *bc, uint64_t cache_blocks)
+{
+	unsigned int chunks = cache_blocks_chunks(cache_blocks);
+
+	M_ASSERT(chunks <= CACHE_BLOCKS_MAX_CHUNKS);
+
+	if (bc->bc_cache_blocks == NULL) {
+		bc->bc_cache_blocks = vzalloc(sizeof(struct cache_block *) *
+					      CACHE_BLOCKS_MAX_CHUNKS);
+		if (bc->bc_cache_blocks == NULL)
+			return -ENOMEM;
+		bc->bc_cache_blocks_chunks = 0;
+	}
+
+	while (bc->bc_cache_blocks_chunks < chunks) {
+		struct cache_block *chunk;
+
+		/* interleaved over the online nodes */
+		chunk = vmalloc_node(sizeof(struct cache_block) *
+				     CACHE_BLOCKS_PER_CHUNK,
+				     cache_numa_chunk_node(
+						bc->bc_cache_blocks_chunks));
+		if (chunk == NULL)
+			return -ENOMEM;
+		cache_numa_account_chunk(bc, chunk, 1);
+		bc->bc_cache_blocks[bc->bc_cache_blocks_chunks] = chunk;
+		/* publish the chunk before making it reachable */
+		smp_wmb();
+		bc->bc_cache_blocks_chunks++;
+	}
+
+	return 0;
+}
+
+void cache_blocks_free_chunks(struct bittern_cache *bc, uint64_t cache_blocks)
+{
+	unsigned int chunks = cache_blocks_chunks(cache_blocks);
+
+	if (bc->bc_cache_blocks == NULL)
+		return;
+
+	while (bc->bc_cache_blocks_chunks > chunks) {
+		struct cache_block *chunk;
+
+		bc->bc_cache_blocks_chunks--;
+		chunk = bc->bc_cache_blocks[bc->bc_cache_blocks_chunks];
+		bc->bc_cache_blocks[bc->bc_cache_blocks_chunks] = NULL;
+		cache_numa_account_chunk(bc, chunk, -1);
+		vfree(chunk);
+	}
+
+	if (cache_blocks == 0) {
+		vfree(bc->bc_cache_blocks);
+		bc->bc_cache_blocks = NULL;
+	}
+}
+
+/*
+ * header update failures mean the cache device is in trouble,
+ * handle them the same way the periodic header update does.
+ */
+static void cache_resize_header_error(struct bittern_cache *bc, int ret)
+{
+	if (ret == -ENOMEM)
+		return;
+	printk_err("%s: resize: cannot update header: %d. will fail all future requests\n",
+		   bc->bc_name,
+		   ret);
+	bc->error_state = ES_ERROR_FAIL_ALL;
+}
+
+static int cache_resize_grow(struct bittern_cache *bc,
+			     unsigned int cache_blocks)
+{
+	unsigned int curr_blocks = atomic_read(&bc->bc_total_entries);
+
+	while (curr_blocks < cache_blocks) {
+		unsigned int end_blocks;
+		unsigned int block_id;
+		unsigned long flags;
+		int ret;
+
+		if (bc->bc_resize_abort)
+			return -EINTR;
+
+		end_blocks = min(curr_blocks + CACHE_RESIZE_GROW_BATCH_BLOCKS,
+				 cache_blocks);
+
+		ret = cache_blocks_alloc_chunks(bc, end_blocks);
+		if (ret < 0) {
+			printk_err("%s: resize: cannot allocate cache_blocks chunks\n",
+				   bc->bc_name);
+			return ret;
+		}
+
+		ret = pmem_header_resize(bc, end_blocks);
+		if (ret < 0) {
+			cache_resize_header_error(bc, ret);
+			return ret;
+		}
+
+		spin_lock_irqsave(&bc->bc_entries_lock, flags);
+		for (block_id = curr_blocks + 1;
+		     block_id <= end_blocks;
+		     block_id++) {
+			struct cache_block *bcb;
+
+			bcb = cache_block_from_id(bc, block_id);
+			cache_block_initialize(bc, block_id, bcb);
+			cache_block_add(bc, bcb);
+		}
+		M_ASSERT(atomic_read(&bc->bc_total_entries) == end_blocks);
+		spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+		bc->bc_resize_blocks_added += end_blocks - curr_blocks;
+		curr_blocks = end_blocks;
+
+		/* new invalid blocks may unblock deferred requests */
+		wakeup_deferred(bc);
+		schedule();
+	}
+
+	return 0;
+}
+
+/*
+ * put evacuated blocks back in the invalid list and drop the fence.
+ */
+static void cache_resize_shrink_undo(struct bittern_cache *bc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	atomic_add(atomic_read(&bc->bc_resize_evacuated),
+		   &bc->bc_invalid_entries);
+	atomic_set(&bc->bc_resize_evacuated, 0);
+	list_splice_tail_init(&bc->bc_resize_evacuated_list,
+			      &bc->bc_invalid_entries_list);
+	bc->bc_resize_fence = 0;
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	wakeup_deferred(bc);
+}
+
+/*
+ * one pass over the blocks past the fence: start writeback of dirty
+ * blocks and invalidation of clean blocks. busy blocks are retried on
+ * the next pass, invalid blocks have already been parked.
+ */
+static void cache_resize_shrink_pass(struct bittern_cache *bc,
+				     unsigned int cache_blocks,
+				     unsigned int curr_blocks)
+{
+	unsigned int block_id;
+
+	bc->bc_resize_passes++;
+
+	for (block_id = cache_blocks + 1;
+	     block_id <= curr_blocks;
+	     block_id++) {
+		struct cache_block *cache_block;
+		sector_t sector, sector_hint;
+		int ret;
+
+		if (block_id % CACHE_RESIZE_SHRINK_BATCH_BLOCKS == 0) {
+			if (bc->bc_resize_abort)
+				return;
+			schedule();
+		}
+
+		ret = cache_get_by_id(bc, block_id, &cache_block);
+		ASSERT_CACHE_GET_RET(ret);
+		if (ret != CACHE_GET_RET_HIT_IDLE)
+			continue;
+
+		ASSERT(cache_block != NULL);
+		ASSERT_CACHE_BLOCK(cache_block, bc);
+		if (cache_block->bcb_state == S_CLEAN) {
+			cache_invalidate_clean_block(bc, cache_block);
+			bc->bc_resize_invalidations++;
+			continue;
+		}
+
+		/*
+		 * dirty block, write it back. the next pass will
+		 * invalidate it if the writeback left it clean.
+		 */
+		ASSERT(cache_block->bcb_state == S_DIRTY);
+		sector = cache_block->bcb_sector;
+		cache_put(bc, cache_block, 1);
+		if (cache_pool_owner_dev(bc, sector) == NULL)
+			continue;
+		ret = cache_bgwriter_wait_for_resources(bc, true);
+		ASSERT(ret == 0);
+		ret = cache_bgwriter_io_start_one(bc, sector, &sector_hint);
+		ASSERT(ret == 0 || ret == 1);
+		if (ret == 1)
+			bc->bc_resize_writebacks++;
+	}
+}
+
+static int cache_resize_shrink(struct bittern_cache *bc,
+			       unsigned int cache_blocks)
+{
+	unsigned int curr_blocks = atomic_read(&bc->bc_total_entries);
+	unsigned int evacuate_blocks = curr_blocks - cache_blocks;
+	struct cache_block *bcb, *next_bcb;
+	unsigned long flags;
+	int ret;
+
+	/*
+	 * set the fence and park all invalid blocks past it.
+	 * from now on blocks past the fence are parked as soon as
+	 * they become invalid.
+	 */
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	M_ASSERT(bc->bc_resize_fence == 0);
+	M_ASSERT(list_empty(&bc->bc_resize_evacuated_list));
+	bc->bc_resize_fence = cache_blocks;
+	list_for_each_entry_safe(bcb,
+				 next_bcb,
+				 &bc->bc_invalid_entries_list,
+				 bcb_entry) {
+		if (bcb->bcb_block_id <= cache_blocks)
+			continue;
+		atomic_dec(&bc->bc_invalid_entries);
+		atomic_inc(&bc->bc_resize_evacuated);
+		list_move_tail(&bcb->bcb_entry,
+			       &bc->bc_resize_evacuated_list);
+	}
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	/* we just took away free blocks, let the invalidator catch up */
+	wake_up_interruptible(&bc->bc_invalidator_wait);
+
+	while (atomic_read(&bc->bc_resize_evacuated) < evacuate_blocks) {
+		if (bc->bc_resize_abort) {
+			ret = -EINTR;
+			goto undo;
+		}
+		cache_resize_shrink_pass(bc, cache_blocks, curr_blocks);
+		msleep(CACHE_RESIZE_SHRINK_PASS_DELAY_MS);
+	}
+
+	ret = pmem_header_resize(bc, cache_blocks);
+	if (ret < 0) {
+		cache_resize_header_error(bc, ret);
+		goto undo;
+	}
+
+	/*
+	 * parked blocks are not referenced from anywhere but the evacuated
+	 * list, so we can just drop them.
+	 */
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	M_ASSERT(atomic_read(&bc->bc_resize_evacuated) == evacuate_blocks);
+	M_ASSERT(atomic_read(&bc->bc_total_entries) == curr_blocks);
+	INIT_LIST_HEAD(&bc->bc_resize_evacuated_list);
+	atomic_set(&bc->bc_resize_evacuated, 0);
+	atomic_sub(evacuate_blocks, &bc->bc_total_entries);
+	bc->bc_resize_fence = 0;
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	cache_blocks_free_chunks(bc, cache_blocks);
+	bc->bc_resize_blocks_removed += evacuate_blocks;
+
+	return 0;
+
+undo:
+	cache_resize_shrink_undo(bc);
+	return ret;
+}
+
+static void cache_resize_worker(struct work_struct *work)
+{
+	struct bittern_cache *bc;
+	unsigned int cache_blocks;
+	unsigned int curr_blocks;
+	int ret;
+
+	bc = container_of(work, struct bittern_cache, bc_resize_work);
+	__ASSERT_BITTERN_CACHE(bc);
+	M_ASSERT(atomic_read(&bc->bc_resize_active) != 0);
+
+	cache_blocks = bc->bc_resize_target_blocks;
+	curr_blocks = atomic_read(&bc->bc_total_entries);
+
+	printk_info("%s: resize: %u -> %u cache blocks\n",
+		    bc->bc_name,
+		    curr_blocks,
+		    cache_blocks);
+
+	/* the log is past the end of the cache, which is about to move */
+	pmem_mlog_stop(bc);
+
+	if (cache_blocks > curr_blocks) {
+		bc->bc_resize_grows++;
+		ret = cache_resize_grow(bc, cache_blocks);
+	} else {
+		bc->bc_resize_shrinks++;
+		ret = cache_resize_shrink(bc, cache_blocks);
+	}
+	if (ret == -EINTR)
+		bc->bc_resize_aborts++;
+
+	cache_calculate_max_pending(bc, bc->bc_max_pending_requests);
+
+	printk_info("%s: resize: done, total_entries=%u, lm_cache_blocks=%llu: ret=%d\n",
+		    bc->bc_name,
+		    atomic_read(&bc->bc_total_entries),
+		    bc->bc_papi.papi_hdr.lm_cache_blocks,
+		    ret);
+
+	M_ASSERT(atomic_read(&bc->bc_total_entries) ==
+		 bc->bc_papi.papi_hdr.lm_cache_blocks);
+	M_ASSERT(bc->bc_resize_fence == 0);
+
+	bc->bc_resize_ret = ret;
+	bc->bc_resize_completed = jiffies;
+	atomic_set(&bc->bc_resize_active, 0);
+
+	ret = pmem_mlog_start(bc);
+	if (ret < 0)
+		printk_err("%s: resize: cannot restart metadata intent log: ret=%d\n",
+			   bc->bc_name,
+			   ret);
+}
+
+int cache_resize_start(struct bittern_cache *bc, uint64_t cache_size_bytes)
+{
+	uint64_t cache_blocks;
+	unsigned int min_blocks;
+	int ret;
+
+	if (bc->bc_resize_abort)
+		return -ESHUTDOWN;
+
+	if (atomic_cmpxchg(&bc->bc_resize_active, 0, 1) != 0) {
+		printk_err("%s: resize: resize already in progress\n",
+			   bc->bc_name);
+		return -EBUSY;
+	}
+
+	ret = pmem_resize_cache_blocks(bc, cache_size_bytes, &cache_blocks);
+	if (ret < 0) {
+		printk_err("%s: resize: cannot resize to %llu bytes: ret=%d\n",
+			   bc->bc_name,
+			   cache_size_bytes,
+			   ret);
+		goto out;
+	}
+
+	/* keep enough blocks around for forward progress */
+	min_blocks = bc->bc_invalidator_conf_min_invalid_count +
+		     bc->bc_max_pending_requests;
+	if (cache_blocks <= min_blocks) {
+		printk_err("%s: resize: %llu cache blocks is too small (min %u)\n",
+			   bc->bc_name,
+			   cache_blocks,
+			   min_blocks);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (cache_blocks == atomic_read(&bc->bc_total_entries)) {
+		ret = 0;
+		goto out;
+	}
+
+	/* dirty blocks of absent pool members cannot be evacuated */
+	if (cache_blocks < atomic_read(&bc->bc_total_entries) &&
+	    atomic_read(&bc->bc_pool_orphan_dirty) > 0) {
+		printk_err("%s: resize: cannot shrink with %u orphaned pool blocks\n",
+			   bc->bc_name,
+			   atomic_read(&bc->bc_pool_orphan_dirty));
+		ret = -EBUSY;
+		goto out;
+	}
+
+	printk_info("%s: resize: starting resize to %llu bytes (%llu cache blocks)\n",
+		    bc->bc_name,
+		    cache_size_bytes,
+		    cache_blocks);
+
+	bc->bc_resize_target_blocks = cache_blocks;
+	bc->bc_resize_ret = 0;
+	bc->bc_resize_started = jiffies;
+	bc->bc_resize_completed = 0;
+	queue_work(bc->bc_resize_wq, &bc->bc_resize_work);
+	return 0;
+
+out:
+	atomic_set(&bc->bc_resize_active, 0);
+	return ret;
+}
+
+int cache_resize_initialize(struct bittern_cache *bc)
+{
+	atomic_set(&bc->bc_resize_active, 0);
+	bc->bc_resize_abort = 0;
+	bc->bc_resize_target_blocks = 0;
+	bc->bc_resize_fence = 0;
+	INIT_LIST_HEAD(&bc->bc_resize_evacuated_list);
+	atomic_set(&bc->bc_resize_evacuated, 0);
+	bc->bc_resize_ret = 0;
+	bc->bc_resize_grows = 0;
+	bc->bc_resize_shrinks = 0;
+	bc->bc_resize_aborts = 0;
+	bc->bc_resize_passes = 0;
+	bc->bc_resize_blocks_added = 0;
+	bc->bc_resize_blocks_removed = 0;
+	bc->bc_resize_writebacks = 0;
+	bc->bc_resize_invalidations = 0;
+	bc->bc_resize_started = 0;
+	bc->bc_resize_completed = 0;
+
+	INIT_WORK(&bc->bc_resize_work, cache_resize_worker);
+	bc->bc_resize_wq = alloc_workqueue("b_rsz:%s",
+					   WQ_UNBOUND,
+					   1,
+					   bc->bc_name);
+	if (bc->bc_resize_wq == NULL) {
+		printk_err("%s: cannot allocate resize workqueue\n",
+			   bc->bc_name);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void cache_resize_deinitialize(struct bittern_cache *bc)
+{
+	if (bc->bc_resize_wq == NULL)
+		return;
+
+	/*
+	 * abort any resize in progress. a shrink puts its evacuated blocks
+	 * back, a grow stops at the end of the current batch.
+	 */
+	bc->bc_resize_abort = 1;
+	flush_workqueue(bc->bc_resize_wq);
+	destroy_workqueue(bc->bc_resize_wq);
+	bc->bc_resize_wq = NULL;
+
+	M_ASSERT(atomic_read(&bc->bc_resize_active) == 0);
+	M_ASSERT(bc->bc_resize_fence == 0);
+	M_ASSERT(list_empty(&bc->bc_resize_evacuated_list));
+}
+
+ssize_t cache_resize_op_show(struct bittern_cache *bc, char *result)
+{
+	size_t sz = 0, maxlen = PAGE_SIZE;
+	unsigned long s_started = 0, s_completed = 0;
+
+	if (bc->bc_resize_started != 0)
+		s_started = jiffies - bc->bc_resize_started;
+	if (bc->bc_resize_completed != 0)
+		s_completed = jiffies - bc->bc_resize_completed;
+
+	DMEMIT("%s: resize: active=%d target_blocks=%u total_entries=%u lm_cache_blocks=%llu cache_blocks_chunks=%u\n",
+	       bc->bc_name,
+	       atomic_read(&bc->bc_resize_active),
+	       bc->bc_resize_target_blocks,
+	       atomic_read(&bc->bc_total_entries),
+	       bc->bc_papi.papi_hdr.lm_cache_blocks,
+	       bc->bc_cache_blocks_chunks);
+	DMEMIT("%s: resize: fence=%u evacuated=%u passes=%u writebacks=%llu invalidations=%llu\n",
+	       bc->bc_name,
+	       bc->bc_resize_fence,
+	       atomic_read(&bc->bc_resize_evacuated),
+	       bc->bc_resize_passes,
+	       bc->bc_resize_writebacks,
+	       bc->bc_resize_invalidations);
+	DMEMIT("%s: resize: grows=%u shrinks=%u aborts=%u blocks_added=%llu blocks_removed=%llu last_ret=%d started=%ums completed=%ums\n",
+	       bc->bc_name,
+	       bc->bc_resize_grows,
+	       bc->bc_resize_shrinks,
+	       bc->bc_resize_aborts,
+	       bc->bc_resize_blocks_added,
+	       bc->bc_resize_blocks_removed,
+	       bc->bc_resize_ret,
+	       jiffies_to_msecs(s_started),
+	       jiffies_to_msecs(s_completed));
+	return sz;
+}
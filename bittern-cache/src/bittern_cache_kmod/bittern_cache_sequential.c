@@ -16,7 +16,15 @@
 
 /*! \file */
 
+/*
+ * This file is also built in userspace by the trace driven simulator,
+ * see ../sim/bittern_cache_user.h .
+ */
+#ifdef BITTERN_CACHE_USERSPACE
+#include "bittern_cache_user.h"
+#else /* BITTERN_CACHE_USERSPACE */
 #include "bittern_cache.h"
+#endif /* BITTERN_CACHE_USERSPACE */
 
 static void __seq_bypass_initialize(struct seq_io_bypass *bsi,
 				    unsigned int bypass_threshold)
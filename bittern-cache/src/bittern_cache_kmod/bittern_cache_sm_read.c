@@ -52,6 +52,21 @@ void sm_read_hit_copy_from_cache_start(struct bittern_cache *bc,
 					S_DIRTY_READ_HIT_CPF_CACHE_END);
 	}
 
+	/*
+	 * clean read hits can be served from the DRAM front tier,
+	 * in which case there is no need to read from the cache device.
+	 */
+	ASSERT(wi->wi_l1_entry == NULL);
+	if (cache_block->bcb_state == S_CLEAN_READ_HIT_CPF_CACHE_END)
+		wi->wi_l1_entry = cache_l1_get(bc, cache_block);
+	if (wi->wi_l1_entry != NULL) {
+		BT_TRACE(BT_LEVEL_TRACE2, bc, wi, cache_block, bio, NULL,
+			 "l1 hit: wi=%p, bc=%p, cache_block=%p, bio=%p",
+			 wi, bc, cache_block, bio);
+		sm_read_hit_copy_from_cache_end(bc, wi, 0);
+		return;
+	}
+
 	BT_TRACE(BT_LEVEL_TRACE2, bc, wi, cache_block, bio, NULL,
 		 "start_async_read (get_page_read): wi=%p, bc=%p, cache_block=%p, bio=%p",
 		 wi, bc, cache_block, bio);
@@ -70,6 +85,7 @@ void sm_read_hit_copy_from_cache_end(struct bittern_cache *bc,
 	struct cache_block *cache_block = wi->wi_cache_block;
 	enum cache_state original_state = cache_block->bcb_state;
 	unsigned long cache_flags;
+	struct cache_l1_entry *l1e = wi->wi_l1_entry;
 
 	M_ASSERT(bio != NULL);
 	M_ASSERT_FIXME(err == 0);
@@ -111,12 +127,28 @@ void sm_read_hit_copy_from_cache_end(struct bittern_cache *bc,
 	 */
 	cache_track_hash_check(bc, cache_block, cache_block->bcb_hash_data);
 
-	/*
-	 * release cache page
-	 */
-	pmem_data_put_page_read(bc,
-				cache_block,
-				&wi->wi_pmem_ctx);
+	if (l1e != NULL) {
+		/*
+		 * release L1 entry
+		 */
+		wi->wi_l1_entry = NULL;
+		cache_l1_put(bc, l1e);
+	} else {
+		/*
+		 * keep a DRAM copy of clean blocks for the next read hit
+		 */
+		if (original_state == S_CLEAN_READ_HIT_CPF_CACHE_END)
+			cache_l1_insert(bc,
+					cache_block,
+					pmem_context_data_vaddr(
+							&wi->wi_pmem_ctx));
+		/*
+		 * release cache page
+		 */
+		pmem_data_put_page_read(bc,
+					cache_block,
+					&wi->wi_pmem_ctx);
+	}
 
 	ASSERT_WORK_ITEM(wi, bc);
 	ASSERT_BITTERN_CACHE(bc);
@@ -148,6 +180,9 @@ void sm_read_hit_copy_from_cache_end(struct bittern_cache *bc,
 					wi->wi_ts_started);
 		cache_timer_add(&bc->bc_timer_read_clean_hits,
 					wi->wi_ts_started);
+		if (l1e != NULL)
+			cache_timer_add(&bc->bc_timer_read_l1_hits,
+					wi->wi_ts_started);
 	} else {
 		ASSERT(original_state == S_DIRTY_READ_HIT_CPF_CACHE_END);
 		cache_timer_add(&bc->bc_timer_read_hits,
@@ -275,6 +310,11 @@ void sm_read_miss_copy_from_device_end(struct bittern_cache *bc,
 	cache_track_hash_set(bc, cache_block,
 				       cache_block->bcb_hash_data);
 
+	/* keep a DRAM copy for the next read hit */
+	cache_l1_insert(bc,
+			cache_block,
+			pmem_context_data_vaddr(&wi->wi_pmem_ctx));
+
 	BT_TRACE(BT_LEVEL_TRACE2, bc, wi, cache_block, bio, wi->wi_cloned_bio,
 		 "endio - release cache page");
 
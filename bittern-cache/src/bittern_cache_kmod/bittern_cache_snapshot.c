@@ -0,0 +1,129 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include "bittern_cache.h"
+#include "bittern_cache_module.h"
+
+/*
+ * Binary statistics snapshot.
+ *
+ * Monitoring agents want all the counters at once and at a fixed cost.
+ * The text sysfs files are meant for humans, each of them formats a few
+ * hundred bytes of text, and values read from different files are taken at
+ * different times.
+ *
+ * The snapshot instead copies every value listed in CACHE_SNAPSHOT_VALUES()
+ * (see bittern_cache_snapshot.h) into a flat array of 64 bits integers in a
+ * single pass, with no formatting. The pass is done while holding
+ * @ref bittern_cache::bc_entries_lock, which serializes all cache block state
+ * transitions, so that the cache entry counts always add up and the request
+ * counters are read within a few hundred nanoseconds of each other. Timers are
+ * read under their own spinlock so that count, sum and max are coherent.
+ * Counters which are updated without locks (atomics, bgwriter and invalidator
+ * statistics) can still move during the pass, but never by more than the
+ * requests which complete during it.
+ *
+ * The snapshot is read from /sys/fs/bittern/<cache>/stats_snapshot with a
+ * single read(2) call of at least CACHE_SNAPSHOT_SIZE bytes. Each read at
+ * offset zero takes a new snapshot. The userland reader library is
+ * tools/bc_stats_lib.c .
+ */
+
+void cache_snapshot_fill(struct bittern_cache *bc, void *buf)
+{
+	struct cache_snapshot_header *sh = buf;
+	uint64_t *v = (uint64_t *)(sh + 1);
+	unsigned long flags, timer_flags;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+
+	sh->sh_magic = CACHE_SNAPSHOT_MAGIC;
+	sh->sh_version = CACHE_SNAPSHOT_VERSION;
+	sh->sh_header_size = sizeof(struct cache_snapshot_header);
+	sh->sh_nr_values = __CACHE_SNAPSHOT_NUM;
+	sh->sh_reserved = 0;
+	sh->sh_ts_nsec = current_kernel_time_nsec();
+	sh->sh_xid = cache_xid_get(bc);
+
+#define __CACHE_SNAPSHOT_A(__name, __field)				\
+	v[CACHE_SNAPSHOT_##__name] =					\
+		(uint64_t)(unsigned int)atomic_read(&bc->__field);
+#define __CACHE_SNAPSHOT_U(__name, __field)				\
+	v[CACHE_SNAPSHOT_##__name] = (uint64_t)bc->__field;
+#define __CACHE_SNAPSHOT_T(__name, __field)				\
+	spin_lock_irqsave(&bc->__field.bct_spinlock, timer_flags);	\
+	v[CACHE_SNAPSHOT_timer_##__name##_count] =			\
+		bc->__field.bct_count;					\
+	v[CACHE_SNAPSHOT_timer_##__name##_sum_nsec] =			\
+		bc->__field.bct_sum_nsec;				\
+	v[CACHE_SNAPSHOT_timer_##__name##_max_nsec] =			\
+		bc->__field.bct_max_nsec;				\
+	spin_unlock_irqrestore(&bc->__field.bct_spinlock, timer_flags);
+
+	CACHE_SNAPSHOT_VALUES(__CACHE_SNAPSHOT_A,
+			      __CACHE_SNAPSHOT_U,
+			      __CACHE_SNAPSHOT_T)
+
+#undef __CACHE_SNAPSHOT_A
+#undef __CACHE_SNAPSHOT_U
+#undef __CACHE_SNAPSHOT_T
+
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+}
+
+static ssize_t cache_snapshot_read(struct file *filp,
+				   struct kobject *kobj,
+				   struct bin_attribute *attr,
+				   char *buf,
+				   loff_t off,
+				   size_t count)
+{
+	struct bittern_cache *bc =
+	    container_of(kobj, struct bittern_cache, bc_kobj);
+
+	__ASSERT_BITTERN_CACHE(bc);
+
+	/*
+	 * A snapshot is only consistent if it's returned by a single call,
+	 * so partial reads are not supported.
+	 */
+	if (off != 0)
+		return 0;
+	if (count < CACHE_SNAPSHOT_SIZE)
+		return -EINVAL;
+
+	cache_snapshot_fill(bc, buf);
+
+	return CACHE_SNAPSHOT_SIZE;
+}
+
+static struct bin_attribute cache_sysfs_stats_snapshot = {
+	.attr = {
+		.name = "stats_snapshot",
+		.mode = 0444,
+	},
+	.size = CACHE_SNAPSHOT_SIZE,
+	.read = cache_snapshot_read,
+};
+
+int cache_snapshot_sysfs_add(struct bittern_cache *bc)
+{
+	BUILD_BUG_ON(CACHE_SNAPSHOT_SIZE > PAGE_SIZE);
+	return sysfs_create_bin_file(&bc->bc_kobj,
+				     &cache_sysfs_stats_snapshot);
+}
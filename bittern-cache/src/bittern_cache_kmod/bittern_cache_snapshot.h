@@ -0,0 +1,289 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#ifndef BITTERN_CACHE_SNAPSHOT_H
+#define BITTERN_CACHE_SNAPSHOT_H
+
+/*!
+ * Binary statistics snapshot format.
+ *
+ * The snapshot is read from /sys/fs/bittern/<cache>/stats_snapshot and
+ * consists of a @ref cache_snapshot_header followed by
+ * @ref cache_snapshot_header.sh_nr_values 64 bits values, all in the native
+ * byte order of the host.
+ *
+ * This header is shared between the kernel module and the userland reader
+ * library (tools/bc_stats_lib.c), so it must not depend on any kernel header.
+ * The value list below is the only definition of the snapshot layout, the
+ * kernel uses it to fill the snapshot and userland uses it to name the
+ * values. The list is append-only: new values are always added at the end,
+ * so that an older reader can still make sense of the first values of a newer
+ * snapshot. Any other change to the layout requires bumping
+ * @ref CACHE_SNAPSHOT_VERSION .
+ *
+ * Each entry is one of:
+ *
+ * A(name, field)	atomic_t in struct bittern_cache
+ * U(name, field)	plain integer in struct bittern_cache
+ * T(name, field)	struct cache_timer in struct bittern_cache, expands to
+ *			the three values name_count, name_sum_nsec and
+ *			name_max_nsec
+ *
+ * Value names are the same as the ones used in the text sysfs files wherever
+ * such a name exists.
+ */
+#define CACHE_SNAPSHOT_VALUES(A, U, T)					\
+	/* requests */							\
+	A(read_requests, bc_read_requests)				\
+	A(write_requests, bc_write_requests)				\
+	A(deferred_requests, bc_deferred_requests)			\
+	A(highest_deferred_requests, bc_highest_deferred_requests)	\
+	A(total_deferred_requests, bc_total_deferred_requests)		\
+	A(pending_requests, bc_pending_requests)			\
+	A(pending_read_requests, bc_pending_read_requests)		\
+	A(pending_read_bypass_requests,					\
+	  bc_pending_read_bypass_requests)				\
+	A(pending_write_requests, bc_pending_write_requests)		\
+	A(pending_write_bypass_requests,				\
+	  bc_pending_write_bypass_requests)				\
+	A(pending_writeback_requests, bc_pending_writeback_requests)	\
+	A(pending_invalidate_requests, bc_pending_invalidate_requests)	\
+	A(highest_pending_requests, bc_highest_pending_requests)	\
+	A(highest_pending_invalidate_requests,				\
+	  bc_highest_pending_invalidate_requests)			\
+	A(completed_requests, bc_completed_requests)			\
+	A(completed_read_requests, bc_completed_read_requests)		\
+	A(completed_write_requests, bc_completed_write_requests)	\
+	A(completed_writebacks, bc_completed_writebacks)		\
+	A(completed_invalidations, bc_completed_invalidations)		\
+	A(flush_requests, bc_flush_requests)				\
+	A(pure_flush_requests, bc_pure_flush_requests)			\
+	A(discard_requests, bc_discard_requests)			\
+	A(make_request_count, bc_make_request_count)			\
+	A(make_request_wq_count, bc_make_request_wq_count)		\
+	/* cached device */						\
+	A(read_cached_device_requests, bc_read_cached_device_requests)	\
+	A(write_cached_device_requests, bc_write_cached_device_requests) \
+	A(pending_cached_device_requests,				\
+	  bc_pending_cached_device_requests)				\
+	A(highest_pending_cached_device_requests,			\
+	  bc_highest_pending_cached_device_requests)			\
+	U(dev_pending_count, devio.pending_count)			\
+	U(dev_flush_pending_count, devio.flush_pending_count)		\
+	U(dev_pure_flush_pending_count, devio.pure_flush_pending_count) \
+	U(dev_flush_total_count, devio.flush_total_count)		\
+	U(dev_pure_flush_total_count, devio.pure_flush_total_count)	\
+	U(dev_gennum, devio.gennum)					\
+	U(dev_gennum_flush, devio.gennum_flush)				\
+	/* hits and misses */						\
+	A(total_read_misses, bc_total_read_misses)			\
+	A(total_read_hits, bc_total_read_hits)				\
+	A(total_write_misses, bc_total_write_misses)			\
+	A(total_write_hits, bc_total_write_hits)			\
+	A(read_misses, bc_read_misses)					\
+	A(clean_read_hits, bc_clean_read_hits)				\
+	A(dirty_read_hits, bc_dirty_read_hits)				\
+	A(clean_write_hits, bc_clean_write_hits)			\
+	A(clean_write_hits_rmw, bc_clean_write_hits_rmw)		\
+	A(clean_write_misses, bc_clean_write_misses)			\
+	A(clean_write_misses_rmw, bc_clean_write_misses_rmw)		\
+	A(dirty_write_hits, bc_dirty_write_hits)			\
+	A(dirty_write_hits_rmw, bc_dirty_write_hits_rmw)		\
+	A(dirty_write_misses, bc_dirty_write_misses)			\
+	A(dirty_write_misses_rmw, bc_dirty_write_misses_rmw)		\
+	A(read_hits_busy, bc_read_hits_busy)				\
+	A(write_hits_busy, bc_write_hits_busy)				\
+	A(read_misses_busy, bc_read_misses_busy)			\
+	A(write_misses_busy, bc_write_misses_busy)			\
+	A(dirty_write_clone_alloc_ok, bc_dirty_write_clone_alloc_ok)	\
+	A(dirty_write_clone_alloc_fail, bc_dirty_write_clone_alloc_fail) \
+	/* writebacks and invalidations */				\
+	A(writebacks, bc_writebacks)					\
+	A(writebacks_clean, bc_writebacks_clean)			\
+	A(writebacks_invalid, bc_writebacks_invalid)			\
+	A(writebacks_stalls, bc_writebacks_stalls)			\
+	A(invalidations, bc_invalidations)				\
+	A(idle_invalidations, bc_idle_invalidations)			\
+	A(busy_invalidations, bc_busy_invalidations)			\
+	A(no_invalidations_all_blocks_busy,				\
+	  bc_no_invalidations_all_blocks_busy)				\
+	A(invalidations_map, bc_invalidations_map)			\
+	A(invalidations_invalidator, bc_invalidations_invalidator)	\
+	A(invalidations_writeback, bc_invalidations_writeback)		\
+	A(invalid_blocks_busy, bc_invalid_blocks_busy)			\
+	/* cache entries */						\
+	A(total_entries, bc_total_entries)				\
+	A(invalid_cache_entries, bc_invalid_entries)			\
+	A(valid_cache_entries, bc_valid_entries)			\
+	A(valid_clean_cache_entries, bc_valid_entries_clean)		\
+	A(valid_dirty_cache_entries, bc_valid_entries_dirty)		\
+	/* sequential bypass */						\
+	A(read_sequential_bypass_count, bc_seq_read.bypass_count)	\
+	A(read_sequential_io_count, bc_seq_read.seq_io_count)		\
+	A(read_non_sequential_io_count, bc_seq_read.non_seq_io_count)	\
+	A(read_sequential_bypass_hit, bc_seq_read.bypass_hit)		\
+	U(read_sequential_streams_count, bc_seq_read.streams_count)	\
+	A(write_sequential_bypass_count, bc_seq_write.bypass_count)	\
+	A(write_sequential_io_count, bc_seq_write.seq_io_count)		\
+	A(write_non_sequential_io_count, bc_seq_write.non_seq_io_count) \
+	A(write_sequential_bypass_hit, bc_seq_write.bypass_hit)		\
+	U(write_sequential_streams_count, bc_seq_write.streams_count)	\
+	/* miss admission */						\
+	A(read_admit_count, bc_admit_read.admit_count)			\
+	A(read_reject_count, bc_admit_read.reject_count)		\
+	A(write_admit_count, bc_admit_write.admit_count)		\
+	A(write_reject_count, bc_admit_write.reject_count)		\
+	/* dram front tier */						\
+	A(l1_entries, bc_l1_entries)					\
+	A(l1_hits, bc_l1_hits)						\
+	A(l1_misses, bc_l1_misses)					\
+	A(l1_inserts, bc_l1_inserts)					\
+	A(l1_evictions, bc_l1_evictions)				\
+	A(l1_invalidations, bc_l1_invalidations)			\
+	A(l1_alloc_failures, bc_l1_alloc_failures)			\
+	/* deferred queues */						\
+	U(defer_busy_curr_count, defer_busy.curr_count)			\
+	U(defer_busy_requeue_count, defer_busy.requeue_count)		\
+	U(defer_busy_max_count, defer_busy.max_count)			\
+	U(defer_busy_work_count, defer_busy.work_count)			\
+	U(defer_busy_no_work_count, defer_busy.no_work_count)		\
+	U(defer_page_curr_count, defer_page.curr_count)			\
+	U(defer_page_requeue_count, defer_page.requeue_count)		\
+	U(defer_page_max_count, defer_page.max_count)			\
+	U(defer_page_work_count, defer_page.work_count)			\
+	U(defer_page_no_work_count, defer_page.no_work_count)		\
+	/* bgwriter */							\
+	U(bgwriter_no_work_count, bc_bgwriter_no_work_count)		\
+	U(bgwriter_work_count, bc_bgwriter_work_count)			\
+	U(bgwriter_loop_count, bc_bgwriter_loop_count)			\
+	U(bgwriter_stalls_count, bc_bgwriter_stalls_count)		\
+	U(bgwriter_stalls_nowait_count, bc_bgwriter_stalls_nowait_count) \
+	U(bgwriter_cache_block_busy_count,				\
+	  bc_bgwriter_cache_block_busy_count)				\
+	U(bgwriter_queue_full_count, bc_bgwriter_queue_full_count)	\
+	U(bgwriter_too_young_count, bc_bgwriter_too_young_count)	\
+	U(bgwriter_ready_count, bc_bgwriter_ready_count)		\
+	U(bgwriter_hint_block_clean_count,				\
+	  bc_bgwriter_hint_block_clean_count)				\
+	U(bgwriter_hint_no_block_count, bc_bgwriter_hint_no_block_count) \
+	U(bgwriter_curr_queue_depth, bc_bgwriter_curr_queue_depth)	\
+	U(bgwriter_curr_max_queue_depth, bc_bgwriter_curr_max_queue_depth) \
+	U(bgwriter_curr_target_pct, bc_bgwriter_curr_target_pct)	\
+	U(bgwriter_curr_rate_per_sec, bc_bgwriter_curr_rate_per_sec)	\
+	U(bgwriter_curr_min_age_secs, bc_bgwriter_curr_min_age_secs)	\
+	U(bgwriter_curr_block_count, bc_bgwriter_curr_block_count)	\
+	U(bgwriter_curr_block_count_sum, bc_bgwriter_curr_block_count_sum) \
+	U(bgwriter_curr_cluster_count, bc_bgwriter_curr_cluster_count)	\
+	U(bgwriter_curr_cluster_count_sum,				\
+	  bc_bgwriter_curr_cluster_count_sum)				\
+	U(bgwriter_active_policy, bc_bgwriter_active_policy)		\
+	U(bgwriter_conf_greedyness, bc_bgwriter_conf_greedyness)	\
+	U(bgwriter_conf_max_queue_depth_pct,				\
+	  bc_bgwriter_conf_max_queue_depth_pct)				\
+	U(bgwriter_conf_cluster_size, bc_bgwriter_conf_cluster_size)	\
+	/* invalidator */						\
+	U(invalidator_no_work_count, bc_invalidator_no_work_count)	\
+	U(invalidator_work_count, bc_invalidator_work_count)		\
+	U(invalidator_conf_min_invalid_count,				\
+	  bc_invalidator_conf_min_invalid_count)			\
+	/* misc */							\
+	A(error_count, error_count)					\
+	U(cache_mode_writeback, bc_cache_mode_writeback)		\
+	U(max_pending_requests, bc_max_pending_requests)		\
+	/* timers */							\
+	T(reads, bc_timer_reads)					\
+	T(writes, bc_timer_writes)					\
+	T(read_hits, bc_timer_read_hits)				\
+	T(write_hits, bc_timer_write_hits)				\
+	T(read_misses, bc_timer_read_misses)				\
+	T(write_misses, bc_timer_write_misses)				\
+	T(write_dirty_misses, bc_timer_write_dirty_misses)		\
+	T(write_clean_misses, bc_timer_write_clean_misses)		\
+	T(read_clean_hits, bc_timer_read_clean_hits)			\
+	T(write_clean_hits, bc_timer_write_clean_hits)			\
+	T(read_dirty_hits, bc_timer_read_dirty_hits)			\
+	T(write_dirty_hits, bc_timer_write_dirty_hits)			\
+	T(read_l1_hits, bc_timer_read_l1_hits)				\
+	T(writebacks, bc_timer_writebacks)				\
+	T(invalidations, bc_timer_invalidations)			\
+	T(pending_queue, bc_timer_pending_queue)			\
+	T(deferred_wait_busy, defer_busy.timer)				\
+	T(deferred_wait_page, defer_page.timer)				\
+	T(cached_device_reads, bc_timer_cached_device_reads)		\
+	T(cached_device_writes, bc_timer_cached_device_writes)		\
+	T(cached_device_flushes, bc_timer_cached_device_flushes)	\
+	T(resource_alloc_reads, bc_timer_resource_alloc_reads)		\
+	T(resource_alloc_writes, bc_timer_resource_alloc_writes)	\
+	T(make_request_wq_timer, bc_make_request_wq_timer)		\
+	/* write-hot dirty blocks */					\
+	A(bgwriter_hot_deferred_count, bc_bgwriter_hot_deferred_count)	\
+	A(bgwriter_hot_writebacks_saved,				\
+	  bc_bgwriter_hot_writebacks_saved)				\
+	/* requests held back by their i/o class */			\
+	U(defer_class_curr_count, defer_class.curr_count)		\
+	U(defer_class_requeue_count, defer_class.requeue_count)		\
+	U(defer_class_max_count, defer_class.max_count)			\
+	U(defer_class_work_count, defer_class.work_count)		\
+	U(defer_class_no_work_count, defer_class.no_work_count)		\
+	T(deferred_wait_class, defer_class.timer)
+
+/*! index of each snapshot value */
+enum cache_snapshot_value {
+#define __CACHE_SNAPSHOT_ENUM(__name, __field)				\
+	CACHE_SNAPSHOT_##__name,
+#define __CACHE_SNAPSHOT_ENUM_T(__name, __field)			\
+	CACHE_SNAPSHOT_timer_##__name##_count,				\
+	CACHE_SNAPSHOT_timer_##__name##_sum_nsec,			\
+	CACHE_SNAPSHOT_timer_##__name##_max_nsec,
+	CACHE_SNAPSHOT_VALUES(__CACHE_SNAPSHOT_ENUM,
+			      __CACHE_SNAPSHOT_ENUM,
+			      __CACHE_SNAPSHOT_ENUM_T)
+#undef __CACHE_SNAPSHOT_ENUM
+#undef __CACHE_SNAPSHOT_ENUM_T
+	__CACHE_SNAPSHOT_NUM,
+};
+
+#define CACHE_SNAPSHOT_MAGIC	0xbc5a9501
+#define CACHE_SNAPSHOT_VERSION	1
+
+/*!
+ * Snapshot header. All values which follow the header are captured in the
+ * same pass, see cache_snapshot_fill() .
+ */
+struct cache_snapshot_header {
+	/*! @ref CACHE_SNAPSHOT_MAGIC */
+	uint32_t sh_magic;
+	/*! @ref CACHE_SNAPSHOT_VERSION */
+	uint16_t sh_version;
+	/*! sizeof(struct cache_snapshot_header) */
+	uint16_t sh_header_size;
+	/*! number of 64 bits values following the header */
+	uint32_t sh_nr_values;
+	uint32_t sh_reserved;
+	/*! time the snapshot was taken, in nanoseconds */
+	uint64_t sh_ts_nsec;
+	/*! current io transaction id, increments for each request */
+	uint64_t sh_xid;
+};
+
+/*! total size of a snapshot */
+#define CACHE_SNAPSHOT_SIZE						\
+	(sizeof(struct cache_snapshot_header) +				\
+	 __CACHE_SNAPSHOT_NUM * sizeof(uint64_t))
+
+#endif /* BITTERN_CACHE_SNAPSHOT_H */
@@ -0,0 +1,339 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+/*
+ * Static tracepoints.
+ *
+ * Unlike BT_TRACE, which tests the trace level and formats text on each
+ * call, a disabled tracepoint costs a single predicted branch, so these are
+ * always compiled in. They show up in /sys/kernel/debug/tracing/events/bittern
+ * and can be used with ftrace, perf and eBPF, e.g.:
+ *
+ *   perf record -e 'bittern:*' -a
+ *   perf script
+ *
+ * Every request related event carries the cache name and the request xid,
+ * so per request (and per state transition) latency breakdowns can be built
+ * by joining events on xid and diffing their timestamps.
+ *
+ * States and transitions are printed as numbers, they are the values of
+ * enum cache_state and enum cache_transition in bittern_cache_states.h .
+ *
+ * The tracepoints are instantiated in bittern_cache_module.c .
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bittern
+
+#if !defined(BITTERN_CACHE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define BITTERN_CACHE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef BITTERN_CACHE_TRACE_ONCE_H
+#define BITTERN_CACHE_TRACE_ONCE_H
+/*! bgwriter decisions, see @ref trace_bittern_bgwriter_decision */
+enum cache_bgwriter_decision {
+	/*! no dirty block on the dirty list */
+	BGWRITER_DECISION_NO_WORK = 0,
+	/*! oldest dirty block is busy */
+	BGWRITER_DECISION_BUSY,
+	/*! dirty block is write-hot, writeback deferred */
+	BGWRITER_DECISION_HOT,
+	/*! oldest dirty block is younger than the current min age */
+	BGWRITER_DECISION_TOO_YOUNG,
+	/*! block hinted by the previous writeback is clean */
+	BGWRITER_DECISION_HINT_CLEAN,
+	/*! no block for the hinted sector */
+	BGWRITER_DECISION_HINT_MISS,
+	/*! writeback to a clean state */
+	BGWRITER_DECISION_WRITEBACK,
+	/*! writeback and invalidate */
+	BGWRITER_DECISION_WRITEBACK_INVALIDATE,
+};
+#endif /* BITTERN_CACHE_TRACE_ONCE_H */
+
+TRACE_EVENT(bittern_state_transition,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct cache_block *cache_block,
+		 int p_from, int s_from,
+		 int p_to, int s_to),
+	TP_ARGS(bc, cache_block, p_from, s_from, p_to, s_to),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(uint64_t, xid)
+		__field(sector_t, sector)
+		__field(int, block_id)
+		__field(int, p_from)
+		__field(int, s_from)
+		__field(int, p_to)
+		__field(int, s_to)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->xid = cache_block->bcb_xid;
+		__entry->sector = cache_block->bcb_sector;
+		__entry->block_id = cache_block->bcb_block_id;
+		__entry->p_from = p_from;
+		__entry->s_from = s_from;
+		__entry->p_to = p_to;
+		__entry->s_to = s_to;
+	),
+	TP_printk("%s: xid=%llu sector=%llu block_id=%d transition=%d->%d state=%d->%d",
+		  __get_str(name),
+		  (unsigned long long)__entry->xid,
+		  (unsigned long long)__entry->sector,
+		  __entry->block_id,
+		  __entry->p_from, __entry->p_to,
+		  __entry->s_from, __entry->s_to)
+);
+
+TRACE_EVENT(bittern_request_done,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct work_item *wi),
+	TP_ARGS(bc, wi),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(uint64_t, xid)
+		__field(sector_t, sector)
+		__field(int, write)
+		__field(int, bypass)
+		__field(int, transition)
+		__field(uint64_t, service_nsec)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->xid = wi->wi_io_xid;
+		__entry->sector = wi->wi_iotrace_sector;
+		__entry->write = !data_dir_read(wi->wi_op_rw);
+		__entry->bypass = wi->wi_bypass;
+		__entry->transition = wi->wi_iotrace_transition;
+		__entry->service_nsec =
+			current_kernel_time_nsec() - wi->wi_ts_started;
+	),
+	TP_printk("%s: xid=%llu sector=%llu %s bypass=%d transition=%d service_usecs=%llu",
+		  __get_str(name),
+		  (unsigned long long)__entry->xid,
+		  (unsigned long long)__entry->sector,
+		  __entry->write ? "W" : "R",
+		  __entry->bypass,
+		  __entry->transition,
+		  (unsigned long long)__entry->service_nsec / 1000ULL)
+);
+
+TRACE_EVENT(bittern_defer,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct bio *bio,
+		 const char *queue,
+		 int requeue,
+		 int deferred_requests),
+	TP_ARGS(bc, bio, queue, requeue, deferred_requests),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(sector_t, sector)
+		__field(int, write)
+		__string(queue, queue)
+		__field(int, requeue)
+		__field(int, deferred_requests)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->sector = bio->bi_iter.bi_sector;
+		__entry->write = bio_data_dir(bio) == WRITE;
+		__assign_str(queue, queue);
+		__entry->requeue = requeue;
+		__entry->deferred_requests = deferred_requests;
+	),
+	TP_printk("%s: sector=%llu %s queue=%s requeue=%d deferred_requests=%d",
+		  __get_str(name),
+		  (unsigned long long)__entry->sector,
+		  __entry->write ? "W" : "R",
+		  __get_str(queue),
+		  __entry->requeue,
+		  __entry->deferred_requests)
+);
+
+DECLARE_EVENT_CLASS(bittern_pmem_io,
+	TP_PROTO(struct bittern_cache *bc,
+		 sector_t sector,
+		 int write,
+		 int err),
+	TP_ARGS(bc, sector, write, err),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(sector_t, sector)
+		__field(int, write)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->sector = sector;
+		__entry->write = write;
+		__entry->err = err;
+	),
+	TP_printk("%s: pmem_sector=%llu %s err=%d",
+		  __get_str(name),
+		  (unsigned long long)__entry->sector,
+		  __entry->write ? "W" : "R",
+		  __entry->err)
+);
+
+DEFINE_EVENT(bittern_pmem_io, bittern_pmem_submit,
+	TP_PROTO(struct bittern_cache *bc,
+		 sector_t sector,
+		 int write,
+		 int err),
+	TP_ARGS(bc, sector, write, err)
+);
+
+DEFINE_EVENT(bittern_pmem_io, bittern_pmem_complete,
+	TP_PROTO(struct bittern_cache *bc,
+		 sector_t sector,
+		 int write,
+		 int err),
+	TP_ARGS(bc, sector, write, err)
+);
+
+DECLARE_EVENT_CLASS(bittern_devio,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct work_item *wi,
+		 struct bio *bio,
+		 int err),
+	TP_ARGS(bc, wi, bio, err),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(uint64_t, xid)
+		__field(sector_t, sector)
+		__field(int, write)
+		__field(int, flush)
+		__field(uint64_t, gennum)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->xid = wi->wi_io_xid;
+		/* bi_iter has been consumed by the time the bio completes */
+		__entry->sector = wi->wi_cache_block->bcb_sector;
+		__entry->write = bio_data_dir(bio) == WRITE;
+		__entry->flush = (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) != 0;
+		__entry->gennum = wi->devio_gennum;
+		__entry->err = err;
+	),
+	TP_printk("%s: xid=%llu sector=%llu %s flush=%d gennum=%llu err=%d",
+		  __get_str(name),
+		  (unsigned long long)__entry->xid,
+		  (unsigned long long)__entry->sector,
+		  __entry->write ? "W" : "R",
+		  __entry->flush,
+		  (unsigned long long)__entry->gennum,
+		  __entry->err)
+);
+
+DEFINE_EVENT(bittern_devio, bittern_devio_submit,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct work_item *wi,
+		 struct bio *bio,
+		 int err),
+	TP_ARGS(bc, wi, bio, err)
+);
+
+DEFINE_EVENT(bittern_devio, bittern_devio_complete,
+	TP_PROTO(struct bittern_cache *bc,
+		 struct work_item *wi,
+		 struct bio *bio,
+		 int err),
+	TP_ARGS(bc, wi, bio, err)
+);
+
+TRACE_EVENT(bittern_bgwriter_decision,
+	TP_PROTO(struct bittern_cache *bc,
+		 sector_t sector,
+		 int decision),
+	TP_ARGS(bc, sector, decision),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(sector_t, sector)
+		__field(int, decision)
+		__field(unsigned int, min_age_secs)
+		__field(unsigned int, queue_depth)
+		__field(int, pending_writebacks)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->sector = sector;
+		__entry->decision = decision;
+		__entry->min_age_secs = bc->bc_bgwriter_curr_min_age_secs;
+		__entry->queue_depth = bc->bc_bgwriter_curr_queue_depth;
+		__entry->pending_writebacks =
+			atomic_read(&bc->bc_pending_writeback_requests);
+	),
+	TP_printk("%s: sector=%llu decision=%s min_age_secs=%u queue_depth=%u pending_writebacks=%d",
+		  __get_str(name),
+		  (unsigned long long)__entry->sector,
+		  __print_symbolic(__entry->decision,
+			{ BGWRITER_DECISION_NO_WORK, "no_work" },
+			{ BGWRITER_DECISION_BUSY, "busy" },
+			{ BGWRITER_DECISION_HOT, "hot" },
+			{ BGWRITER_DECISION_TOO_YOUNG, "too_young" },
+			{ BGWRITER_DECISION_HINT_CLEAN, "hint_clean" },
+			{ BGWRITER_DECISION_HINT_MISS, "hint_miss" },
+			{ BGWRITER_DECISION_WRITEBACK, "writeback" },
+			{ BGWRITER_DECISION_WRITEBACK_INVALIDATE,
+			  "writeback_invalidate" }),
+		  __entry->min_age_secs,
+		  __entry->queue_depth,
+		  __entry->pending_writebacks)
+);
+
+TRACE_EVENT(bittern_bgwriter_policy,
+	TP_PROTO(struct bittern_cache *bc,
+		 int dirty_entries),
+	TP_ARGS(bc, dirty_entries),
+	TP_STRUCT__entry(
+		__string(name, bc->bc_name)
+		__field(int, dirty_entries)
+		__field(unsigned int, queue_depth)
+		__field(unsigned int, target_pct)
+		__field(unsigned int, rate_per_sec)
+		__field(unsigned int, min_age_secs)
+	),
+	TP_fast_assign(
+		__assign_str(name, bc->bc_name);
+		__entry->dirty_entries = dirty_entries;
+		__entry->queue_depth = bc->bc_bgwriter_curr_queue_depth;
+		__entry->target_pct = bc->bc_bgwriter_curr_target_pct;
+		__entry->rate_per_sec = bc->bc_bgwriter_curr_rate_per_sec;
+		__entry->min_age_secs = bc->bc_bgwriter_curr_min_age_secs;
+	),
+	TP_printk("%s: dirty_entries=%d queue_depth=%u target_pct=%u rate_per_sec=%u min_age_secs=%u",
+		  __get_str(name),
+		  __entry->dirty_entries,
+		  __entry->queue_depth,
+		  __entry->target_pct,
+		  __entry->rate_per_sec,
+		  __entry->min_age_secs)
+);
+
+#endif /* BITTERN_CACHE_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bittern_cache_trace
+#include <trace/define_trace.h>
@@ -61,6 +61,18 @@
 /* millisecond delay between one cache block scan and the next (default) */
 #define CACHE_VERIFIER_BLOCK_SCAN_DELAY_DEFAULT_MS 10
 
+/* clean blocks verified together, their I/O is issued in parallel */
+#define CACHE_VERIFIER_BATCH_BLOCKS 32
+
+/* max value of the verifier_max_iops budget */
+#define CACHE_VERIFIER_MAX_IOPS_MAX 1000000
+
+/* max value of the verifier_scan_target_secs budget (30 days) */
+#define CACHE_VERIFIER_SCAN_TARGET_SECS_MAX (30 * 24 * 3600)
+
+/* max millisecond sleep of the verifier before checking budget changes */
+#define CACHE_VERIFIER_THROTTLE_SLICE_MS 100
+
 /*! How many sequential IO streams we keep track */
 #define SEQ_IO_TRACK_DEPTH		32
 /*!
@@ -126,6 +138,23 @@
  */
 #define SEQ_IO_BYPASS_ENABLED_DEFAULT	1
 
+/*
+ * miss admission filter
+ */
+/*! number of hash functions (rows) of the frequency sketch */
+#define CACHE_ADMIT_SKETCH_DEPTH	4
+/*! counters per row, must be a power of two */
+#define CACHE_ADMIT_SKETCH_WIDTH	(64 * 1024)
+/*! counters saturate at this value */
+#define CACHE_ADMIT_COUNTER_MAX		15
+/*! all counters are halved every this many accesses per sketch width */
+#define CACHE_ADMIT_SAMPLE_FACTOR	10
+/*!
+ * Admission threshold default. A miss is admitted if its block has been
+ * accessed at least this many times recently, zero admits all misses.
+ */
+#define CACHE_ADMIT_THRESHOLD_DEFAULT	0
+
 /*
  * random replacement
  */
@@ -163,6 +192,59 @@
 #define CACHE_BGWRITER_DEFAULT_CLUSTER_SIZE 64 /* 256 kbytes */
 #define CACHE_BGWRITER_MAX_CLUSTER_SIZE 512 /* 2048 mbytes */
 
+/*!
+ * number of bgwriter worker threads. each worker writes back the dirty
+ * blocks of its own shard of the cached device, a shard being made of every
+ * N-th cluster sized sector range (N being the number of workers).
+ */
+#define CACHE_BGWRITER_MIN_WORKERS 1
+#define CACHE_BGWRITER_DEFAULT_WORKERS 1
+#define CACHE_BGWRITER_MAX_WORKERS 8
+/*!
+ * how many dirty list entries a worker looks at to find a dirty block
+ * in its own shard.
+ */
+#define CACHE_BGWRITER_SHARD_SCAN 64
+
+/*!
+ * read miss latency target of the latency-feedback bgwriter policy,
+ * in microseconds. the policy shrinks the writeback queue depth and rate
+ * whenever the average read miss latency goes above this.
+ */
+#define CACHE_BGWRITER_MIN_LATENCY_TARGET_US 100
+#define CACHE_BGWRITER_DEFAULT_LATENCY_TARGET_US 10000
+#define CACHE_BGWRITER_MAX_LATENCY_TARGET_US 1000000
+/*! how often the latency-feedback policy samples latencies */
+#define CACHE_BGWRITER_LATENCY_INTERVAL_MS 100
+/*!
+ * minimum number of completed requests in a sampling interval for the
+ * average latency to be used by the latency-feedback policy.
+ */
+#define CACHE_BGWRITER_LATENCY_MIN_SAMPLES 8
+
+/*!
+ * write-hot dirty blocks. a block is write-hot once its write heat, which
+ * goes up by one on each write hit and halves every
+ * CACHE_BGWRITER_HOT_DECAY_SECS without writes, reaches hot_writes.
+ * the bgwriter skips write-hot blocks until they have been dirty for
+ * hot_max_age_secs, or until the dirty ratio reaches hot_max_dirty_pct.
+ * a hot_writes value of 0 disables this.
+ */
+#define CACHE_BGWRITER_DEFAULT_HOT_WRITES 0
+#define CACHE_BGWRITER_MAX_HOT_WRITES 15
+#define CACHE_BGWRITER_MIN_HOT_MAX_AGE_SECS 1
+#define CACHE_BGWRITER_DEFAULT_HOT_MAX_AGE_SECS 60
+#define CACHE_BGWRITER_MAX_HOT_MAX_AGE_SECS 3600
+#define CACHE_BGWRITER_MIN_HOT_MAX_DIRTY_PCT 1
+#define CACHE_BGWRITER_DEFAULT_HOT_MAX_DIRTY_PCT 50
+#define CACHE_BGWRITER_MAX_HOT_MAX_DIRTY_PCT 100
+#define CACHE_BGWRITER_HOT_DECAY_SECS 10
+/*!
+ * how many write-hot blocks are moved to the tail of the dirty list
+ * before giving up on finding a block to write back.
+ */
+#define CACHE_BGWRITER_HOT_SCAN 16
+
 /*! bgwriter policy */
 #define CACHE_BGWRITER_DEFAULT_POLICY	"dirty-ratio"
 /* #define CACHE_BGWRITER_DEFAULT_POLICY	"classic" */
@@ -176,6 +258,16 @@
 #define INVALIDATOR_DEFAULT_INVALID_COUNT 1000
 #define INVALIDATOR_MAX_INVALID_COUNT 2000
 
+/*!
+ * how many clean blocks the invalidator thread selects with a single hold
+ * of bc_entries_lock. 1 selects blocks one at a time with cache_get_clean().
+ */
+#define INVALIDATOR_MIN_BATCH_SIZE 1
+#define INVALIDATOR_DEFAULT_BATCH_SIZE 16
+#define INVALIDATOR_MAX_BATCH_SIZE 64
+/*! batch size histogram buckets, 1, 2-3, 4-7 .. 64 */
+#define INVALIDATOR_BATCH_HIST_BUCKETS 7
+
 /*
  * we need a minimal amount of allocatable page pool buffers.
  * this is because page pools are used during initialization
@@ -188,6 +280,57 @@
  */
 #define CACHE_PGPOOL_MIN_BUFFERS 256
 
+/*!
+ * online resize: number of cache blocks which are made available
+ * at a time when growing the cache.
+ */
+#define CACHE_RESIZE_GROW_BATCH_BLOCKS 4096
+/*!
+ * online resize: number of cache blocks examined between scheduling
+ * points when evacuating blocks during shrink.
+ */
+#define CACHE_RESIZE_SHRINK_BATCH_BLOCKS 256
+/*! online resize: millisecond delay between shrink evacuation passes */
+#define CACHE_RESIZE_SHRINK_PASS_DELAY_MS 10
+
+/*
+ * shared pool mode
+ */
+/*! max sum of min quota percentages of all pool owners */
+#define CACHE_POOL_MAX_MIN_PCT_SUM 90
+/*! max blocks skipped by replacement because of owner min quota */
+#define CACHE_POOL_MIN_QUOTA_MAX_SCANS 64
+/*! member evacuation: blocks scanned between reschedules */
+#define CACHE_POOL_EVACUATE_BATCH_BLOCKS 1024
+/*! member evacuation: millisecond delay between passes */
+#define CACHE_POOL_EVACUATE_PASS_DELAY_MS 10
+
+/*
+ * I/O classes
+ */
+/*! default max quota of the low class, in percent of the cache blocks */
+#define CACHE_IO_CLASS_LOW_MAX_PCT_DEFAULT 25
+/*! default share of the pending requests of the low class, in percent */
+#define CACHE_IO_CLASS_LOW_PENDING_PCT_DEFAULT 50
+
+/*
+ * DRAM front tier (L1)
+ */
+/*! number of hash buckets of the L1 index, must be a power of two */
+#define CACHE_L1_HASH_BUCKETS 4096
+/*! default L1 size in megabytes, zero means disabled */
+#define CACHE_L1_MAX_MBYTES_DEFAULT 0
+/*! max L1 size in megabytes */
+#define CACHE_L1_MAX_MBYTES_MAX (64 * 1024)
+
+/*
+ * binary I/O trace
+ */
+/*! events per cpu ring, must be a power of two */
+#define CACHE_IOTRACE_RING_EVENTS 8192
+/*! max sampling interval, that is record one every this many requests */
+#define CACHE_IOTRACE_SAMPLE_MAX (1024 * 1024)
+
 /*
  * background threads priorities
  */
@@ -214,4 +357,20 @@
 #define CACHED_DEV_FUA_INSERT_DEFAULT 500
 #define CACHED_DEV_FUA_INSERT_MAX 5000
 
+/*! max explicit flush generations in flight on the cached device */
+#define CACHED_DEV_FLUSH_INFLIGHT_MAX 4
+/*! flush batch size histogram buckets, 1, 2-3, 4-7 .. 128+ */
+#define CACHED_DEV_FLUSH_BATCH_HIST_BUCKETS 8
+/*! flush wait histogram buckets in microseconds, 0-1, 2-3 .. 32768+ */
+#define CACHED_DEV_FLUSH_WAIT_HIST_BUCKETS 16
+
+/*! metadata intent log size in pages, capped by the room past the cache */
+#define PMEM_MLOG_PAGES 256
+/*! smallest log worth using */
+#define PMEM_MLOG_PAGES_MIN 8
+/*! a checkpoint starts when this many percent of the log is in use */
+#define PMEM_MLOG_CHECKPOINT_PCT 50
+/*! records per log page write histogram buckets, 1, 2-3 .. 32-63 */
+#define PMEM_MLOG_BATCH_HIST_BUCKETS 6
+
 #endif /* BITTERN_CACHE_TUNABLES_H */
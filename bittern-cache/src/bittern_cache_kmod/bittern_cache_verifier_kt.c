@@ -16,69 +16,101 @@
 
 /*! \file */
 
+#include <linux/sort.h>
+
 #include "bittern_cache.h"
 
-void cache_block_verify_callback(struct bittern_cache *bc,
-				 struct cache_block *cache_block,
-				 struct pmem_context *pmem_ctx,
-				 void *callback_context,
-				 int err)
+/*
+ * Clean block verifier.
+ *
+ * The verifier walks the cache in block id order and compares each idle
+ * clean block with its copy on the cached device. It works on batches of
+ * up to @ref CACHE_VERIFIER_BATCH_BLOCKS clean blocks, which are held in
+ * the S_CLEAN_VERIFY state until the batch is done:
+ *
+ * - the cached device reads of the whole batch are issued at once, in
+ *   sector order and under a plug, so that adjacent blocks are merged;
+ * - the cache reads of the whole batch are issued at once;
+ * - the cache side checks (data hash, metadata) of each block run while
+ *   the cached device reads are still in flight;
+ * - once the device reads are done, data is compared block by block.
+ *
+ * The scan is paced by two budgets: "verifier_max_iops" caps the blocks
+ * verified per second (each costs one cached device read and one cache
+ * read), and "verifier_scan_target_secs" spreads a full scan over the
+ * given time. With neither set, the verifier sleeps "verifier_scan_delay_ms"
+ * every 10 blocks verified, as it always did.
+ */
+
+struct cache_verifier_batch;
+
+/*! one clean block of a verifier batch */
+struct cache_verifier_entry {
+	struct cache_verifier_batch *ve_batch;
+	int ve_block_id;
+	struct cache_block *ve_cache_block;
+	struct pmem_context *ve_pmem_ctx;
+	int ve_pmem_err;
+	/*! copy read from the cached device, NULL if there is no device */
+	void *ve_device_buf;
+	int ve_device_err;
+	int ve_errors;
+};
+
+struct cache_verifier_batch {
+	unsigned int vb_count;
+	/*! upped once by each cache read completion */
+	struct semaphore vb_pmem_sema;
+	/*! upped once by each cached device read completion */
+	struct semaphore vb_device_sema;
+	unsigned int vb_device_reads;
+	/*! cached device read buffers, allocated once per scan */
+	void *vb_buffers[CACHE_VERIFIER_BATCH_BLOCKS];
+	struct cache_verifier_entry vb_entries[CACHE_VERIFIER_BATCH_BLOCKS];
+};
+
+static void cache_verifier_pmem_callback(struct bittern_cache *bc,
+					 struct cache_block *cache_block,
+					 struct pmem_context *pmem_ctx,
+					 void *callback_context,
+					 int err)
 {
-	struct semaphore *sema = (struct semaphore *)callback_context;
+	struct cache_verifier_entry *ve;
+
+	ve = (struct cache_verifier_entry *)callback_context;
 	ASSERT(pmem_ctx != NULL);
 	M_ASSERT(pmem_ctx->magic1 == PMEM_CONTEXT_MAGIC1);
 	M_ASSERT(pmem_ctx->magic2 == PMEM_CONTEXT_MAGIC2);
+	ASSERT(ve->ve_pmem_ctx == pmem_ctx);
 
-	M_ASSERT_FIXME(err == 0);
-	up(sema);
+	ve->ve_pmem_err = err;
+	up(&ve->ve_batch->vb_pmem_sema);
 }
 
-struct bio_context {
-	struct semaphore sema;
-	int err;
-};
-
-void cache_block_verify_data_enbio(struct bio *bio, int err)
+static void cache_verifier_device_endio(struct bio *bio, int err)
 {
-	struct bio_context *bcont = (struct bio_context *)bio->bi_private;
+	struct cache_verifier_entry *ve;
 
-	bcont->err = err;
-	up(&bcont->sema);
+	ve = (struct cache_verifier_entry *)bio->bi_private;
+	ve->ve_device_err = err;
+	up(&ve->ve_batch->vb_device_sema);
 	bio_put(bio);
 }
 
-int cache_block_verify_data(struct bittern_cache *bc,
-			    int block_id,
-			    struct cache_block *cache_block,
-			    void *cache_vaddr)
+static void cache_verifier_device_read(struct bittern_cache *bc,
+				       struct cache_verifier_entry *ve)
 {
-	int errors = 0;
 	struct bio *bio;
-	struct bio_context bcontext;
-	void *buf;
-
-	buf = vmalloc(PAGE_SIZE);
-	M_ASSERT_FIXME(buf != NULL);
 
-	bcontext.err = -EIO;
-	sema_init(&bcontext.sema, 0);
-	/*
-	 * read disk block and verify crc
-	 */
-
-	/*
-	 * in this case the bio argument is the original bio.
-	 * clone bio, start i/o to write data to device.
-	 */
 	bio = bio_alloc(GFP_NOIO, 1);
 	M_ASSERT_FIXME(bio != NULL);
 	bio_set_data_dir_read(bio);
-	bio->bi_iter.bi_sector = cache_block->bcb_sector;
+	bio->bi_iter.bi_sector = ve->ve_cache_block->bcb_sector;
 	bio->bi_iter.bi_size = PAGE_SIZE;
-	bio->bi_bdev = bc->devio.dm_dev->bdev;
-	bio->bi_end_io = cache_block_verify_data_enbio;
-	bio->bi_private = (void *)&bcontext;
-	bio->bi_io_vec[0].bv_page = virtual_to_page(buf);
+	cache_pool_remap_bio(bc, bio);
+	bio->bi_end_io = cache_verifier_device_endio;
+	bio->bi_private = (void *)ve;
+	bio->bi_io_vec[0].bv_page = virtual_to_page(ve->ve_device_buf);
 	ASSERT(bio->bi_io_vec[0].bv_page != NULL);
 	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
 	bio->bi_io_vec[0].bv_offset = 0;
@@ -86,11 +118,30 @@ int cache_block_verify_data(struct bittern_cache *bc,
 	ASSERT(bio->bi_iter.bi_idx == 0);
 	ASSERT(bio->bi_vcnt == 1);
 
+	bc->bc_verifier_device_reads++;
 	generic_make_request(bio);
+}
 
-	down(&bcontext.sema);
+/*! compare the cache copy of a block with the cached device copy */
+static int cache_block_verify_data(struct bittern_cache *bc,
+				   struct cache_verifier_entry *ve)
+{
+	struct cache_block *cache_block = ve->ve_cache_block;
+	void *cache_vaddr = pmem_context_data_vaddr(ve->ve_pmem_ctx);
+	void *buf = ve->ve_device_buf;
+	int errors = 0;
+
+	/* pool member which has not joined yet, nothing to compare with */
+	if (buf == NULL)
+		return 0;
 
-	M_ASSERT_FIXME(bcontext.err == 0);
+	if (ve->ve_device_err != 0) {
+		bc->bc_verifier_device_read_errors++;
+		printk_err("error: block id #%d device block read error %d\n",
+			   ve->ve_block_id,
+			   ve->ve_device_err);
+		return 1;
+	}
 
 	errors += cache_verify_hash_data_buffer_ret(bc, cache_block, buf);
 
@@ -107,59 +158,28 @@ int cache_block_verify_data(struct bittern_cache *bc,
 			 cache_block->bcb_block_id,
 			 UINT128_ARG(cache_block->bcb_hash_data));
 		printk_err("error: block id #%d device block data compare mismatch\n",
-			   block_id);
+			   ve->ve_block_id);
 		errors++;
 	}
 
-	vfree(buf);
-
 	return errors;
 }
 
-int cache_block_verify(struct bittern_cache *bc,
-		       int block_id,
-		       struct cache_block *cache_block)
+/*! cache side checks of a block whose cache read has completed */
+static int cache_block_verify(struct bittern_cache *bc,
+			      struct cache_verifier_entry *ve)
 {
 	int errors = 0;
 	int ret;
-	struct semaphore sema;
-	uint64_t t_start, t_end;	/*FIXME need to put timers */
-	struct pmem_context *pmem_ctx;
+	int block_id = ve->ve_block_id;
+	struct cache_block *cache_block = ve->ve_cache_block;
+	struct pmem_context *pmem_ctx = ve->ve_pmem_ctx;
 	char *cache_vaddr;
 	struct pmem_block_metadata *pmbm;
 	uint128_t computed_hash_metadata;
 
-	M_ASSERT(bc != NULL);
-	M_ASSERT(block_id >= 1 &&
-		 block_id <= atomic_read(&bc->bc_total_entries));
-	M_ASSERT(cache_block != NULL);
-	ASSERT_BITTERN_CACHE(bc);
-	ASSERT_CACHE_BLOCK(cache_block, bc);
 	M_ASSERT(block_id == cache_block->bcb_block_id);
-
-	pmem_ctx = kmem_zalloc(sizeof(struct pmem_context), GFP_NOIO);
-	M_ASSERT_FIXME(pmem_ctx != NULL);
-
-	pmem_context_initialize(pmem_ctx);
-
-	ret = pmem_context_setup(bc,
-				 bc->bc_kmem_threads,
-				 cache_block,
-				 NULL,
-				 pmem_ctx);
-	M_ASSERT_FIXME(ret == 0);
-
-	t_start = current_kernel_time_nsec();
-	sema_init(&sema, 0);
-
-	pmem_data_get_page_read(bc,
-				cache_block,
-				pmem_ctx,
-				&sema, /*callback context */
-				cache_block_verify_callback);
-
-	down(&sema);
-	t_end = current_kernel_time_nsec();
+	M_ASSERT_FIXME(ve->ve_pmem_err == 0);
 
 	cache_vaddr = pmem_context_data_vaddr(pmem_ctx);
 
@@ -279,80 +299,20 @@ int cache_block_verify(struct bittern_cache *bc,
 			 UINT128_ARG(pmbm->pmbm_hash_data));
 	}
 
-	errors += cache_block_verify_data(bc,
-					  block_id,
-					  cache_block,
-					  cache_vaddr);
-
-	/*
-	 * all done, free up resources
-	 */
-
-	pmem_data_put_page_read(bc,
-				cache_block,
-				pmem_ctx);
-
-	pmem_context_destroy(bc, pmem_ctx);
-
-	M_ASSERT(pmem_ctx != NULL);
-	kmem_free(pmem_ctx, sizeof(struct pmem_context));
-
-	return errors;
-}
-
-int cache_block_verify_clean(struct bittern_cache *bc,
-			     int block_id,
-			     struct cache_block *cache_block)
-{
-	unsigned long flags, cache_flags;
-	struct cache_block *bcb;
-	int errors = 0;
-
-	M_ASSERT(cache_block->bcb_cache_transition == TS_NONE);
-	M_ASSERT(cache_block->bcb_state == S_CLEAN);
-
-	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
-	cache_state_transition_initial(bc,
-				       cache_block,
-				       TS_VERIFY_CLEAN_WTWB,
-				       S_CLEAN_VERIFY);
-	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
-
-	bc->bc_verifier_blocks_verified++;
-
-	errors += cache_block_verify(bc, block_id, cache_block);
-
-	spin_lock_irqsave(&bc->bc_entries_lock, flags);
-	bcb = cache_rb_lookup(bc, cache_block->bcb_sector);
-	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
-
-	if (bcb != NULL) {
-		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL,
-			 "verify: block #%d in red-black tree",
-			 block_id);
-	} else {
-		BT_TRACE(BT_LEVEL_ERROR, bc, NULL, cache_block, NULL, NULL,
-			 "verify: block #%d not in red-black tree",
-			 block_id);
-		printk_err("error: block #%d not in red-black-tree\n",
-			   block_id);
-		errors += 1;
-	}
-
-	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
-	cache_state_transition_final(bc,
-				     cache_block,
-				     TS_NONE,
-				     S_CLEAN);
-	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
-
 	return errors;
 }
 
-void cache_block_verifier_block(struct bittern_cache *bc,
-				int block_id)
+/*!
+ * add block_id to the batch if it is idle and clean, otherwise just
+ * account for it. blocks added are held in the S_CLEAN_VERIFY state.
+ */
+static void cache_verifier_collect_block(struct bittern_cache *bc,
+					 struct cache_verifier_batch *batch,
+					 int block_id)
 {
 	struct cache_block *cache_block = NULL;
+	struct cache_verifier_entry *ve;
+	unsigned long cache_flags;
 	enum cache_get_ret ret;
 
 	M_ASSERT(bc != NULL);
@@ -373,43 +333,7 @@ void cache_block_verifier_block(struct bittern_cache *bc,
 		 */
 		M_ASSERT(cache_block != NULL);
 		ASSERT_CACHE_BLOCK(cache_block, bc);
-		M_ASSERT(bc->bc_verifier_scan_delay_ms >= 0);
-		M_ASSERT(bc->bc_verifier_scan_delay_ms >=
-			 CACHE_VERIFIER_BLOCK_SCAN_DELAY_MIN_MS);
-		M_ASSERT(bc->bc_verifier_scan_delay_ms <=
-			 CACHE_VERIFIER_BLOCK_SCAN_DELAY_MAX_MS);
-		if (cache_block->bcb_state == S_CLEAN) {
-			int errors;
-
-			errors = cache_block_verify_clean(bc,
-							  block_id,
-							  cache_block);
-			cache_put(bc, cache_block, 1);
-
-			BT_TRACE(BT_LEVEL_TRACE1,
-				 bc, NULL, cache_block, NULL, NULL,
-				 "verify: verified block #%d, errors=%d",
-				 block_id,
-				 errors);
-			if (errors != 0) {
-				bc->bc_verifier_verify_errors++;
-				bc->bc_verifier_verify_errors_cumulative++;
-				BT_TRACE(BT_LEVEL_ERROR,
-					 bc, NULL, cache_block, NULL, NULL,
-					 "verify: verified block #%d, errors=%d: block has errors",
-					 block_id, errors);
-				printk_err("verified block #%d, errors=%d: block has errors\n",
-					   block_id,
-					   errors);
-			}
-
-			schedule();
-
-			if ((bc->bc_verifier_blocks_verified % 10) == 0) {
-				if (bc->bc_verifier_scan_delay_ms > 0)
-					msleep(bc->bc_verifier_scan_delay_ms);
-			}
-		} else {
+		if (cache_block->bcb_state != S_CLEAN) {
 			ASSERT(cache_block->bcb_state == S_DIRTY);
 			cache_put(bc, cache_block, 1);
 			bc->bc_verifier_blocks_not_verified_dirty++;
@@ -417,7 +341,23 @@ void cache_block_verifier_block(struct bittern_cache *bc,
 				 bc, NULL, cache_block, NULL, NULL,
 				 "verify: block #%d dirty -- skipping",
 				 block_id);
+			break;
 		}
+		M_ASSERT(cache_block->bcb_cache_transition == TS_NONE);
+		spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
+		cache_state_transition_initial(bc,
+					       cache_block,
+					       TS_VERIFY_CLEAN_WTWB,
+					       S_CLEAN_VERIFY);
+		spin_unlock_irqrestore(&cache_block->bcb_spinlock,
+				       cache_flags);
+		bc->bc_verifier_blocks_verified++;
+		M_ASSERT(batch->vb_count < CACHE_VERIFIER_BATCH_BLOCKS);
+		ve = &batch->vb_entries[batch->vb_count++];
+		memset(ve, 0, sizeof(struct cache_verifier_entry));
+		ve->ve_batch = batch;
+		ve->ve_block_id = block_id;
+		ve->ve_cache_block = cache_block;
 		break;
 	case CACHE_GET_RET_HIT_BUSY:
 		M_ASSERT(cache_block == NULL);
@@ -445,16 +385,234 @@ void cache_block_verifier_block(struct bittern_cache *bc,
 	}
 }
 
+/*! release a verified block and account for its errors */
+static void cache_verifier_finish_block(struct bittern_cache *bc,
+					struct cache_verifier_entry *ve)
+{
+	struct cache_block *cache_block = ve->ve_cache_block;
+	int block_id = ve->ve_block_id;
+	unsigned long flags, cache_flags;
+	struct cache_block *bcb;
+
+	spin_lock_irqsave(&bc->bc_entries_lock, flags);
+	bcb = cache_rb_lookup(bc, cache_block->bcb_sector);
+	spin_unlock_irqrestore(&bc->bc_entries_lock, flags);
+
+	if (bcb != NULL) {
+		BT_TRACE(BT_LEVEL_TRACE1, bc, NULL, cache_block, NULL, NULL,
+			 "verify: block #%d in red-black tree",
+			 block_id);
+	} else {
+		BT_TRACE(BT_LEVEL_ERROR, bc, NULL, cache_block, NULL, NULL,
+			 "verify: block #%d not in red-black tree",
+			 block_id);
+		printk_err("error: block #%d not in red-black-tree\n",
+			   block_id);
+		ve->ve_errors += 1;
+	}
+
+	spin_lock_irqsave(&cache_block->bcb_spinlock, cache_flags);
+	cache_state_transition_final(bc,
+				     cache_block,
+				     TS_NONE,
+				     S_CLEAN);
+	spin_unlock_irqrestore(&cache_block->bcb_spinlock, cache_flags);
+	cache_put(bc, cache_block, 1);
+
+	BT_TRACE(BT_LEVEL_TRACE1,
+		 bc, NULL, cache_block, NULL, NULL,
+		 "verify: verified block #%d, errors=%d",
+		 block_id,
+		 ve->ve_errors);
+	if (ve->ve_errors != 0) {
+		bc->bc_verifier_verify_errors++;
+		bc->bc_verifier_verify_errors_cumulative++;
+		BT_TRACE(BT_LEVEL_ERROR,
+			 bc, NULL, cache_block, NULL, NULL,
+			 "verify: verified block #%d, errors=%d: block has errors",
+			 block_id, ve->ve_errors);
+		printk_err("verified block #%d, errors=%d: block has errors\n",
+			   block_id,
+			   ve->ve_errors);
+	}
+}
+
+static int cache_verifier_entry_cmp(const void *a, const void *b)
+{
+	const struct cache_verifier_entry *ve_a = a;
+	const struct cache_verifier_entry *ve_b = b;
+
+	if (ve_a->ve_cache_block->bcb_sector < ve_b->ve_cache_block->bcb_sector)
+		return -1;
+	if (ve_a->ve_cache_block->bcb_sector > ve_b->ve_cache_block->bcb_sector)
+		return 1;
+	return 0;
+}
+
+/*! verify all blocks of a batch, see the comment at the top */
+static void cache_verifier_run_batch(struct bittern_cache *bc,
+				     struct cache_verifier_batch *batch)
+{
+	struct blk_plug plug;
+	unsigned int i;
+	int ret;
+
+	ASSERT(batch->vb_count > 0);
+	ASSERT(batch->vb_count <= CACHE_VERIFIER_BATCH_BLOCKS);
+
+	/*
+	 * Issue the cached device reads first, in sector order. Pool
+	 * owner ids are in the high bits of the sector, so the reads of
+	 * each device are contiguous too.
+	 */
+	sort(batch->vb_entries,
+	     batch->vb_count,
+	     sizeof(struct cache_verifier_entry),
+	     cache_verifier_entry_cmp,
+	     NULL);
+	sema_init(&batch->vb_pmem_sema, 0);
+	sema_init(&batch->vb_device_sema, 0);
+	batch->vb_device_reads = 0;
+	blk_start_plug(&plug);
+	for (i = 0; i < batch->vb_count; i++) {
+		struct cache_verifier_entry *ve = &batch->vb_entries[i];
+
+		/* pool member which has not joined yet, nothing to read */
+		if (cache_pool_owner_dev(bc, ve->ve_cache_block->bcb_sector) ==
+		    NULL)
+			continue;
+		ve->ve_device_buf = batch->vb_buffers[i];
+		cache_verifier_device_read(bc, ve);
+		batch->vb_device_reads++;
+	}
+	blk_finish_plug(&plug);
+
+	/*
+	 * Then the cache reads.
+	 */
+	for (i = 0; i < batch->vb_count; i++) {
+		struct cache_verifier_entry *ve = &batch->vb_entries[i];
+
+		ve->ve_pmem_ctx = kmem_zalloc(sizeof(struct pmem_context),
+					      GFP_NOIO);
+		M_ASSERT_FIXME(ve->ve_pmem_ctx != NULL);
+		pmem_context_initialize(ve->ve_pmem_ctx);
+		ret = pmem_context_setup(bc,
+					 bc->bc_kmem_threads,
+					 ve->ve_cache_block,
+					 NULL,
+					 ve->ve_pmem_ctx);
+		M_ASSERT_FIXME(ret == 0);
+		pmem_data_get_page_read(bc,
+					ve->ve_cache_block,
+					ve->ve_pmem_ctx,
+					ve, /*callback context */
+					cache_verifier_pmem_callback);
+	}
+	for (i = 0; i < batch->vb_count; i++)
+		down(&batch->vb_pmem_sema);
+
+	/*
+	 * Cache side checks overlap the cached device reads.
+	 */
+	for (i = 0; i < batch->vb_count; i++) {
+		struct cache_verifier_entry *ve = &batch->vb_entries[i];
+
+		ve->ve_errors += cache_block_verify(bc, ve);
+	}
+	for (i = 0; i < batch->vb_device_reads; i++)
+		down(&batch->vb_device_sema);
+
+	for (i = 0; i < batch->vb_count; i++) {
+		struct cache_verifier_entry *ve = &batch->vb_entries[i];
+
+		ve->ve_errors += cache_block_verify_data(bc, ve);
+		pmem_data_put_page_read(bc,
+					ve->ve_cache_block,
+					ve->ve_pmem_ctx);
+		pmem_context_destroy(bc, ve->ve_pmem_ctx);
+		kmem_free(ve->ve_pmem_ctx, sizeof(struct pmem_context));
+		ve->ve_pmem_ctx = NULL;
+		cache_verifier_finish_block(bc, ve);
+	}
+}
+
+/*!
+ * milliseconds the current scan should have taken so far to stay within
+ * its budget, zero if there is no budget.
+ */
+static uint64_t cache_verifier_budget_ms(struct bittern_cache *bc)
+{
+	uint64_t budget_ms = 0, target_ms;
+	int max_iops = bc->bc_verifier_max_iops;
+	int target_secs = bc->bc_verifier_scan_target_secs;
+	unsigned int total = atomic_read(&bc->bc_total_entries);
+
+	if (max_iops > 0)
+		budget_ms = div_u64((uint64_t)bc->bc_verifier_blocks_verified *
+				    1000ULL,
+				    max_iops);
+	if (target_secs > 0 && total > 0) {
+		target_ms = div_u64((uint64_t)bc->bc_verifier_scan_position *
+				    (uint64_t)target_secs * 1000ULL,
+				    total);
+		if (target_ms > budget_ms)
+			budget_ms = target_ms;
+	}
+	return budget_ms;
+}
+
+/*! sleep as needed after a batch of batch_count verified blocks */
+static void cache_verifier_throttle(struct bittern_cache *bc,
+				    unsigned int batch_count)
+{
+	uint64_t budget_ms, elapsed_ms;
+
+	if (bc->bc_verifier_max_iops == 0 &&
+	    bc->bc_verifier_scan_target_secs == 0) {
+		M_ASSERT(bc->bc_verifier_scan_delay_ms >=
+			 CACHE_VERIFIER_BLOCK_SCAN_DELAY_MIN_MS);
+		M_ASSERT(bc->bc_verifier_scan_delay_ms <=
+			 CACHE_VERIFIER_BLOCK_SCAN_DELAY_MAX_MS);
+		if (bc->bc_verifier_scan_delay_ms > 0 && batch_count > 0)
+			msleep(bc->bc_verifier_scan_delay_ms *
+			       DIV_ROUND_UP(batch_count, 10));
+		return;
+	}
+
+	/* sleep in slices, so that budget changes and stop apply quickly */
+	while (!kthread_should_stop() && bc->bc_verifier_running != 0) {
+		budget_ms = cache_verifier_budget_ms(bc);
+		elapsed_ms = jiffies_to_msecs(jiffies -
+					      bc->bc_verifier_scan_started);
+		if (elapsed_ms >= budget_ms)
+			break;
+		msleep(min_t(uint64_t,
+			     budget_ms - elapsed_ms,
+			     CACHE_VERIFIER_THROTTLE_SLICE_MS));
+	}
+}
+
 void cache_block_verifier(struct bittern_cache *bc)
 {
+	struct cache_verifier_batch *batch;
 	int block_id;
+	unsigned int i;
 
 	M_ASSERT(bc != NULL);
 	ASSERT_BITTERN_CACHE(bc);
 
+	batch = kmem_zalloc(sizeof(struct cache_verifier_batch), GFP_NOIO);
+	M_ASSERT_FIXME(batch != NULL);
+	for (i = 0; i < CACHE_VERIFIER_BATCH_BLOCKS; i++) {
+		batch->vb_buffers[i] = vmalloc(PAGE_SIZE);
+		M_ASSERT_FIXME(batch->vb_buffers[i] != NULL);
+	}
+
 	bc->bc_verifier_scan_started = jiffies;
 	bc->bc_verifier_scan_completed = 0;
 	bc->bc_verifier_scan_last_block = jiffies;
+	bc->bc_verifier_scan_position = 0;
 	bc->bc_verifier_blocks_verified = 0;
 	bc->bc_verifier_blocks_not_verified_dirty = 0;
 	bc->bc_verifier_blocks_not_verified_busy = 0;
@@ -466,15 +624,34 @@ void cache_block_verifier(struct bittern_cache *bc)
 
 	BT_TRACE(BT_LEVEL_TRACE0, bc, NULL, NULL, NULL, NULL, "enter");
 
-	for (block_id = 1; block_id <= atomic_read(&bc->bc_total_entries);
-	     block_id++) {
-
-		cache_block_verifier_block(bc, block_id);
+	block_id = 1;
+	while (block_id <= atomic_read(&bc->bc_total_entries)) {
+
+		batch->vb_count = 0;
+		while (batch->vb_count < CACHE_VERIFIER_BATCH_BLOCKS &&
+		       block_id <= atomic_read(&bc->bc_total_entries)) {
+			cache_verifier_collect_block(bc, batch, block_id);
+			bc->bc_verifier_scan_position = block_id;
+			block_id++;
+			if (kthread_should_stop() ||
+			    bc->bc_verifier_running == 0)
+				break;
+		}
+		/* blocks in the batch are held, always finish it */
+		if (batch->vb_count > 0)
+			cache_verifier_run_batch(bc, batch);
 
 		if (kthread_should_stop() || bc->bc_verifier_running == 0)
 			break;
+
+		schedule();
+		cache_verifier_throttle(bc, batch->vb_count);
 	}
 
+	for (i = 0; i < CACHE_VERIFIER_BATCH_BLOCKS; i++)
+		vfree(batch->vb_buffers[i]);
+	kmem_free(batch, sizeof(struct cache_verifier_batch));
+
 	if (kthread_should_stop() || bc->bc_verifier_running == 0) {
 		bc->bc_verifier_blocks_verified = 0;
 		bc->bc_verifier_blocks_not_verified_dirty = 0;
@@ -0,0 +1,978 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+/*
+ * Trace driven cache simulator.
+ *
+ * Replays a block trace against a virtual cache of arbitrary size and
+ * reports hit ratios, dirty ratio over time and writeback volume for each
+ * replacement mode and bgwriter policy. No data is moved and there is no
+ * actual cache device, so it runs at several million requests per second.
+ *
+ * Sequential access detection and bgwriter policies are the kernel code,
+ * built in userspace (see bittern_cache_user.h). Block replacement mirrors
+ * cache_get_clean() and the bgwriter loop mirrors cache_bgwriter_kthread().
+ *
+ * Two trace formats are accepted, and can be mixed in the same file:
+ *
+ *   csv:      timestamp_usecs,pid,R|W,sector,bytes
+ *   blkparse: default blkparse(1) text output, only Q events are used
+ *
+ * Binary blktrace files need to be converted with "blkparse -i" first.
+ * Traces captured by bittern itself can be converted with "bc_iotrace -s -u".
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "bittern_cache_user.h"
+
+#define CACHE_BLOCK_SIZE PAGE_SIZE
+#define SECTORS_PER_CACHE_BLOCK (CACHE_BLOCK_SIZE / SECTOR_SIZE)
+
+/* same values as in bittern_cache.h */
+#define CACHE_REPLACEMENT_MODE_FIFO 1
+#define CACHE_REPLACEMENT_MODE_LRU 2
+#define CACHE_REPLACEMENT_MODE_RANDOM 3
+#define CACHE_REPLACEMENT_MODE_DEFAULT CACHE_REPLACEMENT_MODE_RANDOM
+
+/*! bgwriter policies, all the ones known to bittern_cache_bgwriter_policy.c */
+static const char *sim_policies[] = {
+	"classic",
+	"old-default",
+	"dirty-ratio",
+	"latency-feedback",
+	"exp/queue-depth-adaptive",
+};
+
+static const char *sim_replacement_modes[] = {
+	[CACHE_REPLACEMENT_MODE_FIFO] = "fifo",
+	[CACHE_REPLACEMENT_MODE_LRU] = "lru",
+	[CACHE_REPLACEMENT_MODE_RANDOM] = "random",
+};
+
+struct sim_record {
+	uint64_t ts_usecs;
+	uint64_t sector;
+	uint32_t bytes;
+	uint32_t seq;
+	pid_t pid;
+	int dir;
+};
+
+struct sim_trace {
+	struct sim_record *records;
+	size_t count;
+	size_t size;
+	size_t skipped;
+};
+
+enum sim_block_state {
+	SIM_INVALID = 0,
+	SIM_CLEAN,
+	SIM_DIRTY,
+};
+
+struct sim_block {
+	/*! invalid list or valid list (fifo/lru order) */
+	struct list_head entry;
+	/*! clean list or dirty list */
+	struct list_head cleandirty;
+	/*! cached device block number */
+	uint64_t bblock;
+	/*! jiffies of last write, used for bgwriter min age */
+	unsigned long last_modify;
+	/*! hash chain, index + 1 of next block, zero terminates */
+	uint32_t hnext;
+	enum sim_block_state state;
+};
+
+struct sim_conf {
+	int replacement_mode;
+	const char *policy;
+	int writeback;
+	unsigned int cache_mbytes;
+	unsigned int max_pending_requests;
+	unsigned int writeback_latency_usecs;
+	unsigned int interval_secs;
+	int seq_bypass_enabled;
+	unsigned int seed;
+};
+
+struct sim_stats {
+	uint64_t requests;
+	uint64_t read_hits;
+	uint64_t read_misses;
+	uint64_t write_hits;
+	uint64_t write_misses;
+	uint64_t read_bypass;
+	uint64_t write_bypass;
+	uint64_t writebacks;
+	uint64_t writethrus;
+	uint64_t invalidations;
+	uint64_t stalls;
+	uint64_t dirty_sum;
+	unsigned int dirty_max;
+};
+
+struct sim_cache {
+	struct bittern_cache bc;
+	const struct sim_conf *conf;
+	struct sim_block *blocks;
+	unsigned int nblocks;
+	uint32_t *hash;
+	uint32_t hash_mask;
+	struct list_head invalid_list;
+	struct list_head valid_list;
+	struct list_head clean_list;
+	struct list_head dirty_list;
+	unsigned int random_value;
+	/*! writebacks the bgwriter can still start in the current tick */
+	double wb_credit;
+	unsigned long clock;
+	unsigned long next_sample;
+	struct sim_stats st;
+	struct sim_stats st_sample;
+};
+
+static inline uint32_t sim_hash(struct sim_cache *sc, uint64_t bblock)
+{
+	return (uint32_t)((bblock * 0x9e3779b97f4a7c15ULL) >> 32) &
+	       sc->hash_mask;
+}
+
+static struct sim_block *sim_lookup(struct sim_cache *sc, uint64_t bblock)
+{
+	uint32_t i = sc->hash[sim_hash(sc, bblock)];
+
+	while (i != 0) {
+		struct sim_block *b = &sc->blocks[i - 1];
+
+		if (b->bblock == bblock)
+			return b;
+		i = b->hnext;
+	}
+	return NULL;
+}
+
+static void sim_hash_insert(struct sim_cache *sc, struct sim_block *b)
+{
+	uint32_t *head = &sc->hash[sim_hash(sc, b->bblock)];
+
+	b->hnext = *head;
+	*head = (b - sc->blocks) + 1;
+}
+
+static void sim_hash_remove(struct sim_cache *sc, struct sim_block *b)
+{
+	uint32_t *p = &sc->hash[sim_hash(sc, b->bblock)];
+	uint32_t id = (b - sc->blocks) + 1;
+
+	while (*p != id) {
+		ASSERT(*p != 0);
+		p = &sc->blocks[*p - 1].hnext;
+	}
+	*p = b->hnext;
+	b->hnext = 0;
+}
+
+static unsigned int sim_dirty(struct sim_cache *sc)
+{
+	return atomic_read(&sc->bc.bc_valid_entries_dirty);
+}
+
+static void sim_timer_add(struct cache_timer *timer, uint64_t usecs)
+{
+	timer->bct_sum_nsec += usecs * 1000;
+	timer->bct_count++;
+	if (usecs * 1000 > timer->bct_max_nsec)
+		timer->bct_max_nsec = usecs * 1000;
+	timer->bct_avg_nsec = timer->bct_sum_nsec / timer->bct_count;
+}
+
+static void sim_move_to_clean(struct sim_cache *sc, struct sim_block *b)
+{
+	ASSERT(b->state == SIM_DIRTY);
+	b->state = SIM_CLEAN;
+	atomic_dec(&sc->bc.bc_valid_entries_dirty);
+	list_del_init(&b->cleandirty);
+	list_add_tail(&b->cleandirty, &sc->clean_list);
+	sc->st.writebacks++;
+	sim_timer_add(&sc->bc.bc_timer_cached_device_writes,
+		      sc->conf->writeback_latency_usecs);
+}
+
+static void sim_move_to_dirty(struct sim_cache *sc, struct sim_block *b)
+{
+	ASSERT(b->state == SIM_CLEAN);
+	b->state = SIM_DIRTY;
+	atomic_inc(&sc->bc.bc_valid_entries_dirty);
+	if (sim_dirty(sc) > sc->st.dirty_max)
+		sc->st.dirty_max = sim_dirty(sc);
+}
+
+static void sim_invalidate(struct sim_cache *sc, struct sim_block *b)
+{
+	ASSERT(b->state == SIM_CLEAN);
+	sim_hash_remove(sc, b);
+	list_del_init(&b->cleandirty);
+	list_del_init(&b->entry);
+	list_add_tail(&b->entry, &sc->invalid_list);
+	b->state = SIM_INVALID;
+	sc->st.invalidations++;
+}
+
+/*! linear congruent generator, same as __cache_block_pseudo_random() */
+static unsigned int sim_pseudo_random(unsigned int previous_pseudo_random)
+{
+	return (previous_pseudo_random * 1103515245 + 12345) % 0x7fffffff;
+}
+
+/*!
+ * Find a clean block to replace, same selection as cache_get_clean().
+ */
+static struct sim_block *sim_get_clean(struct sim_cache *sc)
+{
+	struct sim_block *b;
+	int scan_count;
+
+	if (sc->conf->replacement_mode == CACHE_REPLACEMENT_MODE_RANDOM) {
+		unsigned int id;
+
+		sc->random_value = (unsigned int)random();
+		id = sc->random_value % sc->nblocks;
+		for (scan_count = 0;
+		     scan_count < CACHE_REPLACEMENT_MODE_RANDOM_MAX_SCANS;
+		     scan_count++) {
+			b = &sc->blocks[id];
+			if (b->state == SIM_CLEAN)
+				return b;
+			sc->random_value =
+				sim_pseudo_random(sc->random_value);
+			id = sc->random_value % sc->nblocks;
+		}
+	} else if (!list_empty(&sc->valid_list)) {
+		b = list_first_entry(&sc->valid_list, struct sim_block, entry);
+		if (b->state == SIM_CLEAN)
+			return b;
+	}
+
+	/* last resort, the least recently used clean block */
+	if (!list_empty(&sc->clean_list))
+		return list_first_entry(&sc->clean_list,
+					struct sim_block,
+					cleandirty);
+	return NULL;
+}
+
+/*!
+ * Get an invalid block for a miss. As in the kernel, a clean block gets
+ * invalidated if there are no invalid blocks. If all blocks are dirty the
+ * request would be deferred until the bgwriter cleans one, which here is
+ * modeled by writing back the oldest dirty block right away.
+ */
+static struct sim_block *sim_get_invalid(struct sim_cache *sc)
+{
+	struct sim_block *b;
+
+	if (list_empty(&sc->invalid_list)) {
+		b = sim_get_clean(sc);
+		if (b == NULL) {
+			ASSERT(!list_empty(&sc->dirty_list));
+			b = list_first_entry(&sc->dirty_list,
+					     struct sim_block,
+					     cleandirty);
+			sim_move_to_clean(sc, b);
+			sc->st.stalls++;
+		}
+		sim_invalidate(sc, b);
+	}
+	b = list_first_entry(&sc->invalid_list, struct sim_block, entry);
+	list_del_init(&b->entry);
+	return b;
+}
+
+/*!
+ * One iteration of the bgwriter loop, elapsed_ms after the previous one.
+ * Writebacks are started at the rate allowed by the current queue depth,
+ * each one taking writeback_latency_usecs to complete, further limited by
+ * the policy rate limit and the minimum block age.
+ */
+static void sim_bgwriter(struct sim_cache *sc, unsigned long elapsed_ms)
+{
+	struct bittern_cache *bc = &sc->bc;
+	unsigned int queue_depth, started = 0;
+	double credit;
+
+	cache_bgwriter_compute_policy_slow(bc);
+
+	queue_depth = bc->bc_bgwriter_curr_queue_depth;
+	credit = (double)queue_depth * elapsed_ms * 1000.0 /
+		 sc->conf->writeback_latency_usecs;
+	if (bc->bc_bgwriter_curr_rate_per_sec > 0) {
+		double rate_credit = (double)bc->bc_bgwriter_curr_rate_per_sec *
+				     elapsed_ms / 1000.0;
+
+		if (rate_credit < credit)
+			credit = rate_credit;
+	}
+	sc->wb_credit += credit;
+
+	while (sc->wb_credit >= 1.0 && !list_empty(&sc->dirty_list)) {
+		struct sim_block *b;
+		unsigned long age_secs;
+
+		b = list_first_entry(&sc->dirty_list,
+				     struct sim_block,
+				     cleandirty);
+		age_secs = jiffies_to_secs(jiffies - b->last_modify);
+		if (age_secs < bc->bc_bgwriter_curr_min_age_secs)
+			break;
+		sim_move_to_clean(sc, b);
+		sc->wb_credit -= 1.0;
+		started++;
+	}
+	/* unused credit does not carry over */
+	if (sc->wb_credit >= 1.0)
+		sc->wb_credit = 0.0;
+
+	/* writebacks in flight, as seen by the policies */
+	if (elapsed_ms > 0)
+		started = ((uint64_t)started *
+			   sc->conf->writeback_latency_usecs) /
+			  (elapsed_ms * 1000);
+	if (started > queue_depth)
+		started = queue_depth;
+	atomic_set(&bc->bc_pending_writeback_requests, started);
+	atomic_set(&bc->bc_pending_requests, started);
+}
+
+static void sim_sample(struct sim_cache *sc)
+{
+	struct bittern_cache *bc = &sc->bc;
+	struct sim_stats *st = &sc->st, *prev = &sc->st_sample;
+	uint64_t hits, misses;
+
+	hits = (st->read_hits - prev->read_hits) +
+	       (st->write_hits - prev->write_hits);
+	misses = (st->read_misses - prev->read_misses) +
+		 (st->write_misses - prev->write_misses);
+	printf("bc_sim: timeline: secs=%lu dirty_pct=%" PRIu64 " hit_pct=%" PRIu64 " requests=%" PRIu64 " writebacks=%" PRIu64 " queue_depth=%u rate_per_sec=%u min_age_secs=%u\n",
+	       jiffies_to_secs(jiffies),
+	       T_PCT(sc->nblocks, sim_dirty(sc)),
+	       T_PCT(hits + misses, hits),
+	       st->requests - prev->requests,
+	       st->writebacks - prev->writebacks,
+	       bc->bc_bgwriter_curr_queue_depth,
+	       bc->bc_bgwriter_curr_rate_per_sec,
+	       bc->bc_bgwriter_curr_min_age_secs);
+	*prev = *st;
+}
+
+/*!
+ * Advance simulated time to now, running the bgwriter every millisecond
+ * while there are dirty blocks, the sequential detector timeout worker and
+ * the timeline sampling when due.
+ */
+static void sim_advance(struct sim_cache *sc, unsigned long now)
+{
+	struct bittern_cache *bc = &sc->bc;
+
+	while (sc->clock < now) {
+		unsigned long prev = sc->clock;
+		unsigned long next = now;
+
+		if (sim_dirty(sc) > 0)
+			next = prev + 1;
+		if (bc->bc_seq_work.pending &&
+		    bc->bc_seq_work.expires < next)
+			next = bc->bc_seq_work.expires > prev ?
+			       bc->bc_seq_work.expires : prev + 1;
+		if (sc->conf->interval_secs > 0 && sc->next_sample < next)
+			next = sc->next_sample > prev ?
+			       sc->next_sample : prev + 1;
+
+		sc->clock = next;
+		jiffies = next;
+		bc_sim_run_delayed_work(&bc->bc_seq_work);
+		if (sim_dirty(sc) > 0)
+			sim_bgwriter(sc, next - prev);
+		if (sc->conf->interval_secs > 0 &&
+		    jiffies >= sc->next_sample) {
+			sim_sample(sc);
+			sc->next_sample += sc->conf->interval_secs * 1000UL;
+		}
+	}
+}
+
+/*!
+ * Handle a single cache block sized bio, same flow as cache_map_workfunc().
+ */
+static void sim_map(struct sim_cache *sc, struct bio *bio)
+{
+	struct bittern_cache *bc = &sc->bc;
+	struct seq_io_bypass *bsi;
+	struct sim_block *b;
+	uint64_t bblock;
+	int do_bypass;
+
+	do_bypass = seq_bypass_is_sequential(bc, bio);
+	bsi = bio_data_dir(bio) == WRITE ? &bc->bc_seq_write : &bc->bc_seq_read;
+	if (do_bypass)
+		atomic_inc(&bsi->seq_io_count);
+	else
+		atomic_inc(&bsi->non_seq_io_count);
+
+	bblock = bio->bi_iter.bi_sector / SECTORS_PER_CACHE_BLOCK;
+	b = sim_lookup(sc, bblock);
+	if (b != NULL) {
+		if (sc->conf->replacement_mode == CACHE_REPLACEMENT_MODE_LRU) {
+			list_del_init(&b->entry);
+			list_add_tail(&b->entry, &sc->valid_list);
+		}
+		list_del_init(&b->cleandirty);
+		if (bio_data_dir(bio) == WRITE) {
+			sc->st.write_hits++;
+			if (is_cache_mode_writeback(bc)) {
+				if (b->state == SIM_CLEAN)
+					sim_move_to_dirty(sc, b);
+				b->last_modify = jiffies;
+			} else {
+				sc->st.writethrus++;
+			}
+		} else {
+			sc->st.read_hits++;
+			if (do_bypass)
+				atomic_inc(&bsi->bypass_hit);
+		}
+		list_add_tail(&b->cleandirty,
+			      b->state == SIM_CLEAN ?
+			      &sc->clean_list : &sc->dirty_list);
+		return;
+	}
+
+	if (bio_data_dir(bio) == WRITE)
+		sc->st.write_misses++;
+	else
+		sc->st.read_misses++;
+
+	if (do_bypass) {
+		atomic_inc(&bsi->bypass_count);
+		if (bio_data_dir(bio) == WRITE)
+			sc->st.write_bypass++;
+		else
+			sc->st.read_bypass++;
+		return;
+	}
+
+	/*
+	 * a read miss queues on the cached device behind the writebacks
+	 * in flight, which is what the latency-feedback policy controls
+	 */
+	if (bio_data_dir(bio) == READ)
+		sim_timer_add(&bc->bc_timer_read_misses,
+			      (uint64_t)sc->conf->writeback_latency_usecs *
+			      (1 + atomic_read(
+				&bc->bc_pending_writeback_requests)));
+
+	b = sim_get_invalid(sc);
+	ASSERT(b->state == SIM_INVALID);
+	b->bblock = bblock;
+	b->last_modify = jiffies;
+	b->state = SIM_CLEAN;
+	sim_hash_insert(sc, b);
+	list_add_tail(&b->entry, &sc->valid_list);
+	if (bio_data_dir(bio) == WRITE && is_cache_mode_writeback(bc)) {
+		sim_move_to_dirty(sc, b);
+		list_add_tail(&b->cleandirty, &sc->dirty_list);
+	} else {
+		if (bio_data_dir(bio) == WRITE)
+			sc->st.writethrus++;
+		list_add_tail(&b->cleandirty, &sc->clean_list);
+	}
+}
+
+/*!
+ * Split a trace record in cache block sized bios, as device mapper does
+ * for bittern, and map each of them.
+ */
+static void sim_request(struct sim_cache *sc, const struct sim_record *r)
+{
+	struct bio bio;
+	sector_t sector = r->sector;
+	uint64_t remaining = r->bytes;
+
+	bc_sim_current.pid = r->pid;
+	bio.bi_rw = r->dir;
+	while (remaining > 0) {
+		uint64_t len;
+
+		len = (SECTORS_PER_CACHE_BLOCK -
+		       (sector % SECTORS_PER_CACHE_BLOCK)) * SECTOR_SIZE;
+		if (len > remaining)
+			len = remaining;
+		bio.bi_iter.bi_sector = sector;
+		bio.bi_iter.bi_size = len;
+		sim_map(sc, &bio);
+		sector += len / SECTOR_SIZE;
+		remaining -= len;
+	}
+	sc->st.requests++;
+	sc->st.dirty_sum += sim_dirty(sc);
+}
+
+static int sim_cache_init(struct sim_cache *sc, const struct sim_conf *conf)
+{
+	struct bittern_cache *bc = &sc->bc;
+	unsigned int i, hash_size;
+	int ret;
+
+	memset(sc, 0, sizeof(*sc));
+	sc->conf = conf;
+	sc->nblocks = (uint64_t)conf->cache_mbytes * 1024 * 1024 /
+		      CACHE_BLOCK_SIZE;
+	for (hash_size = 1; hash_size < sc->nblocks; hash_size <<= 1)
+		;
+	sc->hash_mask = hash_size - 1;
+	sc->blocks = calloc(sc->nblocks, sizeof(*sc->blocks));
+	sc->hash = calloc(hash_size, sizeof(*sc->hash));
+	if (sc->blocks == NULL || sc->hash == NULL) {
+		fprintf(stderr, "bc_sim: error: cannot allocate %u blocks\n",
+			sc->nblocks);
+		return -ENOMEM;
+	}
+	INIT_LIST_HEAD(&sc->invalid_list);
+	INIT_LIST_HEAD(&sc->valid_list);
+	INIT_LIST_HEAD(&sc->clean_list);
+	INIT_LIST_HEAD(&sc->dirty_list);
+	for (i = 0; i < sc->nblocks; i++) {
+		INIT_LIST_HEAD(&sc->blocks[i].cleandirty);
+		list_add_tail(&sc->blocks[i].entry, &sc->invalid_list);
+	}
+	srandom(conf->seed);
+
+	bc->bc_magic1 = BC_MAGIC1;
+	bc->bc_magic4 = BC_MAGIC4;
+	snprintf(bc->bc_name, sizeof(bc->bc_name), "bc_sim");
+	bc->bc_cache_mode_writeback = conf->writeback;
+	atomic_set(&bc->bc_total_entries, sc->nblocks);
+	bc->bc_max_pending_requests = conf->max_pending_requests;
+	if (bc->bc_max_pending_requests < CACHE_MAX_PENDING_REQUESTS_MIN)
+		bc->bc_max_pending_requests = CACHE_MAX_PENDING_REQUESTS_MIN;
+	if (bc->bc_max_pending_requests > CACHE_MAX_PENDING_REQUESTS_MAX)
+		bc->bc_max_pending_requests = CACHE_MAX_PENDING_REQUESTS_MAX;
+	if (bc->bc_max_pending_requests > sc->nblocks / 10)
+		bc->bc_max_pending_requests = sc->nblocks / 10;
+	bc->bc_bgwriter_conf_cluster_size = CACHE_BGWRITER_DEFAULT_CLUSTER_SIZE;
+	bc->bc_bgwriter_conf_greedyness = 0;
+	bc->bc_bgwriter_conf_max_queue_depth_pct =
+		CACHE_BGWRITER_DEFAULT_QUEUE_DEPTH_PCT;
+	bc->bc_bgwriter_conf_latency_target_us =
+		CACHE_BGWRITER_DEFAULT_LATENCY_TARGET_US;
+	cache_bgwriter_policy_init(bc);
+	ret = cache_bgwriter_policy_set(bc, conf->policy);
+	if (ret < 0)
+		return ret;
+
+	ret = seq_bypass_initialize(bc);
+	if (ret < 0)
+		return ret;
+	set_read_bypass_enabled(bc, conf->seq_bypass_enabled);
+	set_write_bypass_enabled(bc, conf->seq_bypass_enabled);
+	seq_bypass_start_workqueue(bc);
+
+	return 0;
+}
+
+static void sim_cache_deinit(struct sim_cache *sc)
+{
+	if (sc->bc.bc_seq_workqueue != NULL) {
+		seq_bypass_stop_workqueue(&sc->bc);
+		seq_bypass_deinitialize(&sc->bc);
+	}
+	free(sc->blocks);
+	free(sc->hash);
+}
+
+static void sim_report(struct sim_cache *sc, double elapsed)
+{
+	struct sim_stats *st = &sc->st;
+	uint64_t hits = st->read_hits + st->write_hits;
+	uint64_t misses = st->read_misses + st->write_misses;
+	uint64_t dirty_avg = 0;
+
+	if (st->requests > 0)
+		dirty_avg = st->dirty_sum / st->requests;
+	printf("bc_sim: replacement=%s policy=%s mode=%s cache_mbytes=%u cache_blocks=%u requests=%" PRIu64 " read_hits=%" PRIu64 " read_misses=%" PRIu64 " write_hits=%" PRIu64 " write_misses=%" PRIu64 " read_hit_pct=%" PRIu64 " write_hit_pct=%" PRIu64 " hit_pct=%" PRIu64 ".%02" PRIu64 " read_bypass=%" PRIu64 " write_bypass=%" PRIu64 " invalidations=%" PRIu64 " stalls=%" PRIu64 " writebacks=%" PRIu64 " writeback_mbytes=%" PRIu64 " writethrus=%" PRIu64 " dirty_pct_avg=%" PRIu64 " dirty_pct_max=%" PRIu64 " dirty_pct_end=%" PRIu64 " sim_secs=%.3f sim_requests_per_sec=%.0f\n",
+	       sim_replacement_modes[sc->conf->replacement_mode],
+	       sc->conf->policy,
+	       sc->conf->writeback ? "writeback" : "writethrough",
+	       sc->conf->cache_mbytes,
+	       sc->nblocks,
+	       st->requests,
+	       st->read_hits,
+	       st->read_misses,
+	       st->write_hits,
+	       st->write_misses,
+	       T_PCT(st->read_hits + st->read_misses, st->read_hits),
+	       T_PCT(st->write_hits + st->write_misses, st->write_hits),
+	       T_PCT(hits + misses, hits),
+	       T_PCT_F100(hits + misses, hits),
+	       st->read_bypass,
+	       st->write_bypass,
+	       st->invalidations,
+	       st->stalls,
+	       st->writebacks,
+	       st->writebacks * CACHE_BLOCK_SIZE / (1024 * 1024),
+	       st->writethrus,
+	       T_PCT(sc->nblocks, dirty_avg),
+	       T_PCT(sc->nblocks, st->dirty_max),
+	       T_PCT(sc->nblocks, sim_dirty(sc)),
+	       elapsed,
+	       elapsed > 0.0 ? st->requests / elapsed : 0.0);
+}
+
+static double sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sim_run(const struct sim_trace *trace, const struct sim_conf *conf)
+{
+	struct sim_cache sc;
+	uint64_t ts_base;
+	double start;
+	size_t i;
+	int ret;
+
+	jiffies = 0;
+	ret = sim_cache_init(&sc, conf);
+	if (ret < 0) {
+		sim_cache_deinit(&sc);
+		return ret;
+	}
+	sc.next_sample = conf->interval_secs * 1000UL;
+
+	start = sim_now();
+	ts_base = trace->count > 0 ? trace->records[0].ts_usecs : 0;
+	for (i = 0; i < trace->count; i++) {
+		const struct sim_record *r = &trace->records[i];
+
+		sim_advance(&sc, (r->ts_usecs - ts_base) / 1000);
+		sim_request(&sc, r);
+	}
+	if (conf->interval_secs > 0 && sc.st.requests != sc.st_sample.requests)
+		sim_sample(&sc);
+	sim_report(&sc, sim_now() - start);
+	if (bc_sim_verbose) {
+		char buf[PAGE_SIZE * 2];
+
+		seq_bypass_stats(&sc.bc, buf, sizeof(buf));
+		fputs(buf, stdout);
+	}
+
+	sim_cache_deinit(&sc);
+	return 0;
+}
+
+static int sim_trace_add(struct sim_trace *trace,
+			 uint64_t ts_usecs,
+			 pid_t pid,
+			 int dir,
+			 uint64_t sector,
+			 uint32_t bytes)
+{
+	struct sim_record *r;
+
+	if (trace->count == trace->size) {
+		size_t size = trace->size ? trace->size * 2 : 1024 * 1024;
+
+		r = realloc(trace->records, size * sizeof(*r));
+		if (r == NULL)
+			return -ENOMEM;
+		trace->records = r;
+		trace->size = size;
+	}
+	r = &trace->records[trace->count];
+	r->ts_usecs = ts_usecs;
+	r->pid = pid;
+	r->dir = dir;
+	r->sector = sector;
+	r->bytes = bytes;
+	r->seq = trace->count;
+	trace->count++;
+	return 0;
+}
+
+/*! parse "timestamp_usecs,pid,R|W,sector,bytes" */
+static int sim_parse_csv(struct sim_trace *trace, const char *line)
+{
+	uint64_t ts_usecs, sector;
+	unsigned int bytes;
+	int pid;
+	char op;
+
+	if (sscanf(line, "%" SCNu64 ",%d,%c,%" SCNu64 ",%u",
+		   &ts_usecs, &pid, &op, &sector, &bytes) != 5)
+		return 0;
+	if (op == 'R' || op == 'r')
+		return sim_trace_add(trace, ts_usecs, pid, READ,
+				     sector, bytes) ?: 1;
+	if (op == 'W' || op == 'w')
+		return sim_trace_add(trace, ts_usecs, pid, WRITE,
+				     sector, bytes) ?: 1;
+	return 0;
+}
+
+/*!
+ * parse default blkparse output, e.g.
+ * "  8,0    3        1     0.000000000  4162  Q  WS 3418216 + 8 [jbd2]"
+ */
+static int sim_parse_blkparse(struct sim_trace *trace, const char *line)
+{
+	unsigned int major, minor, cpu, seq, sectors;
+	double ts_secs;
+	int pid, dir;
+	char action[8], rwbs[8];
+	uint64_t sector;
+
+	if (sscanf(line, "%u,%u %u %u %lf %d %7s %7s %" SCNu64 " + %u",
+		   &major, &minor, &cpu, &seq, &ts_secs, &pid,
+		   action, rwbs, &sector, &sectors) != 10)
+		return 0;
+	if (strcmp(action, "Q") != 0 || strchr(rwbs, 'D') != NULL)
+		return 0;
+	if (strchr(rwbs, 'W') != NULL)
+		dir = WRITE;
+	else if (strchr(rwbs, 'R') != NULL)
+		dir = READ;
+	else
+		return 0;
+	return sim_trace_add(trace, (uint64_t)(ts_secs * 1e6), pid, dir,
+			     sector, sectors * SECTOR_SIZE) ?: 1;
+}
+
+static int sim_record_compare(const void *a, const void *b)
+{
+	const struct sim_record *ra = a, *rb = b;
+
+	if (ra->ts_usecs != rb->ts_usecs)
+		return ra->ts_usecs < rb->ts_usecs ? -1 : 1;
+	return ra->seq < rb->seq ? -1 : (ra->seq > rb->seq);
+}
+
+static int sim_load(struct sim_trace *trace, const char *path)
+{
+	char line[1024];
+	FILE *f;
+	bool sorted = true;
+	size_t i;
+
+	f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "bc_sim: error: cannot open %s: %s\n",
+			path, strerror(errno));
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		int ret;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		ret = sim_parse_csv(trace, line);
+		if (ret == 0)
+			ret = sim_parse_blkparse(trace, line);
+		if (ret < 0) {
+			fprintf(stderr, "bc_sim: error: out of memory\n");
+			if (f != stdin)
+				fclose(f);
+			return ret;
+		}
+		if (ret == 0)
+			trace->skipped++;
+	}
+	if (f != stdin)
+		fclose(f);
+
+	/* blkparse output is merged from per-cpu buffers */
+	for (i = 1; i < trace->count; i++) {
+		if (trace->records[i].ts_usecs <
+		    trace->records[i - 1].ts_usecs) {
+			sorted = false;
+			break;
+		}
+	}
+	if (!sorted)
+		qsort(trace->records, trace->count, sizeof(*trace->records),
+		      sim_record_compare);
+	return 0;
+}
+
+static void usage(void)
+{
+	int i;
+
+	printf("bc_sim: usage: bc_sim [-s|--size <cache-mbytes>] ");
+	printf("[-r|--replacement fifo|lru|random|all] ");
+	printf("[-p|--policy <bgwriter-policy>|all] ");
+	printf("[-m|--mode writeback|writethrough] ");
+	printf("[-q|--max-pending <requests>] ");
+	printf("[-l|--writeback-latency <usecs>] ");
+	printf("[-i|--interval <secs>] [-S|--no-sequential-bypass] ");
+	printf("[-R|--seed <seed>] [-v|--verbose] <trace-file>|-\n");
+	printf("bc_sim: bgwriter policies:");
+	for (i = 0; i < ARRAY_SIZE(sim_policies); i++)
+		printf(" %s", sim_policies[i]);
+	printf("\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"size", required_argument, 0, 's'},
+		{"replacement", required_argument, 0, 'r'},
+		{"policy", required_argument, 0, 'p'},
+		{"mode", required_argument, 0, 'm'},
+		{"max-pending", required_argument, 0, 'q'},
+		{"writeback-latency", required_argument, 0, 'l'},
+		{"interval", required_argument, 0, 'i'},
+		{"no-sequential-bypass", no_argument, 0, 'S'},
+		{"seed", required_argument, 0, 'R'},
+		{"verbose", no_argument, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+	struct sim_conf conf = {
+		.replacement_mode = CACHE_REPLACEMENT_MODE_DEFAULT,
+		.policy = CACHE_BGWRITER_DEFAULT_POLICY,
+		.writeback = 1,
+		.cache_mbytes = 1024,
+		.max_pending_requests = CACHE_MAX_PENDING_REQUESTS_DEFAULT,
+		.writeback_latency_usecs = 5000,
+		.interval_secs = 60,
+		.seq_bypass_enabled = SEQ_IO_BYPASS_ENABLED_DEFAULT,
+		.seed = 1,
+	};
+	struct sim_trace trace = { NULL, 0, 0, 0 };
+	bool all_modes = false, all_policies = false;
+	int mode, p, c, ret = 0;
+
+	for (;;) {
+		int option_index = 0;
+
+		c = getopt_long(argc, argv, "s:r:p:m:q:l:i:SR:v", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 's':
+			conf.cache_mbytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			if (strcmp(optarg, "all") == 0) {
+				all_modes = true;
+				break;
+			}
+			for (mode = CACHE_REPLACEMENT_MODE_FIFO;
+			     mode <= CACHE_REPLACEMENT_MODE_RANDOM;
+			     mode++)
+				if (strcmp(optarg,
+					   sim_replacement_modes[mode]) == 0)
+					break;
+			if (mode > CACHE_REPLACEMENT_MODE_RANDOM)
+				usage();
+			conf.replacement_mode = mode;
+			break;
+		case 'p':
+			if (strcmp(optarg, "all") == 0) {
+				all_policies = true;
+				break;
+			}
+			for (p = 0; p < ARRAY_SIZE(sim_policies); p++)
+				if (strcmp(optarg, sim_policies[p]) == 0)
+					break;
+			if (p == ARRAY_SIZE(sim_policies))
+				usage();
+			conf.policy = sim_policies[p];
+			break;
+		case 'm':
+			if (strcmp(optarg, "writeback") == 0)
+				conf.writeback = 1;
+			else if (strcmp(optarg, "writethrough") == 0)
+				conf.writeback = 0;
+			else
+				usage();
+			break;
+		case 'q':
+			conf.max_pending_requests = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			conf.writeback_latency_usecs = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			conf.interval_secs = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			conf.seq_bypass_enabled = 0;
+			break;
+		case 'R':
+			conf.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			bc_sim_verbose++;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+	if (conf.cache_mbytes == 0 || conf.writeback_latency_usecs == 0)
+		usage();
+
+	ret = sim_load(&trace, argv[optind]);
+	if (ret < 0)
+		return 1;
+	printf("bc_sim: trace=%s records=%zu skipped_lines=%zu\n",
+	       argv[optind], trace.count, trace.skipped);
+
+	for (mode = CACHE_REPLACEMENT_MODE_FIFO;
+	     mode <= CACHE_REPLACEMENT_MODE_RANDOM;
+	     mode++) {
+		if (!all_modes && mode != conf.replacement_mode)
+			continue;
+		for (p = 0; p < ARRAY_SIZE(sim_policies); p++) {
+			struct sim_conf run_conf = conf;
+
+			if (!all_policies &&
+			    strcmp(sim_policies[p], conf.policy) != 0)
+				continue;
+			run_conf.replacement_mode = mode;
+			run_conf.policy = sim_policies[p];
+			if (sim_run(&trace, &run_conf) < 0)
+				ret = 1;
+		}
+	}
+
+	free(trace.records);
+	return ret;
+}
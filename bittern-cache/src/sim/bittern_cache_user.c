@@ -0,0 +1,77 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <stdarg.h>
+
+#include "bittern_cache_user.h"
+
+int bc_sim_verbose;
+unsigned long jiffies;
+struct task_struct bc_sim_current;
+
+struct workqueue_struct *alloc_workqueue(const char *fmt,
+					 unsigned int flags,
+					 int max_active,
+					 ...)
+{
+	struct workqueue_struct *wq;
+	va_list ap;
+
+	wq = calloc(1, sizeof(*wq));
+	if (wq == NULL)
+		return NULL;
+	va_start(ap, max_active);
+	vsnprintf(wq->name, sizeof(wq->name), fmt, ap);
+	va_end(ap);
+	return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	free(wq);
+}
+
+void flush_workqueue(struct workqueue_struct *wq)
+{
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	if (dwork->pending)
+		return false;
+	dwork->expires = jiffies + delay;
+	dwork->pending = true;
+	return true;
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+	bool was_pending = dwork->pending;
+
+	dwork->pending = false;
+	return was_pending;
+}
+
+void bc_sim_run_delayed_work(struct delayed_work *dwork)
+{
+	if (!dwork->pending || jiffies < dwork->expires)
+		return;
+	/* the worker may reschedule itself */
+	dwork->pending = false;
+	dwork->work.func(&dwork->work);
+}
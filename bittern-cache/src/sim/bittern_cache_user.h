@@ -0,0 +1,430 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+/*
+ * Userspace replacement for bittern_cache.h, used to build the kernel
+ * policy code (sequential access detection and bgwriter policies) into
+ * the trace driven simulator.
+ *
+ * Only the subset of the kernel API and of struct bittern_cache which is
+ * used by those files is provided here. Locks are no-ops, as the simulator
+ * is single threaded. Time (jiffies) and the current pid are driven by the
+ * trace being replayed, and delayed work is run by the simulator when due.
+ *
+ * struct seq_io_stream and struct seq_io_bypass must be kept in sync with
+ * bittern_cache.h .
+ */
+
+#ifndef BITTERN_CACHE_USER_H
+#define BITTERN_CACHE_USER_H
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef uint64_t sector_t;
+
+#define PAGE_SIZE 4096
+#define SECTOR_SIZE 512
+#define KBYTES_TO_SECTORS(__kb) (((__kb) * 1024) / SECTOR_SIZE)
+#define MBYTES_TO_SECTORS(__mb) (((__mb) * 1024 * 1024) / SECTOR_SIZE)
+
+#define ARRAY_SIZE(__a) (sizeof(__a) / sizeof((__a)[0]))
+
+#define container_of(__ptr, __type, __member) \
+	((__type *)((char *)(__ptr) - offsetof(__type, __member)))
+
+/*
+ * printk
+ */
+extern int bc_sim_verbose;
+
+#define printk_err(__fmt, ...) \
+	fprintf(stderr, "%s: " __fmt, __func__, ##__VA_ARGS__)
+#define printk_info(__fmt, ...) do {					\
+	if (bc_sim_verbose)						\
+		fprintf(stderr, "%s: " __fmt, __func__, ##__VA_ARGS__);	\
+} while (0)
+#define printk_debug(__fmt, ...) do {					\
+	if (bc_sim_verbose > 1)						\
+		fprintf(stderr, "%s: " __fmt, __func__, ##__VA_ARGS__);	\
+} while (0)
+
+#define M_ASSERT(__assert_expr__) assert(__assert_expr__)
+#define ASSERT(__assert_expr__) assert(__assert_expr__)
+
+#define BT_LEVEL_TRACE0 3
+#define BT_LEVEL_TRACE1 4
+#define BT_LEVEL_TRACE2 5
+#define BT_LEVEL_TRACE3 6
+#define BT_LEVEL_TRACE4 7
+#define BT_TRACE(__level, __bc, __wi, __cache_block, __original_bio, __cloned_bio, __printf_args...) (void)0
+
+/*! same semantics as dm's DMEMIT, caller needs result, sz and maxlen */
+#define DMEMIT(__fmt, ...) do {						\
+	if (sz < maxlen)						\
+		sz += snprintf(result + sz, maxlen - sz,		\
+			       __fmt, ##__VA_ARGS__);			\
+	if (sz > maxlen)						\
+		sz = maxlen;						\
+} while (0)
+
+/*
+ * atomics and locks, simulator is single threaded
+ */
+typedef struct {
+	int counter;
+} atomic_t;
+
+#define atomic_read(__v) ((__v)->counter)
+#define atomic_set(__v, __i) ((__v)->counter = (__i))
+#define atomic_inc(__v) ((__v)->counter++)
+#define atomic_dec(__v) ((__v)->counter--)
+#define atomic_add(__i, __v) ((__v)->counter += (__i))
+#define atomic_sub(__i, __v) ((__v)->counter -= (__i))
+
+typedef int spinlock_t;
+
+#define spin_lock_init(__lock) (*(__lock) = 0)
+#define spin_lock_irqsave(__lock, __flags) ((void)(__lock), (__flags) = 0)
+#define spin_unlock_irqrestore(__lock, __flags) \
+	((void)(__lock), (void)(__flags))
+
+#define div_u64(__dividend, __divisor) \
+	((uint64_t)(__dividend) / (uint32_t)(__divisor))
+
+/*! same layout as bittern_cache_timer.h, updated by bc_sim.c */
+struct cache_timer {
+	spinlock_t bct_spinlock;
+	uint64_t bct_sum_nsec;
+	uint64_t bct_avg_nsec;
+	uint64_t bct_max_nsec;
+	uint64_t bct_count;
+	uint64_t bct_timewarp;
+};
+
+/*
+ * doubly linked lists, same semantics as linux/list.h
+ */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new,
+			      struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(__ptr, __type, __member) \
+	container_of(__ptr, __type, __member)
+#define list_first_entry(__list, __type, __member) \
+	list_entry((__list)->next, __type, __member)
+#define list_tail(__list, __type, __member) \
+	list_entry((__list)->prev, __type, __member)
+#define list_non_empty(__list) (!list_empty(__list))
+#define list_for_each_entry(__pos, __head, __member)			\
+	for (__pos = list_entry((__head)->next, typeof(*__pos), __member); \
+	     &__pos->__member != (__head);				\
+	     __pos = list_entry(__pos->__member.next, typeof(*__pos), __member))
+
+/*
+ * time, HZ is 1000 so a jiffy is a millisecond of trace time
+ */
+extern unsigned long jiffies;
+
+#define jiffies_to_msecs(__jiffies) ((unsigned int)(__jiffies))
+#define msecs_to_jiffies(__msecs) ((unsigned long)(__msecs))
+#define jiffies_to_secs(__jiffies) \
+	((unsigned long)(jiffies_to_msecs(__jiffies)) / 1000UL)
+
+/*
+ * current task, its pid is the one of the trace record being replayed
+ */
+struct task_struct {
+	pid_t pid;
+};
+
+extern struct task_struct bc_sim_current;
+
+#define get_current() (&bc_sim_current)
+
+/*
+ * workqueues, delayed work is run by bc_sim_run_delayed_work()
+ */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+};
+
+struct delayed_work {
+	struct work_struct work;
+	unsigned long expires;
+	bool pending;
+};
+
+struct workqueue_struct {
+	char name[64];
+};
+
+#define WQ_MEM_RECLAIM 0
+
+#define to_delayed_work(__work) \
+	container_of(__work, struct delayed_work, work)
+#define INIT_DELAYED_WORK(__dwork, __func) do {				\
+	(__dwork)->work.func = (__func);				\
+	(__dwork)->pending = false;					\
+} while (0)
+
+extern struct workqueue_struct *alloc_workqueue(const char *fmt,
+						unsigned int flags,
+						int max_active,
+						...);
+extern void destroy_workqueue(struct workqueue_struct *wq);
+extern void flush_workqueue(struct workqueue_struct *wq);
+extern bool schedule_delayed_work(struct delayed_work *dwork,
+				  unsigned long delay);
+extern bool cancel_delayed_work(struct delayed_work *dwork);
+/*! run delayed work if it is due at the current value of jiffies */
+extern void bc_sim_run_delayed_work(struct delayed_work *dwork);
+
+/*
+ * bio, only what the sequential detector needs
+ */
+#define READ 0
+#define WRITE 1
+
+struct bvec_iter {
+	sector_t bi_sector;
+	unsigned int bi_size;
+};
+
+struct bio {
+	struct bvec_iter bi_iter;
+	unsigned long bi_rw;
+};
+
+#define bio_data_dir(__bio) ((__bio)->bi_rw & 1)
+
+#include "bittern_cache_tunables.h"
+
+#define PERCENT_OF(_a, _b) ({ ((_a) * 100) / (_b); })
+
+/* gives integer percentage of __part over __total */
+#define T_PCT(__total, __part) ({				\
+		uint64_t total = (__total);			\
+		uint64_t part = (__part);			\
+		uint64_t r = 0;					\
+		if (total) {					\
+			r = (part * 100) / (total);		\
+		}						\
+		r;						\
+})
+/* gives first two digits after decimal of percentage of __part over __total */
+#define T_PCT_F100(__total, __part) ({				\
+		uint64_t total = (__total);			\
+		uint64_t part = (__part);			\
+		uint64_t r = 0;					\
+		if (total) {					\
+			r = (part * 100 * 100) / (total);	\
+			r = r % 100;				\
+		}						\
+		r;						\
+})
+
+#define BC_MAGIC1 0xf10c7a93
+#define BC_MAGIC4 0xf10c85a7
+
+#define BC_NAMELEN 128
+
+#define BCSIO_MAGIC 0xf10c1234
+
+/*
+ * sequential i/o bypass, see bittern_cache.h
+ */
+struct seq_io_stream {
+	struct list_head list_entry;
+	int magic;
+	sector_t last_sector;
+	unsigned int sector_count;
+	pid_t stream_pid;
+	unsigned long timestamp_ms;
+};
+
+struct seq_io_bypass {
+	/* counters */
+	atomic_t seq_io_count;
+	atomic_t non_seq_io_count;
+	atomic_t bypass_count;
+	atomic_t bypass_hit;
+	/* superuser tunables */
+	unsigned int bypass_threshold;
+	unsigned int bypass_timeout;
+	bool bypass_enabled;
+	/* internal stuff */
+	spinlock_t seq_lock;
+	unsigned int streams_count;
+	unsigned int streams_count_max;
+	uint64_t s_streams_len_sum;
+	uint64_t s_streams_len_count;
+	unsigned int s_streams_len_max;
+	uint64_t ns_streams_len_sum;
+	uint64_t ns_streams_len_count;
+	unsigned int ns_streams_len_max;
+	struct list_head streams_lru;
+	struct seq_io_stream streams_array[SEQ_IO_TRACK_DEPTH];
+	uint64_t lru_hit_depth_sum;
+	uint64_t lru_hit_depth_count;
+};
+
+/*!
+ * Subset of the kernel struct bittern_cache. Field names and types are the
+ * same as in bittern_cache.h, so the policy code builds unchanged.
+ */
+struct bittern_cache {
+	unsigned int bc_magic1;
+	char bc_name[BC_NAMELEN];
+	volatile int bc_cache_mode_writeback;
+	/* request counters, inputs to the bgwriter policies */
+	atomic_t bc_deferred_requests;
+	atomic_t bc_pending_requests;
+	atomic_t bc_pending_writeback_requests;
+	volatile unsigned int bc_max_pending_requests;
+	atomic_t bc_valid_entries_dirty;
+	atomic_t bc_total_entries;
+	/* bgwriter policy outputs */
+	unsigned int bc_bgwriter_curr_queue_depth;
+	unsigned int bc_bgwriter_curr_max_queue_depth;
+	unsigned int bc_bgwriter_curr_rate_per_sec;
+	unsigned int bc_bgwriter_curr_min_age_secs;
+	unsigned long bc_bgwriter_curr_policy[8];
+	/* bgwriter tunables */
+	volatile unsigned int bc_bgwriter_conf_policy;
+	volatile unsigned int bc_bgwriter_active_policy;
+	volatile unsigned int bc_bgwriter_conf_cluster_size;
+	volatile int bc_bgwriter_conf_greedyness;
+	volatile unsigned int bc_bgwriter_conf_max_queue_depth_pct;
+	volatile unsigned int bc_bgwriter_conf_latency_target_us;
+	/* latency timers, inputs to the latency-feedback policy */
+	struct cache_timer bc_timer_read_misses;
+	struct cache_timer bc_timer_cached_device_writes;
+	/* sequential access detection */
+	struct seq_io_bypass bc_seq_read;
+	struct seq_io_bypass bc_seq_write;
+	struct workqueue_struct *bc_seq_workqueue;
+	struct delayed_work bc_seq_work;
+	unsigned int bc_magic4;
+};
+
+#define ASSERT_BITTERN_CACHE(__bc) ({				\
+	ASSERT((__bc)->bc_magic1 == BC_MAGIC1);			\
+	ASSERT((__bc)->bc_magic4 == BC_MAGIC4);			\
+})
+
+static inline bool is_cache_mode_writeback(struct bittern_cache *bc)
+{
+	ASSERT(bc->bc_cache_mode_writeback == 0 ||
+	       bc->bc_cache_mode_writeback == 1);
+	return bc->bc_cache_mode_writeback != 0;
+}
+
+static inline bool is_cache_mode_writethru(struct bittern_cache *bc)
+{
+	return !is_cache_mode_writeback(bc);
+}
+
+/*
+ * bittern_cache_sequential.c
+ */
+extern int seq_bypass_initialize(struct bittern_cache *bc);
+extern void seq_bypass_deinitialize(struct bittern_cache *bc);
+extern void seq_bypass_start_workqueue(struct bittern_cache *bc);
+extern void seq_bypass_stop_workqueue(struct bittern_cache *bc);
+extern int seq_bypass_is_sequential(struct bittern_cache *bc, struct bio *bio);
+extern int seq_bypass_stats(struct bittern_cache *bc,
+			    char *result,
+			    size_t maxlen);
+extern int set_read_bypass_enabled(struct bittern_cache *bc, int value);
+extern int read_bypass_enabled(struct bittern_cache *bc);
+extern int set_read_bypass_threshold(struct bittern_cache *bc, int value);
+extern int read_bypass_threshold(struct bittern_cache *bc);
+extern int set_read_bypass_timeout(struct bittern_cache *bc, int value);
+extern int read_bypass_timeout(struct bittern_cache *bc);
+extern int set_write_bypass_enabled(struct bittern_cache *bc, int value);
+extern int write_bypass_enabled(struct bittern_cache *bc);
+extern int set_write_bypass_threshold(struct bittern_cache *bc, int value);
+extern int write_bypass_threshold(struct bittern_cache *bc);
+extern int set_write_bypass_timeout(struct bittern_cache *bc, int value);
+extern int write_bypass_timeout(struct bittern_cache *bc);
+
+/*
+ * bittern_cache_bgwriter_policy.c
+ */
+extern const char *cache_bgwriter_policy(struct bittern_cache *bc);
+extern ssize_t cache_bgwriter_op_show_policy(struct bittern_cache *bc,
+					     char *result);
+extern ssize_t cache_bgwriter_op_show_policy_state(struct bittern_cache *bc,
+						   char *result,
+						   size_t maxlen);
+extern int cache_bgwriter_policy_set(struct bittern_cache *bc,
+				     const char *buf);
+extern void cache_bgwriter_policy_init(struct bittern_cache *bc);
+extern void cache_bgwriter_compute_policy_slow(struct bittern_cache *bc);
+extern void cache_bgwriter_compute_policy_fast(struct bittern_cache *bc);
+
+#endif /* BITTERN_CACHE_USER_H */
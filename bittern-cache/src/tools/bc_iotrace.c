@@ -0,0 +1,360 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*
+ * Binary I/O trace reader.
+ *
+ * Drains the iotrace rings of a cache thru debugfs, or reads a file of raw
+ * events previously saved with -o, and prints one csv line per event:
+ *
+ *   timestamp_usecs,pid,R|W,sector,bytes,outcome,transition,cpu,
+ *   queue_usecs,service_usecs
+ *
+ * The first five fields are the same as the bc_sim csv trace format, so the
+ * output of "bc_iotrace -u" can be replayed with bc_sim directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <assert.h>
+
+#include <math128.h>
+/* persistent cache states used by bittern_cache_states.h */
+#include "../bittern_cache_kmod/bittern_cache_pmem_header.h"
+#include "../bittern_cache_kmod/bittern_cache_states.h"
+#include "../bittern_cache_kmod/bittern_cache_iotrace.h"
+
+#define BC_DEBUGFS_PATH "/sys/kernel/debug/bittern"
+
+/*! events per read(2) call */
+#define BC_IOTRACE_READ_EVENTS 1024
+/*! milliseconds between drains in follow mode */
+#define BC_IOTRACE_FOLLOW_MSECS 100
+
+#define ULL_CAST(__x)                           ((unsigned long long)(__x))
+
+int bc_user_only_flag = 0;
+int bc_sort_flag = 0;
+int bc_follow_flag = 0;
+volatile sig_atomic_t bc_interrupted = 0;
+
+static const char *bc_outcome_str[] = {
+	[CACHE_IOTRACE_OUTCOME_NONE] = "none",
+	[CACHE_IOTRACE_OUTCOME_HIT] = "hit",
+	[CACHE_IOTRACE_OUTCOME_MISS] = "miss",
+	[CACHE_IOTRACE_OUTCOME_BYPASS] = "bypass",
+	[CACHE_IOTRACE_OUTCOME_WRITEBACK] = "writeback",
+	[CACHE_IOTRACE_OUTCOME_INVALIDATE] = "invalidate",
+	[CACHE_IOTRACE_OUTCOME_VERIFY] = "verify",
+};
+
+static const char *bc_transition_str[] = {
+	[TS_NONE] = "NONE",
+	[TS_READ_MISS_WTWB_CLEAN] = "READ_MISS_WTWB_CLEAN",
+	[TS_READ_HIT_WTWB_CLEAN] = "READ_HIT_WTWB_CLEAN",
+	[TS_READ_HIT_WB_DIRTY] = "READ_HIT_WB_DIRTY",
+	[TS_WRITE_MISS_WT] = "WRITE_MISS_WT",
+	[TS_WRITE_MISS_WB] = "WRITE_MISS_WB",
+	[TS_WRITE_HIT_WT] = "WRITE_HIT_WT",
+	[TS_P_WRITE_HIT_WT] = "P_WRITE_HIT_WT",
+	[TS_WRITE_HIT_WB_C2_DIRTY] = "WRITE_HIT_WB_C2_DIRTY",
+	[TS_P_WRITE_HIT_WB_C2_DIRTY] = "P_WRITE_HIT_WB_C2_DIRTY",
+	[TS_P_WRITE_HIT_WB_DIRTY] = "P_WRITE_HIT_WB_DIRTY",
+	[TS_WRITE_HIT_WB_DIRTY] = "WRITE_HIT_WB_DIRTY",
+	[TS_P_WRITE_MISS_WT] = "P_WRITE_MISS_WT",
+	[TS_P_WRITE_MISS_WB] = "P_WRITE_MISS_WB",
+	[TS_WRITEBACK_WB] = "WRITEBACK_WB",
+	[TS_WRITEBACK_INV_WB] = "WRITEBACK_INV_WB",
+	[TS_CLEAN_INVALIDATION_WTWB] = "CLEAN_INVALIDATION_WTWB",
+	[TS_DIRTY_INVALIDATION_WB] = "DIRTY_INVALIDATION_WB",
+	[TS_VERIFY_CLEAN_WTWB] = "VERIFY_CLEAN_WTWB",
+};
+
+static const char *bc_outcome_name(unsigned int outcome)
+{
+	if (outcome < sizeof(bc_outcome_str) / sizeof(bc_outcome_str[0]))
+		return bc_outcome_str[outcome];
+	return "unknown";
+}
+
+static const char *bc_transition_name(unsigned int transition)
+{
+	if (transition < __TS_NUM)
+		return bc_transition_str[transition];
+	return "UNKNOWN";
+}
+
+static int bc_is_user_event(const struct cache_iotrace_event *te)
+{
+	return te->te_outcome == CACHE_IOTRACE_OUTCOME_HIT ||
+	       te->te_outcome == CACHE_IOTRACE_OUTCOME_MISS ||
+	       te->te_outcome == CACHE_IOTRACE_OUTCOME_BYPASS;
+}
+
+static void bc_print_event(const struct cache_iotrace_event *te)
+{
+	if (bc_user_only_flag && !bc_is_user_event(te))
+		return;
+	printf("%llu,%u,%c,%llu,%u,%s,%s,%u,%u,%u\n",
+	       ULL_CAST(te->te_ts_started / 1000ULL),
+	       te->te_pid,
+	       te->te_dir == CACHE_IOTRACE_DIR_WRITE ? 'W' : 'R',
+	       ULL_CAST(te->te_sector),
+	       te->te_size,
+	       bc_outcome_name(te->te_outcome),
+	       bc_transition_name(te->te_transition),
+	       te->te_cpu,
+	       te->te_queue_usecs,
+	       te->te_service_usecs);
+}
+
+static int bc_event_compare(const void *a, const void *b)
+{
+	const struct cache_iotrace_event *ta = a, *tb = b;
+
+	if (ta->te_ts_started != tb->te_ts_started)
+		return ta->te_ts_started < tb->te_ts_started ? -1 : 1;
+	return 0;
+}
+
+static void bc_sigint(int sig)
+{
+	bc_interrupted = 1;
+}
+
+/*!
+ * Reads all events from fd, either writes them as is to raw_fd, or prints
+ * them (possibly after sorting). In follow mode keeps polling until
+ * interrupted.
+ */
+static int bc_drain(int fd, int raw_fd)
+{
+	const size_t esize = sizeof(struct cache_iotrace_event);
+	struct cache_iotrace_event *buf;
+	struct cache_iotrace_event *all = NULL;
+	size_t all_count = 0, all_size = 0;
+	size_t i;
+
+	buf = malloc(esize * BC_IOTRACE_READ_EVENTS);
+	if (buf == NULL) {
+		fprintf(stderr, "bc_iotrace: error: out of memory\n");
+		return 6;
+	}
+	while (!bc_interrupted) {
+		ssize_t c = read(fd, buf, esize * BC_IOTRACE_READ_EVENTS);
+		size_t n;
+
+		if (c < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "bc_iotrace: error: read: %s\n",
+				strerror(errno));
+			free(buf);
+			free(all);
+			return 6;
+		}
+		if (c == 0) {
+			if (!bc_follow_flag)
+				break;
+			fflush(stdout);
+			usleep(BC_IOTRACE_FOLLOW_MSECS * 1000);
+			continue;
+		}
+		if (c % esize != 0)
+			fprintf(stderr,
+				"bc_iotrace: warning: ignoring partial event\n");
+		n = c / esize;
+		if (raw_fd >= 0) {
+			if (write(raw_fd, buf, n * esize) != n * esize) {
+				fprintf(stderr,
+					"bc_iotrace: error: write: %s\n",
+					strerror(errno));
+				free(buf);
+				return 6;
+			}
+			continue;
+		}
+		if (!bc_sort_flag) {
+			for (i = 0; i < n; i++)
+				bc_print_event(&buf[i]);
+			continue;
+		}
+		if (all_count + n > all_size) {
+			struct cache_iotrace_event *p;
+
+			all_size = (all_count + n) * 2;
+			p = realloc(all, all_size * esize);
+			if (p == NULL) {
+				fprintf(stderr,
+					"bc_iotrace: error: out of memory\n");
+				free(buf);
+				free(all);
+				return 6;
+			}
+			all = p;
+		}
+		memcpy(&all[all_count], buf, n * esize);
+		all_count += n;
+	}
+	free(buf);
+
+	if (bc_sort_flag && all_count != 0) {
+		qsort(all, all_count, esize, bc_event_compare);
+		for (i = 0; i < all_count; i++)
+			bc_print_event(&all[i]);
+	}
+	free(all);
+	return 0;
+}
+
+void usage(void)
+{
+	printf("bc_iotrace: usage: bc_iotrace ");
+	printf("[-u|--user-only] [-s|--sort] [-F|--follow] ");
+	printf("[-o|--output <raw-file>] ");
+	printf("-c|--cache-name <cache-name> | -f|--file <raw-file>\n");
+	printf("bc_iotrace: -c drains %s/<cache-name>/iotrace\n",
+	       BC_DEBUGFS_PATH);
+	printf("bc_iotrace: -f reads raw events saved with -o\n");
+	printf("bc_iotrace: -o saves raw events instead of printing them\n");
+	printf("bc_iotrace: -u only prints user requests (for bc_sim)\n");
+	printf("bc_iotrace: -s sorts events by start time before printing\n");
+	printf("bc_iotrace: -F keeps draining until interrupted\n");
+	printf("bc_iotrace: event format version %d, %lu bytes\n",
+	       CACHE_IOTRACE_VERSION,
+	       (unsigned long)sizeof(struct cache_iotrace_event));
+	exit(1);
+}
+
+/*
+ * exit codes:
+ *  x > 0 && x < 5: usage error
+ *          x == 5: cannot open input or output file
+ *          x == 6: i/o error
+ */
+int main(int argc, char **argv)
+{
+	char path[256];
+	char *cache_name = NULL;
+	char *input_file = NULL;
+	char *output_file = NULL;
+	int fd, raw_fd = -1;
+	int ret;
+
+	assert(sizeof(struct cache_iotrace_event) == 40);
+
+	while (1) {
+		int c, option_index;
+		static struct option long_options[] = {
+			{ "cache-name", required_argument, 0, 'c', },
+			{ "file", required_argument, 0, 'f', },
+			{ "output", required_argument, 0, 'o', },
+			{ "user-only", no_argument, 0, 'u', },
+			{ "sort", no_argument, 0, 's', },
+			{ "follow", no_argument, 0, 'F', },
+			{ NULL, 0, 0, 0, },
+		};
+		c = getopt_long(argc, argv, "c:f:o:usF", long_options,
+				&option_index);
+		switch (c) {
+		case -1:
+			goto done_getopt;
+		case 'c':
+			cache_name = optarg;
+			break;
+		case 'f':
+			input_file = optarg;
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'u':
+			bc_user_only_flag = 1;
+			break;
+		case 's':
+			bc_sort_flag = 1;
+			break;
+		case 'F':
+			bc_follow_flag = 1;
+			break;
+		default:
+			usage();
+			/*NOTREACHED*/
+		}
+	}
+done_getopt:
+	if ((cache_name == NULL) == (input_file == NULL)) {
+		fprintf(stderr,
+			"bc_iotrace: error: need exactly one of -c and -f\n");
+		usage();
+		/*NOTREACHED*/
+	}
+	if (input_file != NULL && bc_follow_flag) {
+		fprintf(stderr, "bc_iotrace: error: -F needs -c\n");
+		usage();
+		/*NOTREACHED*/
+	}
+	if (output_file != NULL && (bc_sort_flag || bc_user_only_flag)) {
+		fprintf(stderr,
+			"bc_iotrace: error: -o cannot be used with -s or -u\n");
+		usage();
+		/*NOTREACHED*/
+	}
+
+	if (cache_name != NULL) {
+		snprintf(path, sizeof(path), "%s/%s/iotrace",
+			 BC_DEBUGFS_PATH, cache_name);
+		input_file = path;
+	}
+	fd = open(input_file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "bc_iotrace: error: cannot open %s: %s\n",
+			input_file, strerror(errno));
+		exit(5);
+	}
+	if (output_file != NULL) {
+		raw_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (raw_fd < 0) {
+			fprintf(stderr,
+				"bc_iotrace: error: cannot open %s: %s\n",
+				output_file, strerror(errno));
+			exit(5);
+		}
+	}
+
+	signal(SIGINT, bc_sigint);
+	signal(SIGTERM, bc_sigint);
+
+	if (raw_fd < 0) {
+		printf("# timestamp_usecs,pid,R|W,sector,bytes,outcome,");
+		printf("transition,cpu,queue_usecs,service_usecs\n");
+	}
+	ret = bc_drain(fd, raw_fd);
+
+	close(fd);
+	if (raw_fd >= 0)
+		close(raw_fd);
+	return ret;
+}
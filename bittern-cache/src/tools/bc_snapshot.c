@@ -0,0 +1,186 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*
+ * Statistics snapshot reader.
+ *
+ * Takes a binary statistics snapshot of each cache given on the command line,
+ * or of all caches if none is given, and prints it as a single line of
+ * key=value pairs:
+ *
+ *   <cache>: snapshot: ts_nsec=<n> xid=<n> read_requests=<n> ...
+ *
+ * With -i the caches are sampled every <interval> seconds and each round of
+ * lines is terminated by an empty line, which is what bc_stats.pl consumes.
+ * The snapshot files are kept open between rounds, so each sample costs one
+ * read(2) call per cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "bc_stats_lib.h"
+
+#define BC_SNAPSHOT_MAX_CACHES	256
+
+#define ULL_CAST(__x)                           ((unsigned long long)(__x))
+
+void usage(void)
+{
+	printf("bc_snapshot: usage: bc_snapshot ");
+	printf("[-i|--interval <secs>] [-n|--count <count>] [<cache> ...]\n");
+	printf("bc_snapshot: usage: bc_snapshot -l|--list-values\n");
+	printf("bc_snapshot: reads %s/<cache>/stats_snapshot of each cache, ",
+	       BC_STATS_SYSFS_PATH);
+	printf("or of all caches if none is given\n");
+	printf("bc_snapshot: -i samples every <secs> seconds, ");
+	printf("each round is terminated by an empty line\n");
+	printf("bc_snapshot: -n stops after <count> rounds\n");
+	printf("bc_snapshot: -l lists the names of all values\n");
+	printf("bc_snapshot: snapshot format version %d, %d values\n",
+	       CACHE_SNAPSHOT_VERSION,
+	       __CACHE_SNAPSHOT_NUM);
+	exit(1);
+}
+
+static void bc_print_snapshot(const char *cache_name,
+			      const struct bc_stats_snapshot *snap)
+{
+	unsigned int i;
+
+	printf("%s: snapshot: ts_nsec=%llu xid=%llu",
+	       cache_name,
+	       ULL_CAST(snap->ss_header.sh_ts_nsec),
+	       ULL_CAST(snap->ss_header.sh_xid));
+	for (i = 0; i < snap->ss_nr_values; i++)
+		printf(" %s=%llu",
+		       bc_stats_value_name(i),
+		       ULL_CAST(snap->ss_values[i]));
+	printf("\n");
+}
+
+/*
+ * exit codes:
+ *  x > 0 && x < 5: usage error
+ *          x == 5: no cache found
+ *          x == 6: cannot open or read a snapshot
+ */
+int main(int argc, char **argv)
+{
+	static char names[BC_SNAPSHOT_MAX_CACHES][BC_STATS_NAME_MAX];
+	static struct bc_stats_handle handles[BC_SNAPSHOT_MAX_CACHES];
+	struct bc_stats_snapshot snap;
+	unsigned int interval = 0;
+	int count = -1;
+	int n_caches, i, ret;
+	int errors = 0;
+
+	while (1) {
+		int c, option_index;
+		static struct option long_options[] = {
+			{ "interval", required_argument, 0, 'i', },
+			{ "count", required_argument, 0, 'n', },
+			{ "list-values", no_argument, 0, 'l', },
+			{ NULL, 0, 0, 0, },
+		};
+		c = getopt_long(argc, argv, "i:n:l", long_options,
+				&option_index);
+		switch (c) {
+		case -1:
+			goto done_getopt;
+		case 'i':
+			interval = atoi(optarg);
+			if (interval == 0) {
+				fprintf(stderr,
+					"bc_snapshot: error: bad interval\n");
+				usage();
+			}
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'l':
+			for (i = 0; i < __CACHE_SNAPSHOT_NUM; i++)
+				printf("%s\n", bc_stats_value_name(i));
+			exit(0);
+		default:
+			usage();
+			/*NOTREACHED*/
+		}
+	}
+done_getopt:
+	if (optind < argc) {
+		n_caches = 0;
+		for (i = optind; i < argc; i++) {
+			if (n_caches == BC_SNAPSHOT_MAX_CACHES) {
+				fprintf(stderr,
+					"bc_snapshot: error: too many caches\n");
+				usage();
+			}
+			snprintf(names[n_caches], BC_STATS_NAME_MAX, "%s",
+				 argv[i]);
+			n_caches++;
+		}
+	} else {
+		n_caches = bc_stats_list(names, BC_SNAPSHOT_MAX_CACHES);
+	}
+	if (n_caches <= 0) {
+		fprintf(stderr, "bc_snapshot: error: no cache found\n");
+		exit(5);
+	}
+
+	for (i = 0; i < n_caches; i++) {
+		ret = bc_stats_open(&handles[i], names[i]);
+		if (ret < 0) {
+			fprintf(stderr,
+				"bc_snapshot: error: cannot open %s: %s\n",
+				names[i], strerror(-ret));
+			exit(6);
+		}
+	}
+
+	while (1) {
+		for (i = 0; i < n_caches; i++) {
+			ret = bc_stats_read(&handles[i], &snap);
+			if (ret < 0) {
+				/* keep going, the cache may have been removed */
+				fprintf(stderr,
+					"bc_snapshot: error: cannot read %s: %s\n",
+					names[i], strerror(-ret));
+				errors++;
+				continue;
+			}
+			bc_print_snapshot(names[i], &snap);
+		}
+		if (interval == 0)
+			break;
+		printf("\n");
+		fflush(stdout);
+		if (count > 0 && --count == 0)
+			break;
+		sleep(interval);
+	}
+
+	for (i = 0; i < n_caches; i++)
+		bc_stats_close(&handles[i]);
+
+	return errors > 0 ? 6 : 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "bc_stats_lib.h"
+
+static const char *bc_stats_value_names[__CACHE_SNAPSHOT_NUM] = {
+#define __BC_STATS_NAME(__name, __field)				\
+	[CACHE_SNAPSHOT_##__name] = #__name,
+#define __BC_STATS_NAME_T(__name, __field)				\
+	[CACHE_SNAPSHOT_timer_##__name##_count] =			\
+		"timer_" #__name "_count",				\
+	[CACHE_SNAPSHOT_timer_##__name##_sum_nsec] =			\
+		"timer_" #__name "_sum_nsec",				\
+	[CACHE_SNAPSHOT_timer_##__name##_max_nsec] =			\
+		"timer_" #__name "_max_nsec",
+	CACHE_SNAPSHOT_VALUES(__BC_STATS_NAME,
+			      __BC_STATS_NAME,
+			      __BC_STATS_NAME_T)
+#undef __BC_STATS_NAME
+#undef __BC_STATS_NAME_T
+};
+
+int bc_stats_list(char names[][BC_STATS_NAME_MAX], int max_names)
+{
+	DIR *dir;
+	struct dirent *de;
+	int n = 0;
+
+	dir = opendir(BC_STATS_SYSFS_PATH);
+	if (dir == NULL)
+		return -errno;
+	while (n < max_names && (de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' ||
+		    strlen(de->d_name) >= BC_STATS_NAME_MAX)
+			continue;
+		memcpy(names[n], de->d_name, strlen(de->d_name) + 1);
+		n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+int bc_stats_open(struct bc_stats_handle *h, const char *cache_name)
+{
+	char path[256 + BC_STATS_NAME_MAX];
+
+	snprintf(h->sh_name, sizeof(h->sh_name), "%s", cache_name);
+	snprintf(path, sizeof(path), "%s/%s/stats_snapshot",
+		 BC_STATS_SYSFS_PATH, cache_name);
+	h->sh_fd = open(path, O_RDONLY);
+	if (h->sh_fd < 0)
+		return -errno;
+	return 0;
+}
+
+void bc_stats_close(struct bc_stats_handle *h)
+{
+	if (h->sh_fd >= 0)
+		close(h->sh_fd);
+	h->sh_fd = -1;
+}
+
+int bc_stats_read(struct bc_stats_handle *h, struct bc_stats_snapshot *snap)
+{
+	/* room for a snapshot from a newer kernel with more values */
+	char buf[4096];
+	struct cache_snapshot_header *sh = (struct cache_snapshot_header *)buf;
+	ssize_t ret;
+	unsigned int nr;
+
+	ret = pread(h->sh_fd, buf, sizeof(buf), 0);
+	if (ret < 0)
+		return -errno;
+	if (ret < sizeof(struct cache_snapshot_header))
+		return -EIO;
+	if (sh->sh_magic != CACHE_SNAPSHOT_MAGIC ||
+	    sh->sh_version != CACHE_SNAPSHOT_VERSION ||
+	    sh->sh_header_size < sizeof(struct cache_snapshot_header))
+		return -EPROTO;
+	if (sh->sh_header_size + sh->sh_nr_values * sizeof(uint64_t) > ret)
+		return -EIO;
+
+	nr = sh->sh_nr_values;
+	if (nr > __CACHE_SNAPSHOT_NUM)
+		nr = __CACHE_SNAPSHOT_NUM;
+	memset(snap, 0, sizeof(*snap));
+	memcpy(&snap->ss_header, sh, sizeof(struct cache_snapshot_header));
+	memcpy(snap->ss_values, buf + sh->sh_header_size,
+	       nr * sizeof(uint64_t));
+	snap->ss_nr_values = nr;
+	return 0;
+}
+
+const char *bc_stats_value_name(unsigned int idx)
+{
+	if (idx >= __CACHE_SNAPSHOT_NUM)
+		return NULL;
+	return bc_stats_value_names[idx];
+}
+
+int bc_stats_value_index(const char *name)
+{
+	int i;
+
+	for (i = 0; i < __CACHE_SNAPSHOT_NUM; i++)
+		if (strcmp(bc_stats_value_names[i], name) == 0)
+			return i;
+	return -1;
+}
+
+double bc_stats_elapsed(const struct bc_stats_snapshot *curr,
+			const struct bc_stats_snapshot *prev)
+{
+	if (curr->ss_header.sh_ts_nsec <= prev->ss_header.sh_ts_nsec)
+		return 0.0;
+	return (double)(curr->ss_header.sh_ts_nsec -
+			prev->ss_header.sh_ts_nsec) / 1000000000.0;
+}
+
+static uint64_t bc_stats_delta(const struct bc_stats_snapshot *curr,
+			       const struct bc_stats_snapshot *prev,
+			       unsigned int idx)
+{
+	uint64_t c = curr->ss_values[idx];
+	uint64_t p = prev->ss_values[idx];
+
+	if (c >= p)
+		return c - p;
+	/* 32 bits kernel counter which wrapped around */
+	if (p <= UINT32_MAX)
+		return c + (1ULL << 32) - p;
+	return 0;
+}
+
+double bc_stats_rate(const struct bc_stats_snapshot *curr,
+		     const struct bc_stats_snapshot *prev,
+		     unsigned int idx)
+{
+	double secs = bc_stats_elapsed(curr, prev);
+
+	if (idx >= __CACHE_SNAPSHOT_NUM || secs == 0.0)
+		return 0.0;
+	return (double)bc_stats_delta(curr, prev, idx) / secs;
+}
+
+double bc_stats_timer_avg_usecs(const struct bc_stats_snapshot *curr,
+				const struct bc_stats_snapshot *prev,
+				unsigned int idx)
+{
+	uint64_t count, sum_nsec;
+
+	if (idx + 1 >= __CACHE_SNAPSHOT_NUM)
+		return 0.0;
+	count = bc_stats_delta(curr, prev, idx);
+	sum_nsec = bc_stats_delta(curr, prev, idx + 1);
+	if (count == 0)
+		return 0.0;
+	return (double)sum_nsec / (double)count / 1000.0;
+}
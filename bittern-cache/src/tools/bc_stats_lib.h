@@ -0,0 +1,90 @@
+/*
+ * Bittern Cache.
+ *
+ * Copyright(c) 2013, 2014, 2015, Twitter, Inc., All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ */
+
+/*! \file */
+
+#ifndef BC_STATS_LIB_H
+#define BC_STATS_LIB_H
+
+#include <stdint.h>
+
+#include "../bittern_cache_kmod/bittern_cache_snapshot.h"
+
+/*!
+ * Reader library for the binary statistics snapshot exported by the kernel
+ * module in /sys/fs/bittern/<cache>/stats_snapshot .
+ *
+ * A handle keeps the snapshot file open, so taking a snapshot of a cache
+ * costs a single pread(2) call. Values are looked up by index with the
+ * CACHE_SNAPSHOT_ enum from bittern_cache_snapshot.h, or by name.
+ */
+
+#define BC_STATS_SYSFS_PATH	"/sys/fs/bittern"
+#define BC_STATS_NAME_MAX	128
+
+/*! open snapshot file for one cache */
+struct bc_stats_handle {
+	int sh_fd;
+	char sh_name[BC_STATS_NAME_MAX];
+};
+
+/*! one snapshot */
+struct bc_stats_snapshot {
+	struct cache_snapshot_header ss_header;
+	/*!
+	 * Values known to both the kernel and this library, that is the
+	 * minimum of __CACHE_SNAPSHOT_NUM and the kernel's sh_nr_values.
+	 * Values past this are zero.
+	 */
+	unsigned int ss_nr_values;
+	uint64_t ss_values[__CACHE_SNAPSHOT_NUM];
+};
+
+/*!
+ * List the caches present in /sys/fs/bittern. Returns the number of
+ * caches found, up to max_names, or -errno on error.
+ */
+extern int bc_stats_list(char names[][BC_STATS_NAME_MAX], int max_names);
+/*! open the snapshot file of cache_name, returns 0 or -errno */
+extern int bc_stats_open(struct bc_stats_handle *h, const char *cache_name);
+extern void bc_stats_close(struct bc_stats_handle *h);
+/*! take one snapshot, returns 0 or -errno */
+extern int bc_stats_read(struct bc_stats_handle *h,
+			 struct bc_stats_snapshot *snap);
+/*! name of the value at index idx, NULL if idx is out of range */
+extern const char *bc_stats_value_name(unsigned int idx);
+/*! index of the value with the given name, -1 if not found */
+extern int bc_stats_value_index(const char *name);
+/*! seconds elapsed between two snapshots */
+extern double bc_stats_elapsed(const struct bc_stats_snapshot *curr,
+			       const struct bc_stats_snapshot *prev);
+/*!
+ * Per second rate of change of the counter at index idx between two
+ * snapshots. Counters are 32 bits wide in the kernel, wraparound is handled.
+ */
+extern double bc_stats_rate(const struct bc_stats_snapshot *curr,
+			    const struct bc_stats_snapshot *prev,
+			    unsigned int idx);
+/*!
+ * Average latency in microseconds of the operations timed by a timer in
+ * between two snapshots. idx is the index of the timer count, e.g.
+ * CACHE_SNAPSHOT_timer_reads_count .
+ */
+extern double bc_stats_timer_avg_usecs(const struct bc_stats_snapshot *curr,
+				       const struct bc_stats_snapshot *prev,
+				       unsigned int idx);
+
+#endif /* BC_STATS_LIB_H */
@@ -14,6 +14,7 @@
  *
  */
 
+#define _GNU_SOURCE	/* O_DIRECT */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -28,6 +29,8 @@
 #include <getopt.h>
 #include <assert.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <math128.h>
 #include <murmurhash3.h>
@@ -79,6 +82,8 @@ int bc_stat_cb_valid_dirty = 0;
 int bc_stat_cb_invalid = 0;
 int bc_stat_cb_transient = 0;
 int bc_stat_cb_corrupt = 0;
+int bc_stat_cb_corrupt_data = 0;
+int bc_stat_cb_other_owner = 0;
 
 int bc_read_header(int fd,
 		   unsigned long offset,
@@ -139,6 +144,36 @@ int bc_read_header(int fd,
 	bc_print_info("bc_read_header(%lu): lm_xid_current=%llu\n",
 			offset,
 			ULL_CAST(lm->lm_xid_current));
+	bc_print_info("bc_read_header(%lu): lm_stripe_count=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_stripe_count));
+	bc_print_info("bc_read_header(%lu): lm_clean_shutdown_xid=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_clean_shutdown_xid));
+	bc_print_info("bc_read_header(%lu): lm_snapshot_offset_bytes=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_snapshot_offset_bytes));
+	bc_print_info("bc_read_header(%lu): lm_snapshot_blocks=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_snapshot_blocks));
+	bc_print_info("bc_read_header(%lu): lm_mlog_epoch=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_mlog_epoch));
+	bc_print_info("bc_read_header(%lu): lm_mlog_last_epoch=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_mlog_last_epoch));
+	bc_print_info("bc_read_header(%lu): lm_mlog_offset_bytes=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_mlog_offset_bytes));
+	bc_print_info("bc_read_header(%lu): lm_mlog_pages=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_mlog_pages));
+	bc_print_info("bc_read_header(%lu): lm_one_io_epoch=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_one_io_epoch));
+	bc_print_info("bc_read_header(%lu): lm_one_io_acked_epoch=%llu\n",
+			offset,
+			ULL_CAST(lm->lm_one_io_acked_epoch));
 
 	if (lm->lm_magic != LM_MAGIC) {
 		bc_print_err("bc_read_header(%lu): magic numbers mismatch (0x%x/0x%x)\n",
@@ -222,6 +257,15 @@ int bc_read_header(int fd,
 				ULL_CAST(lm->lm_cache_size_bytes));
 		return -1;
 	}
+	if (lm->lm_stripe_count > 1) {
+		/*
+		 * striped cache, this device only holds every
+		 * lm_stripe_count-th data/metadata pair.
+		 */
+		cache_size = d_first_offset;
+		cache_size += ((lm->lm_cache_blocks + lm->lm_stripe_count - 1) /
+			       lm->lm_stripe_count) * (PAGE_SIZE * 2);
+	}
 	if (cache_size < device_size_bytes) {
 		bc_print_info("bc_read_header(%lu): cache smaller than device\n",
 				offset);
@@ -243,221 +287,6 @@ int bc_read_header(int fd,
 	return 0;
 }
 
-int bc_read_cache_block(int fd, unsigned int block_id,
-			struct pmem_header *lm,
-			uint64_t device_size_bytes)
-{
-	size_t m_offset;
-	size_t data_m_offset;
-	struct pmem_block_metadata mcbm;
-	ssize_t sz;
-	uint128_t hash_computed;
-	uint128_t data_hash_computed;
-	char databuf[PAGE_SIZE];
-
-	if (lm->lm_cache_layout == CACHE_LAYOUT_SEQUENTIAL) {
-		m_offset = lm->lm_first_offset_bytes +
-			   (block_id - 1) * lm->lm_mcb_size_bytes;
-		data_m_offset = lm->lm_first_data_block_offset_bytes +
-				(block_id - 1) * PAGE_SIZE;
-	} else {
-		data_m_offset = lm->lm_first_offset_bytes +
-				(block_id - 1) * (PAGE_SIZE * 2);
-		m_offset = data_m_offset + PAGE_SIZE;
-	}
-	bc_print_debug("bc_read_cache_block(%u): m_offset=%lu, d_offset=%lu\n",
-			block_id,
-			m_offset,
-			data_m_offset);
-	sz = pread(fd, &mcbm, sizeof(struct pmem_block_metadata), m_offset);
-	if (sz != sizeof(struct pmem_block_metadata)) {
-		bc_print_err("bc_tool: bc_read: bc_read_cache_block(%u), m_offset=%lu: error reading metadata block\n",
-				block_id,
-				m_offset);
-		exit(6);
-	}
-	bc_print_debug("bc_read_cache_block(%u): magic=0x%x\n",
-			block_id,
-			mcbm.pmbm_magic);
-	bc_print_debug("bc_read_cache_block(%u): block_id=%u\n",
-			block_id,
-			mcbm.pmbm_block_id);
-	bc_print_debug("bc_read_cache_block(%u): status=%u\n",
-			block_id,
-			mcbm.pmbm_status);
-	bc_print_debug("bc_read_cache_block(%u): device_sector=%llu\n",
-			block_id,
-			ULL_CAST(mcbm.pmbm_device_sector));
-	bc_print_debug("bc_read_cache_block(%u): hash_data=" UINT128_FMT "\n",
-			block_id,
-			UINT128_ARG(mcbm.pmbm_hash_data));
-	bc_print_debug("bc_read_cache_block(%u): hash_metadata=" UINT128_FMT "\n",
-			block_id,
-			UINT128_ARG(mcbm.pmbm_hash_metadata));
-
-#if 0
-	bc_print_debug("           %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-			((unsigned char *)&mcbm)[0],
-			((unsigned char *)&mcbm)[1],
-			((unsigned char *)&mcbm)[2],
-			((unsigned char *)&mcbm)[3],
-			((unsigned char *)&mcbm)[4],
-			((unsigned char *)&mcbm)[5],
-			((unsigned char *)&mcbm)[6],
-			((unsigned char *)&mcbm)[7],
-			((unsigned char *)&mcbm)[8],
-			((unsigned char *)&mcbm)[9],
-			((unsigned char *)&mcbm)[10],
-			((unsigned char *)&mcbm)[11],
-			((unsigned char *)&mcbm)[12],
-			((unsigned char *)&mcbm)[13],
-			((unsigned char *)&mcbm)[14],
-			((unsigned char *)&mcbm)[15]);
-	bc_print_debug("           %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-			((unsigned char *)&mcbm)[16+0],
-			((unsigned char *)&mcbm)[16+1],
-			((unsigned char *)&mcbm)[16+2],
-			((unsigned char *)&mcbm)[16+3],
-			((unsigned char *)&mcbm)[16+4],
-			((unsigned char *)&mcbm)[16+5],
-			((unsigned char *)&mcbm)[16+6],
-			((unsigned char *)&mcbm)[16+7],
-			((unsigned char *)&mcbm)[16+8],
-			((unsigned char *)&mcbm)[16+9],
-			((unsigned char *)&mcbm)[16+10],
-			((unsigned char *)&mcbm)[16+11],
-			((unsigned char *)&mcbm)[16+12],
-			((unsigned char *)&mcbm)[16+13],
-			((unsigned char *)&mcbm)[16+14],
-			((unsigned char *)&mcbm)[16+15]);
-	bc_print_debug("           %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-			((unsigned char *)&mcbm)[32+0],
-			((unsigned char *)&mcbm)[32+1],
-			((unsigned char *)&mcbm)[32+2],
-			((unsigned char *)&mcbm)[32+3],
-			((unsigned char *)&mcbm)[32+4],
-			((unsigned char *)&mcbm)[32+5],
-			((unsigned char *)&mcbm)[32+6],
-			((unsigned char *)&mcbm)[32+7],
-			((unsigned char *)&mcbm)[32+8],
-			((unsigned char *)&mcbm)[32+9],
-			((unsigned char *)&mcbm)[32+10],
-			((unsigned char *)&mcbm)[32+11],
-			((unsigned char *)&mcbm)[32+12],
-			((unsigned char *)&mcbm)[32+13],
-			((unsigned char *)&mcbm)[32+14],
-			((unsigned char *)&mcbm)[32+15]);
-	bc_print_debug("           %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
-			((unsigned char *)&mcbm)[48+0],
-			((unsigned char *)&mcbm)[48+1],
-			((unsigned char *)&mcbm)[48+2],
-			((unsigned char *)&mcbm)[48+3],
-			((unsigned char *)&mcbm)[48+4],
-			((unsigned char *)&mcbm)[48+5],
-			((unsigned char *)&mcbm)[48+6],
-			((unsigned char *)&mcbm)[48+7],
-			((unsigned char *)&mcbm)[48+8],
-			((unsigned char *)&mcbm)[48+9],
-			((unsigned char *)&mcbm)[48+10],
-			((unsigned char *)&mcbm)[48+11],
-			((unsigned char *)&mcbm)[48+12],
-			((unsigned char *)&mcbm)[48+13],
-			((unsigned char *)&mcbm)[48+14],
-			((unsigned char *)&mcbm)[48+15]);
-#endif
-
-	if (mcbm.pmbm_magic != MCBM_MAGIC) {
-		bc_print_err("bc_read_cache_block(%u): wrong magic 0x%x\n",
-				block_id,
-				mcbm.pmbm_magic);
-		exit(12);
-	}
-	if (mcbm.pmbm_block_id != block_id) {
-		bc_print_err("bc_read_cache_block(%u), wrong block_id (%u)\n",
-			     block_id, mcbm.pmbm_block_id);
-		exit(12);
-	}
-
-	hash_computed = murmurhash3_128((void *)&mcbm,
-					PMEM_BLOCK_METADATA_HASHING_SIZE);
-	if (uint128_ne(hash_computed, mcbm.pmbm_hash_metadata)) {
-		bc_print_err("bc_read_cache_block(%u): computed metadata_hash=" UINT128_FMT " does not match stored metadata_hash=" UINT128_FMT "\n",
-			     block_id,
-			     UINT128_ARG(hash_computed),
-			     UINT128_ARG(mcbm.pmbm_hash_metadata));
-		bc_stat_cb_corrupt++;
-		/* FIXME: abort if there are too many corrupt blocks */
-	}
-	bc_print_info("bc_read_cache_block(%u): computed metadata_hash=" UINT128_FMT " matches stored metadata_hash=" UINT128_FMT "\n",
-		      block_id,
-		      UINT128_ARG(hash_computed),
-		      UINT128_ARG(mcbm.pmbm_hash_metadata));
-
-	switch (mcbm.pmbm_status) {
-	case P_S_INVALID:
-		bc_print_verbose("bc_read_cache_block(%u,%llu), ",
-				 block_id, ULL_CAST(mcbm.pmbm_device_sector));
-		bc_print_verbose("data_m_offset=%lu: state=invalid\n",
-				 data_m_offset);
-		bc_stat_cb_invalid++;
-		return 0;
-	case P_S_CLEAN:
-		bc_print_verbose("bc_read_cache_block(%u,%llu), ",
-				 block_id, ULL_CAST(mcbm.pmbm_device_sector));
-		bc_print_verbose("data_m_offset=%lu: state=clean\n",
-				 data_m_offset);
-		bc_stat_cb_valid_clean++;
-		/* need to check data checksum */
-		break;
-	case P_S_DIRTY:
-		bc_print_verbose("bc_read_cache_block(%u,%llu), ",
-				 block_id, ULL_CAST(mcbm.pmbm_device_sector));
-		bc_print_verbose("data_m_offset=%lu: state=dirty\n",
-				 data_m_offset);
-		bc_stat_cb_valid_dirty++;
-		/* need to check data checksum */
-		break;
-	default:
-		bc_stat_cb_transient++;
-		bc_print_warning("bc_read_cache_block(%u,%llu), ",
-				 block_id,
-				 ULL_CAST(mcbm.pmbm_device_sector));
-		bc_print_warning("data_m_offset=%lu, m_offset=%lu: ",
-				 data_m_offset, m_offset);
-		bc_print_warning("invalid / transient cache state %u (0x%x)\n",
-				 mcbm.pmbm_status, mcbm.pmbm_status);
-		return -1;
-	}
-
-	/* need to check data hash */
-	bc_print_debug("bc_read_cache_block(%u), data_m_offset=%lu\n",
-		       block_id, data_m_offset);
-
-	sz = pread(fd, &databuf[0], PAGE_SIZE, data_m_offset);
-	if (sz != PAGE_SIZE) {
-		bc_print_err("bc_tool: bc_read: bc_read_cache_block(%u), m_offset=%lu: error reading data block\n",
-			     block_id, m_offset);
-		exit(6);
-	}
-
-	data_hash_computed = murmurhash3_128(databuf, PAGE_SIZE);
-	if (uint128_ne(data_hash_computed, mcbm.pmbm_hash_data)) {
-		bc_print_err("bc_read_cache_block(%u): computed data_hash=" UINT128_FMT " does not match stored data_hash=" UINT128_FMT "\n",
-			     block_id,
-			     UINT128_ARG(hash_computed),
-			     UINT128_ARG(mcbm.pmbm_hash_data));
-		/* FIXME: should count all errors */
-		exit(12);
-	}
-
-	bc_print_info("bc_read_cache_block(%u): computed data_hash=" UINT128_FMT " matches stored data_hash=" UINT128_FMT "\n",
-		      block_id,
-		      UINT128_ARG(hash_computed),
-		      UINT128_ARG(mcbm.pmbm_hash_metadata));
-
-	return 0;
-}
-
 int read_sector(int fd, uint64_t sector, char buffer[512])
 {
 	ssize_t sz = pread(fd, &buffer[0], 512, sector * 512);
@@ -550,16 +379,675 @@ unsigned long long find_device_size(int fd)
 	return device_size;
 }
 
-void bc_read(const char *cache_device)
+/*
+ * Parallel scan.
+ *
+ * The cache blocks are split in bc_threads contiguous ranges of block ids,
+ * and each range is scanned by its own thread. Each thread reads large
+ * extents of the metadata (and, when checking data blocks, of the data)
+ * with a single pread(2) and verifies the metadata and data hashes of all
+ * the blocks in the extent, so that a scan is limited by the cache device
+ * rather than by hashing on a single cpu.
+ *
+ * Block states are counted in the bc_stat_cb_ counters, and the location of
+ * the first bc_scan_max_errors problems found is recorded and printed at
+ * the end of the scan, sorted by block id.
+ */
+
+#define BC_SCAN_BYTES		(4 * 1024 * 1024)
+#define BC_MAX_THREADS		256
+/* must match CACHE_POOL_OWNER_SHIFT in bittern_cache.h */
+#define BC_POOL_OWNER_SHIFT	48
+#define BC_POOL_SECTOR_MASK	((1ULL << BC_POOL_OWNER_SHIFT) - 1ULL)
+
+int bc_threads = 16;
+int bc_scan_max_errors = 10;
+
+/*! dirty block collected by the scan */
+struct bc_dirty_block {
+	uint64_t db_sector;
+	uint64_t db_xid;
+	uint32_t db_block_id;
+};
+
+/*! problem found by the scan */
+struct bc_scan_error {
+	unsigned int er_block_id;
+	uint64_t er_offset;
+	uint64_t er_sector;
+	const char *er_what;
+};
+
+/*! per thread scan state */
+struct bc_scan {
+	pthread_t bs_thread;
+	int bs_fd;
+	struct pmem_header *bs_lm;
+	int bs_check_data;
+	int bs_collect_dirty;
+	unsigned int bs_owner;
+	unsigned int bs_block_first;
+	unsigned int bs_block_last;
+	struct bc_dirty_block *bs_dirty;
+	size_t bs_dirty_count;
+	size_t bs_dirty_size;
+	unsigned int bs_clean;
+	unsigned int bs_dirty_blocks;
+	unsigned int bs_invalid;
+	unsigned int bs_transient;
+	unsigned int bs_corrupt;
+	unsigned int bs_corrupt_data;
+	unsigned int bs_other_owner;
+	int bs_io_error;
+};
+
+pthread_mutex_t bc_scan_lock = PTHREAD_MUTEX_INITIALIZER;
+/* protected by bc_scan_lock */
+struct bc_scan_error *bc_scan_errors;
+int bc_scan_errors_count;
+/* updated with atomic builtins */
+uint64_t bc_scan_blocks_done;
+uint64_t bc_scan_bytes_done;
+int bc_scan_threads_done;
+
+static uint64_t bc_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bc_block_offsets(struct pmem_header *lm,
+			     unsigned int block_id,
+			     uint64_t *m_offset,
+			     uint64_t *d_offset)
+{
+	if (lm->lm_cache_layout == CACHE_LAYOUT_SEQUENTIAL) {
+		*m_offset = lm->lm_first_offset_bytes +
+			    (uint64_t)(block_id - 1) * lm->lm_mcb_size_bytes;
+		*d_offset = lm->lm_first_data_block_offset_bytes +
+			    (uint64_t)(block_id - 1) * PAGE_SIZE;
+	} else {
+		*d_offset = lm->lm_first_offset_bytes +
+			    (uint64_t)(block_id - 1) * (PAGE_SIZE * 2);
+		*m_offset = *d_offset + PAGE_SIZE;
+	}
+}
+
+static void bc_scan_error(unsigned int block_id,
+			  uint64_t offset,
+			  uint64_t sector,
+			  const char *what)
+{
+	pthread_mutex_lock(&bc_scan_lock);
+	if (bc_scan_errors_count < bc_scan_max_errors) {
+		struct bc_scan_error *er;
+
+		er = &bc_scan_errors[bc_scan_errors_count++];
+		er->er_block_id = block_id;
+		er->er_offset = offset;
+		er->er_sector = sector;
+		er->er_what = what;
+	}
+	pthread_mutex_unlock(&bc_scan_lock);
+}
+
+/*
+ * epoch recorded by a data/metadata write, 0 if the record is not valid.
+ * in the interleaved layout the record follows the metadata.
+ */
+static uint64_t bc_one_io_epoch(struct pmem_header *lm,
+				struct pmem_block_metadata *mcbm)
+{
+	struct pmem_block_one_io_record *pbor;
+
+	if (lm->lm_cache_layout != CACHE_LAYOUT_INTERLEAVED)
+		return 0;
+	pbor = (struct pmem_block_one_io_record *)(mcbm + 1);
+	if (pbor->pbor_magic != MCBM_ONE_IO_RECORD_MAGIC ||
+	    pbor->pbor_block_id != mcbm->pmbm_block_id ||
+	    pbor->pbor_xid != mcbm->pmbm_xid)
+		return 0;
+	return pbor->pbor_epoch;
+}
+
+/*
+ * Metadata intent log.
+ *
+ * With the log enabled, metadata-only updates (writeback done, invalidation)
+ * are appended to the log pages instead of being written to the block
+ * metadata, so the block metadata can still say dirty for a block which has
+ * been written back and reused since. The records of the current epoch are
+ * loaded before scanning and replayed on top of the block metadata, the same
+ * way pmem_mlog_replay_block() does on restore.
+ */
+
+/* must match PMEM_MLOG_PAGES in bittern_cache_tunables.h */
+#define BC_MLOG_MAX_PAGES	256
+
+/* sorted by block id, newest record of each block only */
+struct pmem_block_metadata *bc_mlog;
+size_t bc_mlog_count;
+unsigned int bc_mlog_replayed;
+
+static int bc_mlog_state_rank(uint32_t status)
+{
+	switch (status) {
+	case P_S_DIRTY:
+		return 0;
+	case P_S_CLEAN:
+		return 1;
+	case P_S_INVALID:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+/* true if log record rec has a newer state than mcbm */
+static int bc_mlog_is_newer(const struct pmem_block_metadata *rec,
+			    const struct pmem_block_metadata *mcbm)
+{
+	if (rec->pmbm_xid != mcbm->pmbm_xid)
+		return rec->pmbm_xid > mcbm->pmbm_xid;
+	return bc_mlog_state_rank(rec->pmbm_status) >
+	       bc_mlog_state_rank(mcbm->pmbm_status);
+}
+
+static int bc_mlog_record_cmp(const void *a, const void *b)
+{
+	const struct pmem_block_metadata *ra = a;
+	const struct pmem_block_metadata *rb = b;
+
+	if (ra->pmbm_block_id == rb->pmbm_block_id)
+		return 0;
+	return ra->pmbm_block_id < rb->pmbm_block_id ? -1 : 1;
+}
+
+/*
+ * load the metadata intent log of the current epoch. a cache whose log
+ * cannot be read back cannot be scanned or flushed, as the block metadata
+ * alone may be stale.
+ */
+void bc_mlog_load(int fd,
+		  struct pmem_header *lm,
+		  unsigned long long device_size_bytes)
+{
+	struct pmem_mlog_page_header *mlph;
+	struct pmem_block_metadata *rec;
+	uint128_t hash;
+	uint64_t page;
+	unsigned int i, pages = 0;
+	size_t n = 0, j;
+	char *buf;
+	ssize_t sz;
+
+	bc_print_info("mlog: epoch=%llu, offset=%llu, pages=%llu\n",
+		      ULL_CAST(lm->lm_mlog_epoch),
+		      ULL_CAST(lm->lm_mlog_offset_bytes),
+		      ULL_CAST(lm->lm_mlog_pages));
+	if (lm->lm_cache_layout != CACHE_LAYOUT_INTERLEAVED ||
+	    lm->lm_mlog_offset_bytes < lm->lm_cache_size_bytes ||
+	    (lm->lm_mlog_offset_bytes % PAGE_SIZE) != 0 ||
+	    lm->lm_mlog_pages == 0 ||
+	    lm->lm_mlog_pages > BC_MLOG_MAX_PAGES ||
+	    lm->lm_mlog_offset_bytes + lm->lm_mlog_pages * PAGE_SIZE >
+	    device_size_bytes) {
+		bc_print_err("bc_mlog: metadata intent log geometry is invalid, cannot use block metadata\n");
+		exit(14);
+	}
+
+	buf = malloc(PAGE_SIZE);
+	bc_mlog = malloc(lm->lm_mlog_pages * PMEM_MLOG_RECORDS_PER_PAGE *
+			 sizeof(struct pmem_block_metadata));
+	if (buf == NULL || bc_mlog == NULL) {
+		bc_print_err("bc_mlog: out of memory\n");
+		exit(3);
+	}
+	mlph = (struct pmem_mlog_page_header *)buf;
+	rec = (struct pmem_block_metadata *)(mlph + 1);
+
+	for (page = 0; page < lm->lm_mlog_pages; page++) {
+		sz = pread(fd, buf, PAGE_SIZE,
+			   lm->lm_mlog_offset_bytes + page * PAGE_SIZE);
+		if (sz != PAGE_SIZE) {
+			bc_print_err("bc_mlog(%llu): error reading log page\n",
+				     ULL_CAST(page));
+			exit(14);
+		}
+		/* never written in this epoch, or torn */
+		if (mlph->mlph_magic != PMEM_MLOG_MAGIC ||
+		    mlph->mlph_epoch != lm->lm_mlog_epoch ||
+		    memcmp(mlph->mlph_uuid, lm->lm_uuid,
+			   sizeof(mlph->mlph_uuid)) != 0 ||
+		    mlph->mlph_nr_records > PMEM_MLOG_RECORDS_PER_PAGE)
+			continue;
+		hash = mlph->mlph_hash;
+		mlph->mlph_hash = UINT128_ZERO;
+		if (uint128_ne(hash, murmurhash3_128(buf, PAGE_SIZE)))
+			continue;
+		pages++;
+		for (i = 0; i < mlph->mlph_nr_records; i++) {
+			/* the page hash is good, this can only be a bug */
+			if (rec[i].pmbm_magic != MCBM_MAGIC ||
+			    uint128_ne(murmurhash3_128(&rec[i],
+					PMEM_BLOCK_METADATA_HASHING_SIZE),
+				       rec[i].pmbm_hash_metadata) ||
+			    rec[i].pmbm_block_id < 1 ||
+			    rec[i].pmbm_block_id > lm->lm_cache_blocks ||
+			    bc_mlog_state_rank(rec[i].pmbm_status) < 0) {
+				bc_print_err("bc_mlog(%llu): record %u is corrupt\n",
+					     ULL_CAST(page), i);
+				exit(14);
+			}
+			bc_mlog[n++] = rec[i];
+		}
+	}
+	free(buf);
+
+	/* keep the newest record of each block */
+	qsort(bc_mlog, n, sizeof(struct pmem_block_metadata),
+	      bc_mlog_record_cmp);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 && bc_mlog[j - 1].pmbm_block_id ==
+			     bc_mlog[i].pmbm_block_id) {
+			if (bc_mlog_is_newer(&bc_mlog[i], &bc_mlog[j - 1]))
+				bc_mlog[j - 1] = bc_mlog[i];
+			continue;
+		}
+		bc_mlog[j++] = bc_mlog[i];
+	}
+	bc_mlog_count = j;
+	bc_print_info("mlog: pages=%u, records=%llu, blocks=%llu\n",
+		      pages, ULL_CAST(n), ULL_CAST(bc_mlog_count));
+}
+
+/*
+ * replace mcbm with its newer log record, if any.
+ * returns 1 if the block metadata was stale.
+ */
+static int bc_mlog_replay_block(struct pmem_block_metadata *mcbm)
+{
+	struct pmem_block_metadata *rec;
+
+	if (bc_mlog == NULL)
+		return 0;
+	rec = bsearch(mcbm, bc_mlog, bc_mlog_count,
+		      sizeof(struct pmem_block_metadata),
+		      bc_mlog_record_cmp);
+	if (rec == NULL || !bc_mlog_is_newer(rec, mcbm))
+		return 0;
+	bc_print_verbose("bc_mlog(%u): xid=%llu, status=%u\n",
+			 rec->pmbm_block_id,
+			 ULL_CAST(rec->pmbm_xid),
+			 rec->pmbm_status);
+	*mcbm = *rec;
+	return 1;
+}
+
+static void bc_scan_block(struct bc_scan *bs,
+			  unsigned int block_id,
+			  struct pmem_block_metadata *mcbm,
+			  const char *data)
+{
+	uint128_t hash_computed;
+	uint64_t m_offset, d_offset;
+	struct bc_dirty_block *db;
+
+	bc_block_offsets(bs->bs_lm, block_id, &m_offset, &d_offset);
+
+	if (mcbm->pmbm_magic != MCBM_MAGIC &&
+	    mcbm->pmbm_magic != MCBM_MAGIC_ONE_IO) {
+		bs->bs_corrupt++;
+		bc_scan_error(block_id, m_offset, 0, "wrong metadata magic");
+		return;
+	}
+	if (mcbm->pmbm_block_id != block_id) {
+		bs->bs_corrupt++;
+		bc_scan_error(block_id, m_offset, 0, "wrong block_id");
+		return;
+	}
+	hash_computed = murmurhash3_128((void *)mcbm,
+					PMEM_BLOCK_METADATA_HASHING_SIZE);
+	if (uint128_ne(hash_computed, mcbm->pmbm_hash_metadata)) {
+		bs->bs_corrupt++;
+		bc_scan_error(block_id, m_offset, 0,
+			      "metadata hash mismatch");
+		return;
+	}
+
+	/* the metadata intent log may have a newer state for this block */
+	if (bc_mlog_replay_block(mcbm))
+		__sync_fetch_and_add(&bc_mlog_replayed, 1);
+
+	switch (mcbm->pmbm_status) {
+	case P_S_INVALID:
+		bs->bs_invalid++;
+		return;
+	case P_S_CLEAN:
+		bs->bs_clean++;
+		break;
+	case P_S_DIRTY:
+		bs->bs_dirty_blocks++;
+		break;
+	default:
+		bs->bs_transient++;
+		/* transient blocks are rolled back on restore */
+		if (bs->bs_check_data)
+			bc_scan_error(block_id, m_offset,
+				      mcbm->pmbm_device_sector,
+				      "transient cache state");
+		return;
+	}
+	bc_print_verbose("bc_scan(%u,%llu): state=%s\n",
+			 block_id,
+			 ULL_CAST(mcbm->pmbm_device_sector),
+			 mcbm->pmbm_status == P_S_CLEAN ? "clean" : "dirty");
+
+	if (data != NULL) {
+		hash_computed = murmurhash3_128(data, PAGE_SIZE);
+		if (uint128_ne(hash_computed, mcbm->pmbm_hash_data) &&
+		    mcbm->pmbm_magic == MCBM_MAGIC_ONE_IO &&
+		    bc_one_io_epoch(bs->bs_lm, mcbm) >
+		    bs->bs_lm->lm_one_io_acked_epoch) {
+			/* interrupted data/metadata write, rolled back */
+			bs->bs_transient++;
+			bc_scan_error(block_id, d_offset,
+				      mcbm->pmbm_device_sector,
+				      "interrupted data/metadata write");
+			return;
+		}
+		if (uint128_ne(hash_computed, mcbm->pmbm_hash_data)) {
+			bs->bs_corrupt_data++;
+			bc_scan_error(block_id, d_offset,
+				      mcbm->pmbm_device_sector,
+				      "data hash mismatch");
+			return;
+		}
+	}
+
+	if (!bs->bs_collect_dirty || mcbm->pmbm_status != P_S_DIRTY)
+		return;
+	if (mcbm->pmbm_owner != bs->bs_owner) {
+		bs->bs_other_owner++;
+		return;
+	}
+	if (bs->bs_dirty_count == bs->bs_dirty_size) {
+		bs->bs_dirty_size = bs->bs_dirty_size * 2 + 1024;
+		bs->bs_dirty = realloc(bs->bs_dirty,
+				       bs->bs_dirty_size *
+				       sizeof(struct bc_dirty_block));
+		if (bs->bs_dirty == NULL) {
+			bc_print_err("bc_scan: out of memory\n");
+			exit(3);
+		}
+	}
+	db = &bs->bs_dirty[bs->bs_dirty_count++];
+	db->db_sector = mcbm->pmbm_device_sector & BC_POOL_SECTOR_MASK;
+	db->db_xid = mcbm->pmbm_xid;
+	db->db_block_id = block_id;
+}
+
+static void *bc_scan_thread(void *arg)
+{
+	struct bc_scan *bs = arg;
+	struct pmem_header *lm = bs->bs_lm;
+	uint64_t m_offset, d_offset;
+	unsigned int batch, block_id, n, i;
+	char *mbuf, *dbuf;
+	size_t len;
+	ssize_t sz;
+
+	/*
+	 * sequential layout: metadata and data are in two separate regions,
+	 * interleaved layout: each data block is followed by its metadata.
+	 */
+	if (lm->lm_cache_layout == CACHE_LAYOUT_INTERLEAVED)
+		batch = BC_SCAN_BYTES / (PAGE_SIZE * 2);
+	else if (bs->bs_check_data)
+		batch = BC_SCAN_BYTES / PAGE_SIZE;
+	else
+		batch = BC_SCAN_BYTES / lm->lm_mcb_size_bytes;
+	mbuf = malloc(BC_SCAN_BYTES);
+	dbuf = malloc(BC_SCAN_BYTES);
+	if (mbuf == NULL || dbuf == NULL) {
+		bc_print_err("bc_scan: out of memory\n");
+		exit(3);
+	}
+
+	for (block_id = bs->bs_block_first;
+	     block_id <= bs->bs_block_last;
+	     block_id += n) {
+		n = bs->bs_block_last - block_id + 1;
+		if (n > batch)
+			n = batch;
+		bc_block_offsets(lm, block_id, &m_offset, &d_offset);
+		if (lm->lm_cache_layout == CACHE_LAYOUT_INTERLEAVED) {
+			len = (size_t)(n - 1) * (PAGE_SIZE * 2) + PAGE_SIZE +
+			      sizeof(struct pmem_block_metadata) +
+			      sizeof(struct pmem_block_one_io_record);
+			sz = pread(bs->bs_fd, dbuf, len, d_offset);
+		} else {
+			len = (size_t)(n - 1) * lm->lm_mcb_size_bytes +
+			      sizeof(struct pmem_block_metadata);
+			sz = pread(bs->bs_fd, mbuf, len, m_offset);
+			if (sz == len && bs->bs_check_data) {
+				len = (size_t)n * PAGE_SIZE;
+				sz = pread(bs->bs_fd, dbuf, len, d_offset);
+			}
+		}
+		if (sz != len) {
+			bc_print_err("bc_scan(%u): error reading %u blocks\n",
+				     block_id, n);
+			bs->bs_io_error = 1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			struct pmem_block_metadata *mcbm;
+			char *data;
+
+			if (lm->lm_cache_layout == CACHE_LAYOUT_INTERLEAVED) {
+				data = dbuf + (size_t)i * (PAGE_SIZE * 2);
+				mcbm = (struct pmem_block_metadata *)(data +
+								      PAGE_SIZE);
+			} else {
+				data = dbuf + (size_t)i * PAGE_SIZE;
+				mcbm = (struct pmem_block_metadata *)(mbuf +
+					(size_t)i * lm->lm_mcb_size_bytes);
+			}
+			/*
+			 * a one-io block can be a torn write which restore
+			 * rolls back, so its data is always checked: the
+			 * dirty copy collected for a sector must be the one
+			 * the kernel would have restored.
+			 */
+			if (!bs->bs_check_data &&
+			    (lm->lm_cache_layout != CACHE_LAYOUT_INTERLEAVED ||
+			     mcbm->pmbm_magic != MCBM_MAGIC_ONE_IO))
+				data = NULL;
+			bc_scan_block(bs, block_id + i, mcbm, data);
+		}
+		__sync_fetch_and_add(&bc_scan_blocks_done, n);
+		__sync_fetch_and_add(&bc_scan_bytes_done,
+				     bs->bs_check_data &&
+				     lm->lm_cache_layout ==
+				     CACHE_LAYOUT_SEQUENTIAL ?
+				     len + n * lm->lm_mcb_size_bytes : len);
+	}
+
+	free(mbuf);
+	free(dbuf);
+	__sync_fetch_and_add(&bc_scan_threads_done, 1);
+	return NULL;
+}
+
+static int bc_scan_error_cmp(const void *a, const void *b)
+{
+	const struct bc_scan_error *ea = a;
+	const struct bc_scan_error *eb = b;
+
+	if (ea->er_block_id == eb->er_block_id)
+		return 0;
+	return ea->er_block_id < eb->er_block_id ? -1 : 1;
+}
+
+/*
+ * scan all the cache blocks. if dirty is not NULL, collect the dirty blocks
+ * of the given shared pool owner. returns the number of problems found.
+ */
+unsigned int bc_scan_cache(int fd,
+			   struct pmem_header *lm,
+			   int check_data,
+			   unsigned int owner,
+			   struct bc_dirty_block **dirty,
+			   size_t *dirty_count)
+{
+	struct bc_scan *scan;
+	unsigned int blocks_per_thread;
+	unsigned int problems;
+	uint64_t ts_started, ts_progress;
+	double secs;
+	int t, io_error = 0;
+
+	bc_scan_errors = calloc(bc_scan_max_errors + 1,
+				sizeof(struct bc_scan_error));
+	scan = calloc(bc_threads, sizeof(struct bc_scan));
+	if (scan == NULL || bc_scan_errors == NULL) {
+		bc_print_err("bc_scan: out of memory\n");
+		exit(3);
+	}
+	bc_scan_errors_count = 0;
+	bc_mlog_replayed = 0;
+	bc_scan_blocks_done = 0;
+	bc_scan_bytes_done = 0;
+	bc_scan_threads_done = 0;
+
+	ts_started = bc_now_nsec();
+	blocks_per_thread = (lm->lm_cache_blocks + bc_threads - 1) /
+			    bc_threads;
+	for (t = 0; t < bc_threads; t++) {
+		scan[t].bs_fd = fd;
+		scan[t].bs_lm = lm;
+		scan[t].bs_check_data = check_data;
+		scan[t].bs_collect_dirty = (dirty != NULL);
+		scan[t].bs_owner = owner;
+		scan[t].bs_block_first = 1 + t * blocks_per_thread;
+		scan[t].bs_block_last = (t + 1) * blocks_per_thread;
+		if (scan[t].bs_block_last > lm->lm_cache_blocks)
+			scan[t].bs_block_last = lm->lm_cache_blocks;
+		if (pthread_create(&scan[t].bs_thread, NULL,
+				   bc_scan_thread, &scan[t]) != 0) {
+			bc_print_err("bc_scan: cannot create thread\n");
+			exit(3);
+		}
+	}
+	ts_progress = ts_started;
+	while (__sync_fetch_and_add(&bc_scan_threads_done, 0) < bc_threads) {
+		usleep(100000);
+		if (bc_now_nsec() - ts_progress < 1000000000ULL)
+			continue;
+		ts_progress = bc_now_nsec();
+		secs = (double)(ts_progress - ts_started) / 1000000000.0;
+		bc_print_info("scan: progress: %llu/%llu blocks, %.1f secs, %.1f mbytes/sec\n",
+			      ULL_CAST(bc_scan_blocks_done),
+			      ULL_CAST(lm->lm_cache_blocks),
+			      secs,
+			      (double)bc_scan_bytes_done /
+			      (1024.0 * 1024.0) / secs);
+	}
+
+	bc_stat_cb_valid_clean = 0;
+	bc_stat_cb_valid_dirty = 0;
+	bc_stat_cb_invalid = 0;
+	bc_stat_cb_transient = 0;
+	bc_stat_cb_corrupt = 0;
+	bc_stat_cb_corrupt_data = 0;
+	bc_stat_cb_other_owner = 0;
+	if (dirty != NULL) {
+		*dirty = NULL;
+		*dirty_count = 0;
+	}
+	for (t = 0; t < bc_threads; t++) {
+		pthread_join(scan[t].bs_thread, NULL);
+		bc_stat_cb_valid_clean += scan[t].bs_clean;
+		bc_stat_cb_valid_dirty += scan[t].bs_dirty_blocks;
+		bc_stat_cb_invalid += scan[t].bs_invalid;
+		bc_stat_cb_transient += scan[t].bs_transient;
+		bc_stat_cb_corrupt += scan[t].bs_corrupt;
+		bc_stat_cb_corrupt_data += scan[t].bs_corrupt_data;
+		bc_stat_cb_other_owner += scan[t].bs_other_owner;
+		io_error |= scan[t].bs_io_error;
+		if (dirty == NULL)
+			continue;
+		*dirty = realloc(*dirty,
+				 (*dirty_count + scan[t].bs_dirty_count + 1) *
+				 sizeof(struct bc_dirty_block));
+		if (*dirty == NULL) {
+			bc_print_err("bc_scan: out of memory\n");
+			exit(3);
+		}
+		memcpy(&(*dirty)[*dirty_count],
+		       scan[t].bs_dirty,
+		       scan[t].bs_dirty_count * sizeof(struct bc_dirty_block));
+		*dirty_count += scan[t].bs_dirty_count;
+		free(scan[t].bs_dirty);
+	}
+	free(scan);
+	if (io_error)
+		exit(6);
+
+	secs = (double)(bc_now_nsec() - ts_started) / 1000000000.0;
+	bc_print_info("cache_blocks: valid_clean=%d, valid_dirty=%d, invalid=%d, transient=%d, corrupt=%d, corrupt_data=%d%s, %.1f secs, %.1f mbytes/sec\n",
+		      bc_stat_cb_valid_clean, bc_stat_cb_valid_dirty,
+		      bc_stat_cb_invalid, bc_stat_cb_transient,
+		      bc_stat_cb_corrupt, bc_stat_cb_corrupt_data,
+		      check_data ? "" : " (data not checked)",
+		      secs,
+		      secs > 0.0 ?
+		      (double)bc_scan_bytes_done /
+		      (1024.0 * 1024.0) / secs : 0.0);
+
+	if (bc_mlog != NULL)
+		bc_print_info("mlog: replayed %u blocks\n", bc_mlog_replayed);
+
+	problems = bc_stat_cb_corrupt + bc_stat_cb_corrupt_data;
+	if (check_data)
+		problems += bc_stat_cb_transient;
+	qsort(bc_scan_errors, bc_scan_errors_count,
+	      sizeof(struct bc_scan_error), bc_scan_error_cmp);
+	for (t = 0; t < bc_scan_errors_count; t++)
+		bc_print_err("bc_scan(%u): offset=%llu sector=%llu: %s\n",
+			     bc_scan_errors[t].er_block_id,
+			     ULL_CAST(bc_scan_errors[t].er_offset),
+			     ULL_CAST(bc_scan_errors[t].er_sector),
+			     bc_scan_errors[t].er_what);
+	if (problems > bc_scan_errors_count)
+		bc_print_err("bc_scan: %u more problems not shown\n",
+			     problems - bc_scan_errors_count);
+	free(bc_scan_errors);
+	bc_scan_errors = NULL;
+
+	return problems;
+}
+
+void bc_flush_cache(int fd,
+		    struct pmem_header *lm,
+		    const char *cached_device);
+
+/*
+ * read and check the cache device. if cached_device is not NULL,
+ * flush all dirty blocks to it.
+ */
+void bc_read(const char *cache_device, const char *cached_device)
 {
 	struct pmem_header pmem_header_0, pmem_header_1;
 	int fd;
-	unsigned int block_id;
 	unsigned long long device_size;
 	unsigned long long device_size_bytes;
 	struct stat stbuf;
 	int ret, ret0, ret1;
-	int fatal;
+	unsigned int fatal;
 
 	bc_print_debug("bc_tool: bc_read(%s)\n", cache_device);
 	bc_print_debug("bc_tool: bc_read: sizeof(struct pmem_header) = %lu\n",
@@ -614,6 +1102,13 @@ void bc_read(const char *cache_device)
 	if (ret0 != 0 && ret1 != 0) {
 		bc_print_err("bc_tool: both headers corrupt (or no headers)\n");
 		exit(10);
+	} else if (cached_device != NULL && ret0 != 0) {
+		/* flushing is best effort, one good header is enough */
+		bc_print_warning("header_0 corrupt (or no header_0), using header_1\n");
+		pmem_header_0 = pmem_header_1;
+	} else if (cached_device != NULL && ret1 != 0) {
+		bc_print_warning("header_1 corrupt (or no header_1), using header_0\n");
+		pmem_header_1 = pmem_header_0;
 	} else if (ret0 != 0) {
 		bc_print_err("bc_tool: header_0 corrupt (or no header_0)\n");
 		exit(10);
@@ -635,30 +1130,385 @@ void bc_read(const char *cache_device)
 		pmem_header_0.lm_xid_current = pmem_header_1.lm_xid_current;
 	}
 
+	/*
+	 * the block metadata is only current once the metadata intent log
+	 * has been replayed on top of it.
+	 */
+	if (pmem_header_0.lm_mlog_epoch != 0 &&
+	    pmem_header_0.lm_stripe_count <= 1 &&
+	    (bc_check_data_blocks || cached_device != NULL))
+		bc_mlog_load(fd, &pmem_header_0, device_size_bytes);
+
 	fatal = 0;
 
-	if (bc_check_data_blocks) {
-		for (block_id = 1; block_id <= pmem_header_0.lm_cache_blocks;
-		     block_id++) {
-			if (bc_read_cache_block(fd, block_id, &pmem_header_0,
-						device_size_bytes) < 0)
-				fatal++;
-		}
-		bc_print_info("cache_blocks: valid_clean=%d, valid_dirty=%d, invalid=%d, transient=%d, corrupt=%d\n",
-			      bc_stat_cb_valid_clean, bc_stat_cb_valid_dirty,
-			      bc_stat_cb_invalid, bc_stat_cb_transient,
-			      bc_stat_cb_corrupt);
+	if (bc_check_data_blocks && pmem_header_0.lm_stripe_count > 1) {
+		bc_print_warning("cache is striped across %llu devices, skipping data block checks\n",
+				 ULL_CAST(pmem_header_0.lm_stripe_count));
+	} else if (bc_check_data_blocks) {
+		fatal = bc_scan_cache(fd, &pmem_header_0, 1, 0, NULL, NULL);
 	}
 
 	if (fatal)
 		exit(12);
+
+	if (cached_device != NULL)
+		bc_flush_cache(fd, &pmem_header_0, cached_device);
+}
+
+/*
+ * Offline flush.
+ *
+ * Writes back all the dirty blocks of a cache which cannot be loaded anymore
+ * (e.g. the host died and the module is not available) to the cached device.
+ *
+ * The metadata is scanned with bc_scan_cache(). Corrupt metadata blocks and
+ * transient blocks are skipped, the same way the kernel does on restore.
+ * So are one-io blocks whose data/metadata write was interrupted, which
+ * are rolled back to the previous copy of their sector.
+ * If there is more than one dirty copy of a sector, the one with the highest
+ * xid wins.
+ *
+ * The dirty blocks are then sorted by sector and written back by bc_threads
+ * threads. Each thread claims the next run of contiguous sectors (up to
+ * BC_FLUSH_MAX_RUN blocks), reads and verifies the data hash of each block
+ * and writes the whole run with a single O_DIRECT pwrite(2), so that there
+ * are up to bc_threads large sequential writes in flight to the cached device
+ * at any time. Blocks whose data hash doesn't match are not written.
+ */
+
+#define BC_FLUSH_MAX_RUN	64
+
+int bc_flush_dry_run = 0;
+unsigned int bc_flush_owner = 0;
+
+struct bc_flush {
+	int f_cache_fd;
+	int f_cached_fd;
+	struct pmem_header *f_lm;
+	uint64_t f_cached_device_sectors;
+	struct bc_dirty_block *f_entries;
+	size_t f_entries_count;
+	pthread_mutex_t f_lock;
+	/* next entry to be claimed by a writer, protected by f_lock */
+	size_t f_next;
+	/* updated with atomic builtins */
+	uint64_t f_written_blocks;
+	uint64_t f_bad_data_blocks;
+	uint64_t f_io_errors;
+	uint64_t f_writes;
+	int f_threads_done;
+};
+
+struct bc_flush bc_flush;
+
+static int bc_dirty_block_cmp(const void *a, const void *b)
+{
+	const struct bc_dirty_block *ea = a;
+	const struct bc_dirty_block *eb = b;
+
+	if (ea->db_sector != eb->db_sector)
+		return ea->db_sector < eb->db_sector ? -1 : 1;
+	/* highest xid first */
+	if (ea->db_xid != eb->db_xid)
+		return ea->db_xid > eb->db_xid ? -1 : 1;
+	return 0;
+}
+
+/*
+ * claim the next run of blocks with contiguous sectors,
+ * returns the number of blocks in the run.
+ */
+static unsigned int bc_flush_claim_run(struct bc_flush *f, size_t *first)
+{
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&f->f_lock);
+	*first = f->f_next;
+	while (f->f_next < f->f_entries_count && n < BC_FLUSH_MAX_RUN) {
+		if (n > 0 &&
+		    f->f_entries[f->f_next].db_sector !=
+		    f->f_entries[f->f_next - 1].db_sector +
+		    PAGE_SIZE / SECTOR_SIZE)
+			break;
+		f->f_next++;
+		n++;
+	}
+	pthread_mutex_unlock(&f->f_lock);
+	return n;
+}
+
+/* write n blocks from buf, starting with entry e */
+static void bc_flush_write(struct bc_flush *f,
+			   struct bc_dirty_block *e,
+			   unsigned int n,
+			   char *buf)
+{
+	ssize_t sz;
+
+	if (n == 0)
+		return;
+	if (!bc_flush_dry_run) {
+		sz = pwrite(f->f_cached_fd, buf, (size_t)n * PAGE_SIZE,
+			    e->db_sector * SECTOR_SIZE);
+		if (sz != (ssize_t)n * PAGE_SIZE) {
+			bc_print_err("bc_flush: error writing %u blocks at sector %llu: %s\n",
+				     n, ULL_CAST(e->db_sector),
+				     sz < 0 ? strerror(errno) : "short write");
+			__sync_fetch_and_add(&f->f_io_errors, 1);
+			return;
+		}
+	}
+	__sync_fetch_and_add(&f->f_writes, 1);
+	__sync_fetch_and_add(&f->f_written_blocks, n);
+}
+
+static void *bc_flush_write_thread(void *arg)
+{
+	struct bc_flush *f = arg;
+	uint64_t m_offset, d_offset;
+	uint128_t data_hash_computed, data_hash;
+	struct pmem_block_metadata mcbm;
+	struct bc_dirty_block *e, *run_start;
+	unsigned int n, i, in_buf;
+	size_t first;
+	char *buf;
+	ssize_t sz;
+
+	/* O_DIRECT needs an aligned buffer */
+	if (posix_memalign((void **)&buf, PAGE_SIZE,
+			   BC_FLUSH_MAX_RUN * PAGE_SIZE) != 0) {
+		bc_print_err("bc_flush: out of memory\n");
+		exit(3);
+	}
+
+	while ((n = bc_flush_claim_run(f, &first)) > 0) {
+		run_start = &f->f_entries[first];
+		in_buf = 0;
+		for (i = 0; i < n; i++) {
+			e = &f->f_entries[first + i];
+			bc_block_offsets(f->f_lm, e->db_block_id,
+					       &m_offset, &d_offset);
+			sz = pread(f->f_cache_fd, buf + in_buf * PAGE_SIZE,
+				   PAGE_SIZE, d_offset);
+			if (sz != PAGE_SIZE) {
+				bc_print_err("bc_flush(%u): error reading data block\n",
+					     e->db_block_id);
+				__sync_fetch_and_add(&f->f_io_errors, 1);
+				goto skip_block;
+			}
+			/*
+			 * the metadata was verified during the scan,
+			 * reread it (and its log record) to get the data hash.
+			 */
+			sz = pread(f->f_cache_fd, &mcbm,
+				   sizeof(struct pmem_block_metadata),
+				   m_offset);
+			if (sz != sizeof(struct pmem_block_metadata)) {
+				bc_print_err("bc_flush(%u): error reading metadata block\n",
+					     e->db_block_id);
+				__sync_fetch_and_add(&f->f_io_errors, 1);
+				goto skip_block;
+			}
+			bc_mlog_replay_block(&mcbm);
+			data_hash = mcbm.pmbm_hash_data;
+			data_hash_computed = murmurhash3_128(buf + in_buf *
+							     PAGE_SIZE,
+							     PAGE_SIZE);
+			if (uint128_ne(data_hash_computed, data_hash)) {
+				bc_print_err("bc_flush(%u,%llu): computed data_hash=" UINT128_FMT " does not match stored data_hash=" UINT128_FMT ", not written\n",
+					     e->db_block_id,
+					     ULL_CAST(e->db_sector),
+					     UINT128_ARG(data_hash_computed),
+					     UINT128_ARG(data_hash));
+				__sync_fetch_and_add(&f->f_bad_data_blocks, 1);
+				goto skip_block;
+			}
+			bc_print_verbose("bc_flush(%u,%llu): xid=%llu\n",
+					 e->db_block_id,
+					 ULL_CAST(e->db_sector),
+					 ULL_CAST(e->db_xid));
+			in_buf++;
+			continue;
+skip_block:
+			/* write what we have, restart the run after this block */
+			bc_flush_write(f, run_start, in_buf, buf);
+			run_start = e + 1;
+			in_buf = 0;
+		}
+		bc_flush_write(f, run_start, in_buf, buf);
+	}
+
+	free(buf);
+	__sync_fetch_and_add(&f->f_threads_done, 1);
+	return NULL;
+}
+
+static void bc_flush_progress(struct bc_flush *f,
+			      uint64_t ts_started,
+			      const char *what)
+{
+	uint64_t elapsed = bc_now_nsec() - ts_started;
+	uint64_t written = f->f_written_blocks;
+	double secs = (double)elapsed / 1000000000.0;
+	double mbytes = (double)written * PAGE_SIZE / (1024.0 * 1024.0);
+
+	bc_print_info("flush: %s: %llu/%llu blocks, %llu writes, %.1f mbytes, %.1f secs, %.1f mbytes/sec\n",
+		      what,
+		      ULL_CAST(written),
+		      ULL_CAST(f->f_entries_count),
+		      ULL_CAST(f->f_writes),
+		      mbytes,
+		      secs,
+		      secs > 0.0 ? mbytes / secs : 0.0);
+}
+
+void bc_flush_cache(int fd,
+		    struct pmem_header *lm,
+		    const char *cached_device)
+{
+	struct bc_flush *f = &bc_flush;
+	pthread_t *writers;
+	unsigned int corrupt, duplicates = 0;
+	uint64_t ts_started, ts_progress;
+	size_t i, j;
+	off_t end;
+	int t;
+
+	if (lm->lm_stripe_count > 1) {
+		bc_print_err("bc_flush: cache is striped across %llu devices, cannot flush\n",
+			     ULL_CAST(lm->lm_stripe_count));
+		exit(13);
+	}
+
+	memset(f, 0, sizeof(*f));
+	pthread_mutex_init(&f->f_lock, NULL);
+	f->f_cache_fd = fd;
+	f->f_lm = lm;
+
+	f->f_cached_fd = open(cached_device, O_RDWR | O_DIRECT);
+	if (f->f_cached_fd < 0 && errno == EINVAL) {
+		bc_print_warning("bc_flush: %s does not support O_DIRECT\n",
+				 cached_device);
+		f->f_cached_fd = open(cached_device, O_RDWR);
+	}
+	if (f->f_cached_fd < 0) {
+		bc_print_err("bc_flush: cannot open %s for write: %s\n",
+			     cached_device, strerror(errno));
+		exit(7);
+	}
+	end = lseek(f->f_cached_fd, 0, SEEK_END);
+	if (end <= 0) {
+		bc_print_err("bc_flush: cannot find size of %s\n",
+			     cached_device);
+		exit(7);
+	}
+	f->f_cached_device_sectors = end / SECTOR_SIZE;
+	bc_print_info("flush: cached-device=%s, %llu sectors\n",
+		      cached_device,
+		      ULL_CAST(f->f_cached_device_sectors));
+
+	/*
+	 * scan, then sort by sector and keep the highest xid copy of each
+	 * sector. one-io blocks are verified while scanning, so that an
+	 * interrupted write never hides the older copy it would roll back to.
+	 * the other data hashes are checked when the blocks are written.
+	 */
+	corrupt = bc_scan_cache(fd, lm, 0, bc_flush_owner,
+				&f->f_entries, &f->f_entries_count);
+	if (bc_stat_cb_other_owner > 0)
+		bc_print_info("flush: skipping %d dirty blocks of other shared pool owners\n",
+			      bc_stat_cb_other_owner);
+	qsort(f->f_entries, f->f_entries_count,
+	      sizeof(struct bc_dirty_block), bc_dirty_block_cmp);
+	for (i = 0, j = 0; i < f->f_entries_count; i++) {
+		if (j > 0 &&
+		    f->f_entries[i].db_sector == f->f_entries[j - 1].db_sector) {
+			duplicates++;
+			continue;
+		}
+		if (f->f_entries[i].db_sector + PAGE_SIZE / SECTOR_SIZE >
+		    f->f_cached_device_sectors) {
+			bc_print_err("bc_flush(%u): sector %llu is past the end of %s\n",
+				     f->f_entries[i].db_block_id,
+				     ULL_CAST(f->f_entries[i].db_sector),
+				     cached_device);
+			exit(8);
+		}
+		f->f_entries[j++] = f->f_entries[i];
+	}
+	f->f_entries_count = j;
+	bc_print_info("flush: %llu dirty blocks to write, %u older duplicates%s\n",
+		      ULL_CAST(f->f_entries_count), duplicates,
+		      bc_flush_dry_run ? " (dry run)" : "");
+
+	/*
+	 * write back
+	 */
+	ts_started = bc_now_nsec();
+	writers = calloc(bc_threads, sizeof(pthread_t));
+	if (writers == NULL) {
+		bc_print_err("bc_flush: out of memory\n");
+		exit(3);
+	}
+	for (t = 0; t < bc_threads; t++) {
+		if (pthread_create(&writers[t], NULL,
+				   bc_flush_write_thread, f) != 0) {
+			bc_print_err("bc_flush: cannot create thread\n");
+			exit(3);
+		}
+	}
+	ts_progress = ts_started;
+	while (__sync_fetch_and_add(&f->f_threads_done, 0) < bc_threads) {
+		usleep(100000);
+		if (bc_now_nsec() - ts_progress < 1000000000ULL)
+			continue;
+		ts_progress = bc_now_nsec();
+		bc_flush_progress(f, ts_started, "progress");
+	}
+	for (t = 0; t < bc_threads; t++)
+		pthread_join(writers[t], NULL);
+	free(writers);
+
+	if (!bc_flush_dry_run && fsync(f->f_cached_fd) < 0) {
+		bc_print_err("bc_flush: fsync %s: %s\n",
+			     cached_device, strerror(errno));
+		exit(8);
+	}
+	close(f->f_cached_fd);
+	bc_flush_progress(f, ts_started, "done");
+
+	if (f->f_io_errors > 0) {
+		bc_print_err("bc_flush: %llu i/o errors\n",
+			     ULL_CAST(f->f_io_errors));
+		exit(8);
+	}
+	if (f->f_bad_data_blocks > 0 || corrupt > 0) {
+		bc_print_err("bc_flush: %llu dirty blocks with bad data hash and %u corrupt cache blocks were not written\n",
+			     ULL_CAST(f->f_bad_data_blocks), corrupt);
+		exit(12);
+	}
+	free(f->f_entries);
 }
 
 void usage(void)
 {
 	printf("bc_tool: usage: bc_tool [-r|--read] [-v|--verbose] ");
 	printf("[-d|--debug] [-s|--silent] [-b|--check-data-blocks] ");
+	printf("[-t|--threads <n>] [-e|--max-errors <n>] ");
 	printf("-c|--cache-device <cache-device>\n");
+	printf("bc_tool: usage: bc_tool -f|--flush [-v|--verbose] ");
+	printf("[-d|--debug] [-s|--silent] [-t|--threads <n>] ");
+	printf("[-n|--dry-run] [-o|--owner <owner-id>] ");
+	printf("-c|--cache-device <cache-device> ");
+	printf("-D|--cached-device <cached-device>\n");
+	printf("bc_tool: -f writes back all dirty blocks of an offline cache ");
+	printf("to the cached device\n");
+	printf("bc_tool: -t number of scan and write threads (default %d)\n",
+	       bc_threads);
+	printf("bc_tool: -e number of problem locations to print ");
+	printf("(default %d)\n", bc_scan_max_errors);
+	printf("bc_tool: -o shared pool owner id of the cached device ");
+	printf("(default 0)\n");
 	exit(2);
 }
 
@@ -668,13 +1518,17 @@ void usage(void)
  *  x > 0 && x < 5: usage error
  *	  x == 5: cannot open cache device
  *	  x == 6: i/o error on cache device
+ *	  x == 7: cannot open cached device
+ *	  x == 8: i/o error on cached device
  *	 x == 10: header_0 corrupt (or no header_0)
  *	 x == 11: header_1 corrupt (or no header_1)
  *	 x == 12: cache block corrupt
+ *	 x == 13: striped cache, cannot flush
  */
 int main(int argc, char **argv)
 {
 	char *cache_device = NULL;
+	char *cached_device = NULL;
 	char command = ' ';
 
 	setbuf(stdout, NULL);
@@ -689,9 +1543,15 @@ int main(int argc, char **argv)
 			{ "silent", no_argument, 0, 's', },
 			{ "debug", no_argument, 0, 'd', },
 			{ "check-data-blocks", no_argument, 0, 'b', },
+			{ "flush", no_argument, 0, 'f', },
+			{ "cached-device", required_argument, 0, 'D', },
+			{ "threads", required_argument, 0, 't', },
+			{ "dry-run", no_argument, 0, 'n', },
+			{ "owner", required_argument, 0, 'o', },
+			{ "max-errors", required_argument, 0, 'e', },
 			{ NULL, 0, 0, 0, },
 		};
-		c = getopt_long(argc, argv, "rc:vsdb", long_options,
+		c = getopt_long(argc, argv, "rc:vsdbfD:t:no:e:", long_options,
 				&option_index);
 		switch (c) {
 		case -1:
@@ -714,6 +1574,41 @@ int main(int argc, char **argv)
 			}
 			command = 'R';
 			break;
+		case 'f':
+			if (command != ' ') {
+				bc_print_err("bc_tool: error: command already specified\n");
+				usage();
+				/*NOTREACHED*/
+			}
+			command = 'F';
+			break;
+		case 'D':
+			cached_device = optarg;
+			break;
+		case 't':
+			bc_threads = atoi(optarg);
+			if (bc_threads <= 0 ||
+			    bc_threads > BC_MAX_THREADS) {
+				bc_print_err("bc_tool: error: threads must be between 1 and %d\n",
+					     BC_MAX_THREADS);
+				usage();
+				/*NOTREACHED*/
+			}
+			break;
+		case 'n':
+			bc_flush_dry_run = 1;
+			break;
+		case 'o':
+			bc_flush_owner = atoi(optarg);
+			break;
+		case 'e':
+			bc_scan_max_errors = atoi(optarg);
+			if (bc_scan_max_errors < 0) {
+				bc_print_err("bc_tool: error: bad max-errors\n");
+				usage();
+				/*NOTREACHED*/
+			}
+			break;
 		case 'c':
 			cache_device = optarg;
 			break;
@@ -738,6 +1633,11 @@ done_getopt:
 		usage();
 		/*NOTREACHED*/
 	}
+	if (command == 'F' && cached_device == NULL) {
+		bc_print_err("bc_tool: error: need to specify cached-device\n");
+		usage();
+		/*NOTREACHED*/
+	}
 
 	if (getuid() != 0) {
 		bc_print_err("bc_tool: error: only root can execute this command\n");
@@ -746,7 +1646,10 @@ done_getopt:
 
 	switch (command) {
 	case 'R':
-		bc_read(cache_device);
+		bc_read(cache_device, NULL);
+		break;
+	case 'F':
+		bc_read(cache_device, cached_device);
 		break;
 	default:
 		break;